@@ -12,12 +12,20 @@
 
 #include "3ds.h"
 
+// The loader is also built into the Linux tools, without the NDK
+#ifdef __ANDROID__
 #include <jni.h>
 #include <android/log.h>
 
 #define  LOG_TAG    "3ds"
 #define  LOGI(...)  __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
 #define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+#else
+#include <string.h>
+
+#define  LOGI(...)  printf(__VA_ARGS__)
+#define  LOGE(...)  fprintf(stderr,__VA_ARGS__)
+#endif
 
 // Global
 int gBuffer[50000] = {0};					// This is used to read past unwanted data
@@ -326,6 +334,11 @@ void CLoad3DS::ProcessNextMaterialChunk(t3DModel *pModel, tChunk *pPreviousChunk
 			ReadColorChunk(&(pModel->pMaterials[pModel->numOfMaterials - 1]), &currentChunk);
 			break;
 		
+		case MATSHINSTRENGTH:
+            // This holds how much of the specular highlight the material shows
+			pModel->pMaterials[pModel->numOfMaterials - 1].shineStrength = ReadPercentageChunk(&currentChunk);
+			break;
+
 		case MATMAP:
             // This is the header for the texture info
 			// Proceed to read in the material information
@@ -413,6 +426,42 @@ void CLoad3DS::ReadColorChunk(tMaterialInfo *pMaterial, tChunk *pChunk)
 }
 
 
+///////////////////////////////// READ PERCENTAGE \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*
+/////
+/////	This function reads in a percentage, stored either as a short or a float
+/////
+///////////////////////////////// READ PERCENTAGE \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*
+
+float CLoad3DS::ReadPercentageChunk(tChunk *pChunk)
+{
+	tChunk tempChunk = {0};
+	float percentage = 0;
+
+	// Read the percentage chunk info
+	ReadChunk(&tempChunk);
+
+	if (tempChunk.ID == PERCENT_INT && tempChunk.length - tempChunk.bytesRead == 2)
+	{
+		short value = 0;
+		tempChunk.bytesRead += fread(&value, 1, 2, m_FilePointer);
+		percentage = value/100.0f;
+	}
+	else if (tempChunk.ID == PERCENT_FLOAT && tempChunk.length - tempChunk.bytesRead == 4)
+	{
+		tempChunk.bytesRead += fread(&percentage, 1, 4, m_FilePointer);
+	}
+	else
+	{
+		// Read past a chunk we don't know
+		tempChunk.bytesRead += fread(gBuffer, 1, tempChunk.length - tempChunk.bytesRead, m_FilePointer);
+	}
+
+	// Add the bytes read to our chunk
+	pChunk->bytesRead += tempChunk.bytesRead;
+	return percentage;
+}
+
+
 ///////////////////////////////// READ VERTEX INDECES \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*
 /////
 /////	This function reads in the indices for the vertex array
@@ -33,9 +33,14 @@ using namespace std;
 //>------ sub defines of MATERIAL
 #define MATNAME       0xA000				// This holds the material name
 #define MATDIFFUSE    0xA020				// This holds the color of the object/material
+#define MATSHINSTRENGTH 0xA041				// This holds how strong the specular highlight is
 #define MATMAP        0xA200				// This is a header for a new material
 #define MATMAPFILE    0xA300				// This holds the file name of the texture
 
+//>------ sub defines of MATSHINSTRENGTH
+#define PERCENT_INT   0x0030				// A percentage as a short, 0 through 100
+#define PERCENT_FLOAT 0x0031				// A percentage as a float, 0 through 1
+
 #define OBJECT_MESH   0x4100				// This lets us know that we are reading a new object
 
 //>------ sub defines of OBJECT_MESH
@@ -84,6 +89,7 @@ struct tMaterialInfo
 	char  strName[255];			// The texture name
 	char  strFile[255];			// The texture file name (If this is set it's a texture map)
 	unsigned char color[3];				// The color of the object (R, G, B)
+	float shineStrength;		// The strength of the specular highlight (0 means none)
 	int   texureId;				// the texture ID
 	float uTile;				// u tiling of texture  (Currently not used)
 	float vTile;				// v tiling of texture	(Currently not used)
@@ -166,6 +172,9 @@ private:
 	// This reads the RGB value for the object's color
 	void ReadColorChunk(tMaterialInfo *pMaterial, tChunk *pChunk);
 
+	// This reads a percentage as a value from 0 to 1
+	float ReadPercentageChunk(tChunk *pChunk);
+
 	// This reads the objects vertices
 	void ReadVertices(t3DObject *pObject, tChunk *);
 
@@ -0,0 +1,406 @@
+#include <math.h>
+
+#include "aabbtree.h"
+
+static inline Aabb combine(const Aabb &a, const Aabb &b)
+{
+    Aabb r;
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        r.min[k] = (a.min[k] < b.min[k]) ? a.min[k] : b.min[k];
+        r.max[k] = (a.max[k] > b.max[k]) ? a.max[k] : b.max[k];
+    }
+    return r;
+}
+
+static inline bool contains(const Aabb &outer, const Aabb &inner)
+{
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        if (inner.min[k] < outer.min[k] || inner.max[k] > outer.max[k]) return false;
+    }
+    return true;
+}
+
+static inline bool overlaps(const Aabb &a, const Aabb &b)
+{
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        if (a.max[k] < b.min[k] || a.min[k] > b.max[k]) return false;
+    }
+    return true;
+}
+
+static inline float surfaceArea(const Aabb &a)
+{
+    float dx = a.max[0]-a.min[0], dy = a.max[1]-a.min[1], dz = a.max[2]-a.min[2];
+    return 2.0f*(dx*dy + dy*dz + dz*dx);
+}
+
+// Entry distance of the ray into the box, or -1 when it misses within maxT
+static inline float rayEntry(const Aabb &box, const float* origin, const float* inverseDir, float maxT)
+{
+    float tmin = 0, tmax = maxT;
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        float t1 = (box.min[k] - origin[k]) * inverseDir[k];
+        float t2 = (box.max[k] - origin[k]) * inverseDir[k];
+        if (t1 > t2) { float t = t1; t1 = t2; t2 = t; }
+        if (t1 > tmin) tmin = t1;
+        if (t2 < tmax) tmax = t2;
+        if (tmin > tmax) return -1;
+    }
+    return tmin;
+}
+
+AabbTree::AabbTree()
+{
+    m_Root = -1;
+    m_FreeList = -1;
+    m_ProxyCount = 0;
+}
+
+int AabbTree::allocateNode()
+{
+    if (m_FreeList < 0)
+    {
+        Node node;
+        node.parent = -1;
+        m_Nodes.push_back(node);
+        m_FreeList = (int)m_Nodes.size() - 1;
+    }
+
+    int node = m_FreeList;
+    m_FreeList = m_Nodes[node].parent;
+    m_Nodes[node].parent = -1;
+    m_Nodes[node].child1 = -1;
+    m_Nodes[node].child2 = -1;
+    m_Nodes[node].height = 0;
+    m_Nodes[node].userData = -1;
+    return node;
+}
+
+void AabbTree::freeNode(int node)
+{
+    m_Nodes[node].parent = m_FreeList;
+    m_Nodes[node].height = -1;
+    m_FreeList = node;
+}
+
+int AabbTree::createProxy(const Aabb &box, int userData)
+{
+    int proxy = allocateNode();
+    Node &node = m_Nodes[proxy];
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        node.box.min[k] = box.min[k] - AABB_TREE_MARGIN;
+        node.box.max[k] = box.max[k] + AABB_TREE_MARGIN;
+    }
+    node.userData = userData;
+
+    insertLeaf(proxy);
+    m_ProxyCount++;
+    return proxy;
+}
+
+void AabbTree::destroyProxy(int proxy)
+{
+    removeLeaf(proxy);
+    freeNode(proxy);
+    m_ProxyCount--;
+}
+
+bool AabbTree::moveProxy(int proxy, const Aabb &box)
+{
+    if (contains(m_Nodes[proxy].box, box)) return false;
+
+    removeLeaf(proxy);
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        m_Nodes[proxy].box.min[k] = box.min[k] - AABB_TREE_MARGIN;
+        m_Nodes[proxy].box.max[k] = box.max[k] + AABB_TREE_MARGIN;
+    }
+    insertLeaf(proxy);
+    return true;
+}
+
+void AabbTree::insertLeaf(int leaf)
+{
+    if (m_Root < 0)
+    {
+        m_Root = leaf;
+        m_Nodes[leaf].parent = -1;
+        return;
+    }
+
+    // Walk down to the sibling with the lowest surface area heuristic cost
+    Aabb box = m_Nodes[leaf].box;
+    int index = m_Root;
+    while (m_Nodes[index].child1 >= 0)
+    {
+        const Node &node = m_Nodes[index];
+        float area = surfaceArea(node.box);
+        float combined_area = surfaceArea(combine(node.box, box));
+
+        // Cost of a new parent for this node and the leaf, and the cost
+        // every level below pays for growing this node
+        float cost = 2.0f*combined_area;
+        float inheritance = 2.0f*(combined_area - area);
+
+        float child_cost[2];
+        int children[2] = {node.child1, node.child2};
+        for (int c = 0 ; c < 2 ; c++)
+        {
+            const Node &child = m_Nodes[children[c]];
+            float grown = surfaceArea(combine(child.box, box));
+            child_cost[c] = ((child.child1 < 0) ? grown : grown - surfaceArea(child.box)) + inheritance;
+        }
+
+        if (cost < child_cost[0] && cost < child_cost[1]) break;
+        index = (child_cost[0] < child_cost[1]) ? children[0] : children[1];
+    }
+
+    int sibling = index;
+    int old_parent = m_Nodes[sibling].parent;
+    int new_parent = allocateNode();
+    m_Nodes[new_parent].parent = old_parent;
+    m_Nodes[new_parent].box = combine(box, m_Nodes[sibling].box);
+    m_Nodes[new_parent].height = m_Nodes[sibling].height + 1;
+    m_Nodes[new_parent].child1 = sibling;
+    m_Nodes[new_parent].child2 = leaf;
+    m_Nodes[sibling].parent = new_parent;
+    m_Nodes[leaf].parent = new_parent;
+
+    if (old_parent >= 0)
+    {
+        if (m_Nodes[old_parent].child1 == sibling) m_Nodes[old_parent].child1 = new_parent;
+        else m_Nodes[old_parent].child2 = new_parent;
+    }
+    else
+    {
+        m_Root = new_parent;
+    }
+
+    refitUpwards(m_Nodes[leaf].parent);
+}
+
+void AabbTree::removeLeaf(int leaf)
+{
+    if (leaf == m_Root)
+    {
+        m_Root = -1;
+        return;
+    }
+
+    int parent = m_Nodes[leaf].parent;
+    int grand_parent = m_Nodes[parent].parent;
+    int sibling = (m_Nodes[parent].child1 == leaf) ? m_Nodes[parent].child2 : m_Nodes[parent].child1;
+
+    freeNode(parent);
+    m_Nodes[sibling].parent = grand_parent;
+
+    if (grand_parent >= 0)
+    {
+        if (m_Nodes[grand_parent].child1 == parent) m_Nodes[grand_parent].child1 = sibling;
+        else m_Nodes[grand_parent].child2 = sibling;
+        refitUpwards(grand_parent);
+    }
+    else
+    {
+        m_Root = sibling;
+    }
+}
+
+// Rebalances and refits the boxes from node up to the root
+void AabbTree::refitUpwards(int index)
+{
+    while (index >= 0)
+    {
+        index = balance(index);
+
+        Node &node = m_Nodes[index];
+        const Node &child1 = m_Nodes[node.child1];
+        const Node &child2 = m_Nodes[node.child2];
+        node.height = 1 + ((child1.height > child2.height) ? child1.height : child2.height);
+        node.box = combine(child1.box, child2.box);
+
+        index = node.parent;
+    }
+}
+
+// Rotates the taller child of node a up when the subtree heights differ by
+// more than one.  Returns the node now at a's place.
+int AabbTree::balance(int a)
+{
+    Node &A = m_Nodes[a];
+    if (A.child1 < 0 || A.height < 2) return a;
+
+    int b = A.child1;
+    int c = A.child2;
+    int difference = m_Nodes[c].height - m_Nodes[b].height;
+    if (difference >= -1 && difference <= 1) return a;
+
+    // up is the taller child, it takes a's place and a takes its shorter child
+    int up = (difference > 1) ? c : b;
+    int other = (difference > 1) ? b : c;
+    Node &U = m_Nodes[up];
+    int f = U.child1;
+    int g = U.child2;
+
+    U.child1 = a;
+    U.parent = A.parent;
+    A.parent = up;
+
+    if (U.parent >= 0)
+    {
+        if (m_Nodes[U.parent].child1 == a) m_Nodes[U.parent].child1 = up;
+        else m_Nodes[U.parent].child2 = up;
+    }
+    else
+    {
+        m_Root = up;
+    }
+
+    int keep = (m_Nodes[f].height > m_Nodes[g].height) ? f : g;
+    int give = (keep == f) ? g : f;
+    U.child2 = keep;
+    if (up == c) A.child2 = give;
+    else A.child1 = give;
+    m_Nodes[give].parent = a;
+
+    const Node &O = m_Nodes[other];
+    const Node &G = m_Nodes[give];
+    const Node &K = m_Nodes[keep];
+    A.box = combine(O.box, G.box);
+    A.height = 1 + ((O.height > G.height) ? O.height : G.height);
+    U.box = combine(A.box, K.box);
+    U.height = 1 + ((A.height > K.height) ? A.height : K.height);
+
+    return up;
+}
+
+void AabbTree::queryFrustum(const Frustum &frustum, std::vector<int> &results) const
+{
+    if (m_Root < 0) return;
+
+    std::vector<int> stack;
+    stack.push_back(m_Root);
+    while (!stack.empty())
+    {
+        int index = stack.back();
+        stack.pop_back();
+
+        const Node &node = m_Nodes[index];
+        if (!boxInFrustum(frustum, node.box.min, node.box.max)) continue;
+
+        if (node.child1 < 0)
+        {
+            results.push_back(index);
+        }
+        else
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+void AabbTree::querySphere(const float* center, float radius, std::vector<int> &results) const
+{
+    if (m_Root < 0) return;
+
+    std::vector<int> stack;
+    stack.push_back(m_Root);
+    while (!stack.empty())
+    {
+        int index = stack.back();
+        stack.pop_back();
+
+        // Squared distance from the center to the box
+        const Node &node = m_Nodes[index];
+        float distance = 0;
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            float d = 0;
+            if (center[k] < node.box.min[k]) d = node.box.min[k] - center[k];
+            else if (center[k] > node.box.max[k]) d = center[k] - node.box.max[k];
+            distance += d*d;
+        }
+        if (distance > radius*radius) continue;
+
+        if (node.child1 < 0)
+        {
+            results.push_back(index);
+        }
+        else
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+void AabbTree::queryAabb(const Aabb &box, std::vector<int> &results) const
+{
+    if (m_Root < 0) return;
+
+    std::vector<int> stack;
+    stack.push_back(m_Root);
+    while (!stack.empty())
+    {
+        int index = stack.back();
+        stack.pop_back();
+
+        const Node &node = m_Nodes[index];
+        if (!overlaps(node.box, box)) continue;
+
+        if (node.child1 < 0)
+        {
+            results.push_back(index);
+        }
+        else
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+void AabbTree::queryRay(const float* origin, const float* dir, float maxT, const std::function<float(int proxy, float maxT)> &hit) const
+{
+    if (m_Root < 0) return;
+
+    float inverse_dir[3];
+    for (int k = 0 ; k < 3 ; k++)
+        inverse_dir[k] = (dir[k] != 0) ? 1.0f/dir[k] : INFINITY;
+
+    std::vector<int> stack;
+    stack.push_back(m_Root);
+    while (!stack.empty())
+    {
+        int index = stack.back();
+        stack.pop_back();
+
+        const Node &node = m_Nodes[index];
+        if (rayEntry(node.box, origin, inverse_dir, maxT) < 0) continue;
+
+        if (node.child1 < 0)
+        {
+            maxT = hit(index, maxT);
+            if (maxT <= 0) return;
+        }
+        else
+        {
+            // Push the farther child first so the nearer one is visited first
+            float t1 = rayEntry(m_Nodes[node.child1].box, origin, inverse_dir, maxT);
+            float t2 = rayEntry(m_Nodes[node.child2].box, origin, inverse_dir, maxT);
+            if (t1 >= 0 && t2 >= 0)
+            {
+                stack.push_back((t1 <= t2) ? node.child2 : node.child1);
+                stack.push_back((t1 <= t2) ? node.child1 : node.child2);
+            }
+            else if (t1 >= 0) stack.push_back(node.child1);
+            else if (t2 >= 0) stack.push_back(node.child2);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef AABBTREE_H
+#define AABBTREE_H
+
+#include <vector>
+#include <functional>
+
+#include "cull.h"
+
+#define AABB_TREE_MARGIN 0.1f           // Fattening of leaf boxes, in world units
+
+struct Aabb
+{
+    float min[3];
+    float max[3];
+};
+
+// Dynamic bounding volume hierarchy (a binary tree of boxes, kept balanced
+// by rotations like Box2D's b2DynamicTree).  Every leaf is a "proxy" for one
+// object and stores a fattened box, so small moves only cost a containment
+// check and bigger ones a remove and reinsert of that single leaf.  Inserts,
+// removes and queries all run in O(log n) for n proxies.
+class AabbTree
+{
+public:
+    AabbTree();
+
+    // Adds an object and returns its proxy id
+    int createProxy(const Aabb &box, int userData);
+    void destroyProxy(int proxy);
+
+    // Updates the box of a proxy.  Returns true when the leaf had to be
+    // reinserted because the box left its fattened box.
+    bool moveProxy(int proxy, const Aabb &box);
+
+    int getUserData(int proxy) const { return m_Nodes[proxy].userData; }
+    void setUserData(int proxy, int userData) { m_Nodes[proxy].userData = userData; }
+    const Aabb& getFatAabb(int proxy) const { return m_Nodes[proxy].box; }
+    int getHeight() const { return (m_Root < 0) ? 0 : m_Nodes[m_Root].height; }
+    int getProxyCount() const { return m_ProxyCount; }
+
+    // Appends the proxies whose fattened boxes intersect the volume
+    void queryFrustum(const Frustum &frustum, std::vector<int> &results) const;
+    void querySphere(const float* center, float radius, std::vector<int> &results) const;
+    void queryAabb(const Aabb &box, std::vector<int> &results) const;
+
+    // Walks the proxies whose boxes the ray origin + t*dir crosses for t in
+    // [0, maxT], nearest subtrees first.  hit returns the new maxT: maxT to
+    // go on, something smaller to clip the ray (closest hit searches) or 0
+    // to stop.
+    void queryRay(const float* origin, const float* dir, float maxT, const std::function<float(int proxy, float maxT)> &hit) const;
+
+private:
+    struct Node
+    {
+        Aabb box;
+        int parent;                     // Next free node while on the free list
+        int child1;                     // -1 for leaves
+        int child2;
+        int height;                     // 0 for leaves, -1 for free nodes
+        int userData;
+    };
+
+    int allocateNode();
+    void freeNode(int node);
+    void insertLeaf(int leaf);
+    void removeLeaf(int leaf);
+    int balance(int node);
+    void refitUpwards(int node);
+
+    std::vector<Node> m_Nodes;
+    int m_Root;
+    int m_FreeList;
+    int m_ProxyCount;
+};
+
+#endif
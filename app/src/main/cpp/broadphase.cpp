@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <iterator>
+
+#include "broadphase.h"
+
+#define SAP_AXIS_HYSTERESIS 1.5f        // How much more spread another axis needs before the sweep moves to it
+#define SAP_MAX_INSERTIONS  16          // More new proxies than this and the order is sorted from scratch
+
+static bool pairLess(const BroadphasePair &p, const BroadphasePair &q)
+{
+    return (p.a != q.a) ? p.a < q.a : p.b < q.b;
+}
+
+SweepAndPrune::SweepAndPrune()
+    : m_FreeList(-1)
+    , m_Axis(0)
+    , m_NumAdded(0)
+    , m_Swaps(0)
+{
+}
+
+int SweepAndPrune::createProxy(const Aabb &box, int userData)
+{
+    int proxy;
+    if (m_FreeList >= 0)
+    {
+        proxy = m_FreeList;
+        m_FreeList = m_Proxies[proxy].userData;
+    }
+    else
+    {
+        proxy = (int)m_Proxies.size();
+        m_Proxies.push_back(Proxy());
+    }
+
+    m_Proxies[proxy].box = box;
+    m_Proxies[proxy].userData = userData;
+
+    // Sorted into place by the next update
+    m_Order.push_back(proxy);
+    m_NumAdded++;
+    return proxy;
+}
+
+void SweepAndPrune::destroyProxy(int proxy)
+{
+    m_Order.erase(std::find(m_Order.begin(), m_Order.end(), proxy));
+    m_Pairs.erase(std::remove_if(m_Pairs.begin(), m_Pairs.end(), [proxy](const BroadphasePair &pair)
+    {
+        return pair.a == proxy || pair.b == proxy;
+    }), m_Pairs.end());
+    m_Proxies[proxy].userData = m_FreeList;
+    m_FreeList = proxy;
+}
+
+void SweepAndPrune::moveProxy(int proxy, const Aabb &box)
+{
+    m_Proxies[proxy].box = box;
+}
+
+int SweepAndPrune::chooseAxis() const
+{
+    if (m_Order.size() < 2) return m_Axis;
+
+    double sum[3] = {0, 0, 0}, sum_squares[3] = {0, 0, 0};
+    for (size_t i = 0 ; i < m_Order.size() ; i++)
+    {
+        const Aabb &box = m_Proxies[m_Order[i]].box;
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            double center = (box.min[k] + box.max[k])*0.5;
+            sum[k] += center;
+            sum_squares[k] += center*center;
+        }
+    }
+
+    double variance[3];
+    int best = m_Axis;
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        variance[k] = sum_squares[k] - sum[k]*sum[k]/m_Order.size();
+        if (variance[k] > variance[best]) best = k;
+    }
+    return (variance[best] > variance[m_Axis]*SAP_AXIS_HYSTERESIS) ? best : m_Axis;
+}
+
+void SweepAndPrune::update()
+{
+    m_Swaps = 0;
+    int axis = chooseAxis();
+    if (axis != m_Axis || m_NumAdded > SAP_MAX_INSERTIONS)
+    {
+        m_Axis = axis;
+        std::sort(m_Order.begin(), m_Order.end(), [this](int p, int q)
+        {
+            return m_Proxies[p].box.min[m_Axis] < m_Proxies[q].box.min[m_Axis];
+        });
+    }
+    else
+    {
+        // Boxes moved a little since the last update, so most are still in
+        // place and the rest only a few slots off
+        for (size_t i = 1 ; i < m_Order.size() ; i++)
+        {
+            int proxy = m_Order[i];
+            float key = m_Proxies[proxy].box.min[m_Axis];
+            size_t j = i;
+            while (j > 0 && m_Proxies[m_Order[j-1]].box.min[m_Axis] > key)
+            {
+                m_Order[j] = m_Order[j-1];
+                j--;
+            }
+            m_Order[j] = proxy;
+            m_Swaps += (int)(i - j);
+        }
+    }
+    m_NumAdded = 0;
+
+    int count = (int)m_Order.size();
+    m_SweepMin.resize(count);
+    m_SweepMax.resize(count);
+    m_SweepBoxes.resize(count);
+    for (int i = 0 ; i < count ; i++)
+    {
+        const Aabb &box = m_Proxies[m_Order[i]].box;
+        m_SweepMin[i] = box.min[m_Axis];
+        m_SweepMax[i] = box.max[m_Axis];
+        m_SweepBoxes[i] = box;
+    }
+
+    int axis1 = (m_Axis + 1)%3, axis2 = (m_Axis + 2)%3;
+    m_Previous.swap(m_Pairs);
+    m_Pairs.clear();
+    for (int i = 0 ; i < count ; i++)
+    {
+        float max = m_SweepMax[i];
+        const Aabb &box = m_SweepBoxes[i];
+        for (int j = i + 1 ; j < count && m_SweepMin[j] <= max ; j++)
+        {
+            const Aabb &other = m_SweepBoxes[j];
+            if (other.min[axis1] > box.max[axis1] || other.max[axis1] < box.min[axis1]) continue;
+            if (other.min[axis2] > box.max[axis2] || other.max[axis2] < box.min[axis2]) continue;
+
+            BroadphasePair pair;
+            pair.a = std::min(m_Order[i], m_Order[j]);
+            pair.b = std::max(m_Order[i], m_Order[j]);
+            m_Pairs.push_back(pair);
+        }
+    }
+    std::sort(m_Pairs.begin(), m_Pairs.end(), pairLess);
+
+    m_Began.clear();
+    m_Ended.clear();
+    std::set_difference(m_Pairs.begin(), m_Pairs.end(), m_Previous.begin(), m_Previous.end(), std::back_inserter(m_Began), pairLess);
+    std::set_difference(m_Previous.begin(), m_Previous.end(), m_Pairs.begin(), m_Pairs.end(), std::back_inserter(m_Ended), pairLess);
+}
@@ -0,0 +1,79 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <vector>
+
+#include "aabbtree.h"
+
+// Sweep-and-prune broadphase for many moving boxes.  Proxies are kept
+// sorted by the low end of their box along one axis; since things move a
+// little between updates, the order is repaired with an insertion sort that
+// costs about one pass when nothing changed places.  A sweep over the
+// sorted boxes then only compares proxies whose ranges on that axis overlap.
+// The axis is the one the proxies are most spread along, picked again when
+// that changes.
+//
+// Every update produces the full list of overlapping pairs, plus the pairs
+// that started and stopped overlapping since the previous update, which a
+// narrowphase can use to keep per-pair state.
+
+struct BroadphasePair
+{
+    int a;                              // Proxy ids, a < b
+    int b;
+};
+
+class SweepAndPrune
+{
+public:
+    SweepAndPrune();
+
+    int createProxy(const Aabb &box, int userData);
+
+    // Its pairs are dropped without showing up as ended
+    void destroyProxy(int proxy);
+    void moveProxy(int proxy, const Aabb &box);
+
+    int getUserData(int proxy) const { return m_Proxies[proxy].userData; }
+    const Aabb& getAabb(int proxy) const { return m_Proxies[proxy].box; }
+    int getProxyCount() const { return (int)m_Order.size(); }
+
+    // Finds the overlapping pairs of the boxes as they are now
+    void update();
+
+    // Sorted by a, then b
+    const std::vector<BroadphasePair>& getPairs() const { return m_Pairs; }
+    const std::vector<BroadphasePair>& getBeganPairs() const { return m_Began; }
+    const std::vector<BroadphasePair>& getEndedPairs() const { return m_Ended; }
+
+    // Order repairs of the last update, to tell how coherent the motion was
+    int getSwapCount() const { return m_Swaps; }
+
+private:
+    struct Proxy
+    {
+        Aabb box;
+        int userData;                   // Next free proxy while free
+    };
+
+    int chooseAxis() const;
+
+    std::vector<Proxy> m_Proxies;
+    int m_FreeList;
+    std::vector<int> m_Order;           // Live proxies sorted by box.min[m_Axis]
+    int m_Axis;
+    int m_NumAdded;                     // Proxies appended to m_Order since the last update
+
+    // The boxes in m_Order's order, gathered for the sweep
+    std::vector<float> m_SweepMin;
+    std::vector<float> m_SweepMax;
+    std::vector<Aabb> m_SweepBoxes;
+
+    std::vector<BroadphasePair> m_Pairs;
+    std::vector<BroadphasePair> m_Previous;
+    std::vector<BroadphasePair> m_Began;
+    std::vector<BroadphasePair> m_Ended;
+    int m_Swaps;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include <math.h>
+
+#include "cull.h"
+#include "simd.h"
+
+void extractFrustum(Frustum &frustum, const float* m)
+{
+    // Gribb & Hartmann: every plane is the last row of the matrix plus or
+    // minus one of the others
+    for (int i = 0 ; i < 4 ; i++)
+    {
+        float row0 = m[i*4+0], row1 = m[i*4+1], row2 = m[i*4+2], row3 = m[i*4+3];
+        frustum.planes[0][i] = row3 + row0;   // Left
+        frustum.planes[1][i] = row3 - row0;   // Right
+        frustum.planes[2][i] = row3 + row1;   // Bottom
+        frustum.planes[3][i] = row3 - row1;   // Top
+        frustum.planes[4][i] = row3 + row2;   // Near
+        frustum.planes[5][i] = row3 - row2;   // Far
+    }
+}
+
+bool boxInFrustum(const Frustum &frustum, const float* min, const float* max)
+{
+    for (int p = 0 ; p < 6 ; p++)
+    {
+        // Corner farthest along the plane normal
+        const float* plane = frustum.planes[p];
+        float x = (plane[0] >= 0) ? max[0] : min[0];
+        float y = (plane[1] >= 0) ? max[1] : min[1];
+        float z = (plane[2] >= 0) ? max[2] : min[2];
+        if (plane[0]*x + plane[1]*y + plane[2]*z + plane[3] < 0) return false;
+    }
+    return true;
+}
+
+// World space center and half extents of a transformed box, one item per
+// SIMD vector: center = M * c, extents = |M| * e
+static void transformCenterExtents(float* center, float* extents, const float* matrix, const float* box)
+{
+    float cx = (box[0]+box[3])*0.5f, cy = (box[1]+box[4])*0.5f, cz = (box[2]+box[5])*0.5f;
+    float ex = (box[3]-box[0])*0.5f, ey = (box[4]-box[1])*0.5f, ez = (box[5]-box[2])*0.5f;
+
+    Float4 col0 = float4Load(&matrix[0]);
+    Float4 col1 = float4Load(&matrix[4]);
+    Float4 col2 = float4Load(&matrix[8]);
+    Float4 col3 = float4Load(&matrix[12]);
+
+    Float4 c = float4Madd(col0, float4Set1(cx), float4Madd(col1, float4Set1(cy), float4Madd(col2, float4Set1(cz), col3)));
+    Float4 e = float4Madd(float4Abs(col0), float4Set1(ex), float4Madd(float4Abs(col1), float4Set1(ey), float4Mul(float4Abs(col2), float4Set1(ez))));
+
+    float4Store(center, c);
+    float4Store(extents, e);
+}
+
+void transformBox(float* worldBox, const float* matrix, const float* box)
+{
+    float center[4], extents[4];
+    transformCenterExtents(center, extents, matrix, box);
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        worldBox[k] = center[k] - extents[k];
+        worldBox[k+3] = center[k] + extents[k];
+    }
+}
+
+int cullBoxes(unsigned char* visible, const float* matrices, const float* boxes, int count, const Frustum &frustum)
+{
+    int num_visible = 0;
+
+    for (int base = 0 ; base < count ; base += 4)
+    {
+        int batch = (count - base < 4) ? count - base : 4;
+
+        // Transpose the batch into structure-of-arrays form
+        float cx[4], cy[4], cz[4], ex[4], ey[4], ez[4];
+        for (int j = 0 ; j < 4 ; j++)
+        {
+            float center[4], extents[4];
+            int item = base + ((j < batch) ? j : batch-1);
+            transformCenterExtents(center, extents, &matrices[item*16], &boxes[item*6]);
+            cx[j] = center[0]; cy[j] = center[1]; cz[j] = center[2];
+            ex[j] = extents[0]; ey[j] = extents[1]; ez[j] = extents[2];
+        }
+
+        Float4 vcx = float4Load(cx), vcy = float4Load(cy), vcz = float4Load(cz);
+        Float4 vex = float4Load(ex), vey = float4Load(ey), vez = float4Load(ez);
+
+        // A box is outside when it lies fully behind any plane:
+        // n.c + d + |n|.e < 0
+        Mask4 inside = mask4True();
+        for (int p = 0 ; p < 6 ; p++)
+        {
+            const float* plane = frustum.planes[p];
+            Float4 distance = float4Madd(vcx, float4Set1(plane[0]),
+                              float4Madd(vcy, float4Set1(plane[1]),
+                              float4Madd(vcz, float4Set1(plane[2]), float4Set1(plane[3]))));
+            Float4 radius = float4Madd(vex, float4Set1(fabsf(plane[0])),
+                            float4Madd(vey, float4Set1(fabsf(plane[1])),
+                            float4Mul(vez, float4Set1(fabsf(plane[2])))));
+            inside = mask4And(inside, float4GreaterEqual(float4Add(distance, radius), float4Set1(0.0f)));
+        }
+
+        int bits = mask4Bits(inside);
+        for (int j = 0 ; j < batch ; j++)
+        {
+            visible[base+j] = (bits >> j) & 1;
+            num_visible += visible[base+j];
+        }
+    }
+
+    return num_visible;
+}
@@ -0,0 +1,41 @@
+#ifndef CULL_H
+#define CULL_H
+
+// View-frustum culling of model-space bounding boxes.  Matrices are 4x4
+// column-major floats, as glm stores them, so &mat[0][0] can be passed
+// straight in.
+
+// Planes are stored as (a, b, c, d) with a*x + b*y + c*z + d >= 0 inside.
+// They are not normalized, which does not matter for the box tests.
+struct Frustum
+{
+    float planes[6][4];
+};
+
+// Per-frame culling counters
+struct CullStats
+{
+    int tested;
+    int culled;                         // Outside the frustum
+    int occluded;                       // Hidden behind occluders
+    int drawn;
+};
+
+// Extracts the six clip planes of a Projection * View matrix
+void extractFrustum(Frustum &frustum, const float* viewProjection);
+
+// Tests one world space box against the frustum
+bool boxInFrustum(const Frustum &frustum, const float* min, const float* max);
+
+// World space box (min x, y, z then max x, y, z) around a transformed
+// model space box
+void transformBox(float* worldBox, const float* matrix, const float* box);
+
+// Tests count boxes against the frustum, four per SIMD batch.  boxes holds
+// 6 floats per item (min x, y, z then max x, y, z) in model space and
+// matrices holds 16 floats per item.  Each box is moved to world space as
+// the box around its transformed corners.  Sets visible[i] to 1 or 0 and
+// returns the number of visible items.
+int cullBoxes(unsigned char* visible, const float* matrices, const float* boxes, int count, const Frustum &frustum);
+
+#endif
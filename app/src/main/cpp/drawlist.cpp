@@ -0,0 +1,23 @@
+#include "drawlist.h"
+
+void DrawList::clear()
+{
+    m_Commands.clear();
+    m_Data.clear();
+}
+
+void DrawList::push(int type, int arg0, int arg1, int arg2)
+{
+    DrawCommand command;
+    command.type = type;
+    command.args[0] = arg0;
+    command.args[1] = arg1;
+    command.args[2] = arg2;
+    command.data = (int)m_Data.size();
+    m_Commands.push_back(command);
+}
+
+void DrawList::pushData(const float* data, int count)
+{
+    m_Data.insert(m_Data.end(), data, data + count);
+}
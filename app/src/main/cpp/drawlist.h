@@ -0,0 +1,39 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include <vector>
+
+// A frame's draws recorded as plain data, so that everything leading up to
+// them (culling, LOD selection, sorting, matrix math) can run off the GL
+// thread and the GL thread only has to replay the list.  What the type and
+// arguments of a command mean is up to the recorder and the replayer; the
+// list only stores them, with the uniform data they refer to kept in a
+// separate float array.
+
+struct DrawCommand
+{
+    int type;
+    int args[3];
+    int data;                           // Offset of the command's floats in the data array
+};
+
+class DrawList
+{
+public:
+    void clear();
+
+    // Appends a command whose data starts at the current end of the data
+    // array, pushData then fills it in
+    void push(int type, int arg0 = 0, int arg1 = 0, int arg2 = 0);
+    void pushData(const float* data, int count);
+
+    int size() const { return (int)m_Commands.size(); }
+    const DrawCommand& getCommand(int i) const { return m_Commands[i]; }
+    const float* getData(int offset) const { return &m_Data[offset]; }
+
+private:
+    std::vector<DrawCommand> m_Commands;
+    std::vector<float> m_Data;
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include <string.h>
+#include <algorithm>
+
+#include "entities.h"
+#include "jobs.h"
+
+#define ENTITY_MAX_SLOTS        ((1 << ENTITY_INDEX_BITS) - 1)   // The last index is left for ENTITY_NONE
+#define ENTITY_GENERATION_MASK  ((1u << (32 - ENTITY_INDEX_BITS)) - 1)
+
+static Entity makeEntity(int index, unsigned int generation)
+{
+    return ((generation & ENTITY_GENERATION_MASK) << ENTITY_INDEX_BITS) | (unsigned int)index;
+}
+
+static unsigned int entityGeneration(Entity entity)
+{
+    return entity >> ENTITY_INDEX_BITS;
+}
+
+EntityStore::EntityStore(const int* componentSizes, int numComponents)
+    : m_NumComponents(numComponents)
+    , m_Count(0)
+{
+    for (int c = 0 ; c < numComponents ; c++)
+        m_ComponentSizes[c] = componentSizes[c];
+}
+
+int EntityStore::findArchetype(unsigned int mask)
+{
+    for (size_t a = 0 ; a < m_Archetypes.size() ; a++)
+    {
+        if (m_Archetypes[a].mask == mask) return (int)a;
+    }
+    m_Archetypes.push_back(Archetype());
+    m_Archetypes.back().mask = mask;
+    return (int)m_Archetypes.size() - 1;
+}
+
+int EntityStore::addRow(int archetype, Entity entity)
+{
+    Archetype &type = m_Archetypes[archetype];
+    int row = (int)type.entities.size();
+    type.entities.push_back(entity);
+    for (int c = 0 ; c < m_NumComponents ; c++)
+    {
+        if (type.mask & COMPONENT_BIT(c))
+            type.columns[c].resize((size_t)(row+1)*m_ComponentSizes[c]);
+    }
+    return row;
+}
+
+// The last row takes the place of the removed one
+void EntityStore::removeRow(int archetype, int row)
+{
+    Archetype &type = m_Archetypes[archetype];
+    int last = (int)type.entities.size() - 1;
+    if (row != last)
+    {
+        for (int c = 0 ; c < m_NumComponents ; c++)
+        {
+            if (!(type.mask & COMPONENT_BIT(c))) continue;
+            int size = m_ComponentSizes[c];
+            memcpy(&type.columns[c][(size_t)row*size], &type.columns[c][(size_t)last*size], size);
+        }
+        type.entities[row] = type.entities[last];
+        m_Slots[entityIndex(type.entities[row])].row = row;
+    }
+
+    type.entities.pop_back();
+    for (int c = 0 ; c < m_NumComponents ; c++)
+    {
+        if (type.mask & COMPONENT_BIT(c))
+            type.columns[c].resize((size_t)last*m_ComponentSizes[c]);
+    }
+}
+
+Entity EntityStore::create(unsigned int mask)
+{
+    int index;
+    if (!m_FreeSlots.empty())
+    {
+        index = m_FreeSlots.back();
+        m_FreeSlots.pop_back();
+    }
+    else
+    {
+        if ((int)m_Slots.size() == ENTITY_MAX_SLOTS) return ENTITY_NONE;
+        index = (int)m_Slots.size();
+        Slot slot = {0, -1, 0};
+        m_Slots.push_back(slot);
+    }
+
+    Slot &slot = m_Slots[index];
+    Entity entity = makeEntity(index, slot.generation);
+    slot.archetype = findArchetype(mask);
+    slot.row = addRow(slot.archetype, entity);
+    m_Count++;
+    return entity;
+}
+
+void EntityStore::destroy(Entity entity)
+{
+    if (!isAlive(entity)) return;
+
+    Slot &slot = m_Slots[entityIndex(entity)];
+    removeRow(slot.archetype, slot.row);
+    slot.archetype = -1;
+    slot.generation = (slot.generation + 1) & ENTITY_GENERATION_MASK;
+    m_FreeSlots.push_back(entityIndex(entity));
+    m_Count--;
+}
+
+bool EntityStore::isAlive(Entity entity) const
+{
+    int index = entityIndex(entity);
+    if (entity == ENTITY_NONE || index >= (int)m_Slots.size()) return false;
+    const Slot &slot = m_Slots[index];
+    return slot.archetype >= 0 && slot.generation == entityGeneration(entity);
+}
+
+void EntityStore::setMask(Entity entity, unsigned int mask)
+{
+    Slot &slot = m_Slots[entityIndex(entity)];
+    int from = slot.archetype;
+    if (m_Archetypes[from].mask == mask) return;
+
+    int to = findArchetype(mask);
+    int row = addRow(to, entity);
+
+    // findArchetype may have moved the archetypes
+    const Archetype &source = m_Archetypes[from];
+    Archetype &target = m_Archetypes[to];
+    for (int c = 0 ; c < m_NumComponents ; c++)
+    {
+        if (!(source.mask & target.mask & COMPONENT_BIT(c))) continue;
+        int size = m_ComponentSizes[c];
+        memcpy(&target.columns[c][(size_t)row*size], &source.columns[c][(size_t)slot.row*size], size);
+    }
+
+    removeRow(from, slot.row);
+    slot.archetype = to;
+    slot.row = row;
+}
+
+void EntityStore::addComponents(Entity entity, unsigned int mask)
+{
+    if (isAlive(entity))
+        setMask(entity, getMask(entity) | mask);
+}
+
+void EntityStore::removeComponents(Entity entity, unsigned int mask)
+{
+    if (isAlive(entity))
+        setMask(entity, getMask(entity) & ~mask);
+}
+
+unsigned int EntityStore::getMask(Entity entity) const
+{
+    if (!isAlive(entity)) return 0;
+    return m_Archetypes[m_Slots[entityIndex(entity)].archetype].mask;
+}
+
+void* EntityStore::get(Entity entity, int component)
+{
+    return const_cast<void*>(static_cast<const EntityStore*>(this)->get(entity, component));
+}
+
+const void* EntityStore::get(Entity entity, int component) const
+{
+    if (!isAlive(entity)) return NULL;
+
+    const Slot &slot = m_Slots[entityIndex(entity)];
+    const Archetype &type = m_Archetypes[slot.archetype];
+    if (!(type.mask & COMPONENT_BIT(component))) return NULL;
+    return &type.columns[component][(size_t)slot.row*m_ComponentSizes[component]];
+}
+
+EntityChunk EntityStore::getRow(Entity entity)
+{
+    if (!isAlive(entity))
+    {
+        EntityChunk chunk;
+        memset(&chunk, 0, sizeof(chunk));
+        return chunk;
+    }
+
+    const Slot &slot = m_Slots[entityIndex(entity)];
+    return getChunk(m_Archetypes[slot.archetype], slot.row, 1);
+}
+
+Entity EntityStore::getEntityAt(int index) const
+{
+    if (index < 0 || index >= (int)m_Slots.size() || m_Slots[index].archetype < 0) return ENTITY_NONE;
+    return makeEntity(index, m_Slots[index].generation);
+}
+
+EntityChunk EntityStore::getChunk(Archetype &archetype, int first, int count)
+{
+    EntityChunk chunk;
+    chunk.entities = &archetype.entities[first];
+    chunk.count = count;
+    for (int c = 0 ; c < ENTITY_MAX_COMPONENTS ; c++)
+    {
+        chunk.columns[c] = NULL;
+        if (c < m_NumComponents && (archetype.mask & COMPONENT_BIT(c)))
+            chunk.columns[c] = &archetype.columns[c][(size_t)first*m_ComponentSizes[c]];
+    }
+    return chunk;
+}
+
+void EntityStore::forEach(unsigned int include, unsigned int exclude, const std::function<void(const EntityChunk&)>& func)
+{
+    for (size_t a = 0 ; a < m_Archetypes.size() ; a++)
+    {
+        Archetype &archetype = m_Archetypes[a];
+        if ((archetype.mask & include) != include || (archetype.mask & exclude) || archetype.entities.empty()) continue;
+        func(getChunk(archetype, 0, (int)archetype.entities.size()));
+    }
+}
+
+void EntityStore::forEachParallel(unsigned int include, unsigned int exclude, const std::function<void(const EntityChunk&, int)>& func)
+{
+    std::vector<EntityChunk> chunks;
+    for (size_t a = 0 ; a < m_Archetypes.size() ; a++)
+    {
+        Archetype &archetype = m_Archetypes[a];
+        if ((archetype.mask & include) != include || (archetype.mask & exclude)) continue;
+
+        int rows = (int)archetype.entities.size();
+        for (int first = 0 ; first < rows ; first += ENTITY_CHUNK_ROWS)
+            chunks.push_back(getChunk(archetype, first, std::min(rows - first, ENTITY_CHUNK_ROWS)));
+    }
+
+    parallelFor((int)chunks.size(), [&](int c)
+    {
+        func(chunks[c], c);
+    });
+}
+
+int EntityStore::getChunkCount(unsigned int include, unsigned int exclude) const
+{
+    int count = 0;
+    for (size_t a = 0 ; a < m_Archetypes.size() ; a++)
+    {
+        const Archetype &archetype = m_Archetypes[a];
+        if ((archetype.mask & include) != include || (archetype.mask & exclude)) continue;
+        count += ((int)archetype.entities.size() + ENTITY_CHUNK_ROWS - 1) / ENTITY_CHUNK_ROWS;
+    }
+    return count;
+}
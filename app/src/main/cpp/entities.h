@@ -0,0 +1,115 @@
+#ifndef ENTITIES_H
+#define ENTITIES_H
+
+#include <vector>
+#include <functional>
+
+// Entity component store.  Entities with the same set of components share an
+// archetype, which keeps every component in its own contiguous array with
+// one row per entity, so a system is a linear sweep over the arrays of the
+// archetypes it queries.  Components are plain data, moved with memcpy.
+//
+// Entities are referred to by handles made of a slot index and a
+// generation.  They stay valid while rows move around inside and between
+// archetypes, and stop matching once the entity is destroyed, even when its
+// slot is handed out again.
+
+typedef unsigned int Entity;
+
+#define ENTITY_NONE             0xffffffffu
+#define ENTITY_INDEX_BITS       20          // Up to a million entities at once
+#define ENTITY_MAX_COMPONENTS   32
+
+#define ENTITY_CHUNK_ROWS       4096        // Rows per job of a parallel query
+
+#define COMPONENT_BIT(component)    (1u << (component))
+
+// Slot of an entity, dense from 0 in creation order until slots get reused
+inline int entityIndex(Entity entity) { return (int)(entity & ((1u << ENTITY_INDEX_BITS) - 1)); }
+
+// Rows of one archetype passed to a query
+struct EntityChunk
+{
+    const Entity* entities;
+    int count;
+    void* columns[ENTITY_MAX_COMPONENTS];   // First row of each component, NULL when the archetype lacks it
+
+    template <class T> T* get(int component) const { return (T*)columns[component]; }
+};
+
+class EntityStore
+{
+public:
+    // Component i has componentSizes[i] bytes, its bit in masks is
+    // COMPONENT_BIT(i)
+    EntityStore(const int* componentSizes, int numComponents);
+
+    // Creates an entity with the components in mask, left uninitialized
+    Entity create(unsigned int mask);
+    void destroy(Entity entity);
+    bool isAlive(Entity entity) const;
+
+    // Move the entity to the archetype with the components added or taken
+    // away.  The components it keeps keep their values.
+    void addComponents(Entity entity, unsigned int mask);
+    void removeComponents(Entity entity, unsigned int mask);
+
+    unsigned int getMask(Entity entity) const;
+    bool has(Entity entity, int component) const { return (getMask(entity) & COMPONENT_BIT(component)) != 0; }
+
+    // Valid until entities are created, destroyed or change components
+    void* get(Entity entity, int component);
+    const void* get(Entity entity, int component) const;
+
+    // The entity's row as a chunk of one, to read several of its components
+    // with a single lookup, or an empty chunk when the entity is gone.  Same
+    // lifetime as get.
+    EntityChunk getRow(Entity entity);
+
+    // Entity in the slot, or ENTITY_NONE when it is free
+    Entity getEntityAt(int index) const;
+    int getSlotCount() const { return (int)m_Slots.size(); }
+    int getCount() const { return m_Count; }
+    int getArchetypeCount() const { return (int)m_Archetypes.size(); }
+
+    // Calls func once per archetype holding every component in include and
+    // none in exclude
+    void forEach(unsigned int include, unsigned int exclude, const std::function<void(const EntityChunk&)>& func);
+
+    // Same, with the archetypes cut into chunks of ENTITY_CHUNK_ROWS rows
+    // spread over the job pool.  func also gets the chunk's number, from 0
+    // to getChunkCount in the order forEach would visit the rows, to keep
+    // per chunk results apart.  func must not create, destroy or change
+    // entities, and must only write to the rows of its own chunk.
+    void forEachParallel(unsigned int include, unsigned int exclude, const std::function<void(const EntityChunk&, int)>& func);
+    int getChunkCount(unsigned int include, unsigned int exclude) const;
+
+private:
+    struct Archetype
+    {
+        unsigned int mask;
+        std::vector<Entity> entities;
+        std::vector<unsigned char> columns[ENTITY_MAX_COMPONENTS];
+    };
+    struct Slot
+    {
+        unsigned int generation;
+        int archetype;                  // -1 when the slot is free
+        int row;
+    };
+
+    int findArchetype(unsigned int mask);
+    int addRow(int archetype, Entity entity);
+    void removeRow(int archetype, int row);
+    void setMask(Entity entity, unsigned int mask);
+    EntityChunk getChunk(Archetype &archetype, int first, int count);
+
+    int m_ComponentSizes[ENTITY_MAX_COMPONENTS];
+    int m_NumComponents;
+    std::vector<Archetype> m_Archetypes;
+    std::vector<Slot> m_Slots;
+    std::vector<int> m_FreeSlots;
+    int m_Count;
+};
+
+#endif
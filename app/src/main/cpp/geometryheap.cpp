@@ -0,0 +1,217 @@
+#include "geometryheap.h"
+#include "glbackend.h"
+#include "glstate.h"
+#include "gldebug.h"
+
+void RangeAllocator::reset(int capacity)
+{
+    m_Capacity = capacity;
+    m_FreeSize = capacity;
+    m_Free.clear();
+    if (capacity > 0)
+    {
+        FreeRange all = {0, capacity};
+        m_Free.push_back(all);
+    }
+}
+
+int RangeAllocator::allocate(int size)
+{
+    if (size <= 0) return 0;
+
+    for (size_t i = 0 ; i < m_Free.size() ; i++)
+    {
+        FreeRange &range = m_Free[i];
+        if (range.size < size) continue;
+
+        int offset = range.offset;
+        range.offset += size;
+        range.size -= size;
+        if (range.size == 0)
+            m_Free.erase(m_Free.begin() + i);
+        m_FreeSize -= size;
+        return offset;
+    }
+    return -1;
+}
+
+void RangeAllocator::free(int offset, int size)
+{
+    if (size <= 0) return;
+    m_FreeSize += size;
+
+    // First free range after the freed one
+    size_t next = 0;
+    while (next < m_Free.size() && m_Free[next].offset < offset)
+        next++;
+
+    bool merge_previous = next > 0 && m_Free[next-1].offset + m_Free[next-1].size == offset;
+    bool merge_next = next < m_Free.size() && offset + size == m_Free[next].offset;
+
+    if (merge_previous && merge_next)
+    {
+        m_Free[next-1].size += size + m_Free[next].size;
+        m_Free.erase(m_Free.begin() + next);
+    }
+    else if (merge_previous)
+    {
+        m_Free[next-1].size += size;
+    }
+    else if (merge_next)
+    {
+        m_Free[next].offset = offset;
+        m_Free[next].size += size;
+    }
+    else
+    {
+        FreeRange range = {offset, size};
+        m_Free.insert(m_Free.begin() + next, range);
+    }
+}
+
+GeometryHeap::GeometryHeap(int vertexSize)
+    : m_VertexSize(vertexSize)
+{
+}
+
+void GeometryHeap::reset()
+{
+    m_Pages.clear();
+}
+
+int GeometryHeap::addPage(int numVertices, int numIndices, GLenum indexType)
+{
+    size_t slot = 0;
+    while (slot < m_Pages.size() && m_Pages[slot].vertexbuffer)
+        slot++;
+    if (slot == m_Pages.size())
+        m_Pages.push_back(Page());
+
+    Page &page = m_Pages[slot];
+    page.indexType = indexType;
+    page.vertices.reset(numVertices > GEOMETRY_PAGE_VERTICES ? numVertices : GEOMETRY_PAGE_VERTICES);
+    page.indices.reset(numIndices > GEOMETRY_PAGE_INDICES ? numIndices : GEOMETRY_PAGE_INDICES);
+
+    gGL->genBuffers(1, &page.vertexbuffer); CHK;
+    cachedBindBuffer(GL_ARRAY_BUFFER, page.vertexbuffer); CHK;
+    gGL->bufferData(GL_ARRAY_BUFFER, (GLsizeiptr)page.vertices.getCapacity()*m_VertexSize, NULL, GL_STATIC_DRAW); CHK;
+
+    gGL->genBuffers(1, &page.indexbuffer); CHK;
+    cachedBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.indexbuffer); CHK;
+    gGL->bufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(page.indices.getCapacity()*indexSize(indexType)), NULL, GL_STATIC_DRAW); CHK;
+
+    return (int)slot;
+}
+
+bool GeometryHeap::allocate(GeometryRange &range, int numVertices, int numIndices, GLenum indexType)
+{
+    range.page = -1;
+    range.numVertices = numVertices;
+    range.numIndices = numIndices;
+
+    for (size_t p = 0 ; p < m_Pages.size() ; p++)
+    {
+        Page &page = m_Pages[p];
+        if (!page.vertexbuffer || page.indexType != indexType) continue;
+        if (page.vertices.getFreeSize() < numVertices || page.indices.getFreeSize() < numIndices) continue;
+
+        int first_vertex = page.vertices.allocate(numVertices);
+        if (first_vertex < 0) continue;
+        int first_index = page.indices.allocate(numIndices);
+        if (first_index < 0)
+        {
+            page.vertices.free(first_vertex, numVertices);
+            continue;
+        }
+
+        range.page = (int)p;
+        range.firstVertex = first_vertex;
+        range.firstIndex = first_index;
+        return true;
+    }
+
+    int p = addPage(numVertices, numIndices, indexType);
+    range.page = p;
+    range.firstVertex = m_Pages[p].vertices.allocate(numVertices);
+    range.firstIndex = m_Pages[p].indices.allocate(numIndices);
+    return true;
+}
+
+void GeometryHeap::free(GeometryRange &range)
+{
+    if (range.page < 0) return;
+
+    Page &page = m_Pages[range.page];
+    page.vertices.free(range.firstVertex, range.numVertices);
+    page.indices.free(range.firstIndex, range.numIndices);
+    range.page = -1;
+
+    if (!page.vertices.isEmpty() || !page.indices.isEmpty() || getPageCount() == 1) return;
+
+    GLuint buffers[2] = {page.vertexbuffer, page.indexbuffer};
+    cachedDeleteBuffers(2, buffers); CHK;
+    page.vertexbuffer = 0;
+    page.indexbuffer = 0;
+}
+
+void GeometryHeap::writeVertices(const GeometryRange &range, const void* vertices)
+{
+    if (range.numVertices == 0) return;
+
+    cachedBindBuffer(GL_ARRAY_BUFFER, m_Pages[range.page].vertexbuffer); CHK;
+    gGL->bufferSubData(GL_ARRAY_BUFFER, (GLintptr)range.firstVertex*m_VertexSize, (GLsizeiptr)range.numVertices*m_VertexSize, vertices); CHK;
+}
+
+void GeometryHeap::writeIndices(const GeometryRange &range, const unsigned int* indices)
+{
+    if (range.numIndices == 0) return;
+
+    cachedBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Pages[range.page].indexbuffer); CHK;
+    if (getIndexType(range) == GL_UNSIGNED_INT)
+    {
+        std::vector<GLuint> page_indices(indices, indices + range.numIndices);
+        for (size_t i = 0 ; i < page_indices.size() ; i++)
+            page_indices[i] += range.firstVertex;
+        gGL->bufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.firstIndex*sizeof(GLuint), page_indices.size()*sizeof(GLuint), &page_indices[0]); CHK;
+    }
+    else
+    {
+        std::vector<unsigned short> short_indices(indices, indices + range.numIndices);
+        gGL->bufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.firstIndex*sizeof(unsigned short), short_indices.size()*sizeof(unsigned short), &short_indices[0]); CHK;
+    }
+}
+
+int GeometryHeap::getPageCount() const
+{
+    int count = 0;
+    for (size_t p = 0 ; p < m_Pages.size() ; p++)
+    {
+        if (m_Pages[p].vertexbuffer) count++;
+    }
+    return count;
+}
+
+size_t GeometryHeap::getUsedBytes() const
+{
+    size_t bytes = 0;
+    for (size_t p = 0 ; p < m_Pages.size() ; p++)
+    {
+        const Page &page = m_Pages[p];
+        if (!page.vertexbuffer) continue;
+        bytes += (size_t)(page.vertices.getCapacity() - page.vertices.getFreeSize())*m_VertexSize;
+        bytes += (size_t)(page.indices.getCapacity() - page.indices.getFreeSize())*indexSize(page.indexType);
+    }
+    return bytes;
+}
+
+size_t GeometryHeap::getCapacityBytes() const
+{
+    size_t bytes = 0;
+    for (size_t p = 0 ; p < m_Pages.size() ; p++)
+    {
+        const Page &page = m_Pages[p];
+        if (!page.vertexbuffer) continue;
+        bytes += (size_t)page.vertices.getCapacity()*m_VertexSize + (size_t)page.indices.getCapacity()*indexSize(page.indexType);
+    }
+    return bytes;
+}
@@ -0,0 +1,109 @@
+#ifndef GEOMETRYHEAP_H
+#define GEOMETRYHEAP_H
+
+#include <stddef.h>
+#include <GLES2/gl2.h>
+
+#include <vector>
+
+// First-fit allocator over [0, capacity).  Freed ranges are merged with
+// their free neighbours, so the free list stays as short as the number of
+// holes.
+class RangeAllocator
+{
+public:
+    void reset(int capacity);
+
+    // Returns the offset of a free range of the given size, or -1
+    int allocate(int size);
+    void free(int offset, int size);
+
+    int getCapacity() const { return m_Capacity; }
+    int getFreeSize() const { return m_FreeSize; }
+    bool isEmpty() const { return m_FreeSize == m_Capacity; }
+
+private:
+    struct FreeRange
+    {
+        int offset;
+        int size;
+    };
+    std::vector<FreeRange> m_Free;      // Sorted by offset
+    int m_Capacity;
+    int m_FreeSize;
+};
+
+// Pages are this big unless a single allocation needs more
+#define GEOMETRY_PAGE_VERTICES  131072
+#define GEOMETRY_PAGE_INDICES   393216
+
+// A span of vertices and indices in one page of the heap
+struct GeometryRange
+{
+    int page;                           // -1 when nothing is allocated
+    int firstVertex;
+    int numVertices;
+    int firstIndex;
+    int numIndices;
+};
+
+// Vertex and index storage shared by all static geometry.  Each page is one
+// vertex buffer and one index buffer carved up by a RangeAllocator, so
+// models in the same page are drawn from the same two buffers.
+//
+// A page holds either 16-bit or 32-bit indices, and ranges only go to
+// pages of the type they ask for.  In 32-bit pages the indices are written
+// relative to the start of the page and every range in the page shares the
+// same attribute pointers.  In 16-bit pages they stay relative to the
+// range, which then needs the attribute pointers moved to getBaseVertex.
+class GeometryHeap
+{
+public:
+    explicit GeometryHeap(int vertexSize);
+
+    // Forgets every page without deleting its buffers, for when the context
+    // that owned them is gone
+    void reset();
+
+    // indexType is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    bool allocate(GeometryRange &range, int numVertices, int numIndices, GLenum indexType);
+
+    // Returns the range for reuse.  Pages left empty are deleted, except
+    // the last one.
+    void free(GeometryRange &range);
+
+    // vertices holds range.numVertices vertices, indices range.numIndices
+    // indices counted from the first vertex of the range
+    void writeVertices(const GeometryRange &range, const void* vertices);
+    void writeIndices(const GeometryRange &range, const unsigned int* indices);
+
+    GLuint getVertexBuffer(int page) const { return m_Pages[page].vertexbuffer; }
+    GLuint getIndexBuffer(int page) const { return m_Pages[page].indexbuffer; }
+    GLenum getIndexType(const GeometryRange &range) const { return m_Pages[range.page].indexType; }
+    size_t getIndexSize(const GeometryRange &range) const { return indexSize(getIndexType(range)); }
+
+    // Vertex the attribute pointers of a range start at
+    int getBaseVertex(const GeometryRange &range) const { return (getIndexType(range) == GL_UNSIGNED_INT) ? 0 : range.firstVertex; }
+
+    int getPageCount() const;
+    size_t getUsedBytes() const;
+    size_t getCapacityBytes() const;
+
+private:
+    struct Page
+    {
+        GLuint vertexbuffer;            // 0 for a deleted page's slot
+        GLuint indexbuffer;
+        GLenum indexType;
+        RangeAllocator vertices;
+        RangeAllocator indices;
+    };
+    int addPage(int numVertices, int numIndices, GLenum indexType);
+
+    static size_t indexSize(GLenum indexType) { return (indexType == GL_UNSIGNED_INT) ? sizeof(GLuint) : sizeof(unsigned short); }
+
+    std::vector<Page> m_Pages;
+    int m_VertexSize;
+};
+
+#endif
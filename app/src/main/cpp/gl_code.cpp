@@ -27,31 +27,50 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
+#include <vector>
+#include <algorithm>
+#include <mutex>
+
 #include "3ds.h"
 #include "texture.h"
+#include "shaders.h"
+#include "programcache.h"
+#include "meshopt.h"
+#include "jobs.h"
+#include "simplify.h"
+#include "cull.h"
+#include "aabbtree.h"
+#include "occlusion.h"
+#include "map.h"
+#include "pvs.h"
+#include "renderqueue.h"
+#include "glstate.h"
+#include "glbackend.h"
+#include "gldebug.h"
+#include "staticbatch.h"
+#include "geometryheap.h"
+#include "streambuffer.h"
+#include "drawlist.h"
+#include "transform.h"
+#include "scenegraph.h"
+#include "entities.h"
+#include "simulation.h"
+#include "trianglebvh.h"
+#include "broadphase.h"
 
 #define  LOG_TAG    "libgl2jni"
 #define  LOGI(...)  __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
 #define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
 
-#define CHK checkGlError(__FILE__,__LINE__)
-
 static void printGLString(const char *name, GLenum s)
 {
-    const char *v = (const char *) glGetString(s);
+    const char *v = (const char *) gGL->getString(s);
     LOGI("GL %s = %s\n", name, v);
 }
 
-static void checkGlError(const char* file, int line)
-{
-    for (GLint error = glGetError(); error ; error = glGetError())
-    {
-        LOGI("Error (0x%x) at %s %d\n", error, file, line);
-    }
-}
-
 glm::mat4 Projection;
 
 #define NUM_VERTICES 2000000
@@ -63,7 +82,7 @@ static GLfloat gColorList[NUM_VERTICES*3];
 static GLfloat gNormalList[NUM_VERTICES*3];
 static GLfloat gUseTextures[NUM_VERTICES];
 static GLfloat gSamplerList[NUM_VERTICES];
-static unsigned short gIndicesList[NUM_INDICES];
+static GLuint gIndicesList[NUM_INDICES];
 
 static int gNumVertexList = 0;
 static int gNumIndicesList = 0;
@@ -81,388 +100,2099 @@ struct TextureInfo
 static TextureInfo gTextureList[30];
 static int gNumTextureList = 0;
 
+#define MAX_LODS        4
+
+// A part of a model drawn with its own vertex attribute offsets, used when
+// a model does not fit 16-bit indices and 32-bit ones are not available
+struct DrawRange
+{
+    int baseVertex;
+    int indexOffset;
+    int numIndices;
+};
+
+// One level of detail: a span of the model's index list and the draw ranges
+// that cover it
+struct ModelLod
+{
+    int indexOffset;
+    int numIndices;
+    int firstRange;
+    int numRanges;
+};
+
+// SHADER_MAX_INSTANCES-capped copies of a model's vertices, each tagged with
+// its copy number, and of every LOD's indices, so that a run of items of the
+// model is drawn with one call per LOD.  maxInstances is 0 for models that
+// are not instanced.
+struct InstancedBuffers
+{
+    int maxInstances;
+    int indexOffsets[MAX_LODS];         // Start of each LOD's copies
+    GLuint vertexbuffer;
+    GLuint uvbuffer;
+    GLuint colorbuffer;
+    GLuint normalbuffer;
+    GLuint samplerbuffer;
+    GLuint usetexbuffer;
+    GLuint instancebuffer;
+    GLuint indicesbuffer;
+};
+
 struct ModelArrayInfo
 {
     int vertexOffset;
     int numVertices;
     int indexOffset;
     int numIndices;
-    GLuint vertexbuffer;
-    GLuint indicesbuffer;
-    GLuint uvbuffer;
+    GeometryRange geometry;             // Where the model lives in gGeometryHeap
     GLfloat max_x;
     GLfloat min_x;
     GLfloat max_y;
     GLfloat min_y;
     GLfloat max_z;
     GLfloat min_z;
-    GLuint colorbuffer;
-    GLuint normalbuffer;
-    GLuint samplerbuffer;
-    GLuint usetexbuffer;
     GLuint sampler_map[32];
     int num_sampler_map;
+    int shader_features;
+    int material_id;                    // First model with the same sampler_map
+    std::vector<DrawRange> ranges;      // As many as the LODs need, one each unless split
+    ModelLod lods[MAX_LODS];
+    int num_lods;
+    InstancedBuffers instanced;
 };
 static ModelArrayInfo gModelArrayInfos[20];
+static TriangleBvh gModelBvhs[20];      // Full-detail triangles of each model, for collision queries
 static int gNumModelArrayInfos = 0;
+static int gNumUploadedModels = 0;      // Models whose buffers are in the current context
+
+// Interleaved vertex layout of the geometry heap, in floats
+#define VERTEX_POSITION     0
+#define VERTEX_NORMAL       3
+#define VERTEX_COLOR        6
+#define VERTEX_UV           9
+#define VERTEX_USE_TEXTURE  11
+#define VERTEX_SAMPLER      12
+#define VERTEX_STRIDE       13
+
+// One vertex and one index buffer per page for every model and static batch
+static GeometryHeap gGeometryHeap(VERTEX_STRIDE*sizeof(GLfloat));
+
+// Per-frame geometry, see DrawStreamedTriangles
+#define STREAM_VERTEX_BYTES     (256*1024)
+#define STREAM_INDEX_BYTES      (64*1024)
+static StreamBuffer gStreamVertices;
+static StreamBuffer gStreamIndices;
 
 volatile int gTotalBytes = 100;
 volatile int gLoadedBytes = 0;
 volatile unsigned char gLoadingPercent = 0;
 
-int getTimeNsec()
+int64_t getTimeNsec()
 {
     struct timespec now;
     clock_gettime(CLOCK_MONOTONIC, &now);
-    return now.tv_nsec;
-}
-
-auto gVertexShader =
-    "#version 100\n"
-    "attribute vec3 vPosition;\n"
-    "attribute vec3 vNormal;\n"
-    "attribute vec3 vColor;\n"
-    "attribute vec2 vTextureUV;\n"
-    "attribute float vUseTexture;\n"
-    "attribute float vSamplerID;\n"
-    "uniform mediump vec3 LightPosition_worldspace;\n"
-    "uniform float lightPower;\n"
-    "uniform mediump vec3 LightColor;\n"
-    "uniform mat4 mvp;\n"
-    "uniform mat4 v;\n"
-    "uniform mat4 m;\n"
-    "varying vec3 fragmentColor;\n"
-    "varying vec3 Normal_cameraspace;\n"
-    "varying vec3 Position_worldspace;\n"
-    "varying vec3 EyeDirection_cameraspace;\n"
-    "varying vec3 LightDirection_cameraspace;\n"
-    "varying float SamplerID;\n"
-    "varying float UseTexture;\n"
-    "varying vec2 UV;\n"
-    "void main() {\n"
-    "  vec4 vPosition4 = vec4(vPosition,1.0);\n"
-    "  gl_Position = mvp*vPosition4;\n"
-    "  Position_worldspace = (m*vPosition4).xyz;\n"
-    "  vec3 vertexPosition_cameraspace = (v*m*vPosition4).xyz;\n"
-    "  EyeDirection_cameraspace = vec3(0.0, 0.0, 0.0) - vertexPosition_cameraspace;\n"
-    "  vec3 LightPosition_cameraspace = (v*vec4(LightPosition_worldspace, 1.0)).xyz;\n"
-    "  LightDirection_cameraspace = LightPosition_cameraspace + EyeDirection_cameraspace;\n"
-    "  Normal_cameraspace = (v*m*vec4(vNormal, 0.0)).xyz;\n"
-    "  fragmentColor = vColor;\n"
-    "  UV = vTextureUV;\n"
-    "  UseTexture = vUseTexture;\n"
-    "  SamplerID = vSamplerID;\n"
-    "}\n";
-
-auto gFragmentShader =
-    "#version 100\n"
-    "precision mediump float;\n"
-    "uniform mediump vec3 LightPosition_worldspace;\n"
-    "uniform mediump vec3 LightColor;\n"
-    "uniform float lightPower;\n"
-    "uniform sampler2D vSamplersArray[32];\n"
-    "varying vec3 fragmentColor;\n"
-    "varying vec3 Position_worldspace;\n"
-    "varying vec3 Normal_cameraspace;\n"
-    "varying vec3 EyeDirection_cameraspace;\n"
-    "varying vec3 LightDirection_cameraspace;\n"
-    "varying float SamplerID;\n"
-    "varying float UseTexture;\n"
-    "varying vec2 UV;\n"
-    "void main() {\n"
-    "  mediump int index = int(SamplerID);\n"
-    "  vec3 MaterialDiffuseColor = (1.0-UseTexture)*fragmentColor + UseTexture*texture2D(vSamplersArray[index],UV).rgb;\n"
-    "  vec3 MaterialAmbientColor = vec3(0.1, 0.1, 0.1)*MaterialDiffuseColor;\n"
-    "  vec3 MaterialSpecularColor = vec3(0.3, 0.3, 0.3);\n"
-    "  float distance = length(LightPosition_worldspace-Position_worldspace);\n"
-    "  vec3 n = normalize(Normal_cameraspace);\n"
-    "  vec3 l = normalize(LightDirection_cameraspace);\n"
-    "  float cosTheta = clamp(dot(n,l),0.0,1.0);\n"
-    "  vec3 E = normalize(EyeDirection_cameraspace);\n"
-    "  vec3 R = reflect(-l,n);\n"
-    "  float cosAlpha = clamp(dot(E,R),0.0,1.0);\n"
-    "  gl_FragColor.rgb =\n"
-    "    MaterialAmbientColor +\n"
-    "    MaterialDiffuseColor*LightColor*lightPower*cosTheta/(distance*distance) +\n"
-    "    MaterialSpecularColor*LightColor*lightPower*pow(cosAlpha, 5.0)/(distance*distance);\n"
-    "}\n";
-
-GLuint loadShader(GLenum shaderType, const char* pSource)
-{
-    GLuint shader = glCreateShader(shaderType); CHK;
-    if (shader)
-    {
-        glShaderSource(shader, 1, &pSource, NULL); CHK;
-        glCompileShader(shader); CHK;
-        GLint compiled = 0;
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-        if (!compiled)
-        {
-            GLint infoLen = 0;
-            glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen); CHK;
-            if (infoLen)
+    return (int64_t)now.tv_sec*1000000000 + now.tv_nsec;
+}
+
+// Features every draw gets on top of what its materials need.  The game
+// adds fog once it starts.
+static int gSceneShaderFeatures = 0;
+static glm::vec3 gFogColor(0.0f, 0.0f, 0.0f);  // The game's clear color
+static float gFogDensity = 0.0001f;             // Half fogged at the far plane
+
+static ShaderProgram* gCurrentShader = NULL;
+
+static bool gHasUintIndices = false;
+
+// LOD n+1 is used once the model's bounding sphere covers less than
+// gLodScreenSize[n] of the viewport height
+static const float gLodScreenSize[MAX_LODS-1] = {0.25f, 0.12f, 0.05f};
+
+static void FinishFramePrepare();
+
+bool resize(int w, int h)
+{
+    FinishFramePrepare();
+    Projection = glm::perspective(glm::radians(90.0f), (float)w/(float)h, 0.1f, 100.0f);
+    cachedViewport(0, 0, w, h); CHK;
+    return true;
+}
+
+static int64_t lastTime = 0;
+
+void createTextures(int i)
+{
+    gGL->genTextures(1, &gTextureList[i].textureID); CHK;
+    cachedBindTexture(GL_TEXTURE_2D, gTextureList[i].textureID); CHK;
+    gGL->texImage2D(GL_TEXTURE_2D, 0, GL_RGB, gTextureList[i].width, gTextureList[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, gTextureList[i].data); CHK;
+    gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); CHK;
+    gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); CHK;
+    gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); CHK;
+    gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR); CHK;
+    gGL->generateMipmap(GL_TEXTURE_2D); CHK;
+}
+
+static void uploadArrayBuffer(GLuint* buffer, GLenum target, GLsizeiptr size, const void* data)
+{
+    gGL->genBuffers(1, buffer); CHK;
+    cachedBindBuffer(target, *buffer); CHK;
+    gGL->bufferData(target, size, data, GL_STATIC_DRAW); CHK;
+}
+
+// Interleaves separate attribute arrays into the heap's vertex layout,
+// taking the vertices in the given order when there is one
+static void interleaveVertices(std::vector<GLfloat> &dst, int count, const GLfloat* positions, const GLfloat* normals,
+                               const GLfloat* colors, const GLfloat* uvs, const GLfloat* useTextures, const GLfloat* samplers,
+                               const unsigned int* order)
+{
+    dst.resize(count*VERTEX_STRIDE);
+    for (int v = 0 ; v < count ; v++)
+    {
+        int src = order ? order[v] : v;
+        GLfloat* vertex = &dst[v*VERTEX_STRIDE];
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            vertex[VERTEX_POSITION+k] = positions[src*3+k];
+            vertex[VERTEX_NORMAL+k] = normals[src*3+k];
+            vertex[VERTEX_COLOR+k] = colors[src*3+k];
+        }
+        vertex[VERTEX_UV] = uvs[src*2];
+        vertex[VERTEX_UV+1] = uvs[src*2+1];
+        vertex[VERTEX_USE_TEXTURE] = useTextures[src];
+        vertex[VERTEX_SAMPLER] = samplers[src];
+    }
+}
+
+// Copies a model's vertices, in the given order when there is one, and its
+// indices into a new range of the geometry heap
+static void uploadModelGeometry(ModelArrayInfo &info, const unsigned int* indices, int numIndices, const std::vector<unsigned int>* order,
+                                GLenum indexType)
+{
+    int third = info.vertexOffset/3;
+    int num_vertices = order ? (int)order->size() : info.numVertices/3;
+
+    std::vector<GLfloat> vertices;
+    interleaveVertices(vertices, num_vertices, &gVertexList[info.vertexOffset], &gNormalList[info.vertexOffset],
+                       &gColorList[info.vertexOffset], &gTexturesUVList[third*2], &gUseTextures[third], &gSamplerList[third],
+                       order ? &(*order)[0] : NULL);
+
+    gGeometryHeap.allocate(info.geometry, num_vertices, numIndices, indexType);
+    gGeometryHeap.writeVertices(info.geometry, vertices.empty() ? NULL : &vertices[0]);
+    gGeometryHeap.writeIndices(info.geometry, indices);
+}
+
+#define INSTANCE_MIN_BATCH  4
+
+// Repeats an attribute array copies times
+static void replicateAttribute(std::vector<GLfloat> &dst, const GLfloat* src, int size, int copies)
+{
+    dst.resize(size*copies);
+    for (int c = 0 ; c < copies ; c++)
+        memcpy(&dst[c*size], src, size*sizeof(GLfloat));
+}
+
+// Uploads the instanced copies of a model whose copies all fit 16-bit
+// indices.  Models too big for INSTANCE_MIN_BATCH copies are left to the
+// regular path, batching them would save little and cost a lot of memory.
+static void createInstancedBuffers(ModelArrayInfo &info)
+{
+    InstancedBuffers &instanced = info.instanced;
+    int num_vertices = info.numVertices/3;
+    int third = info.vertexOffset/3;
+
+    instanced.maxInstances = 0;
+    if (num_vertices == 0) return;
+    int copies = 65536/num_vertices;
+    if (copies > SHADER_MAX_INSTANCES) copies = SHADER_MAX_INSTANCES;
+    if (copies < INSTANCE_MIN_BATCH) return;
+
+    std::vector<unsigned short> indices;
+    for (int l = 0 ; l < info.num_lods ; l++)
+    {
+        const ModelLod &lod = info.lods[l];
+        const GLuint* lod_indices = &gIndicesList[info.indexOffset + lod.indexOffset];
+        instanced.indexOffsets[l] = (int)indices.size();
+        for (int c = 0 ; c < copies ; c++)
+        {
+            for (int k = 0 ; k < lod.numIndices ; k++)
+                indices.push_back((unsigned short)(lod_indices[k] + c*num_vertices));
+        }
+    }
+    uploadArrayBuffer(&instanced.indicesbuffer, GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(unsigned short), &indices[0]);
+
+    std::vector<GLfloat> data(num_vertices*copies);
+    for (int c = 0 ; c < copies ; c++)
+    {
+        for (int v = 0 ; v < num_vertices ; v++)
+            data[c*num_vertices+v] = (GLfloat)c;
+    }
+    uploadArrayBuffer(&instanced.instancebuffer, GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0]);
+
+    replicateAttribute(data, &gVertexList[info.vertexOffset], info.numVertices, copies);
+    uploadArrayBuffer(&instanced.vertexbuffer, GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0]);
+    replicateAttribute(data, &gTexturesUVList[third*2], num_vertices*2, copies);
+    uploadArrayBuffer(&instanced.uvbuffer, GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0]);
+    replicateAttribute(data, &gColorList[info.vertexOffset], info.numVertices, copies);
+    uploadArrayBuffer(&instanced.colorbuffer, GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0]);
+    replicateAttribute(data, &gNormalList[info.vertexOffset], info.numVertices, copies);
+    uploadArrayBuffer(&instanced.normalbuffer, GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0]);
+    replicateAttribute(data, &gSamplerList[third], num_vertices, copies);
+    uploadArrayBuffer(&instanced.samplerbuffer, GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0]);
+    replicateAttribute(data, &gUseTextures[third], num_vertices, copies);
+    uploadArrayBuffer(&instanced.usetexbuffer, GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0]);
+
+    instanced.maxInstances = copies;
+}
+
+void createBuffersForModel(int i)
+{
+    ModelArrayInfo &info = gModelArrayInfos[i];
+    int num_vertices = info.numVertices/3;
+    const GLuint* indices = &gIndicesList[info.indexOffset];
+
+    info.instanced.maxInstances = 0;
+
+    info.ranges.resize(info.num_lods);
+    for (int l = 0 ; l < info.num_lods ; l++)
+    {
+        info.ranges[l].baseVertex = 0;
+        info.ranges[l].indexOffset = info.lods[l].indexOffset;
+        info.ranges[l].numIndices = info.lods[l].numIndices;
+        info.lods[l].firstRange = l;
+        info.lods[l].numRanges = 1;
+    }
+
+    // The heap's 16-bit indices are relative to the model, so they cover it
+    // as long as it has at most 65536 vertices.  Only bigger models pay for
+    // 32-bit ones.
+    if (num_vertices <= 65536 || gHasUintIndices)
+    {
+        uploadModelGeometry(info, indices, info.numIndices, NULL, num_vertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+        createInstancedBuffers(info);
+        return;
+    }
+
+    // Too many vertices for 16-bit indices and no OES_element_index_uint:
+    // split every LOD into ranges of at most 65536 vertices, each drawn with
+    // its own attribute offsets
+    std::vector<unsigned int> range_indices(indices, indices + info.numIndices);
+    std::vector<unsigned int> range_vertices;
+    info.ranges.clear();
+    for (int l = 0 ; l < info.num_lods ; l++)
+    {
+        ModelLod &lod = info.lods[l];
+        std::vector<IndexRange> ranges;
+        std::vector<unsigned int> lod_vertices;
+        splitIndexRanges(ranges, lod_vertices, &range_indices[lod.indexOffset], lod.numIndices, num_vertices, 65536);
+
+        lod.firstRange = (int)info.ranges.size();
+        lod.numRanges = (int)ranges.size();
+        for (size_t r = 0 ; r < ranges.size() ; r++)
+        {
+            DrawRange range;
+            range.baseVertex = (int)range_vertices.size() + ranges[r].vertexOffset;
+            range.indexOffset = lod.indexOffset + ranges[r].indexOffset;
+            range.numIndices = ranges[r].numIndices;
+            info.ranges.push_back(range);
+        }
+        range_vertices.insert(range_vertices.end(), lod_vertices.begin(), lod_vertices.end());
+    }
+
+    uploadModelGeometry(info, &range_indices[0], (int)range_indices.size(), &range_vertices, GL_UNSIGNED_SHORT);
+
+    LOGI("Model %d split into %d draw ranges (%d -> %d vertices)\n", i, (int)info.ranges.size(), num_vertices, (int)range_vertices.size());
+}
+
+// Returns the model's geometry to the heap for reuse.  The model is not
+// drawn again until createBuffersForModel uploads it anew.
+void releaseBuffersForModel(int i)
+{
+    ModelArrayInfo &info = gModelArrayInfos[i];
+    gGeometryHeap.free(info.geometry);
+
+    InstancedBuffers &instanced = info.instanced;
+    if (instanced.maxInstances > 0)
+    {
+        GLuint buffers[8] = {instanced.vertexbuffer, instanced.uvbuffer, instanced.colorbuffer, instanced.normalbuffer,
+                             instanced.samplerbuffer, instanced.usetexbuffer, instanced.instancebuffer, instanced.indicesbuffer};
+        cachedDeleteBuffers(8, buffers); CHK;
+        instanced.maxInstances = 0;
+    }
+}
+
+// Points the attribute arrays at vertices in the heap layout, starting at
+// offset bytes into buffer
+static void BindInterleavedAttributes(GLuint buffer, size_t offset)
+{
+    GLsizei stride = VERTEX_STRIDE*sizeof(GLfloat);
+    cachedVertexAttribPointer(ATTRIB_POSITION, buffer, 3, GL_FLOAT, GL_FALSE, stride, offset + VERTEX_POSITION*sizeof(GLfloat)); CHK;
+    cachedVertexAttribPointer(ATTRIB_COLOR, buffer, 3, GL_FLOAT, GL_FALSE, stride, offset + VERTEX_COLOR*sizeof(GLfloat)); CHK;
+    cachedVertexAttribPointer(ATTRIB_NORMAL, buffer, 3, GL_FLOAT, GL_FALSE, stride, offset + VERTEX_NORMAL*sizeof(GLfloat)); CHK;
+    cachedVertexAttribPointer(ATTRIB_USE_TEXTURE, buffer, 1, GL_FLOAT, GL_FALSE, stride, offset + VERTEX_USE_TEXTURE*sizeof(GLfloat)); CHK;
+    cachedVertexAttribPointer(ATTRIB_SAMPLER_ID, buffer, 1, GL_FLOAT, GL_FALSE, stride, offset + VERTEX_SAMPLER*sizeof(GLfloat)); CHK;
+    cachedVertexAttribPointer(ATTRIB_TEXTURE_UV, buffer, 2, GL_FLOAT, GL_FALSE, stride, offset + VERTEX_UV*sizeof(GLfloat)); CHK;
+}
+
+// Points the attribute arrays at a range of the geometry heap, starting at
+// baseVertex within it.  Ranges of the same page that share a base vertex
+// leave every pointer as it was.
+static void BindHeapAttributes(const GeometryRange &geometry, int baseVertex)
+{
+    size_t offset = (gGeometryHeap.getBaseVertex(geometry) + baseVertex)*VERTEX_STRIDE*sizeof(GLfloat);
+    BindInterleavedAttributes(gGeometryHeap.getVertexBuffer(geometry.page), offset);
+}
+
+static void BindModelAttributes(ModelArrayInfo &model_info, int baseVertex)
+{
+    BindHeapAttributes(model_info.geometry, baseVertex);
+}
+
+// Makes the scene program variant current and sets its lighting and fog
+static void UseSceneProgram(int features, glm::vec3 light_pos, glm::vec3 light_color, float light_power)
+{
+    gCurrentShader = getShaderProgram(features);
+    if (!gCurrentShader) return;
+
+    cachedUseProgram(gCurrentShader->program); CHK;
+
+    gGL->uniform3fv(gCurrentShader->lightPos, 1, &light_pos[0]); CHK;
+    gGL->uniform3fv(gCurrentShader->lightColor, 1, &light_color[0]); CHK;
+    gGL->uniform1f(gCurrentShader->lightPower, light_power); CHK;
+
+    if (gCurrentShader->features & SHADER_FOG)
+    {
+        gGL->uniform3fv(gCurrentShader->fogColor, 1, &gFogColor[0]); CHK;
+        gGL->uniform1f(gCurrentShader->fogDensity, gFogDensity); CHK;
+    }
+}
+
+// Binds the model's texture set to the units the current program samples
+static void BindModelTextures(ModelArrayInfo &model_info)
+{
+    if (!(gCurrentShader->features & SHADER_TEXTURED)) return;
+
+    GLint samplers_array[32] = {0};
+    for (int i = 0 ; i < model_info.num_sampler_map ; i++)
+    {
+        cachedActiveTexture(GL_TEXTURE0+i); CHK;
+        cachedBindTexture(GL_TEXTURE_2D,gTextureList[model_info.sampler_map[i]].textureID); CHK;
+        samplers_array[i] = i;
+    }
+    gGL->uniform1iv(gCurrentShader->samplersArray,model_info.num_sampler_map,&samplers_array[0]); CHK;
+}
+
+static void BindModelBuffers(ModelArrayInfo &model_info)
+{
+    BindModelAttributes(model_info, 0);
+    cachedBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gGeometryHeap.getIndexBuffer(model_info.geometry.page)); CHK;
+}
+
+static void BindInstancedBuffers(ModelArrayInfo &model_info)
+{
+    const InstancedBuffers &instanced = model_info.instanced;
+    cachedVertexAttribPointer(ATTRIB_POSITION, instanced.vertexbuffer, 3, GL_FLOAT, GL_FALSE, 0, 0); CHK;
+    cachedVertexAttribPointer(ATTRIB_COLOR, instanced.colorbuffer, 3, GL_FLOAT, GL_FALSE, 0, 0); CHK;
+    cachedVertexAttribPointer(ATTRIB_NORMAL, instanced.normalbuffer, 3, GL_FLOAT, GL_FALSE, 0, 0); CHK;
+    cachedVertexAttribPointer(ATTRIB_USE_TEXTURE, instanced.usetexbuffer, 1, GL_FLOAT, GL_FALSE, 0, 0); CHK;
+    cachedVertexAttribPointer(ATTRIB_SAMPLER_ID, instanced.samplerbuffer, 1, GL_FLOAT, GL_FALSE, 0, 0); CHK;
+    cachedVertexAttribPointer(ATTRIB_TEXTURE_UV, instanced.uvbuffer, 2, GL_FLOAT, GL_FALSE, 0, 0); CHK;
+    cachedVertexAttribPointer(ATTRIB_INSTANCE, instanced.instancebuffer, 1, GL_FLOAT, GL_FALSE, 0, 0); CHK;
+    cachedBindBuffer(GL_ELEMENT_ARRAY_BUFFER, instanced.indicesbuffer); CHK;
+}
+
+void PrepareModelToBeDrawn(ModelArrayInfo &model_info, glm::vec3 light_pos, glm::vec3 light_color, float light_power)
+{
+    UseSceneProgram(model_info.shader_features | gSceneShaderFeatures, light_pos, light_color, light_power);
+    if (!gCurrentShader) return;
+
+    BindModelTextures(model_info);
+
+    for (int i = 0 ; i < NUM_MODEL_ATTRIBS ; i++)
+    {
+        cachedEnableVertexAttribArray(i); CHK;
+    }
+    BindModelBuffers(model_info);
+}
+
+// Fraction of the viewport height covered by the model's bounding sphere,
+// or a large value when the camera is inside it
+static float ModelScreenSize(const ModelArrayInfo &model_info, const glm::mat4 &Model, const glm::mat4 &View)
+{
+    glm::vec3 center((model_info.min_x+model_info.max_x)*0.5f, (model_info.min_y+model_info.max_y)*0.5f, (model_info.min_z+model_info.max_z)*0.5f);
+    glm::vec3 extent(model_info.max_x-model_info.min_x, model_info.max_y-model_info.min_y, model_info.max_z-model_info.min_z);
+    float scale = fmaxf(glm::length(glm::vec3(Model[0])), fmaxf(glm::length(glm::vec3(Model[1])), glm::length(glm::vec3(Model[2]))));
+    float radius = glm::length(extent)*0.5f*scale;
+
+    glm::vec4 view_center = View * Model * glm::vec4(center, 1.0f);
+    float distance = glm::length(glm::vec3(view_center));
+    if (distance <= radius) return 1e30f;
+
+    return radius * Projection[1][1] / distance;
+}
+
+// Picks the level of detail from how much of the screen the model covers
+static int SelectModelLod(const ModelArrayInfo &model_info, const glm::mat4 &Model, const glm::mat4 &View)
+{
+    if (model_info.num_lods <= 1) return 0;
+
+    float screen_size = ModelScreenSize(model_info, Model, View);
+    int lod = 0;
+    while (lod < model_info.num_lods-1 && screen_size < gLodScreenSize[lod])
+        lod++;
+    return lod;
+}
+
+// Draws one LOD of the bound model with the given mvp and model matrices
+static void DrawModelLod(ModelArrayInfo &model_info, int lod_id, const GLfloat* mvp, const GLfloat* Model, const glm::mat4 &View)
+{
+    const ModelLod &lod = model_info.lods[lod_id];
+
+    gGL->uniformMatrix4fv(gCurrentShader->v, 1, GL_FALSE, &View[0][0]); CHK;
+    gGL->uniformMatrix4fv(gCurrentShader->mvp, 1, GL_FALSE, mvp); CHK;
+    gGL->uniformMatrix4fv(gCurrentShader->m, 1, GL_FALSE, Model); CHK;
+
+    size_t index_size = gGeometryHeap.getIndexSize(model_info.geometry);
+    GLenum index_type = gGeometryHeap.getIndexType(model_info.geometry);
+    for (int r = lod.firstRange ; r < lod.firstRange + lod.numRanges ; r++)
+    {
+        const DrawRange &range = model_info.ranges[r];
+        if (model_info.ranges.size() > 1)
+            BindModelAttributes(model_info, range.baseVertex);
+        size_t offset = (model_info.geometry.firstIndex + range.indexOffset)*index_size;
+        gGL->drawElements(GL_TRIANGLES,range.numIndices,index_type,(void*)offset); CHK;
+    }
+    if (model_info.ranges.size() > 1)
+        BindModelAttributes(model_info, 0);
+}
+
+void DrawModel(ModelArrayInfo &model_info, glm::mat4 Model, glm::mat4 View)
+{
+    if (!gCurrentShader) return;
+
+    glm::mat4 mvp = Projection * View * Model;
+    DrawModelLod(model_info, SelectModelLod(model_info, Model, View), &mvp[0][0], &Model[0][0], View);
+}
+
+// Draws triangles that only live for this frame, such as skid marks or
+// particles, with the current program, made current by UseSceneProgram for
+// the features the streamed vertices need.  vertices are in the heap
+// layout (VERTEX_STRIDE floats each).  The stream buffers stay bound, so
+// models drawn afterwards must be prepared again.
+void DrawStreamedTriangles(const GLfloat* vertices, int numVertices, const unsigned short* indices, int numIndices,
+                           glm::mat4 Model, glm::mat4 View)
+{
+    if (!gCurrentShader || numIndices == 0) return;
+
+    size_t vertex_size = VERTEX_STRIDE*sizeof(GLfloat);
+    StreamAllocation vertex_range = gStreamVertices.append(vertices, numVertices*vertex_size, vertex_size);
+    StreamAllocation index_range = gStreamIndices.append(indices, numIndices*sizeof(unsigned short), sizeof(unsigned short));
+    BindInterleavedAttributes(vertex_range.buffer, vertex_range.offset);
+
+    glm::mat4 mvp = Projection * View * Model;
+    gGL->uniformMatrix4fv(gCurrentShader->v, 1, GL_FALSE, &View[0][0]); CHK;
+    gGL->uniformMatrix4fv(gCurrentShader->mvp, 1, GL_FALSE, &mvp[0][0]); CHK;
+    gGL->uniformMatrix4fv(gCurrentShader->m, 1, GL_FALSE, &Model[0][0]); CHK;
+    gGL->drawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_SHORT, (void*)index_range.offset); CHK;
+}
+
+#define LOADING_BAR_WIDTH   30.0f
+#define LOADING_BAR_HEIGHT  1.5f
+#define LOADING_BAR_Y       -14.0f
+
+// Appends an untextured quad facing +z in the heap's vertex layout
+static void AddStreamedQuad(std::vector<GLfloat> &vertices, std::vector<unsigned short> &indices,
+                            float x0, float y0, float x1, float y1, float z, glm::vec3 color)
+{
+    unsigned short first = (unsigned short)(vertices.size()/VERTEX_STRIDE);
+    float corners[4][2] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+    for (int c = 0 ; c < 4 ; c++)
+    {
+        GLfloat vertex[VERTEX_STRIDE] = {0};
+        vertex[VERTEX_POSITION] = corners[c][0];
+        vertex[VERTEX_POSITION+1] = corners[c][1];
+        vertex[VERTEX_POSITION+2] = z;
+        vertex[VERTEX_NORMAL+2] = 1;
+        for (int k = 0 ; k < 3 ; k++)
+            vertex[VERTEX_COLOR+k] = color[k];
+        vertices.insert(vertices.end(), vertex, vertex + VERTEX_STRIDE);
+    }
+    unsigned short quad[6] = {first, (unsigned short)(first+1), (unsigned short)(first+2),
+                              first, (unsigned short)(first+2), (unsigned short)(first+3)};
+    indices.insert(indices.end(), quad, quad + 6);
+}
+
+// How far the loading thread got, as a bar under the tire.  Its length
+// changes every frame, so it is streamed rather than kept in the heap.
+static void DrawLoadingBar(glm::mat4 View, glm::vec3 light_pos, glm::vec3 light_color, float light_power)
+{
+    static std::vector<GLfloat> vertices;
+    static std::vector<unsigned short> indices;
+    vertices.clear();
+    indices.clear();
+
+    float left = -LOADING_BAR_WIDTH*0.5f;
+    float filled = left + LOADING_BAR_WIDTH*gLoadingPercent/100.0f;
+    AddStreamedQuad(vertices, indices, left, LOADING_BAR_Y, -left, LOADING_BAR_Y + LOADING_BAR_HEIGHT, 0, glm::vec3(0.3f, 0.3f, 0.3f));
+    AddStreamedQuad(vertices, indices, left, LOADING_BAR_Y, filled, LOADING_BAR_Y + LOADING_BAR_HEIGHT, 0.05f, glm::vec3(0.8f, 0.1f, 0.1f));
+    UseSceneProgram(SHADER_VERTEX_COLOR | gSceneShaderFeatures, light_pos, light_color, light_power);
+    DrawStreamedTriangles(&vertices[0], (int)vertices.size()/VERTEX_STRIDE, &indices[0], (int)indices.size(), glm::mat4(1.0f), View);
+}
+
+void UnprepareModel(ModelArrayInfo &model_info)
+{
+    for (int i = 0 ; i < NUM_ATTRIBS ; i++)
+    {
+        cachedDisableVertexAttribArray(i); CHK;
+    }
+}
+
+#define GL_RECORD_TRIGGER       "record_gl"
+#define GL_RECORD_FILE          "gl_recording.bin"
+#define GL_RECORD_FRAMES        600
+
+static char gCacheDir[256] = {0};
+static RecordingGlBackend* gGlRecorder = NULL;
+static int gGlRecordFrames = 0;
+
+static void StopGlRecording()
+{
+    if (!gGlRecorder) return;
+
+    gGL = gGlRecorder->getTarget();
+    delete gGlRecorder;
+    gGlRecorder = NULL;
+    LOGI("GL recording finished\n");
+}
+
+// When the cache directory holds a record_gl file (pushed there with adb),
+// the calls of the first frames of the context go to gl_recording.bin next
+// to it, for replaying with tools/gl_replay.  The file may hold the number
+// of frames to capture.
+static void StartGlRecording()
+{
+    StopGlRecording();
+    if (!gCacheDir[0]) return;
+
+    char path[300];
+    snprintf(path, sizeof(path), "%s/%s", gCacheDir, GL_RECORD_TRIGGER);
+    FILE* trigger = fopen(path, "r");
+    if (!trigger) return;
+    if (fscanf(trigger, "%d", &gGlRecordFrames) != 1 || gGlRecordFrames <= 0)
+        gGlRecordFrames = GL_RECORD_FRAMES;
+    fclose(trigger);
+
+    snprintf(path, sizeof(path), "%s/%s", gCacheDir, GL_RECORD_FILE);
+    gGlRecorder = new RecordingGlBackend(gGL);
+    if (!gGlRecorder->open(path))
+    {
+        LOGE("Could not create %s\n", path);
+        delete gGlRecorder;
+        gGlRecorder = NULL;
+        return;
+    }
+    gGL = gGlRecorder;
+    LOGI("Recording %d frames of GL calls to %s\n", gGlRecordFrames, path);
+}
+
+static void EndFrame()
+{
+    endGlDebugFrame();
+    gGL->endFrame();
+    if (gGlRecorder && --gGlRecordFrames <= 0)
+        StopGlRecording();
+}
+
+static void ResetStaticBatches();
+static void ResetPreparedFrames();
+
+bool setupGraphics()
+{
+    ResetPreparedFrames();
+    StartGlRecording();
+
+    // Nothing is known about a new context
+    resetGlState();
+    initGlDebug();
+
+    cachedEnable(GL_DEPTH_TEST); CHK;
+    cachedDepthFunc(GL_LESS); CHK;
+    cachedEnable(GL_TEXTURE_2D); CHK;
+
+    const char* extensions = (const char*) gGL->getString(GL_EXTENSIONS);
+    gHasUintIndices = extensions && strstr(extensions, "GL_OES_element_index_uint");
+
+    // The heap's pages went with the old context
+    gGeometryHeap.reset();
+    gStreamVertices.reset(GL_ARRAY_BUFFER, STREAM_VERTEX_BYTES);
+    gStreamIndices.reset(GL_ELEMENT_ARRAY_BUFFER, STREAM_INDEX_BYTES);
+
+    // Any programs from a previous context are gone, variants are rebuilt on
+    // demand, preferably from the binaries cached by an earlier run
+    initProgramCache();
+    resetShaderPrograms();
+    ResetStaticBatches();
+
+    // The loading screen needs its variant right away
+    if (!getShaderProgram(gModelArrayInfos[0].shader_features | gSceneShaderFeatures))
+    {
+        LOGE("Could not create program");
+        return false;
+    }
+
+    createTextures(0);
+
+    // The loading screen only uploads each model once, so whatever it got
+    // through before the context was lost goes up again here, except the
+    // models released since
+    if (gNumUploadedModels == 0) gNumUploadedModels = 1;
+    for (int i = 0 ; i < gNumUploadedModels ; i++)
+    {
+        if (gModelArrayInfos[i].geometry.page >= 0)
+            createBuffersForModel(i);
+    }
+
+    lastTime = getTimeNsec();
+
+    return true;
+}
+
+enum GameState { LOADING_SCREEN, CHOOSE_LEVEL, PLAYING_GAME };
+static volatile GameState game_state = LOADING_SCREEN;
+enum LoadingState { LOADING_TEXTURES, BINDING_TEXTURES, LOADING_MODELS, BINDING_MODELS, FINISHED_LOADING };
+static volatile LoadingState loading_state = LOADING_TEXTURES;
+
+static float player_angle = 0;
+static float player_x = 0;
+static float player_y = 0;
+
+#define SIMULATION_HZ   120
+
+// Game state the simulation thread advances, published after every tick
+struct GameSnapshot
+{
+    float time;                         // Simulated seconds
+    float playerAngle;                  // Degrees
+};
+
+// Inputs summed up between ticks
+#define INPUT_TURN      0               // dx of the touch handler
+#define NUM_INPUTS      1
+
+static Simulation* gSimulation = NULL;  // Never deleted, like the job pool
+
+// Items that move on their own (vehicles, not their wheels), paired up
+// against each other at every simulation tick.  The GL thread creates,
+// moves and destroys their proxies, so every use holds the lock.
+// Contacts with the map go through gItemTree and the model BVHs instead.
+static SweepAndPrune gMovingItems;
+static std::mutex gMovingItemsLock;
+
+static void StepGame(void* state, const float* inputs, float dt)
+{
+    GameSnapshot &game = *(GameSnapshot*)state;
+    game.time += dt;
+    game.playerAngle += inputs[INPUT_TURN]*100;
+
+    std::lock_guard<std::mutex> lock(gMovingItemsLock);
+    gMovingItems.update();
+}
+
+// Feeds the frame's input to the simulation, starting it on the first
+// call, and sets the game globals to the state blended for the present
+static void UpdateGameState(float dx)
+{
+    if (!gSimulation)
+    {
+        GameSnapshot start = {0, player_angle};
+        gSimulation = new Simulation(SIMULATION_HZ, sizeof(GameSnapshot), StepGame);
+        gSimulation->start(&start);
+    }
+
+    float inputs[NUM_INPUTS];
+    inputs[INPUT_TURN] = dx;
+    gSimulation->addInput(inputs, NUM_INPUTS);
+
+    GameSnapshot previous, current;
+    float t = gSimulation->getSnapshots(&previous, &current);
+    player_angle = previous.playerAngle + (current.playerAngle - previous.playerAngle)*t;
+}
+
+// Components of a map item, all ints
+#define ITEM_NODE       0               // In gSceneGraph, its world matrix places the item
+#define ITEM_MODEL      1
+#define ITEM_PROXY      2               // Leaf in gItemTree
+#define ITEM_SECTION    3               // Map section whose static batches hold it
+#define ITEM_BODY       4               // Proxy in gMovingItems, for unattached items that moved
+#define ITEM_COMPONENTS 5
+
+// Only items that stay where they were placed have a section
+#define DYNAMIC_ITEM    (COMPONENT_BIT(ITEM_NODE) | COMPONENT_BIT(ITEM_MODEL) | COMPONENT_BIT(ITEM_PROXY))
+#define STATIC_ITEM     (DYNAMIC_ITEM | COMPONENT_BIT(ITEM_SECTION))
+
+// One merged mesh of a map section, in world space
+struct StaticBatch
+{
+    int features;
+    int material;                       // Model whose texture set it samples
+    glm::vec3 center;
+    GeometryRange geometry;
+};
+
+// The items of a map section that have not moved since they were placed,
+// merged into one mesh per program and texture set.  When one of them
+// changes the section is rebuilt on a worker, and until the new meshes are
+// uploaded its items are drawn one by one.
+struct MapSection
+{
+    std::vector<int> items;
+    std::vector<StaticBatch> batches;
+    bool ready;                         // The batches match the items
+    bool dirty;                         // The items changed since the last build started
+    JobHandle build;
+    std::vector<BatchGeometry> built;   // Output of the running build
+};
+
+static MapSection game_map[MAP_SECTIONS][MAP_SECTIONS];
+
+inline void GetMapSection(float x, float y, int &x_id, int &y_id)
+{
+    x -= MAP_ORIGIN;
+    y -= MAP_ORIGIN;
+    x *= 1.0f/MAP_SECTION_SIZE;
+    y *= 1.0f/MAP_SECTION_SIZE;
+    x_id = (int)floorf(x);
+    y_id = (int)floorf(y);
+}
+
+// Every placed item, indexed by a dynamic AABB tree over their world boxes.
+// Item ids are entity handles in gItems.  Items attached to another one (a
+// vehicle's tires) are children of its node in the scene graph and move
+// with it.
+static const int gItemComponentSizes[ITEM_COMPONENTS] = {sizeof(int), sizeof(int), sizeof(int), sizeof(int), sizeof(int)};
+static EntityStore gItems(gItemComponentSizes, ITEM_COMPONENTS);
+static AabbTree gItemTree;
+static std::vector<int> gItemQuery;       // Only for the frame prepare job
+static SceneGraph gSceneGraph;
+static std::vector<int> gChangedNodes;
+
+// Local matrix of a map item standing at position
+static glm::mat4 PlacementMatrix(glm::vec3 position)
+{
+    return glm::translate(position)*glm::scale(glm::vec3(ITEM_SCALE, ITEM_SCALE, ITEM_SCALE));
+}
+
+static int& ItemComponent(int item_id, int component)
+{
+    return *(int*)gItems.get((Entity)item_id, component);
+}
+
+static glm::mat4 ItemModelMatrix(int item_id)
+{
+    glm::mat4 Model;
+    memcpy(&Model[0][0], gSceneGraph.getWorld(ItemComponent(item_id, ITEM_NODE)), sizeof(Model));
+    return Model;
+}
+
+static Aabb ItemBounds(int item_id)
+{
+    const ModelArrayInfo &info = gModelArrayInfos[ItemComponent(item_id, ITEM_MODEL)];
+    float box[6] = {info.min_x, info.min_y, info.min_z, info.max_x, info.max_y, info.max_z};
+    float world_box[6];
+    glm::mat4 Model = ItemModelMatrix(item_id);
+    transformBox(world_box, &Model[0][0], box);
+
+    Aabb bounds;
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        bounds.min[k] = world_box[k];
+        bounds.max[k] = world_box[k+3];
+    }
+    return bounds;
+}
+
+static MapSection& GetSection(int section)
+{
+    return game_map[section/MAP_SECTIONS][section%MAP_SECTIONS];
+}
+
+// Section a new item is batched in, or -1 when it is outside the map or its
+// model is too big to merge
+static int StaticItemSection(int item_id)
+{
+    if (gModelArrayInfos[ItemComponent(item_id, ITEM_MODEL)].numVertices/3 > STATIC_BATCH_MAX_VERTICES) return -1;
+    const float* world = gSceneGraph.getWorld(ItemComponent(item_id, ITEM_NODE));
+    if (world[12] < MAP_ORIGIN || world[14] < MAP_ORIGIN) return -1;
+
+    int x_id, y_id;
+    GetMapSection(world[12], world[14], x_id, y_id);
+    if (x_id >= MAP_SECTIONS || y_id >= MAP_SECTIONS) return -1;
+    return x_id*MAP_SECTIONS + y_id;
+}
+
+static void MarkSectionDirty(MapSection &section)
+{
+    section.dirty = true;
+    section.ready = false;
+}
+
+// Takes an item out of its section's static batches, it is drawn on its
+// own from now on
+static void UnbatchItem(int item_id)
+{
+    if (!gItems.has(item_id, ITEM_SECTION)) return;
+
+    MapSection &section = GetSection(ItemComponent(item_id, ITEM_SECTION));
+    section.items.erase(std::find(section.items.begin(), section.items.end(), item_id));
+    MarkSectionDirty(section);
+    gItems.removeComponents(item_id, COMPONENT_BIT(ITEM_SECTION));
+}
+
+// Adds an item to the world and returns its id.  Items start out static.
+// Like the other map changes it waits for the frame being prepared, so
+// once frames are drawn it must be called on the GL thread.
+int PlaceItem(int model_id, glm::vec3 position)
+{
+    FinishFramePrepare();
+
+    int item_id = (int)gItems.create(DYNAMIC_ITEM);
+    glm::mat4 local = PlacementMatrix(position);
+    ItemComponent(item_id, ITEM_NODE) = gSceneGraph.createNode(SCENE_NO_PARENT, &local[0][0], item_id);
+    ItemComponent(item_id, ITEM_MODEL) = model_id;
+    ItemComponent(item_id, ITEM_PROXY) = gItemTree.createProxy(ItemBounds(item_id), item_id);
+
+    int section_id = StaticItemSection(item_id);
+    if (section_id >= 0)
+    {
+        gItems.addComponents(item_id, COMPONENT_BIT(ITEM_SECTION));
+        ItemComponent(item_id, ITEM_SECTION) = section_id;
+        MapSection &section = GetSection(section_id);
+        section.items.push_back(item_id);
+        MarkSectionDirty(section);
+    }
+    return item_id;
+}
+
+// Adds an item that is going to move, placed by local in the world.  It
+// starts out dynamic, with its proxy among the moving items, so the static
+// batches never see it.
+int PlaceMovingItem(int model_id, const glm::mat4 &local)
+{
+    FinishFramePrepare();
+
+    int item_id = (int)gItems.create(DYNAMIC_ITEM | COMPONENT_BIT(ITEM_BODY));
+    ItemComponent(item_id, ITEM_NODE) = gSceneGraph.createNode(SCENE_NO_PARENT, &local[0][0], item_id);
+    ItemComponent(item_id, ITEM_MODEL) = model_id;
+    ItemComponent(item_id, ITEM_PROXY) = gItemTree.createProxy(ItemBounds(item_id), item_id);
+
+    std::lock_guard<std::mutex> lock(gMovingItemsLock);
+    ItemComponent(item_id, ITEM_BODY) = gMovingItems.createProxy(ItemBounds(item_id), item_id);
+    return item_id;
+}
+
+// Adds an item that follows parent_id around, placed by local relative to
+// it.  Attached items are dynamic.
+int AttachItem(int model_id, int parent_id, const glm::mat4 &local)
+{
+    FinishFramePrepare();
+
+    int item_id = (int)gItems.create(DYNAMIC_ITEM);
+    ItemComponent(item_id, ITEM_NODE) = gSceneGraph.createNode(ItemComponent(parent_id, ITEM_NODE), &local[0][0], item_id);
+    ItemComponent(item_id, ITEM_MODEL) = model_id;
+    ItemComponent(item_id, ITEM_PROXY) = gItemTree.createProxy(ItemBounds(item_id), item_id);
+    return item_id;
+}
+
+// Visibility baked for the items of the map, valid while their ids are
+// and they stay where they were baked
+static PvsData gPvs;
+static bool gHasPvs = false;
+
+// Called before a map item is moved or removed
+static void DisablePvsFor(int item_id, const char* change)
+{
+    if (gHasPvs && entityIndex(item_id) < gPvs.header.numItems)
+    {
+        LOGI("Map item %d %s, PVS disabled\n", item_id, change);
+        gHasPvs = false;
+    }
+}
+
+// Sets an item's matrix relative to its parent, or to the world for items
+// that are not attached.  Moving an item makes it dynamic.  The item and
+// the ones attached to it reach their new place at the next
+// UpdateItemTransforms.
+void SetItemTransform(int item_id, const glm::mat4 &local)
+{
+    FinishFramePrepare();
+    DisablePvsFor(item_id, "moved");
+    UnbatchItem(item_id);
+
+    int node = ItemComponent(item_id, ITEM_NODE);
+    if (!gItems.has(item_id, ITEM_BODY) && gSceneGraph.getParent(node) == SCENE_NO_PARENT)
+    {
+        gItems.addComponents(item_id, COMPONENT_BIT(ITEM_BODY));
+        std::lock_guard<std::mutex> lock(gMovingItemsLock);
+        ItemComponent(item_id, ITEM_BODY) = gMovingItems.createProxy(ItemBounds(item_id), item_id);
+    }
+    gSceneGraph.setLocal(node, &local[0][0]);
+}
+
+void MoveItem(int item_id, glm::vec3 position)
+{
+    SetItemTransform(item_id, PlacementMatrix(position));
+}
+
+#define VEHICLE_WHEELS  4
+
+// A body item with its wheels attached.  Driving it only sets the local
+// matrices of the body and the wheels, the scene graph carries the wheels
+// along with the body.  The wheel model is expected to roll around its z
+// axis, the way the loading screen spins the tire.
+struct Vehicle
+{
+    int body;
+    int wheels[VEHICLE_WHEELS];
+    glm::vec3 wheelOffsets[VEHICLE_WHEELS]; // In the body model's units
+    float wheelRadius;                      // Same units
+    glm::mat4 wheelFit;                     // Centers the wheel model and scales it to wheelRadius
+    float scale;                            // Of the body model in the world
+    glm::vec3 position;
+    float wheelAngle;                       // Degrees rolled so far
+};
+
+static glm::mat4 VehicleWheelMatrix(const Vehicle &vehicle, int w)
+{
+    return glm::rotate(glm::translate(vehicle.wheelOffsets[w]), vehicle.wheelAngle, glm::vec3(0,0,1))*vehicle.wheelFit;
+}
+
+static glm::mat4 VehicleBodyMatrix(const Vehicle &vehicle, float heading)
+{
+    glm::mat4 body = glm::translate(vehicle.position);
+    body = glm::rotate(body, heading, glm::vec3(0,1,0));
+    return body*glm::scale(glm::vec3(vehicle.scale, vehicle.scale, vehicle.scale));
+}
+
+// Places a vehicle with a wheel model at each of the offsets, sized to
+// wheel_radius
+void PlaceVehicle(Vehicle &vehicle, int body_model, int wheel_model, const glm::vec3* wheel_offsets, float wheel_radius,
+                  float scale, glm::vec3 position)
+{
+    const ModelArrayInfo &wheel = gModelArrayInfos[wheel_model];
+    float model_radius = 0.5f*fmaxf(wheel.max_x - wheel.min_x, wheel.max_y - wheel.min_y);
+    glm::vec3 center((wheel.min_x + wheel.max_x)*0.5f, (wheel.min_y + wheel.max_y)*0.5f, (wheel.min_z + wheel.max_z)*0.5f);
+    float fit = wheel_radius/model_radius;
+
+    vehicle.wheelRadius = wheel_radius;
+    vehicle.wheelFit = glm::scale(glm::vec3(fit, fit, fit))*glm::translate(-center);
+    vehicle.scale = scale;
+    vehicle.position = position;
+    vehicle.wheelAngle = 0;
+
+    vehicle.body = PlaceMovingItem(body_model, VehicleBodyMatrix(vehicle, 0));
+    for (int w = 0 ; w < VEHICLE_WHEELS ; w++)
+    {
+        vehicle.wheelOffsets[w] = wheel_offsets[w];
+        vehicle.wheels[w] = AttachItem(wheel_model, vehicle.body, VehicleWheelMatrix(vehicle, w));
+    }
+}
+
+// Moves the vehicle to position, facing heading degrees around the y axis,
+// and rolls its wheels by the distance covered
+void DriveVehicle(Vehicle &vehicle, glm::vec3 position, float heading)
+{
+    float distance = glm::length(position - vehicle.position)/vehicle.scale;
+    vehicle.wheelAngle = fmodf(vehicle.wheelAngle - distance/vehicle.wheelRadius*(180.0f/M_PI), 360.0f);
+    vehicle.position = position;
+
+    SetItemTransform(vehicle.body, VehicleBodyMatrix(vehicle, heading));
+    for (int w = 0 ; w < VEHICLE_WHEELS ; w++)
+        SetItemTransform(vehicle.wheels[w], VehicleWheelMatrix(vehicle, w));
+}
+
+// Propagates the transforms set since the last call down the scene graph
+// and refits the moved items' boxes.  Called on the GL thread every frame
+// before the frame is prepared.
+static void UpdateItemTransforms()
+{
+    gChangedNodes.clear();
+    gSceneGraph.update(&gChangedNodes);
+
+    std::lock_guard<std::mutex> lock(gMovingItemsLock);
+    for (size_t n = 0 ; n < gChangedNodes.size() ; n++)
+    {
+        int item_id = gSceneGraph.getUserData(gChangedNodes[n]);
+        Aabb bounds = ItemBounds(item_id);
+        gItemTree.moveProxy(ItemComponent(item_id, ITEM_PROXY), bounds);
+
+        const int* body = (const int*)gItems.get(item_id, ITEM_BODY);
+        if (body)
+            gMovingItems.moveProxy(*body, bounds);
+    }
+}
+
+// Moving items whose boxes overlapped at the last simulation tick, as item
+// ids for a narrowphase to check with the model BVHs.  Replaces the
+// contents of pairs with the pairs sorted by a, then b, where a < b.
+void GetMovingItemPairs(std::vector<BroadphasePair> &pairs)
+{
+    pairs.clear();
+    {
+        std::lock_guard<std::mutex> lock(gMovingItemsLock);
+        const std::vector<BroadphasePair> &overlapping = gMovingItems.getPairs();
+        for (size_t p = 0 ; p < overlapping.size() ; p++)
+        {
+            int a = gMovingItems.getUserData(overlapping[p].a);
+            int b = gMovingItems.getUserData(overlapping[p].b);
+            BroadphasePair pair;
+            pair.a = std::min(a, b);
+            pair.b = std::max(a, b);
+            pairs.push_back(pair);
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const BroadphasePair &p, const BroadphasePair &q)
+    {
+        return (p.a != q.a) ? p.a < q.a : p.b < q.b;
+    });
+}
+
+// Removes an item, the ids of the others stay valid.  Items with others
+// attached to them stay until those are removed.
+void RemoveItem(int item_id)
+{
+    FinishFramePrepare();
+    if (gSceneGraph.getChildCount(ItemComponent(item_id, ITEM_NODE)) > 0)
+    {
+        LOGE("Map item %d still has attached items, not removing it\n", item_id);
+        return;
+    }
+    DisablePvsFor(item_id, "removed");
+
+    UnbatchItem(item_id);
+    if (gItems.has(item_id, ITEM_BODY))
+    {
+        std::lock_guard<std::mutex> lock(gMovingItemsLock);
+        gMovingItems.destroyProxy(ItemComponent(item_id, ITEM_BODY));
+    }
+    gItemTree.destroyProxy(ItemComponent(item_id, ITEM_PROXY));
+    gSceneGraph.destroyNode(ItemComponent(item_id, ITEM_NODE));
+    gItems.destroy(item_id);
+}
+
+// Ids of the items within radius of a point
+void QueryItemsInSphere(glm::vec3 center, float radius, std::vector<int> &item_ids)
+{
+    std::vector<int> proxies;
+    gItemTree.querySphere(&center[0], radius, proxies);
+    for (size_t i = 0 ; i < proxies.size() ; i++)
+        item_ids.push_back(gItemTree.getUserData(proxies[i]));
+}
+
+// Id of the first item whose box the ray hits within max_distance, or -1
+int RaycastItems(glm::vec3 origin, glm::vec3 dir, float max_distance)
+{
+    int closest = -1;
+    gItemTree.queryRay(&origin[0], &dir[0], max_distance, [&](int proxy, float max_t) -> float
+    {
+        float inverse_dir[3], entry = 0, exit = max_t;
+        Aabb box = ItemBounds(gItemTree.getUserData(proxy));
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            inverse_dir[k] = 1.0f/dir[k];
+            float t1 = (box.min[k]-origin[k])*inverse_dir[k];
+            float t2 = (box.max[k]-origin[k])*inverse_dir[k];
+            entry = fmaxf(entry, fminf(t1, t2));
+            exit = fminf(exit, fmaxf(t1, t2));
+        }
+        if (entry > exit) return max_t;
+
+        closest = gItemTree.getUserData(proxy);
+        return entry;
+    });
+    return closest;
+}
+
+// Scene queries: rays and sweeps against the exact triangles of the map
+// items, as placed by the last UpdateItemTransforms.  They read gItemTree
+// and the scene graph, which the frame prepare job also reads and map
+// edits write, so they run on the GL thread after FinishFramePrepare and
+// never from the simulation thread.
+
+// Closest triangle of the map items a scene query found
+struct SceneHit
+{
+    int item;                           // -1 for a miss
+    int triangle;
+    float t;                            // Along the query's dir, in world units when dir is normalized
+};
+
+// Whether item_id is root_id or attached somewhere below it
+static bool IsPartOfItem(int item_id, int root_id)
+{
+    if (root_id < 0) return false;
+    int root = ItemComponent(root_id, ITEM_NODE);
+    for (int node = ItemComponent(item_id, ITEM_NODE) ; node != SCENE_NO_PARENT ; node = gSceneGraph.getParent(node))
+    {
+        if (node == root) return true;
+    }
+    return false;
+}
+
+// The ray in the space of the item's model.  The transform is affine, so t
+// means the same on both sides.
+static void ItemLocalRay(int item_id, glm::vec3 origin, glm::vec3 dir, glm::vec3 &local_origin, glm::vec3 &local_dir)
+{
+    glm::mat4 inverse = glm::inverse(ItemModelMatrix(item_id));
+    local_origin = glm::vec3(inverse*glm::vec4(origin, 1));
+    local_dir = glm::vec3(inverse*glm::vec4(dir, 0));
+}
+
+// Appends the items whose boxes the segment swept by a sphere of radius
+// may touch
+static void QueryItemsAlong(glm::vec3 origin, glm::vec3 dir, float max_distance, float radius, std::vector<int> &item_ids)
+{
+    glm::vec3 end = origin + dir*max_distance;
+    Aabb box;
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        box.min[k] = fminf(origin[k], end[k]) - radius;
+        box.max[k] = fmaxf(origin[k], end[k]) + radius;
+    }
+    std::vector<int> proxies;
+    gItemTree.queryAabb(box, proxies);
+    for (size_t i = 0 ; i < proxies.size() ; i++)
+        item_ids.push_back(gItemTree.getUserData(proxies[i]));
+}
+
+// Nearest triangle the ray hits within max_distance.  The item tree finds
+// the items whose boxes the ray crosses, nearest first, and each is tested
+// with its model's BVH.  ignore_item and the items attached to it are
+// skipped, so a vehicle can look around without seeing itself.
+bool RaycastScene(glm::vec3 origin, glm::vec3 dir, float max_distance, SceneHit &hit, int ignore_item = -1)
+{
+    hit.item = -1;
+    hit.t = max_distance;
+    gItemTree.queryRay(&origin[0], &dir[0], max_distance, [&](int proxy, float max_t) -> float
+    {
+        int item_id = gItemTree.getUserData(proxy);
+        if (IsPartOfItem(item_id, ignore_item)) return max_t;
+
+        glm::vec3 local_origin, local_dir;
+        ItemLocalRay(item_id, origin, dir, local_origin, local_dir);
+        RayHit ray_hit;
+        if (!gModelBvhs[ItemComponent(item_id, ITEM_MODEL)].raycast(&local_origin[0], &local_dir[0], max_t, ray_hit)) return max_t;
+
+        hit.item = item_id;
+        hit.triangle = ray_hit.triangle;
+        hit.t = ray_hit.t;
+        return ray_hit.t;
+    });
+    return hit.item >= 0;
+}
+
+// First contact of a sphere moving from origin along dir, for checks
+// against walls.  Items are scaled uniformly, so the radius only shrinks
+// by the scale in model space.
+bool SweepSphereScene(glm::vec3 origin, glm::vec3 dir, float radius, float max_distance, SceneHit &hit, int ignore_item = -1)
+{
+    std::vector<int> item_ids;
+    QueryItemsAlong(origin, dir, max_distance, radius, item_ids);
+
+    hit.item = -1;
+    hit.t = max_distance;
+    for (size_t i = 0 ; i < item_ids.size() ; i++)
+    {
+        if (IsPartOfItem(item_ids[i], ignore_item)) continue;
+
+        glm::vec3 local_origin, local_dir;
+        ItemLocalRay(item_ids[i], origin, dir, local_origin, local_dir);
+        float scale = glm::length(glm::vec3(ItemModelMatrix(item_ids[i])[0]));
+        RayHit sweep_hit;
+        if (!gModelBvhs[ItemComponent(item_ids[i], ITEM_MODEL)].sweepSphere(&local_origin[0], &local_dir[0], radius/scale, hit.t, sweep_hit)) continue;
+
+        hit.item = item_ids[i];
+        hit.triangle = sweep_hit.triangle;
+        hit.t = sweep_hit.t;
+    }
+    return hit.item >= 0;
+}
+
+// Nearest hits of 4 rays that run close together, like a vehicle's wheel
+// probes.  Each item their boxes may touch is tested once with a packet of
+// all 4.
+void RaycastScene4(const glm::vec3* origins, const glm::vec3* dirs, float max_distance, SceneHit* hits, int ignore_item = -1)
+{
+    std::vector<int> item_ids;
+    for (int r = 0 ; r < 4 ; r++)
+    {
+        hits[r].item = -1;
+        hits[r].t = max_distance;
+        QueryItemsAlong(origins[r], dirs[r], max_distance, 0, item_ids);
+    }
+    std::sort(item_ids.begin(), item_ids.end());
+    item_ids.erase(std::unique(item_ids.begin(), item_ids.end()), item_ids.end());
+
+    for (size_t i = 0 ; i < item_ids.size() ; i++)
+    {
+        if (IsPartOfItem(item_ids[i], ignore_item)) continue;
+
+        float local_origins[12], local_dirs[12], max_t[4];
+        for (int r = 0 ; r < 4 ; r++)
+        {
+            glm::vec3 local_origin, local_dir;
+            ItemLocalRay(item_ids[i], origins[r], dirs[r], local_origin, local_dir);
+            memcpy(&local_origins[r*3], &local_origin[0], 3*sizeof(float));
+            memcpy(&local_dirs[r*3], &local_dir[0], 3*sizeof(float));
+            max_t[r] = hits[r].t;
+        }
+
+        RayHit ray_hits[4];
+        gModelBvhs[ItemComponent(item_ids[i], ITEM_MODEL)].raycastPacket(local_origins, local_dirs, max_t, ray_hits);
+        for (int r = 0 ; r < 4 ; r++)
+        {
+            if (ray_hits[r].triangle < 0) continue;
+            hits[r].item = item_ids[i];
+            hits[r].triangle = ray_hits[r].triangle;
+            hits[r].t = ray_hits[r].t;
+        }
+    }
+}
+
+// Ground under each wheel of a vehicle, probed straight down from the wheel
+// centers as one packet.  As of the last UpdateItemTransforms.
+void ProbeVehicleGround(const Vehicle &vehicle, float max_distance, SceneHit* hits)
+{
+    glm::vec3 origins[VEHICLE_WHEELS], dirs[VEHICLE_WHEELS];
+    for (int w = 0 ; w < VEHICLE_WHEELS ; w++)
+    {
+        const float* world = gSceneGraph.getWorld(ItemComponent(vehicle.wheels[w], ITEM_NODE));
+        origins[w] = glm::vec3(world[12], world[13], world[14]);
+        dirs[w] = glm::vec3(0, -1, 0);
+    }
+    RaycastScene4(origins, dirs, max_distance, hits, vehicle.body);
+}
+
+#define PLAYER_MODEL            9       // Tuk-tuk
+#define PLAYER_WHEEL_MODEL      0       // Tire
+#define PLAYER_SCALE            0.0003f
+#define PLAYER_WHEEL_RADIUS     0.18f   // Of the body's height
+#define PLAYER_WHEEL_INSET      0.2f    // Of the body's length, from either end
+#define PLAYER_DROP_HEIGHT      50.0f   // The ground under the start is looked for from this high
+#define PLAYER_GROUND_PROBE     2.0f    // How far below its wheel centers the ground is followed
+
+static Vehicle gPlayer;
+static bool gHasPlayer = false;
+
+// The tuk-tuk the player turns, placed with a tire at each corner of its
+// body the first time the game is played and dropped onto what is below.
+// Afterwards its wheels follow the ground as of the previous frame.
+static void UpdatePlayer()
+{
+    if (!gHasPlayer)
+    {
+        const ModelArrayInfo &body = gModelArrayInfos[PLAYER_MODEL];
+        float radius = (body.max_y - body.min_y)*PLAYER_WHEEL_RADIUS;
+        float inset = (body.max_x - body.min_x)*PLAYER_WHEEL_INSET;
+        glm::vec3 offsets[VEHICLE_WHEELS] =
+        {
+            glm::vec3(body.min_x + inset, body.min_y + radius, body.min_z),
+            glm::vec3(body.min_x + inset, body.min_y + radius, body.max_z),
+            glm::vec3(body.max_x - inset, body.min_y + radius, body.min_z),
+            glm::vec3(body.max_x - inset, body.min_y + radius, body.max_z),
+        };
+
+        // A wheel-sized sphere comes to rest where the wheels would
+        glm::vec3 position(0, 0, 0);
+        SceneHit ground;
+        if (SweepSphereScene(glm::vec3(0, PLAYER_DROP_HEIGHT, 0), glm::vec3(0, -1, 0), radius*PLAYER_SCALE, 2*PLAYER_DROP_HEIGHT, ground))
+            position.y = PLAYER_DROP_HEIGHT - ground.t - (body.min_y + radius)*PLAYER_SCALE;
+
+        PlaceVehicle(gPlayer, PLAYER_MODEL, PLAYER_WHEEL_MODEL, offsets, radius, PLAYER_SCALE, position);
+        gHasPlayer = true;
+        return;
+    }
+
+    // Lifted or lowered so the wheel over the highest ground touches it
+    glm::vec3 position = gPlayer.position;
+    float radius = gPlayer.wheelRadius*gPlayer.scale;
+    SceneHit hits[VEHICLE_WHEELS];
+    ProbeVehicleGround(gPlayer, radius + PLAYER_GROUND_PROBE, hits);
+    bool grounded = false;
+    float rise = 0;
+    for (int w = 0 ; w < VEHICLE_WHEELS ; w++)
+    {
+        if (hits[w].item < 0) continue;
+        if (!grounded || radius - hits[w].t > rise) rise = radius - hits[w].t;
+        grounded = true;
+    }
+    position.y += rise;
+    DriveVehicle(gPlayer, position, player_angle);
+}
+
+#define CAMERA_POSITION         glm::vec3(20, 20, 20)
+#define CAMERA_CLEARANCE        0.9f    // Of the distance to an item in the way
+
+// Looks at the player from CAMERA_POSITION, or from just in front of the
+// nearest item that would hide it
+static glm::mat4 PlaceCamera()
+{
+    Aabb box = ItemBounds(gPlayer.body);
+    glm::vec3 target((box.min[0] + box.max[0])*0.5f, (box.min[1] + box.max[1])*0.5f, (box.min[2] + box.max[2])*0.5f);
+    glm::vec3 eye = CAMERA_POSITION;
+    float distance = glm::length(eye - target);
+    glm::vec3 dir = (eye - target)/distance;
+
+    SceneHit hit;
+    if (RaycastScene(target, dir, distance, hit, gPlayer.body))
+        eye = target + dir*(hit.t*CAMERA_CLEARANCE);
+    return glm::lookAt(eye, target, glm::vec3(0,1,0));
+}
+
+static void ReleaseStaticBatches(MapSection &section)
+{
+    for (size_t b = 0 ; b < section.batches.size() ; b++)
+        gGeometryHeap.free(section.batches[b].geometry);
+    section.batches.clear();
+}
+
+// Replaces the section's batches with the meshes its build produced
+static void UploadStaticBatches(MapSection &section)
+{
+    ReleaseStaticBatches(section);
+    for (size_t b = 0 ; b < section.built.size() ; b++)
+    {
+        const BatchGeometry &geometry = section.built[b];
+        StaticBatch batch;
+        batch.features = geometry.features;
+        batch.material = geometry.material;
+        batch.center = glm::vec3((geometry.box[0]+geometry.box[3])*0.5f, (geometry.box[1]+geometry.box[4])*0.5f, (geometry.box[2]+geometry.box[5])*0.5f);
+
+        int num_vertices = (int)geometry.positions.size()/3;
+        std::vector<GLfloat> vertices;
+        interleaveVertices(vertices, num_vertices, &geometry.positions[0], &geometry.normals[0], &geometry.colors[0],
+                           &geometry.uvs[0], &geometry.useTextures[0], &geometry.samplers[0], NULL);
+        std::vector<unsigned int> indices(geometry.indices.begin(), geometry.indices.end());
+
+        gGeometryHeap.allocate(batch.geometry, num_vertices, (int)indices.size(), GL_UNSIGNED_SHORT);
+        gGeometryHeap.writeVertices(batch.geometry, &vertices[0]);
+        gGeometryHeap.writeIndices(batch.geometry, &indices[0]);
+        section.batches.push_back(batch);
+    }
+}
+
+// Merges the section's static items on a worker.  The job gets copies of
+// everything that may change on this thread, the model geometry in the
+// global arrays stays put once loading finished.
+static void StartSectionBuild(MapSection &section)
+{
+    section.dirty = false;
+    if (section.items.empty())
+    {
+        ReleaseStaticBatches(section);
+        return;
+    }
+
+    std::vector<BatchSourceModel> models(gNumModelArrayInfos);
+    for (int m = 0 ; m < gNumModelArrayInfos ; m++)
+    {
+        const ModelArrayInfo &info = gModelArrayInfos[m];
+        int third = info.vertexOffset/3;
+        BatchSourceModel &model = models[m];
+        model.positions = &gVertexList[info.vertexOffset];
+        model.normals = &gNormalList[info.vertexOffset];
+        model.colors = &gColorList[info.vertexOffset];
+        model.uvs = &gTexturesUVList[third*2];
+        model.useTextures = &gUseTextures[third];
+        model.samplers = &gSamplerList[third];
+        model.indices = &gIndicesList[info.indexOffset + info.lods[0].indexOffset];
+        model.numVertices = info.numVertices/3;
+        model.numIndices = info.lods[0].numIndices;
+        model.features = info.shader_features;
+        model.material = info.material_id;
+    }
+
+    std::vector<BatchInstance> instances(section.items.size());
+    for (size_t i = 0 ; i < section.items.size() ; i++)
+    {
+        glm::mat4 Model = ItemModelMatrix(section.items[i]);
+        instances[i].model = ItemComponent(section.items[i], ITEM_MODEL);
+        memcpy(instances[i].matrix, &Model[0][0], sizeof(instances[i].matrix));
+    }
+
+    std::vector<BatchGeometry>* built = &section.built;
+    section.build = startJob([models, instances, built]()
+    {
+        buildStaticBatches(*built, &models[0], &instances[0], (int)instances.size());
+    });
+}
+
+// Picks up finished section builds and starts the ones that are due.
+// Called on the GL thread every frame.
+static void UpdateStaticBatches()
+{
+    for (int s = 0 ; s < MAP_SECTIONS*MAP_SECTIONS ; s++)
+    {
+        MapSection &section = GetSection(s);
+        if (section.build)
+        {
+            if (!isJobDone(section.build)) continue;
+
+            waitJob(section.build);
+            section.build = NULL;
+
+            // Items changed while it ran, its output is already stale
+            if (!section.dirty)
             {
-                char* buf = (char*) malloc(infoLen);
-                if (buf)
-                {
-                    glGetShaderInfoLog(shader, infoLen, NULL, buf); CHK;
-                    LOGE("Could not compile shader %d:\n%s\n",shaderType, buf);
-                    free(buf);
-                }
-                glDeleteShader(shader); CHK;
-                shader = 0;
+                UploadStaticBatches(section);
+                section.ready = true;
             }
+            section.built.clear();
         }
+        if (section.dirty)
+            StartSectionBuild(section);
+    }
+}
+
+// The batches' buffers went with the old context
+static void ResetStaticBatches()
+{
+    for (int s = 0 ; s < MAP_SECTIONS*MAP_SECTIONS ; s++)
+    {
+        MapSection &section = GetSection(s);
+        section.batches.clear();
+        section.ready = false;
+        section.dirty = !section.items.empty();
+    }
+}
+
+// Items gathered for the current frame, culled together before drawing.
+// Their transforms are gathered as SoA, gDrawMatrices and gDrawMvps are
+// filled from them in one pass once all items are in.
+static std::vector<int> gDrawModels;
+static std::vector<int> gDrawSections;
+static TransformArray gDrawTransforms;
+static std::vector<glm::mat4> gDrawMatrices;
+static std::vector<glm::mat4> gDrawMvps;
+static std::vector<float> gDrawBoxes;
+static std::vector<unsigned char> gDrawVisible;
+static CullStats gCullStats;
+
+// Visible items sorted by state, and how much binding replaying them took
+struct QueueStats
+{
+    int draws;
+    int instanced;                      // Items drawn as part of a batch
+    int sections;                       // Map sections drawn from static batches
+    int programs;
+    int materials;
+    int buffers;
+};
+static RenderQueue gRenderQueue;
+static QueueStats gQueueStats;
+
+// Static batches of the map sections with a visible item
+static RenderQueue gBatchQueue;
+static std::vector<const StaticBatch*> gQueuedBatches;
+static unsigned char gSectionVisible[MAP_SECTIONS*MAP_SECTIONS];
+
+// Items in a ready section still go through culling one by one, and only
+// the sections left with a visible item get their batches drawn.  Model
+// must be affine, column-major.
+static void AddDrawItem(int model_id, const float* Model, int section = -1)
+{
+    const ModelArrayInfo &info = gModelArrayInfos[model_id];
+    float box[6] = {info.min_x, info.min_y, info.min_z, info.max_x, info.max_y, info.max_z};
+    gDrawModels.push_back(model_id);
+    gDrawSections.push_back(section);
+    gDrawTransforms.push(Model);
+    gDrawBoxes.insert(gDrawBoxes.end(), box, box + 6);
+}
+
+// Queues the map item in row of chunk.  Items of a ready section are drawn
+// by its batches.
+static void AddDrawMapItem(const EntityChunk &chunk, int row)
+{
+    const int* section = chunk.get<int>(ITEM_SECTION);
+    int batch_section = (section && GetSection(section[row]).ready) ? section[row] : -1;
+    AddDrawItem(chunk.get<int>(ITEM_MODEL)[row], gSceneGraph.getWorld(chunk.get<int>(ITEM_NODE)[row]), batch_section);
+}
+
+// Rows of one item chunk that passed the PVS test
+struct PvsChunk
+{
+    EntityChunk chunk;
+    std::vector<int> rows;
+};
+static std::vector<PvsChunk> gPvsChunks;     // Only for the frame prepare job
+
+// Queues the items the PVS of the camera's map section lists, plus the ones
+// placed after the PVS was baked.  Returns false when the camera is outside
+// the baked sections or above or below the baked eye heights.
+static bool AddPvsItems(glm::vec3 eye)
+{
+    if (eye.y < gPvs.header.minEyeHeight || eye.y > gPvs.header.maxEyeHeight) return false;
+
+    int x_id, y_id;
+    GetMapSection(eye.x, eye.z, x_id, y_id);
+    const unsigned int* row = pvsItemRow(gPvs, x_id, y_id);
+    if (!row) return false;
+
+    // The map's items got the first slots in the order they were baked in,
+    // so an item's slot is its bit.  One sweep over the items' rows tests
+    // every bit instead of looking up the set ones slot by slot.  The chunks
+    // are tested across the job pool, then queued here in order, since the
+    // draw arrays take one writer.
+    int num_items = gPvs.header.numItems;
+    gPvsChunks.resize(gItems.getChunkCount(DYNAMIC_ITEM, 0));
+    gItems.forEachParallel(DYNAMIC_ITEM, 0, [&](const EntityChunk &chunk, int c)
+    {
+        PvsChunk &visible = gPvsChunks[c];
+        visible.chunk = chunk;
+        visible.rows.clear();
+        for (int r = 0 ; r < chunk.count ; r++)
+        {
+            int index = entityIndex(chunk.entities[r]);
+            if (index >= num_items || pvsTest(row, index))
+                visible.rows.push_back(r);
+        }
+    });
+
+    for (size_t c = 0 ; c < gPvsChunks.size() ; c++)
+    {
+        const PvsChunk &visible = gPvsChunks[c];
+        for (size_t r = 0 ; r < visible.rows.size() ; r++)
+            AddDrawMapItem(visible.chunk, visible.rows[r]);
+    }
+    return true;
+}
+
+// Queues the items that may be visible: those in the PVS of the camera's
+// map section if there is one, otherwise those whose tree leaves touch the
+// frustum
+static void AddVisibleItems(const Frustum &frustum, glm::vec3 eye)
+{
+    if (gHasPvs && AddPvsItems(eye)) return;
+
+    gItemQuery.clear();
+    gItemTree.queryFrustum(frustum, gItemQuery);
+    for (size_t i = 0 ; i < gItemQuery.size() ; i++)
+    {
+        EntityChunk item = gItems.getRow(gItemTree.getUserData(gItemQuery[i]));
+        if (item.count) AddDrawMapItem(item, 0);
+    }
+}
+
+#define OCCLUSION_MAX_OCCLUDERS     16
+#define OCCLUDER_MIN_SCREEN_SIZE    0.1f
+
+// Low resolution depth buffer the biggest items on screen are drawn into
+static OcclusionBuffer gOcclusionBuffer(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+static std::vector<int> gOccluders;
+static std::vector<float> gOccluderSizes;
+
+// Picks the gathered items that cover the most of the screen as occluders
+static void SelectOccluders(const glm::mat4 &View)
+{
+    gOccluders.clear();
+    gOccluderSizes.resize(gDrawModels.size());
+    for (size_t i = 0 ; i < gDrawModels.size() ; i++)
+    {
+        gOccluderSizes[i] = ModelScreenSize(gModelArrayInfos[gDrawModels[i]], gDrawMatrices[i], View);
+        if (gOccluderSizes[i] >= OCCLUDER_MIN_SCREEN_SIZE)
+            gOccluders.push_back((int)i);
+    }
+
+    if (gOccluders.size() > OCCLUSION_MAX_OCCLUDERS)
+    {
+        std::partial_sort(gOccluders.begin(), gOccluders.begin() + OCCLUSION_MAX_OCCLUDERS, gOccluders.end(),
+                          [](int a, int b) { return gOccluderSizes[a] > gOccluderSizes[b]; });
+        gOccluders.resize(OCCLUSION_MAX_OCCLUDERS);
     }
-    return shader;
 }
 
-GLuint createProgram(const char* pVertexSource, const char* pFragmentSource)
+// Draws every occluder into the occlusion buffer.  Only the full-detail
+// LOD is inside the surface everywhere; a simplified one can bulge past it
+// and hide things that are actually in front of the real model.
+static void RasterizeOccluders()
 {
-    GLuint vertexShader = loadShader(GL_VERTEX_SHADER, pVertexSource);
-    if (!vertexShader) return 0;
+    gOcclusionBuffer.clear();
+    for (size_t i = 0 ; i < gOccluders.size() ; i++)
+    {
+        const ModelArrayInfo &info = gModelArrayInfos[gDrawModels[gOccluders[i]]];
+        const ModelLod &lod = info.lods[0];
+        gOcclusionBuffer.drawMesh(&gDrawMvps[gOccluders[i]][0][0], &gVertexList[info.vertexOffset], info.numVertices/3,
+                                  &gIndicesList[info.indexOffset + lod.indexOffset], lod.numIndices);
+    }
+}
 
-    GLuint pixelShader = loadShader(GL_FRAGMENT_SHADER, pFragmentSource);
-    if (!pixelShader) return 0;
+// Commands of a prepared frame.  Programs, texture sets and buffer sets
+// are only recorded when they change, as the render queue ordered them.
+#define DRAW_CMD_PROGRAM        0   // args: feature bits
+#define DRAW_CMD_MATERIAL       1   // args: model whose texture set to bind
+#define DRAW_CMD_BUFFERS        2   // args: model whose buffers to bind
+#define DRAW_CMD_MODEL          3   // args: model, LOD; data: mvp and model matrix
+#define DRAW_CMD_INSTANCES      4   // args: model, LOD, count; data: count*12 instanceRows floats
+#define DRAW_CMD_SECTION        5   // args: map section whose static batches to draw
+
+// A frame recorded by the prepare job, and what it is lit and viewed with
+struct PreparedFrame
+{
+    DrawList list;
+    glm::mat4 View;
+    glm::vec3 lightPos;
+    glm::vec3 lightColor;
+    float lightPower;
+};
 
-    GLuint program = glCreateProgram(); CHK;
-    if (program)
+// Frame N is replayed from one of these while the prepare job records
+// frame N+1 into the other
+static PreparedFrame gPreparedFrames[2];
+static int gRecordingFrame = 0;
+static bool gHasPreparedFrame = false;
+static JobHandle gFramePrepare = NULL;
+
+// Bit f is set when variant f|SHADER_INSTANCED built.  Found on the GL
+// thread, the prepare job cannot compile programs.
+static uint64_t gInstancedPrograms = 0;
+
+// Queues the visible items with keys grouping them by program, texture set
+// and buffers, nearest first within a group.  Items of instanced models get
+// the instanced program, so all of a model's items form one run.  Items in
+// static batches mark their section visible instead.
+static void QueueVisibleItems(const glm::mat4 &View)
+{
+    gRenderQueue.clear();
+    memset(gSectionVisible, 0, sizeof(gSectionVisible));
+    for (size_t i = 0 ; i < gDrawModels.size() ; i++)
     {
-        glAttachShader(program, vertexShader); CHK;
-        glAttachShader(program, pixelShader); CHK;
-        glLinkProgram(program); CHK;
-        GLint linkStatus = GL_FALSE;
-        glGetProgramiv(program, GL_LINK_STATUS, &linkStatus); CHK;
-        if (linkStatus != GL_TRUE)
+        if (!gDrawVisible[i]) continue;
+        if (gDrawSections[i] >= 0)
         {
-            GLint bufLength = 0;
-            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &bufLength); CHK;
-            if (bufLength)
-            {
-                char* buf = (char*) malloc(bufLength);
-                if (buf)
-                {
-                    glGetProgramInfoLog(program, bufLength, NULL, buf); CHK;
-                    LOGE("Could not link program:\n%s\n", buf);
-                    free(buf);
-                }
-            }
-            glDeleteProgram(program); CHK;
-            program = 0;
+            gSectionVisible[gDrawSections[i]] = 1;
+            continue;
         }
+
+        const ModelArrayInfo &info = gModelArrayInfos[gDrawModels[i]];
+        glm::vec4 center((info.min_x+info.max_x)*0.5f, (info.min_y+info.max_y)*0.5f, (info.min_z+info.max_z)*0.5f, 1.0f);
+        float depth = -(View * gDrawMatrices[i] * center).z;
+        int features = info.shader_features | gSceneShaderFeatures;
+        if (info.instanced.maxInstances && (gInstancedPrograms & (1ull << features)))
+            features |= SHADER_INSTANCED;
+        gRenderQueue.push(makeSortKey(RENDER_LAYER_OPAQUE, features, info.material_id, gDrawModels[i], depth), (int)i);
     }
-    return program;
+    gRenderQueue.sort();
 }
 
-GLuint gProgram;
-GLuint gvPositionHandle;
-GLuint gvTransHandle;
-GLuint gvUseTextureHandle;
-GLuint gvTextureUVHandle;
-GLuint gvSamplerHandle;
-GLuint gvSamplersArrayHandle;
-GLuint gLightPos;
-GLuint gLightPower;
-GLuint gLightColor;
-GLuint gvVMatHandle;
-GLuint gvMMatHandle;
-GLuint gvColorHandle;
-GLuint gvNormalHandle;
+// Model matrices of the items of the current instanced model waiting to be
+// recorded, one batch per LOD, as the three rows instanceRows expects
+struct InstanceBatch
+{
+    int count;
+    GLfloat rows[SHADER_MAX_INSTANCES*12];
+};
+static InstanceBatch gInstanceBatches[MAX_LODS];
 
-bool resize(int w, int h)
+// Records the pending instances of one LOD of the model as a single draw
+static void FlushInstances(DrawList &list, int model_id, int lod_id)
 {
-    Projection = glm::perspective(glm::radians(90.0f), (float)w/(float)h, 0.1f, 100.0f);
-    glViewport(0, 0, w, h); CHK;
-    return true;
+    InstanceBatch &batch = gInstanceBatches[lod_id];
+    if (batch.count == 0) return;
+
+    list.push(DRAW_CMD_INSTANCES, model_id, lod_id, batch.count);
+    list.pushData(batch.rows, batch.count*12);
+    batch.count = 0;
 }
 
-static int lastTime = 0;
+static void FlushAllInstances(DrawList &list, int model_id)
+{
+    for (int l = 0 ; l < gModelArrayInfos[model_id].num_lods ; l++)
+        FlushInstances(list, model_id, l);
+}
 
-void createTextures(int i)
+// Adds an item to the batch of the LOD it is drawn at, recording the batch
+// once it is full
+static void RecordInstance(DrawList &list, int item, const glm::mat4 &View)
 {
-    glGenTextures(1, &gTextureList[i].textureID); CHK;
-    glBindTexture(GL_TEXTURE_2D, gTextureList[i].textureID); CHK;
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, gTextureList[i].width, gTextureList[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, gTextureList[i].data); CHK;
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); CHK;
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); CHK;
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); CHK;
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR); CHK;
-    glGenerateMipmap(GL_TEXTURE_2D); CHK;
+    int model_id = gDrawModels[item];
+    const ModelArrayInfo &model_info = gModelArrayInfos[model_id];
+    int lod_id = SelectModelLod(model_info, gDrawMatrices[item], View);
+    InstanceBatch &batch = gInstanceBatches[lod_id];
+    gDrawTransforms.getRows(item, &batch.rows[batch.count*12]);
+    batch.count++;
+
+    if (batch.count == model_info.instanced.maxInstances)
+        FlushInstances(list, model_id, lod_id);
 }
 
-void createBuffersForModel(int i)
+// Records the queue in order, with a program, texture set or buffer set
+// only when it differs from the previous draw's.  Runs of an instanced
+// model are gathered into batches and recorded a batch at a time.  The
+// visible sections follow, their batches are picked on replay.
+static void RecordRenderQueue(DrawList &list, const glm::mat4 &View)
 {
-    glGenBuffers(1, &gModelArrayInfos[i].vertexbuffer); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, gModelArrayInfos[i].vertexbuffer); CHK;
-    glBufferData(GL_ARRAY_BUFFER, gModelArrayInfos[i].numVertices*sizeof(GLfloat), &gVertexList[gModelArrayInfos[i].vertexOffset], GL_STATIC_DRAW); CHK;
+    int batched = -1;
+    int program = -1, material = -1, buffer = -1;
+    for (int q = 0 ; q < gRenderQueue.size() ; q++)
+    {
+        uint64_t key = gRenderQueue.getKey(q);
+        int item = gRenderQueue.getItem(q);
+        int model_id = gDrawModels[item];
+
+        // Pending instances are drawn with the state they were batched under
+        if (batched >= 0 && (sortKeyProgram(key) != program || sortKeyBuffer(key) != buffer))
+        {
+            FlushAllInstances(list, batched);
+            batched = -1;
+        }
+
+        // Sampler uniforms belong to the program, so a new program also
+        // needs the texture set again.  Instanced and regular programs read
+        // different buffers for the same model.
+        if (sortKeyProgram(key) != program)
+        {
+            program = sortKeyProgram(key);
+            material = -1;
+            buffer = -1;
+            list.push(DRAW_CMD_PROGRAM, program);
+        }
+        if (sortKeyMaterial(key) != material)
+        {
+            material = sortKeyMaterial(key);
+            list.push(DRAW_CMD_MATERIAL, model_id);
+        }
+        if (sortKeyBuffer(key) != buffer)
+        {
+            buffer = sortKeyBuffer(key);
+            list.push(DRAW_CMD_BUFFERS, model_id);
+        }
+
+        if (program & SHADER_INSTANCED)
+        {
+            RecordInstance(list, item, View);
+            batched = model_id;
+        }
+        else
+        {
+            list.push(DRAW_CMD_MODEL, model_id, SelectModelLod(gModelArrayInfos[model_id], gDrawMatrices[item], View));
+            list.pushData(&gDrawMvps[item][0][0], 16);
+            list.pushData(&gDrawMatrices[item][0][0], 16);
+        }
+    }
+    if (batched >= 0)
+        FlushAllInstances(list, batched);
+
+    for (int s = 0 ; s < MAP_SECTIONS*MAP_SECTIONS ; s++)
+    {
+        if (gSectionVisible[s])
+            list.push(DRAW_CMD_SECTION, s);
+    }
+}
 
-    glGenBuffers(1, &gModelArrayInfos[i].indicesbuffer); CHK;
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gModelArrayInfos[i].indicesbuffer); CHK;
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, gModelArrayInfos[i].numIndices*sizeof(unsigned short), &gIndicesList[gModelArrayInfos[i].indexOffset], GL_STATIC_DRAW); CHK;
+// Culls the gathered items against the view frustum and the occluders and
+// records the visible ones through the render queue.  Runs as the prepare
+// job, so it must not touch GL.
+static void PrepareFrame(PreparedFrame &frame, const Frustum &frustum, glm::vec3 eye)
+{
+    frame.list.clear();
+    AddVisibleItems(frustum, eye);
 
-    glGenBuffers(1, &gModelArrayInfos[i].uvbuffer); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, gModelArrayInfos[i].uvbuffer); CHK;
-    glBufferData(GL_ARRAY_BUFFER, (gModelArrayInfos[i].numVertices/3)*2*sizeof(GLfloat), &gTexturesUVList[(gModelArrayInfos[i].vertexOffset/3)*2], GL_STATIC_DRAW); CHK;
+    int count = (int)gDrawModels.size();
+    if (count > 0)
+    {
+        // Every matrix the culling, the occluders and the draws need
+        glm::mat4 view_projection = Projection * frame.View;
+        gDrawMatrices.resize(count);
+        gDrawMvps.resize(count);
+        computeTransforms(&gDrawMvps[0][0][0], &gDrawMatrices[0][0][0], &view_projection[0][0], gDrawTransforms);
+
+        // The occluders are rasterized on another worker while this one
+        // does the frustum tests
+        SelectOccluders(frame.View);
+        JobHandle raster = NULL;
+        if (!gOccluders.empty())
+            raster = startJob([]() { RasterizeOccluders(); });
+
+        gDrawVisible.resize(count);
+        int drawn = cullBoxes(&gDrawVisible[0], &gDrawMatrices[0][0][0], &gDrawBoxes[0], count, frustum);
+        gCullStats.tested += count;
+        gCullStats.culled += count - drawn;
+
+        if (raster)
+        {
+            waitJob(raster);
+            for (int i = 0 ; i < count ; i++)
+            {
+                if (!gDrawVisible[i]) continue;
 
-    glGenBuffers(1, &gModelArrayInfos[i].colorbuffer); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, gModelArrayInfos[i].colorbuffer); CHK;
-    glBufferData(GL_ARRAY_BUFFER, gModelArrayInfos[i].numVertices*sizeof(GLfloat), &gColorList[gModelArrayInfos[i].vertexOffset], GL_STATIC_DRAW); CHK;
+                if (!gOcclusionBuffer.testBox(&gDrawMvps[i][0][0], &gDrawBoxes[i*6]))
+                {
+                    gDrawVisible[i] = 0;
+                    gCullStats.occluded++;
+                    drawn--;
+                }
+            }
+        }
+        gCullStats.drawn += drawn;
 
-    glGenBuffers(1, &gModelArrayInfos[i].normalbuffer); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, gModelArrayInfos[i].normalbuffer); CHK;
-    glBufferData(GL_ARRAY_BUFFER, gModelArrayInfos[i].numVertices*sizeof(GLfloat), &gNormalList[gModelArrayInfos[i].vertexOffset], GL_STATIC_DRAW); CHK;
+        QueueVisibleItems(frame.View);
+        RecordRenderQueue(frame.list, frame.View);
+    }
 
-    glGenBuffers(1, &gModelArrayInfos[i].samplerbuffer); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, gModelArrayInfos[i].samplerbuffer); CHK;
-    glBufferData(GL_ARRAY_BUFFER, (gModelArrayInfos[i].numVertices/3)*sizeof(GLfloat), &gSamplerList[gModelArrayInfos[i].vertexOffset/3], GL_STATIC_DRAW); CHK;
+    gDrawModels.clear();
+    gDrawSections.clear();
+    gDrawTransforms.clear();
+    gDrawBoxes.clear();
+}
 
-    glGenBuffers(1, &gModelArrayInfos[i].usetexbuffer); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, gModelArrayInfos[i].usetexbuffer); CHK;
-    glBufferData(GL_ARRAY_BUFFER, (gModelArrayInfos[i].numVertices/3)*sizeof(GLfloat), &gUseTextures[gModelArrayInfos[i].vertexOffset/3], GL_STATIC_DRAW); CHK;
+// Waits for the frame being prepared.  Everything the prepare job reads
+// (the items, the PVS, the sections' readiness, Projection) may only
+// change after this.
+static void FinishFramePrepare()
+{
+    if (!gFramePrepare) return;
+    waitJob(gFramePrepare);
+    gFramePrepare = NULL;
 }
 
-void PrepareModelToBeDrawn(ModelArrayInfo &model_info, glm::vec3 light_pos, glm::vec3 light_color, float light_power)
+// A new context starts over with nothing to replay
+static void ResetPreparedFrames()
 {
-    glUseProgram(gProgram); CHK;
+    FinishFramePrepare();
+    gHasPreparedFrame = false;
+}
 
-    GLint samplers_array[32] = {0};
-    for (int i = 0 ; i < model_info.num_sampler_map ; i++)
+// Finds the instanced variants the prepare job may pick, building them on
+// first use
+static void UpdateInstancedPrograms()
+{
+    gInstancedPrograms = 0;
+    for (int m = 0 ; m < gNumModelArrayInfos ; m++)
     {
-        glActiveTexture(GL_TEXTURE0+i); CHK;
-        glBindTexture(GL_TEXTURE_2D,gTextureList[model_info.sampler_map[i]].textureID); CHK;
-        samplers_array[i] = i;
+        const ModelArrayInfo &info = gModelArrayInfos[m];
+        if (!info.instanced.maxInstances) continue;
+
+        int features = info.shader_features | gSceneShaderFeatures;
+        if (getShaderProgram(features | SHADER_INSTANCED))
+            gInstancedPrograms |= 1ull << features;
     }
-    glUniform1iv(gvSamplersArrayHandle,model_info.num_sampler_map,&samplers_array[0]); CHK;
-
-    glEnableVertexAttribArray(gvPositionHandle); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, model_info.vertexbuffer); CHK;
-    glVertexAttribPointer(gvPositionHandle, 3, GL_FLOAT, GL_FALSE, 0, (void*)0); CHK;
-    glEnableVertexAttribArray(gvColorHandle); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, model_info.colorbuffer); CHK;
-    glVertexAttribPointer(gvColorHandle, 3, GL_FLOAT, GL_FALSE, 0, (void*)0); CHK;
-    glEnableVertexAttribArray(gvNormalHandle); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, model_info.normalbuffer); CHK;
-    glVertexAttribPointer(gvNormalHandle, 3, GL_FLOAT, GL_FALSE, 0, (void*)0); CHK;
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model_info.indicesbuffer); CHK;
-    glEnableVertexAttribArray(gvUseTextureHandle); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, model_info.usetexbuffer); CHK;
-    glVertexAttribPointer(gvUseTextureHandle, 1, GL_FLOAT, GL_FALSE, 0, (void*)0); CHK;
-    glEnableVertexAttribArray(gvSamplerHandle); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, model_info.samplerbuffer); CHK;
-    glVertexAttribPointer(gvSamplerHandle, 1, GL_FLOAT, GL_FALSE, 0, (void*)0); CHK;
-    glEnableVertexAttribArray(gvTextureUVHandle); CHK;
-    glBindBuffer(GL_ARRAY_BUFFER, model_info.uvbuffer); CHK;
-    glVertexAttribPointer(gvTextureUVHandle, 2, GL_FLOAT, GL_FALSE, 0, (void*)0); CHK;
-
-    glUniform3fv(gLightPos, 1, &light_pos[0]); CHK;
-    glUniform3fv(gLightColor, 1, &light_color[0]); CHK;
-    glUniform1f(gLightPower, light_power); CHK;
 }
 
-void DrawModel(ModelArrayInfo &model_info, glm::mat4 Model, glm::mat4 View)
+// Starts preparing a frame from the items already added with AddDrawItem
+// and the ones visible from eye
+static void StartFramePrepare(const Frustum &frustum, const glm::mat4 &View, glm::vec3 light_pos, glm::vec3 light_color, float light_power)
 {
-    glm::mat4 mvp = Projection * View * Model;
-    glUniformMatrix4fv(gvVMatHandle, 1, GL_FALSE, &View[0][0]); CHK;
-    glUniformMatrix4fv(gvTransHandle, 1, GL_FALSE, &mvp[0][0]); CHK;
-    glUniformMatrix4fv(gvMMatHandle, 1, GL_FALSE, &Model[0][0]); CHK;
-    glDrawElements(GL_TRIANGLES,model_info.numIndices,GL_UNSIGNED_SHORT,(void*)0); CHK;
+    UpdateInstancedPrograms();
+
+    PreparedFrame* frame = &gPreparedFrames[gRecordingFrame];
+    frame->View = View;
+    frame->lightPos = light_pos;
+    frame->lightColor = light_color;
+    frame->lightPower = light_power;
+
+    glm::vec3 eye(glm::inverse(View)[3]);
+    gFramePrepare = startJob([frame, frustum, eye]() { PrepareFrame(*frame, frustum, eye); });
 }
 
-void UnprepareModel(ModelArrayInfo &model_info)
+// Queues the static batches of a section visible in the replayed frame.
+// They are looked up now rather than when the frame was prepared, since
+// the sections may have been rebuilt in between.
+static void QueueSectionBatches(int s, const glm::mat4 &View)
 {
-    glDisableVertexAttribArray(gvPositionHandle); CHK;
-    glDisableVertexAttribArray(gvColorHandle); CHK;
-    glDisableVertexAttribArray(gvNormalHandle); CHK;
-    glDisableVertexAttribArray(gvUseTextureHandle); CHK;
-    glDisableVertexAttribArray(gvSamplerHandle); CHK;
-    glDisableVertexAttribArray(gvTextureUVHandle); CHK;
+    const MapSection &section = GetSection(s);
+    for (size_t b = 0 ; b < section.batches.size() ; b++)
+    {
+        const StaticBatch &batch = section.batches[b];
+        float depth = -(View * glm::vec4(batch.center, 1.0f)).z;
+        gBatchQueue.push(makeSortKey(RENDER_LAYER_OPAQUE, batch.features | gSceneShaderFeatures, batch.material, 0, depth), (int)gQueuedBatches.size());
+        gQueuedBatches.push_back(&batch);
+    }
+    gQueueStats.sections++;
 }
 
-bool setupGraphics()
+// Draws the queued static batches.  Their vertices are in world space, so
+// the model matrix is the identity and every batch is a single call.
+static void DrawStaticBatches(const glm::mat4 &View, glm::vec3 light_pos, glm::vec3 light_color, float light_power)
 {
-    glEnable(GL_DEPTH_TEST); CHK;
-    glDepthFunc(GL_LESS); CHK;
-    glEnable(GL_TEXTURE_2D); CHK;
+    if (gBatchQueue.size() == 0) return;
 
-    gProgram = createProgram(gVertexShader, gFragmentShader);
-    if (!gProgram)
+    for (int i = 0 ; i < NUM_MODEL_ATTRIBS ; i++)
     {
-        LOGE("Could not create program");
-        return false;
+        cachedEnableVertexAttribArray(i); CHK;
     }
 
-    gvTransHandle = (GLuint)glGetUniformLocation(gProgram, "mvp"); CHK;
-    gvVMatHandle = (GLuint)glGetUniformLocation(gProgram, "v"); CHK;
-    gvMMatHandle = (GLuint)glGetUniformLocation(gProgram, "m"); CHK;
-    gLightPos = (GLuint)glGetUniformLocation(gProgram, "LightPosition_worldspace"); CHK;
-    gLightPower = (GLuint)glGetUniformLocation(gProgram, "lightPower"); CHK;
-    gLightColor = (GLuint)glGetUniformLocation(gProgram, "LightColor"); CHK;
-    gvPositionHandle = (GLuint)glGetAttribLocation(gProgram, "vPosition"); CHK;
-    gvColorHandle = (GLuint)glGetAttribLocation(gProgram, "vColor"); CHK;
-    gvNormalHandle = (GLuint)glGetAttribLocation(gProgram, "vNormal"); CHK;
-    gvTextureUVHandle = (GLuint)glGetAttribLocation(gProgram, "vTextureUV"); CHK;
-    gvUseTextureHandle = (GLuint)glGetAttribLocation(gProgram, "vUseTexture"); CHK;
-    gvSamplerHandle = (GLuint)glGetAttribLocation(gProgram, "vSamplerID"); CHK;
-    gvSamplersArrayHandle = (GLuint)glGetUniformLocation(gProgram, "vSamplersArray"); CHK;
+    glm::mat4 view_projection = Projection * View;
+    glm::mat4 identity(1.0f);
+    int program = -1, material = -1;
+    for (int q = 0 ; q < gBatchQueue.size() ; q++)
+    {
+        uint64_t key = gBatchQueue.getKey(q);
+        const StaticBatch &batch = *gQueuedBatches[gBatchQueue.getItem(q)];
 
-    createTextures(0);
-    createBuffersForModel(0);
+        if (sortKeyProgram(key) != program)
+        {
+            program = sortKeyProgram(key);
+            material = -1;
+            UseSceneProgram(program, light_pos, light_color, light_power);
+            gQueueStats.programs++;
+            if (gCurrentShader)
+            {
+                gGL->uniformMatrix4fv(gCurrentShader->v, 1, GL_FALSE, &View[0][0]); CHK;
+                gGL->uniformMatrix4fv(gCurrentShader->mvp, 1, GL_FALSE, &view_projection[0][0]); CHK;
+                gGL->uniformMatrix4fv(gCurrentShader->m, 1, GL_FALSE, &identity[0][0]); CHK;
+            }
+        }
+        if (!gCurrentShader) continue;
 
-    lastTime = getTimeNsec();
+        if (sortKeyMaterial(key) != material)
+        {
+            material = sortKeyMaterial(key);
+            BindModelTextures(gModelArrayInfos[batch.material]);
+            gQueueStats.materials++;
+        }
 
-    return true;
+        BindHeapAttributes(batch.geometry, 0);
+        cachedBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gGeometryHeap.getIndexBuffer(batch.geometry.page)); CHK;
+        gQueueStats.buffers++;
+        size_t offset = batch.geometry.firstIndex*gGeometryHeap.getIndexSize(batch.geometry);
+        gGL->drawElements(GL_TRIANGLES, batch.geometry.numIndices, gGeometryHeap.getIndexType(batch.geometry), (void*)offset); CHK;
+        gQueueStats.draws++;
+    }
+
+    for (int i = 0 ; i < NUM_MODEL_ATTRIBS ; i++)
+    {
+        cachedDisableVertexAttribArray(i); CHK;
+    }
 }
 
-enum GameState { LOADING_SCREEN, CHOOSE_LEVEL, PLAYING_GAME };
-static volatile GameState game_state = LOADING_SCREEN;
-enum LoadingState { LOADING_TEXTURES, BINDING_TEXTURES, LOADING_MODELS, BINDING_MODELS, FINISHED_LOADING };
-static volatile LoadingState loading_state = LOADING_TEXTURES;
+// Issues the GL calls of a prepared frame
+static void ReplayFrame(const PreparedFrame &frame)
+{
+    const DrawList &list = frame.list;
+    const glm::mat4 &View = frame.View;
+    gBatchQueue.clear();
+    gQueuedBatches.clear();
 
-static float player_angle = 0;
-static float player_x = 0;
-static float player_y = 0;
+    for (int i = 0 ; i < NUM_MODEL_ATTRIBS ; i++)
+    {
+        cachedEnableVertexAttribArray(i); CHK;
+    }
 
-struct ItemInMap
-{
-    glm::vec3 position;
-    int model_id;
-};
+    glm::mat4 view_projection = Projection * View;
+    int program = 0;
+    for (int c = 0 ; c < list.size() ; c++)
+    {
+        const DrawCommand &command = list.getCommand(c);
+        if (command.type == DRAW_CMD_SECTION)
+        {
+            QueueSectionBatches(command.args[0], View);
+            continue;
+        }
+        if (command.type == DRAW_CMD_PROGRAM)
+        {
+            program = command.args[0];
+            UseSceneProgram(program, frame.lightPos, frame.lightColor, frame.lightPower);
+            gQueueStats.programs++;
 
-struct MapSection
-{
-    ItemInMap items[10];
-    int numItems;
-};
+            if (gCurrentShader && (program & SHADER_INSTANCED))
+            {
+                gGL->uniformMatrix4fv(gCurrentShader->v, 1, GL_FALSE, &View[0][0]); CHK;
+                gGL->uniformMatrix4fv(gCurrentShader->mvp, 1, GL_FALSE, &view_projection[0][0]); CHK;
+                cachedEnableVertexAttribArray(ATTRIB_INSTANCE); CHK;
+            }
+            else
+            {
+                cachedDisableVertexAttribArray(ATTRIB_INSTANCE); CHK;
+            }
+            continue;
+        }
+        if (!gCurrentShader) continue;
+
+        ModelArrayInfo &model_info = gModelArrayInfos[command.args[0]];
+        switch (command.type)
+        {
+            case DRAW_CMD_MATERIAL:
+                BindModelTextures(model_info);
+                gQueueStats.materials++;
+                break;
 
-static MapSection game_map[10][10];
+            case DRAW_CMD_BUFFERS:
+                if (program & SHADER_INSTANCED)
+                    BindInstancedBuffers(model_info);
+                else
+                    BindModelBuffers(model_info);
+                gQueueStats.buffers++;
+                break;
 
-inline void GetMapSection(float x, float y, int &x_id, int &y_id)
-{
-    x -= 10;
-    y -= 10;
-    x *= 0.5;
-    y *= 0.5;
-    x_id = (int)x;
-    y_id = (int)y;
+            case DRAW_CMD_MODEL:
+            {
+                const GLfloat* matrices = list.getData(command.data);
+                DrawModelLod(model_info, command.args[1], matrices, matrices + 16, View);
+                gQueueStats.draws++;
+                break;
+            }
+
+            case DRAW_CMD_INSTANCES:
+            {
+                const ModelLod &lod = model_info.lods[command.args[1]];
+                int count = command.args[2];
+                size_t offset = model_info.instanced.indexOffsets[command.args[1]]*sizeof(unsigned short);
+                gGL->uniform4fv(gCurrentShader->instanceRows, count*3, list.getData(command.data)); CHK;
+                gGL->drawElements(GL_TRIANGLES, lod.numIndices*count, GL_UNSIGNED_SHORT, (void*)offset); CHK;
+                gQueueStats.draws++;
+                gQueueStats.instanced += count;
+                break;
+            }
+        }
+    }
+
+    for (int i = 0 ; i < NUM_ATTRIBS ; i++)
+    {
+        cachedDisableVertexAttribArray(i); CHK;
+    }
+
+    gBatchQueue.sort();
+    DrawStaticBatches(View, frame.lightPos, frame.lightColor, frame.lightPower);
 }
 
 void renderFrame(float dx, float dy, float dangle, float scale)
 {
+    // The stats below are the prepared frame's
+    FinishFramePrepare();
+
     /* Handling Delta Time */
     static float timestamp = 0;
     static float finished_loading_timestamp = 0;
-    float delta_time;
-    int now = getTimeNsec();
-    if (lastTime < now) delta_time = (now-lastTime)/1000000000.0f;
-    else delta_time = (now+1000000000-lastTime)/1000000000.0f;
+    int64_t now = getTimeNsec();
+    float delta_time = (now-lastTime)/1000000000.0f;
 
     static int cntr = 0;
     cntr++;
     if (cntr%10 == 0)
     {
         LOGI("Frame Rate %f\n",1.0/delta_time);
+        LOGI("Culling: %d items, %d drawn, %d culled, %d occluded\n",gCullStats.tested,gCullStats.drawn,gCullStats.culled,gCullStats.occluded);
+        LOGI("Queue: %d draws (%d items instanced, %d static sections), %d program, %d texture, %d buffer binds\n",gQueueStats.draws,gQueueStats.instanced,gQueueStats.sections,gQueueStats.programs,gQueueStats.materials,gQueueStats.buffers);
+        LOGI("GL state: %d calls issued, %d skipped\n",getGlStateStats().issued,getGlStateStats().skipped);
+        LOGI("Streamed: %d vertex bytes, %d index bytes, %d stalls\n",(int)gStreamVertices.getStats().bytes,(int)gStreamIndices.getStats().bytes,
+             gStreamVertices.getStats().stalls+gStreamIndices.getStats().stalls);
+        int static_items = 0;
+        gItems.forEach(COMPONENT_BIT(ITEM_SECTION), 0, [&](const EntityChunk &chunk) { static_items += chunk.count; });
+        LOGI("Items: %d (%d static) in %d archetypes\n",gItems.getCount(),static_items,gItems.getArchetypeCount());
+        {
+            std::lock_guard<std::mutex> lock(gMovingItemsLock);
+            LOGI("Broadphase: %d moving items, %d pairs, %d reorders\n",gMovingItems.getProxyCount(),(int)gMovingItems.getPairs().size(),gMovingItems.getSwapCount());
+        }
+        if (gSimulation)
+            LOGI("Simulation: %u ticks, %u dropped\n",gSimulation->getStats().ticks,gSimulation->getStats().dropped);
     }
-
+    memset(&gCullStats,0,sizeof(gCullStats));
+    memset(&gQueueStats,0,sizeof(gQueueStats));
+    memset(&getGlStateStats(),0,sizeof(GlStateStats));
+    gStreamVertices.beginFrame();
+    gStreamIndices.beginFrame();
+
+    // The timestamp only animates the loading screen, the game itself runs
+    // on the simulation thread
     if (delta_time > 0.5)
     {
         delta_time = 0.5;
@@ -486,7 +2216,7 @@ void renderFrame(float dx, float dy, float dangle, float scale)
             static int internal_texture_counter = 1;
             static int internal_model_counter = 1;
 
-            ModelArrayInfo model_info = gModelArrayInfos[0];
+            ModelArrayInfo &model_info = gModelArrayInfos[0];
 
             float close_up = 0;
 
@@ -510,11 +2240,14 @@ void renderFrame(float dx, float dy, float dangle, float scale)
                 case BINDING_MODELS:
                     createBuffersForModel(internal_model_counter);
                     internal_model_counter++;
+                    gNumUploadedModels = internal_model_counter;
                     if (internal_model_counter >= gNumModelArrayInfos)
                     {
                         finished_loading_timestamp = timestamp;
                         loading_state = (volatile LoadingState)FINISHED_LOADING;
                         LOGI("MAXES %d %d\n",gNumVertexList/3,gNumIndicesList);
+                        LOGI("Geometry heap: %d pages, %d KB used of %d KB\n", gGeometryHeap.getPageCount(),
+                             (int)(gGeometryHeap.getUsedBytes()/1024), (int)(gGeometryHeap.getCapacityBytes()/1024));
                     }
                     break;
 
@@ -524,20 +2257,26 @@ void renderFrame(float dx, float dy, float dangle, float scale)
                     {
                         timestamp = 0;
                         game_state = (volatile GameState)CHOOSE_LEVEL;
+                        gSceneShaderFeatures |= SHADER_FOG;
                     }
                     break;
             }
 
-            glClearColor(1.0, 1.0, 0.0, 1.0f); CHK;
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT); CHK;
+            cachedClearColor(1.0, 1.0, 0.0, 1.0f); CHK;
+            gGL->clear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT); CHK;
 
             glm::mat4 Model = glm::scale(glm::vec3(0.003,0.003,0.003));
             Model = glm::rotate(Model,-40.0f-close_up*2.5f,glm::vec3(0,1,0));
             Model = glm::rotate(Model,timestamp*60,glm::vec3(0,0,1));
             glm::mat4 View = glm::lookAt(glm::vec3(0,10-close_up/2,40-close_up*1.5),glm::vec3(0,0,0),glm::vec3(0,1,0));
 
-            PrepareModelToBeDrawn(model_info,glm::vec3(0.0, -30, 10),glm::vec3(1.0, 1.0, 1.0),1600+fabs(800*cos(light_factor*10)));
+            glm::vec3 light_pos(0.0, -30, 10);
+            glm::vec3 light_color(1.0, 1.0, 1.0);
+            float light_power = 1600+fabs(800*cos(light_factor*10));
+            PrepareModelToBeDrawn(model_info,light_pos,light_color,light_power);
             DrawModel(model_info,Model,View);
+            if (loading_state != FINISHED_LOADING)
+                DrawLoadingBar(View,light_pos,light_color,light_power);
             UnprepareModel(model_info);
 
             break;
@@ -545,8 +2284,8 @@ void renderFrame(float dx, float dy, float dangle, float scale)
 
         default:
         {
-            glClearColor(0.0f, 0.0f, 0.0f, 1.0f); CHK;
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT); CHK;
+            cachedClearColor(0.0f, 0.0f, 0.0f, 1.0f); CHK;
+            gGL->clear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT); CHK;
 
 //            player_angle += dx;
 //            float the_angle = glm::radians(player_angle);
@@ -570,9 +2309,13 @@ void renderFrame(float dx, float dy, float dangle, float scale)
             if (mycntr%20 == 0)
                 LOGI("dx,dy,dangle = %f,%f,%f\n",dx,dy,dangle);
 
-            player_angle += dx*100;
+            UpdateGameState(dx);
 
-            glm::mat4 View = glm::lookAt(glm::vec3(20,20,20),glm::vec3(0,0,0),glm::vec3(0,1,0));
+            // The camera is placed against the items where this frame
+            // draws them
+            UpdatePlayer();
+            UpdateItemTransforms();
+            glm::mat4 View = PlaceCamera();
 
 //            ModelArrayInfo model_info = gModelArrayInfos[2];
 //            PrepareModelToBeDrawn(model_info, glm::vec3(20, 20, 20), glm::vec3(1.0, 1.0, 1.0),2000);
@@ -586,15 +2329,200 @@ void renderFrame(float dx, float dy, float dangle, float scale)
 //            DrawModel(model_info, Model, View);
 //            UnprepareModel(model_info);
 
-            ModelArrayInfo model_info = gModelArrayInfos[9];
-            PrepareModelToBeDrawn(model_info, glm::vec3(20, 20, 20), glm::vec3(1.0, 1.0, 1.0),1000);
-            glm::mat4 Model = glm::scale(glm::vec3(0.0003, 0.0003, 0.0003));
-            DrawModel(model_info, Model, View);
-            UnprepareModel(model_info);
+            Frustum frustum;
+            glm::mat4 view_projection = Projection * View;
+            extractFrustum(frustum, &view_projection[0][0]);
+
+            // This frame is prepared on a worker while the previous one is
+            // replayed, so what is drawn lags the input by a frame
+            UpdateStaticBatches();
+            StartFramePrepare(frustum, View, glm::vec3(20, 20, 20), glm::vec3(1.0, 1.0, 1.0), 1000);
+            if (gHasPreparedFrame)
+                ReplayFrame(gPreparedFrames[gRecordingFrame^1]);
+            gRecordingFrame ^= 1;
+            gHasPreparedFrame = true;
+
+            break;
+        }
+    }
+
+    EndFrame();
+}
+
+// Interleaved vertex tuple used while welding, in floats
+#define WELD_POSITION       0
+#define WELD_NORMAL         3
+#define WELD_COLOR          6
+#define WELD_UV             9
+#define WELD_USE_TEXTURE    11
+#define WELD_SAMPLER        12
+#define WELD_STRIDE         13
+#define WELD_EPSILON        0.0001f
+
+// One 3DS object converted to unique vertex tuples and object-local indices
+struct StagedObject
+{
+    int material;
+    int obj_sampler;
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+};
+
+// Expands an object into full vertex tuples and collapses the duplicates.
+// Runs on the job threads, one object per job.
+static void stageObject(const t3DModel &model, int i, StagedObject &object)
+{
+    const t3DObject &source = model.pObject[i];
+    bool textured = object.obj_sampler != -1 && source.pTexVerts && source.numTexVertex >= source.numOfVerts;
+
+    object.vertices.resize(source.numOfVerts*WELD_STRIDE);
+    for (int vindx = 0 ; vindx < source.numOfVerts ; vindx++)
+    {
+        float* vertex = &object.vertices[vindx*WELD_STRIDE];
+
+        vertex[WELD_POSITION] = source.pVerts[vindx].x;
+        vertex[WELD_POSITION+1] = source.pVerts[vindx].y;
+        vertex[WELD_POSITION+2] = source.pVerts[vindx].z;
+
+        vertex[WELD_NORMAL] = source.pNormals[vindx].x;
+        vertex[WELD_NORMAL+1] = source.pNormals[vindx].y;
+        vertex[WELD_NORMAL+2] = source.pNormals[vindx].z;
+
+        if (object.material != -1)
+        {
+            vertex[WELD_COLOR] = model.pMaterials[object.material].color[0]/255.0f;
+            vertex[WELD_COLOR+1] = model.pMaterials[object.material].color[1]/255.0f;
+            vertex[WELD_COLOR+2] = model.pMaterials[object.material].color[2]/255.0f;
+        }
+        else
+        {
+            vertex[WELD_COLOR] = 0.5f;
+            vertex[WELD_COLOR+1] = 0.5f;
+            vertex[WELD_COLOR+2] = 0.5f;
+        }
+
+        if (textured)
+        {
+            vertex[WELD_UV] = source.pTexVerts[vindx].x;
+            vertex[WELD_UV+1] = 1.0f-source.pTexVerts[vindx].y;
+        }
+        else
+        {
+            vertex[WELD_UV] = 0;
+            vertex[WELD_UV+1] = 0;
+        }
+
+        vertex[WELD_USE_TEXTURE] = (object.obj_sampler != -1) ? 1 : 0;
+        vertex[WELD_SAMPLER] = object.obj_sampler;
+    }
+
+    std::vector<unsigned int> remap(source.numOfVerts);
+    int num_unique = 0;
+    if (source.numOfVerts)
+        num_unique = weldVertices(&remap[0], &object.vertices[0], source.numOfVerts, WELD_STRIDE, WELD_EPSILON);
+    object.vertices.resize(num_unique*WELD_STRIDE);
+
+    object.indices.resize(source.numOfFaces*3);
+    for (int f = 0 ; f < source.numOfFaces ; f++)
+    {
+        for (int v = 0 ; v < 3 ; v++)
+        {
+            object.indices[f*3+v] = remap[source.pFaces[f].vertIndex[v]];
+        }
+    }
+}
+
+// Reorders a freshly loaded model for the post-transform vertex cache, for
+// overdraw and for vertex fetch locality, and logs the ACMR/ATVR gained.
+// The model must be the last one appended to the global vertex arrays.
+static void optimizeModel(ModelArrayInfo &info, const char* name)
+{
+    int num_vertices = info.numVertices/3;
+    int num_indices = info.numIndices;
+    if (num_indices == 0) return;
+
+    std::vector<unsigned int> indices(num_indices);
+    std::vector<unsigned int> reordered(num_indices);
+    for (int i = 0 ; i < num_indices ; i++)
+        indices[i] = gIndicesList[info.indexOffset+i];
+
+    VertexCacheStats before = analyzeVertexCache(&indices[0], num_indices, num_vertices, VERTEX_CACHE_SIZE);
+
+    optimizeVertexCache(&reordered[0], &indices[0], num_indices, num_vertices);
+    optimizeOverdraw(&indices[0], &reordered[0], num_indices, &gVertexList[info.vertexOffset], num_vertices);
+
+    std::vector<unsigned int> remap(num_vertices);
+    int used_vertices = optimizeVertexFetchRemap(&remap[0], &indices[0], num_indices, num_vertices);
+    remapIndices(&indices[0], num_indices, &remap[0]);
+
+    int third = info.vertexOffset/3;
+    remapVertexAttribute(&gVertexList[info.vertexOffset], 3, num_vertices, &remap[0]);
+    remapVertexAttribute(&gNormalList[info.vertexOffset], 3, num_vertices, &remap[0]);
+    remapVertexAttribute(&gColorList[info.vertexOffset], 3, num_vertices, &remap[0]);
+    remapVertexAttribute(&gTexturesUVList[third*2], 2, num_vertices, &remap[0]);
+    remapVertexAttribute(&gUseTextures[third], 1, num_vertices, &remap[0]);
+    remapVertexAttribute(&gSamplerList[third], 1, num_vertices, &remap[0]);
+
+    for (int i = 0 ; i < num_indices ; i++)
+        gIndicesList[info.indexOffset+i] = indices[i];
+
+    info.numVertices = used_vertices*3;
+    gNumVertexList = info.vertexOffset + info.numVertices;
+
+    VertexCacheStats after = analyzeVertexCache(&indices[0], num_indices, used_vertices, VERTEX_CACHE_SIZE);
+    LOGI("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %d -> %d vertex shader invocations\n", name,
+         before.acmr, after.acmr, before.atvr, after.atvr, before.misses, after.misses);
+}
+
+#define LOD_MAX_ERROR    0.000001f
+#define LOD_MIN_SAVING   0.9f
+
+// Appends up to MAX_LODS-1 simplified copies of the model's triangles, each
+// with about half the triangles of the one before, to the global index
+// list.  The model must be the last one appended and already optimized.
+static void buildModelLods(ModelArrayInfo &info, const char* name)
+{
+    int num_vertices = info.numVertices/3;
+
+    info.num_lods = 1;
+    info.lods[0].indexOffset = 0;
+    info.lods[0].numIndices = info.numIndices;
+    if (info.numIndices == 0) return;
+
+    const float* positions = &gVertexList[info.vertexOffset];
+    std::vector<unsigned int> previous(&gIndicesList[info.indexOffset], &gIndicesList[info.indexOffset] + info.numIndices);
+    std::vector<unsigned int> simplified(info.numIndices);
+    std::vector<unsigned int> reordered(info.numIndices);
+
+    for (int l = 1 ; l < MAX_LODS ; l++)
+    {
+        int target = info.lods[0].numIndices >> l;
+        float max_error = LOD_MAX_ERROR * (1 << (2*(l-1)));
+        int num_indices = simplifyMesh(&simplified[0], &previous[0], (int)previous.size(), positions, num_vertices, target, max_error);
 
+        // Stop once the simplifier is blocked by seams or the error bound
+        if (num_indices == 0 || num_indices > previous.size()*LOD_MIN_SAVING) break;
+        if (gNumIndicesList + num_indices > NUM_INDICES)
+        {
+            LOGE("%s: no room for LOD %d\n", name, l);
             break;
         }
+
+        optimizeVertexCache(&reordered[0], &simplified[0], num_indices, num_vertices);
+
+        ModelLod &lod = info.lods[info.num_lods++];
+        lod.indexOffset = gNumIndicesList - info.indexOffset;
+        lod.numIndices = num_indices;
+        for (int i = 0 ; i < num_indices ; i++)
+            gIndicesList[gNumIndicesList++] = reordered[i];
+
+        previous.assign(reordered.begin(), reordered.begin() + num_indices);
     }
+
+    info.numIndices = gNumIndicesList - info.indexOffset;
+
+    for (int l = 0 ; l < info.num_lods ; l++)
+        LOGI("%s: LOD %d has %d triangles\n", name, l, info.lods[l].numIndices/3);
 }
 
 extern "C" {
@@ -609,6 +2537,11 @@ extern "C" {
     JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadRAW(JNIEnv * env, jobject obj, jstring filename, jint width, jint height, jint src_size, jintArray buffer);
     JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_doneLoadingTextures(JNIEnv * env, jobject obj);
     JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_doneLoadingModels(JNIEnv * env, jobject obj);
+    JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_setCacheDir(JNIEnv * env, jobject obj, jstring path);
+    JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadMap(JNIEnv * env, jobject obj, jbyteArray buffer);
+    JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadPVS(JNIEnv * env, jobject obj, jbyteArray buffer);
+    JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_pause(JNIEnv * env, jobject obj);
+    JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_resume(JNIEnv * env, jobject obj);
 };
 
 JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_init(JNIEnv * env, jobject obj)
@@ -632,8 +2565,9 @@ JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadModel(JNIEnv * env,
     jboolean isCopy = 0;
     jbyte* data = env->GetByteArrayElements(buffer, &isCopy);
     int buffer_size = env->GetArrayLength(buffer);
+    const char* model_name = env->GetStringUTFChars(name, &isCopy);
 
-    LOGI("Loading Model[%d] %s\n",gNumModelArrayInfos,env->GetStringUTFChars(name,&isCopy));
+    LOGI("Loading Model[%d] %s\n",gNumModelArrayInfos,model_name);
 
     gModelArrayInfos[gNumModelArrayInfos].indexOffset = gNumIndicesList;
     gModelArrayInfos[gNumModelArrayInfos].vertexOffset = gNumVertexList;
@@ -655,13 +2589,15 @@ JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadModel(JNIEnv * env,
     gModelArrayInfos[gNumModelArrayInfos].num_sampler_map = 0;
     memset(gModelArrayInfos[gNumModelArrayInfos].sampler_map,0,sizeof(gModelArrayInfos[gNumModelArrayInfos].sampler_map));
 
+    gModelArrayInfos[gNumModelArrayInfos].shader_features = 0;
+
     int last_offset = 0;
     if (model.numOfMaterials == 0 || external)
     {
         external = true;
 
         char col_tex[50];
-        sprintf(col_tex, "%s_col", env->GetStringUTFChars(name, &isCopy));
+        sprintf(col_tex, "%s_col", model_name);
 
         bool found = false;
         for (int i = 0; i < gNumTextureList; i++)
@@ -725,6 +2661,7 @@ JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadModel(JNIEnv * env,
         }
     }
 
+    std::vector<StagedObject> staged(model.numOfObjects);
     for (int i = 0 ; i < model.numOfObjects ; i++)
     {
         int material = -1;
@@ -744,64 +2681,74 @@ JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadModel(JNIEnv * env,
         {
             obj_sampler = 0;
         }
+        staged[i].material = material;
+        staged[i].obj_sampler = obj_sampler;
+    }
+
+    // Objects are independent, build and weld them on the job threads
+    parallelFor(model.numOfObjects, [&](int i) { stageObject(model, i, staged[i]); });
+
+    int num_source_vertices = 0;
+    for (int i = 0 ; i < model.numOfObjects ; i++)
+    {
+        const StagedObject &object = staged[i];
+        int num_unique = (int)object.vertices.size()/WELD_STRIDE;
+        if (object.material != -1 && model.pMaterials[object.material].shineStrength > 0)
+            gModelArrayInfos[gNumModelArrayInfos].shader_features |= SHADER_SPECULAR;
 
-        for (int vindx = 0 ; vindx < model.pObject[i].numOfVerts ; vindx++)
+        for (int vindx = 0 ; vindx < num_unique ; vindx++)
         {
-            gVertexList[gNumVertexList] = model.pObject[i].pVerts[vindx].x;
-            gVertexList[gNumVertexList+1] = model.pObject[i].pVerts[vindx].y;
-            gVertexList[gNumVertexList+2] = model.pObject[i].pVerts[vindx].z;
+            const float* vertex = &object.vertices[vindx*WELD_STRIDE];
+
+            gVertexList[gNumVertexList] = vertex[WELD_POSITION];
+            gVertexList[gNumVertexList+1] = vertex[WELD_POSITION+1];
+            gVertexList[gNumVertexList+2] = vertex[WELD_POSITION+2];
 
-            if (max_x < model.pObject[i].pVerts[vindx].x) max_x = model.pObject[i].pVerts[vindx].x;
-            if (min_x > model.pObject[i].pVerts[vindx].x) min_x = model.pObject[i].pVerts[vindx].x;
-            if (max_y < model.pObject[i].pVerts[vindx].y) max_y = model.pObject[i].pVerts[vindx].y;
-            if (min_y > model.pObject[i].pVerts[vindx].y) min_y = model.pObject[i].pVerts[vindx].y;
-            if (max_z < model.pObject[i].pVerts[vindx].z) max_z = model.pObject[i].pVerts[vindx].z;
-            if (min_z > model.pObject[i].pVerts[vindx].z) min_z = model.pObject[i].pVerts[vindx].z;
+            if (max_x < vertex[WELD_POSITION]) max_x = vertex[WELD_POSITION];
+            if (min_x > vertex[WELD_POSITION]) min_x = vertex[WELD_POSITION];
+            if (max_y < vertex[WELD_POSITION+1]) max_y = vertex[WELD_POSITION+1];
+            if (min_y > vertex[WELD_POSITION+1]) min_y = vertex[WELD_POSITION+1];
+            if (max_z < vertex[WELD_POSITION+2]) max_z = vertex[WELD_POSITION+2];
+            if (min_z > vertex[WELD_POSITION+2]) min_z = vertex[WELD_POSITION+2];
 
             int third = gNumVertexList/3;
-            gUseTextures[third] = (obj_sampler != -1) ? 1 : 0;
-            gSamplerList[third] = obj_sampler;
+            gModelArrayInfos[gNumModelArrayInfos].shader_features |= vertex[WELD_USE_TEXTURE] ? SHADER_TEXTURED : SHADER_VERTEX_COLOR;
+            gUseTextures[third] = vertex[WELD_USE_TEXTURE];
+            gSamplerList[third] = vertex[WELD_SAMPLER];
 
-            gNormalList[gNumVertexList] = model.pObject[i].pNormals[vindx].x;
-            gNormalList[gNumVertexList+1] = model.pObject[i].pNormals[vindx].y;
-            gNormalList[gNumVertexList+2] = model.pObject[i].pNormals[vindx].z;
+            gNormalList[gNumVertexList] = vertex[WELD_NORMAL];
+            gNormalList[gNumVertexList+1] = vertex[WELD_NORMAL+1];
+            gNormalList[gNumVertexList+2] = vertex[WELD_NORMAL+2];
 
-            if (material != -1)
-            {
-                gColorList[gNumVertexList] = model.pMaterials[material].color[0]/255.0f;
-                gColorList[gNumVertexList+1] = model.pMaterials[material].color[1]/255.0f;
-                gColorList[gNumVertexList+2] = model.pMaterials[material].color[2]/255.0f;
-            }
-            else
-            {
-                gColorList[gNumVertexList] = 0.5f;
-                gColorList[gNumVertexList+1] = 0.5f;
-                gColorList[gNumVertexList+2] = 0.5f;
-            }
+            gColorList[gNumVertexList] = vertex[WELD_COLOR];
+            gColorList[gNumVertexList+1] = vertex[WELD_COLOR+1];
+            gColorList[gNumVertexList+2] = vertex[WELD_COLOR+2];
 
-            if (obj_sampler != -1)
-            {
-                gTexturesUVList[third*2] = model.pObject[i].pTexVerts[vindx].x;
-                gTexturesUVList[third*2+1] = 1.0f-model.pObject[i].pTexVerts[vindx].y;
-            }
+            gTexturesUVList[third*2] = vertex[WELD_UV];
+            gTexturesUVList[third*2+1] = vertex[WELD_UV+1];
 
             gNumVertexList += 3;
         }
 
-        for (int f = 0 ; f < model.pObject[i].numOfFaces ; f++)
+        for (size_t k = 0 ; k < object.indices.size() ; k++)
         {
-            for (int v = 0 ; v < 3 ; v++)
-            {
-                gIndicesList[gNumIndicesList++] = (unsigned short)model.pObject[i].pFaces[f].vertIndex[v] + (unsigned short)last_offset;
-            }
+            gIndicesList[gNumIndicesList++] = object.indices[k] + last_offset;
         }
 
-        last_offset += model.pObject[i].numOfVerts;
+        last_offset += num_unique;
+        num_source_vertices += model.pObject[i].numOfVerts;
     }
 
+    LOGI("Welded %d -> %d vertices\n", num_source_vertices, last_offset);
+
+    if (last_offset > 65536)
+        LOGI("Model has %d vertices, too many for 16-bit indices\n", last_offset);
+
     gModelArrayInfos[gNumModelArrayInfos].numIndices = gNumIndicesList - gModelArrayInfos[gNumModelArrayInfos].indexOffset;
     gModelArrayInfos[gNumModelArrayInfos].numVertices = gNumVertexList - gModelArrayInfos[gNumModelArrayInfos].vertexOffset;
 
+    optimizeModel(gModelArrayInfos[gNumModelArrayInfos], model_name);
+
     gModelArrayInfos[gNumModelArrayInfos].max_x = max_x;
     gModelArrayInfos[gNumModelArrayInfos].min_x = min_x;
     gModelArrayInfos[gNumModelArrayInfos].max_y = max_y;
@@ -809,10 +2756,31 @@ JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadModel(JNIEnv * env,
     gModelArrayInfos[gNumModelArrayInfos].max_z = max_z;
     gModelArrayInfos[gNumModelArrayInfos].min_z = min_z;
 
+    buildModelLods(gModelArrayInfos[gNumModelArrayInfos], model_name);
+
+    const ModelArrayInfo &collision = gModelArrayInfos[gNumModelArrayInfos];
+    TriangleBvh &bvh = gModelBvhs[gNumModelArrayInfos];
+    bvh.build(&gVertexList[collision.vertexOffset], &gIndicesList[collision.indexOffset + collision.lods[0].indexOffset], collision.lods[0].numIndices/3);
+    LOGI("%s: BVH of %d nodes over %d triangles\n", model_name, bvh.getNodeCount(), bvh.getTriangleCount());
+
+    // Models binding the same textures share a material in the render queue
+    ModelArrayInfo &loaded = gModelArrayInfos[gNumModelArrayInfos];
+    loaded.material_id = gNumModelArrayInfos;
+    for (int i = 0 ; i < gNumModelArrayInfos ; i++)
+    {
+        if (gModelArrayInfos[i].num_sampler_map == loaded.num_sampler_map &&
+            memcmp(gModelArrayInfos[i].sampler_map, loaded.sampler_map, loaded.num_sampler_map*sizeof(GLuint)) == 0)
+        {
+            loaded.material_id = gModelArrayInfos[i].material_id;
+            break;
+        }
+    }
+
     LOGI("x -> (%f, %f)\n",min_x,max_x);
     LOGI("y -> (%f, %f)\n",min_y,max_y);
     LOGI("z -> (%f, %f)\n",min_z,max_z);
 
+    env->ReleaseStringUTFChars(name, model_name);
     gNumModelArrayInfos++;
 }
 
@@ -892,3 +2860,71 @@ JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_doneLoadingModels(JNIEn
 {
     loading_state = (volatile LoadingState)BINDING_MODELS;
 }
+
+JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_setCacheDir(JNIEnv * env, jobject obj, jstring path)
+{
+    jboolean isCopy = 0;
+    const char* directory = env->GetStringUTFChars(path, &isCopy);
+    setProgramCacheDir(directory);
+    strncpy(gCacheDir, directory, sizeof(gCacheDir)-1);
+    env->ReleaseStringUTFChars(path, directory);
+}
+
+JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadMap(JNIEnv * env, jobject obj, jbyteArray buffer)
+{
+    jboolean isCopy = 0;
+    jbyte* data = env->GetByteArrayElements(buffer, &isCopy);
+    int size = env->GetArrayLength(buffer);
+
+    std::vector<MapItem> items;
+    if (!parseMap(items, (const char*)data, size))
+        LOGE("Malformed map, placing the first %d items\n", (int)items.size());
+
+    for (size_t i = 0 ; i < items.size() ; i++)
+    {
+        if (items[i].model_id < 0 || items[i].model_id >= gNumModelArrayInfos)
+        {
+            LOGE("Map item %d uses unknown model %d\n", (int)i, items[i].model_id);
+            continue;
+        }
+        PlaceItem(items[i].model_id, glm::vec3(items[i].position[0], items[i].position[1], items[i].position[2]));
+    }
+    LOGI("Placed %d map items\n", gItems.getCount());
+
+    env->ReleaseByteArrayElements(buffer, data, JNI_ABORT);
+}
+
+JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_loadPVS(JNIEnv * env, jobject obj, jbyteArray buffer)
+{
+    jboolean isCopy = 0;
+    jbyte* data = env->GetByteArrayElements(buffer, &isCopy);
+    int size = env->GetArrayLength(buffer);
+
+    gHasPvs = loadPvs(gPvs, data, size) && gPvs.header.numItems == gItems.getCount() &&
+              gItems.getSlotCount() == gItems.getCount() &&
+              gPvs.header.origin == MAP_ORIGIN && gPvs.header.sectionSize == MAP_SECTION_SIZE;
+    if (gHasPvs)
+        LOGI("PVS for %d items in %dx%d sections, eyes at %.1f to %.1f\n", gPvs.header.numItems, gPvs.header.sections, gPvs.header.sections,
+             gPvs.header.minEyeHeight, gPvs.header.maxEyeHeight);
+    else
+        LOGE("PVS does not match the map, ignoring it\n");
+
+    env->ReleaseByteArrayElements(buffer, data, JNI_ABORT);
+}
+
+// Called on the GL thread when the app goes to the background
+JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_pause(JNIEnv * env, jobject obj)
+{
+    if (gSimulation) gSimulation->stop();
+}
+
+// Carries on from the last published state, the time spent paused is not
+// simulated
+JNIEXPORT void JNICALL Java_com_android_gl2jni_GL2JNILib_resume(JNIEnv * env, jobject obj)
+{
+    if (!gSimulation || gSimulation->isRunning()) return;
+
+    GameSnapshot previous, current;
+    gSimulation->getSnapshots(&previous, &current);
+    gSimulation->start(&current);
+}
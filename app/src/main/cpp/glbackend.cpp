@@ -0,0 +1,1033 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+#include <string>
+#include <map>
+
+#include "glbackend.h"
+
+#define GL_RECORDING_MAGIC      0x43524C47      // "GLRC"
+#define GL_RECORDING_VERSION    5
+
+static const char* gGlCallNames[GL_NUM_CALLS] =
+{
+    "glActiveTexture",
+    "glAttachShader",
+    "glBindAttribLocation",
+    "glBindBuffer",
+    "glBindTexture",
+    "glBufferData",
+    "glBufferSubData",
+    "glClear",
+    "glClearColor",
+    "glCompileShader",
+    "glCompressedTexImage2D",
+    "glCreateProgram",
+    "glCreateShader",
+    "glDeleteBuffers",
+    "glDeleteProgram",
+    "glDeleteShader",
+    "glDepthFunc",
+    "glDisable",
+    "glDisableVertexAttribArray",
+    "glDrawElements",
+    "glEnable",
+    "glEnableVertexAttribArray",
+    "glGenBuffers",
+    "glGenerateMipmap",
+    "glGenTextures",
+    "glGetError",
+    "glGetIntegerv",
+    "glGetProgramBinaryOES",
+    "glGetProgramInfoLog",
+    "glGetProgramiv",
+    "glGetShaderInfoLog",
+    "glGetShaderiv",
+    "glGetString",
+    "glGetUniformLocation",
+    "glLinkProgram",
+    "glPixelStorei",
+    "glProgramBinaryOES",
+    "glShaderSource",
+    "glTexImage2D",
+    "glTexParameteri",
+    "glUniform1f",
+    "glUniform1iv",
+    "glUniform3fv",
+    "glUniform4fv",
+    "glUniformMatrix4fv",
+    "glUseProgram",
+    "glVertexAttribPointer",
+    "glViewport",
+    "glDebugMessageCallbackKHR",
+    "endFrame",
+};
+
+const char* getGlCallName(int call)
+{
+    return (call >= 0 && call < GL_NUM_CALLS) ? gGlCallNames[call] : "unknown";
+}
+
+// Size of the client memory glTexImage2D reads, rows padded to alignment
+static size_t texImageSize(GLsizei width, GLsizei height, GLenum format, GLenum type, GLint alignment)
+{
+    if (width <= 0 || height <= 0) return 0;
+
+    int pixel_size;
+    if (type != GL_UNSIGNED_BYTE) pixel_size = 2;       // Packed 565, 4444 and 5551
+    else if (format == GL_RGBA) pixel_size = 4;
+    else if (format == GL_RGB) pixel_size = 3;
+    else if (format == GL_LUMINANCE_ALPHA) pixel_size = 2;
+    else pixel_size = 1;
+
+    size_t row = (size_t)width*pixel_size;
+    size_t stride = (row + alignment - 1) / alignment * alignment;
+    return stride*(height-1) + row;
+}
+
+/* Null backend */
+
+NullGlBackend::NullGlBackend()
+{
+    resetCounts();
+    m_NextName = 1;
+}
+
+void NullGlBackend::resetCounts()
+{
+    memset(m_Counts, 0, sizeof(m_Counts));
+}
+
+int NullGlBackend::getTotalCount() const
+{
+    int total = 0;
+    for (int i = 0 ; i < GL_CALL_END_FRAME ; i++) total += m_Counts[i];
+    return total;
+}
+
+void NullGlBackend::activeTexture(GLenum) { m_Counts[GL_CALL_ACTIVE_TEXTURE]++; }
+void NullGlBackend::attachShader(GLuint, GLuint) { m_Counts[GL_CALL_ATTACH_SHADER]++; }
+void NullGlBackend::bindAttribLocation(GLuint, GLuint, const GLchar*) { m_Counts[GL_CALL_BIND_ATTRIB_LOCATION]++; }
+void NullGlBackend::bindBuffer(GLenum, GLuint) { m_Counts[GL_CALL_BIND_BUFFER]++; }
+void NullGlBackend::bindTexture(GLenum, GLuint) { m_Counts[GL_CALL_BIND_TEXTURE]++; }
+void NullGlBackend::bufferData(GLenum, GLsizeiptr, const void*, GLenum) { m_Counts[GL_CALL_BUFFER_DATA]++; }
+void NullGlBackend::bufferSubData(GLenum, GLintptr, GLsizeiptr, const void*) { m_Counts[GL_CALL_BUFFER_SUB_DATA]++; }
+void NullGlBackend::clear(GLbitfield) { m_Counts[GL_CALL_CLEAR]++; }
+void NullGlBackend::clearColor(GLfloat, GLfloat, GLfloat, GLfloat) { m_Counts[GL_CALL_CLEAR_COLOR]++; }
+void NullGlBackend::compileShader(GLuint) { m_Counts[GL_CALL_COMPILE_SHADER]++; }
+void NullGlBackend::compressedTexImage2D(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const void*) { m_Counts[GL_CALL_COMPRESSED_TEX_IMAGE_2D]++; }
+GLuint NullGlBackend::createProgram() { m_Counts[GL_CALL_CREATE_PROGRAM]++; return m_NextName++; }
+GLuint NullGlBackend::createShader(GLenum) { m_Counts[GL_CALL_CREATE_SHADER]++; return m_NextName++; }
+void NullGlBackend::deleteBuffers(GLsizei, const GLuint*) { m_Counts[GL_CALL_DELETE_BUFFERS]++; }
+void NullGlBackend::deleteProgram(GLuint) { m_Counts[GL_CALL_DELETE_PROGRAM]++; }
+void NullGlBackend::deleteShader(GLuint) { m_Counts[GL_CALL_DELETE_SHADER]++; }
+void NullGlBackend::depthFunc(GLenum) { m_Counts[GL_CALL_DEPTH_FUNC]++; }
+void NullGlBackend::disable(GLenum) { m_Counts[GL_CALL_DISABLE]++; }
+void NullGlBackend::disableVertexAttribArray(GLuint) { m_Counts[GL_CALL_DISABLE_VERTEX_ATTRIB_ARRAY]++; }
+void NullGlBackend::drawElements(GLenum, GLsizei, GLenum, const void*) { m_Counts[GL_CALL_DRAW_ELEMENTS]++; }
+void NullGlBackend::enable(GLenum) { m_Counts[GL_CALL_ENABLE]++; }
+void NullGlBackend::enableVertexAttribArray(GLuint) { m_Counts[GL_CALL_ENABLE_VERTEX_ATTRIB_ARRAY]++; }
+void NullGlBackend::generateMipmap(GLenum) { m_Counts[GL_CALL_GENERATE_MIPMAP]++; }
+GLenum NullGlBackend::getError() { m_Counts[GL_CALL_GET_ERROR]++; return GL_NO_ERROR; }
+void NullGlBackend::linkProgram(GLuint) { m_Counts[GL_CALL_LINK_PROGRAM]++; }
+void NullGlBackend::pixelStorei(GLenum, GLint) { m_Counts[GL_CALL_PIXEL_STOREI]++; }
+void NullGlBackend::programBinary(GLuint, GLenum, const void*, GLint) { m_Counts[GL_CALL_PROGRAM_BINARY]++; }
+void NullGlBackend::shaderSource(GLuint, GLsizei, const GLchar* const*, const GLint*) { m_Counts[GL_CALL_SHADER_SOURCE]++; }
+void NullGlBackend::texImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) { m_Counts[GL_CALL_TEX_IMAGE_2D]++; }
+void NullGlBackend::texParameteri(GLenum, GLenum, GLint) { m_Counts[GL_CALL_TEX_PARAMETERI]++; }
+void NullGlBackend::uniform1f(GLint, GLfloat) { m_Counts[GL_CALL_UNIFORM_1F]++; }
+void NullGlBackend::uniform1iv(GLint, GLsizei, const GLint*) { m_Counts[GL_CALL_UNIFORM_1IV]++; }
+void NullGlBackend::uniform3fv(GLint, GLsizei, const GLfloat*) { m_Counts[GL_CALL_UNIFORM_3FV]++; }
+void NullGlBackend::uniform4fv(GLint, GLsizei, const GLfloat*) { m_Counts[GL_CALL_UNIFORM_4FV]++; }
+void NullGlBackend::uniformMatrix4fv(GLint, GLsizei, GLboolean, const GLfloat*) { m_Counts[GL_CALL_UNIFORM_MATRIX_4FV]++; }
+void NullGlBackend::useProgram(GLuint) { m_Counts[GL_CALL_USE_PROGRAM]++; }
+void NullGlBackend::vertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) { m_Counts[GL_CALL_VERTEX_ATTRIB_POINTER]++; }
+void NullGlBackend::viewport(GLint, GLint, GLsizei, GLsizei) { m_Counts[GL_CALL_VIEWPORT]++; }
+void NullGlBackend::endFrame() { m_Counts[GL_CALL_END_FRAME]++; }
+bool NullGlBackend::debugMessageCallback(GLDEBUGPROCKHR, const void*) { m_Counts[GL_CALL_DEBUG_MESSAGE_CALLBACK]++; return false; }
+
+void NullGlBackend::genBuffers(GLsizei n, GLuint* buffers)
+{
+    m_Counts[GL_CALL_GEN_BUFFERS]++;
+    for (int i = 0 ; i < n ; i++) buffers[i] = m_NextName++;
+}
+
+void NullGlBackend::genTextures(GLsizei n, GLuint* textures)
+{
+    m_Counts[GL_CALL_GEN_TEXTURES]++;
+    for (int i = 0 ; i < n ; i++) textures[i] = m_NextName++;
+}
+
+void NullGlBackend::getIntegerv(GLenum, GLint* data)
+{
+    m_Counts[GL_CALL_GET_INTEGERV]++;
+    *data = 0;
+}
+
+void NullGlBackend::getProgramBinary(GLuint, GLsizei, GLsizei* length, GLenum* binaryFormat, void*)
+{
+    m_Counts[GL_CALL_GET_PROGRAM_BINARY]++;
+    if (length) *length = 0;
+    if (binaryFormat) *binaryFormat = 0;
+}
+
+void NullGlBackend::getProgramInfoLog(GLuint, GLsizei bufSize, GLsizei* length, GLchar* infoLog)
+{
+    m_Counts[GL_CALL_GET_PROGRAM_INFO_LOG]++;
+    if (length) *length = 0;
+    if (bufSize > 0) infoLog[0] = 0;
+}
+
+void NullGlBackend::getProgramiv(GLuint, GLenum pname, GLint* params)
+{
+    m_Counts[GL_CALL_GET_PROGRAMIV]++;
+    *params = (pname == GL_LINK_STATUS) ? GL_TRUE : 0;
+}
+
+void NullGlBackend::getShaderInfoLog(GLuint, GLsizei bufSize, GLsizei* length, GLchar* infoLog)
+{
+    m_Counts[GL_CALL_GET_SHADER_INFO_LOG]++;
+    if (length) *length = 0;
+    if (bufSize > 0) infoLog[0] = 0;
+}
+
+void NullGlBackend::getShaderiv(GLuint, GLenum pname, GLint* params)
+{
+    m_Counts[GL_CALL_GET_SHADERIV]++;
+    *params = (pname == GL_COMPILE_STATUS) ? GL_TRUE : 0;
+}
+
+const GLubyte* NullGlBackend::getString(GLenum name)
+{
+    m_Counts[GL_CALL_GET_STRING]++;
+    switch (name)
+    {
+        case GL_VENDOR: return (const GLubyte*)"blobs";
+        case GL_RENDERER: return (const GLubyte*)"Null";
+        case GL_VERSION: return (const GLubyte*)"OpenGL ES 2.0 Null";
+    }
+    return (const GLubyte*)"";
+}
+
+GLint NullGlBackend::getUniformLocation(GLuint, const GLchar*)
+{
+    m_Counts[GL_CALL_GET_UNIFORM_LOCATION]++;
+    return (GLint)(m_NextName++);
+}
+
+/* Recorder */
+
+RecordingGlBackend::RecordingGlBackend(GlBackend* target)
+{
+    m_Target = target;
+    m_File = NULL;
+    m_UnpackAlignment = 4;
+}
+
+RecordingGlBackend::~RecordingGlBackend()
+{
+    close();
+}
+
+bool RecordingGlBackend::open(const char* path)
+{
+    close();
+    m_File = fopen(path, "wb");
+    if (!m_File) return false;
+
+    GLint header[2] = {GL_RECORDING_MAGIC, GL_RECORDING_VERSION};
+    writeInts(header, 2);
+    return true;
+}
+
+void RecordingGlBackend::close()
+{
+    if (m_File) fclose(m_File);
+    m_File = NULL;
+}
+
+void RecordingGlBackend::writeCall(int call)
+{
+    if (!m_File) return;
+    unsigned char id = (unsigned char)call;
+    fwrite(&id, 1, 1, m_File);
+}
+
+void RecordingGlBackend::writeInts(const GLint* values, int count)
+{
+    if (!m_File || count <= 0) return;
+    fwrite(values, sizeof(GLint), count, m_File);
+}
+
+void RecordingGlBackend::writeBytes(const void* data, size_t size)
+{
+    if (!m_File) return;
+    GLint length = (GLint)size;
+    fwrite(&length, sizeof(length), 1, m_File);
+    if (size) fwrite(data, 1, size, m_File);
+}
+
+void RecordingGlBackend::writeString(const char* str)
+{
+    writeBytes(str, str ? strlen(str) : 0);
+}
+
+// Floats go to the file as their bit patterns
+#define WRITE_FLOATS(values, count) writeInts((const GLint*)(values), count)
+
+void RecordingGlBackend::activeTexture(GLenum texture)
+{
+    GLint args[1] = {(GLint)texture};
+    writeCall(GL_CALL_ACTIVE_TEXTURE); writeInts(args, 1);
+    m_Target->activeTexture(texture);
+}
+
+void RecordingGlBackend::attachShader(GLuint program, GLuint shader)
+{
+    GLint args[2] = {(GLint)program, (GLint)shader};
+    writeCall(GL_CALL_ATTACH_SHADER); writeInts(args, 2);
+    m_Target->attachShader(program, shader);
+}
+
+void RecordingGlBackend::bindAttribLocation(GLuint program, GLuint index, const GLchar* name)
+{
+    GLint args[2] = {(GLint)program, (GLint)index};
+    writeCall(GL_CALL_BIND_ATTRIB_LOCATION); writeInts(args, 2); writeString(name);
+    m_Target->bindAttribLocation(program, index, name);
+}
+
+void RecordingGlBackend::bindBuffer(GLenum target, GLuint buffer)
+{
+    GLint args[2] = {(GLint)target, (GLint)buffer};
+    writeCall(GL_CALL_BIND_BUFFER); writeInts(args, 2);
+    m_Target->bindBuffer(target, buffer);
+}
+
+void RecordingGlBackend::bindTexture(GLenum target, GLuint texture)
+{
+    GLint args[2] = {(GLint)target, (GLint)texture};
+    writeCall(GL_CALL_BIND_TEXTURE); writeInts(args, 2);
+    m_Target->bindTexture(target, texture);
+}
+
+void RecordingGlBackend::bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    GLint args[4] = {(GLint)target, (GLint)usage, (GLint)size, data != NULL};
+    writeCall(GL_CALL_BUFFER_DATA); writeInts(args, 4);
+    if (data) writeBytes(data, size);
+    m_Target->bufferData(target, size, data, usage);
+}
+
+void RecordingGlBackend::bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+    GLint args[2] = {(GLint)target, (GLint)offset};
+    writeCall(GL_CALL_BUFFER_SUB_DATA); writeInts(args, 2); writeBytes(data, size);
+    m_Target->bufferSubData(target, offset, size, data);
+}
+
+void RecordingGlBackend::clear(GLbitfield mask)
+{
+    GLint args[1] = {(GLint)mask};
+    writeCall(GL_CALL_CLEAR); writeInts(args, 1);
+    m_Target->clear(mask);
+}
+
+void RecordingGlBackend::clearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+    GLfloat args[4] = {red, green, blue, alpha};
+    writeCall(GL_CALL_CLEAR_COLOR); WRITE_FLOATS(args, 4);
+    m_Target->clearColor(red, green, blue, alpha);
+}
+
+void RecordingGlBackend::compileShader(GLuint shader)
+{
+    GLint args[1] = {(GLint)shader};
+    writeCall(GL_CALL_COMPILE_SHADER); writeInts(args, 1);
+    m_Target->compileShader(shader);
+}
+
+void RecordingGlBackend::compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void* data)
+{
+    GLint args[6] = {(GLint)target, level, (GLint)internalformat, width, height, border};
+    writeCall(GL_CALL_COMPRESSED_TEX_IMAGE_2D); writeInts(args, 6); writeBytes(data, imageSize);
+    m_Target->compressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+}
+
+GLuint RecordingGlBackend::createProgram()
+{
+    GLuint program = m_Target->createProgram();
+    GLint args[1] = {(GLint)program};
+    writeCall(GL_CALL_CREATE_PROGRAM); writeInts(args, 1);
+    return program;
+}
+
+GLuint RecordingGlBackend::createShader(GLenum type)
+{
+    GLuint shader = m_Target->createShader(type);
+    GLint args[2] = {(GLint)type, (GLint)shader};
+    writeCall(GL_CALL_CREATE_SHADER); writeInts(args, 2);
+    return shader;
+}
+
+void RecordingGlBackend::deleteBuffers(GLsizei n, const GLuint* buffers)
+{
+    writeCall(GL_CALL_DELETE_BUFFERS); writeInts(&n, 1); writeInts((const GLint*)buffers, n);
+    m_Target->deleteBuffers(n, buffers);
+}
+
+void RecordingGlBackend::deleteProgram(GLuint program)
+{
+    GLint args[1] = {(GLint)program};
+    writeCall(GL_CALL_DELETE_PROGRAM); writeInts(args, 1);
+    m_Target->deleteProgram(program);
+}
+
+void RecordingGlBackend::deleteShader(GLuint shader)
+{
+    GLint args[1] = {(GLint)shader};
+    writeCall(GL_CALL_DELETE_SHADER); writeInts(args, 1);
+    m_Target->deleteShader(shader);
+}
+
+void RecordingGlBackend::depthFunc(GLenum func)
+{
+    GLint args[1] = {(GLint)func};
+    writeCall(GL_CALL_DEPTH_FUNC); writeInts(args, 1);
+    m_Target->depthFunc(func);
+}
+
+void RecordingGlBackend::disable(GLenum cap)
+{
+    GLint args[1] = {(GLint)cap};
+    writeCall(GL_CALL_DISABLE); writeInts(args, 1);
+    m_Target->disable(cap);
+}
+
+void RecordingGlBackend::disableVertexAttribArray(GLuint index)
+{
+    GLint args[1] = {(GLint)index};
+    writeCall(GL_CALL_DISABLE_VERTEX_ATTRIB_ARRAY); writeInts(args, 1);
+    m_Target->disableVertexAttribArray(index);
+}
+
+void RecordingGlBackend::drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+    GLint args[4] = {(GLint)mode, count, (GLint)type, (GLint)(size_t)indices};
+    writeCall(GL_CALL_DRAW_ELEMENTS); writeInts(args, 4);
+    m_Target->drawElements(mode, count, type, indices);
+}
+
+void RecordingGlBackend::enable(GLenum cap)
+{
+    GLint args[1] = {(GLint)cap};
+    writeCall(GL_CALL_ENABLE); writeInts(args, 1);
+    m_Target->enable(cap);
+}
+
+void RecordingGlBackend::enableVertexAttribArray(GLuint index)
+{
+    GLint args[1] = {(GLint)index};
+    writeCall(GL_CALL_ENABLE_VERTEX_ATTRIB_ARRAY); writeInts(args, 1);
+    m_Target->enableVertexAttribArray(index);
+}
+
+void RecordingGlBackend::genBuffers(GLsizei n, GLuint* buffers)
+{
+    m_Target->genBuffers(n, buffers);
+    writeCall(GL_CALL_GEN_BUFFERS); writeInts(&n, 1); writeInts((const GLint*)buffers, n);
+}
+
+void RecordingGlBackend::generateMipmap(GLenum target)
+{
+    GLint args[1] = {(GLint)target};
+    writeCall(GL_CALL_GENERATE_MIPMAP); writeInts(args, 1);
+    m_Target->generateMipmap(target);
+}
+
+void RecordingGlBackend::genTextures(GLsizei n, GLuint* textures)
+{
+    m_Target->genTextures(n, textures);
+    writeCall(GL_CALL_GEN_TEXTURES); writeInts(&n, 1); writeInts((const GLint*)textures, n);
+}
+
+GLenum RecordingGlBackend::getError()
+{
+    writeCall(GL_CALL_GET_ERROR);
+    return m_Target->getError();
+}
+
+void RecordingGlBackend::getIntegerv(GLenum pname, GLint* data)
+{
+    GLint args[1] = {(GLint)pname};
+    writeCall(GL_CALL_GET_INTEGERV); writeInts(args, 1);
+    m_Target->getIntegerv(pname, data);
+}
+
+void RecordingGlBackend::getProgramBinary(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary)
+{
+    GLint args[2] = {(GLint)program, bufSize};
+    writeCall(GL_CALL_GET_PROGRAM_BINARY); writeInts(args, 2);
+    m_Target->getProgramBinary(program, bufSize, length, binaryFormat, binary);
+}
+
+void RecordingGlBackend::getProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog)
+{
+    GLint args[2] = {(GLint)program, bufSize};
+    writeCall(GL_CALL_GET_PROGRAM_INFO_LOG); writeInts(args, 2);
+    m_Target->getProgramInfoLog(program, bufSize, length, infoLog);
+}
+
+void RecordingGlBackend::getProgramiv(GLuint program, GLenum pname, GLint* params)
+{
+    GLint args[2] = {(GLint)program, (GLint)pname};
+    writeCall(GL_CALL_GET_PROGRAMIV); writeInts(args, 2);
+    m_Target->getProgramiv(program, pname, params);
+}
+
+void RecordingGlBackend::getShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog)
+{
+    GLint args[2] = {(GLint)shader, bufSize};
+    writeCall(GL_CALL_GET_SHADER_INFO_LOG); writeInts(args, 2);
+    m_Target->getShaderInfoLog(shader, bufSize, length, infoLog);
+}
+
+void RecordingGlBackend::getShaderiv(GLuint shader, GLenum pname, GLint* params)
+{
+    GLint args[2] = {(GLint)shader, (GLint)pname};
+    writeCall(GL_CALL_GET_SHADERIV); writeInts(args, 2);
+    m_Target->getShaderiv(shader, pname, params);
+}
+
+const GLubyte* RecordingGlBackend::getString(GLenum name)
+{
+    GLint args[1] = {(GLint)name};
+    writeCall(GL_CALL_GET_STRING); writeInts(args, 1);
+    return m_Target->getString(name);
+}
+
+GLint RecordingGlBackend::getUniformLocation(GLuint program, const GLchar* name)
+{
+    GLint location = m_Target->getUniformLocation(program, name);
+    GLint args[2] = {(GLint)program, location};
+    writeCall(GL_CALL_GET_UNIFORM_LOCATION); writeInts(args, 2); writeString(name);
+    return location;
+}
+
+void RecordingGlBackend::linkProgram(GLuint program)
+{
+    GLint args[1] = {(GLint)program};
+    writeCall(GL_CALL_LINK_PROGRAM); writeInts(args, 1);
+    m_Target->linkProgram(program);
+}
+
+void RecordingGlBackend::pixelStorei(GLenum pname, GLint param)
+{
+    if (pname == GL_UNPACK_ALIGNMENT) m_UnpackAlignment = param;
+    GLint args[2] = {(GLint)pname, param};
+    writeCall(GL_CALL_PIXEL_STOREI); writeInts(args, 2);
+    m_Target->pixelStorei(pname, param);
+}
+
+void RecordingGlBackend::programBinary(GLuint program, GLenum binaryFormat, const void* binary, GLint length)
+{
+    GLint args[2] = {(GLint)program, (GLint)binaryFormat};
+    writeCall(GL_CALL_PROGRAM_BINARY); writeInts(args, 2); writeBytes(binary, length);
+    m_Target->programBinary(program, binaryFormat, binary, length);
+}
+
+void RecordingGlBackend::shaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length)
+{
+    // The strings are stored joined, which compiles the same
+    std::string source;
+    for (int i = 0 ; i < count ; i++)
+    {
+        if (length && length[i] >= 0) source.append(string[i], length[i]);
+        else source.append(string[i]);
+    }
+    GLint args[1] = {(GLint)shader};
+    writeCall(GL_CALL_SHADER_SOURCE); writeInts(args, 1); writeString(source.c_str());
+    m_Target->shaderSource(shader, count, string, length);
+}
+
+void RecordingGlBackend::texImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+    GLint args[9] = {(GLint)target, level, internalformat, width, height, border, (GLint)format, (GLint)type, pixels != NULL};
+    writeCall(GL_CALL_TEX_IMAGE_2D); writeInts(args, 9);
+    if (pixels) writeBytes(pixels, texImageSize(width, height, format, type, m_UnpackAlignment));
+    m_Target->texImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+void RecordingGlBackend::texParameteri(GLenum target, GLenum pname, GLint param)
+{
+    GLint args[3] = {(GLint)target, (GLint)pname, param};
+    writeCall(GL_CALL_TEX_PARAMETERI); writeInts(args, 3);
+    m_Target->texParameteri(target, pname, param);
+}
+
+void RecordingGlBackend::uniform1f(GLint location, GLfloat v0)
+{
+    writeCall(GL_CALL_UNIFORM_1F); writeInts(&location, 1); WRITE_FLOATS(&v0, 1);
+    m_Target->uniform1f(location, v0);
+}
+
+void RecordingGlBackend::uniform1iv(GLint location, GLsizei count, const GLint* value)
+{
+    GLint args[2] = {location, count};
+    writeCall(GL_CALL_UNIFORM_1IV); writeInts(args, 2); writeInts(value, count);
+    m_Target->uniform1iv(location, count, value);
+}
+
+void RecordingGlBackend::uniform3fv(GLint location, GLsizei count, const GLfloat* value)
+{
+    GLint args[2] = {location, count};
+    writeCall(GL_CALL_UNIFORM_3FV); writeInts(args, 2); WRITE_FLOATS(value, count*3);
+    m_Target->uniform3fv(location, count, value);
+}
+
+void RecordingGlBackend::uniform4fv(GLint location, GLsizei count, const GLfloat* value)
+{
+    GLint args[2] = {location, count};
+    writeCall(GL_CALL_UNIFORM_4FV); writeInts(args, 2); WRITE_FLOATS(value, count*4);
+    m_Target->uniform4fv(location, count, value);
+}
+
+void RecordingGlBackend::uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+    GLint args[3] = {location, count, transpose};
+    writeCall(GL_CALL_UNIFORM_MATRIX_4FV); writeInts(args, 3); WRITE_FLOATS(value, count*16);
+    m_Target->uniformMatrix4fv(location, count, transpose, value);
+}
+
+void RecordingGlBackend::useProgram(GLuint program)
+{
+    GLint args[1] = {(GLint)program};
+    writeCall(GL_CALL_USE_PROGRAM); writeInts(args, 1);
+    m_Target->useProgram(program);
+}
+
+void RecordingGlBackend::vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer)
+{
+    GLint args[6] = {(GLint)index, size, (GLint)type, normalized, stride, (GLint)(size_t)pointer};
+    writeCall(GL_CALL_VERTEX_ATTRIB_POINTER); writeInts(args, 6);
+    m_Target->vertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+void RecordingGlBackend::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint args[4] = {x, y, width, height};
+    writeCall(GL_CALL_VIEWPORT); writeInts(args, 4);
+    m_Target->viewport(x, y, width, height);
+}
+
+bool RecordingGlBackend::debugMessageCallback(GLDEBUGPROCKHR callback, const void* userParam)
+{
+    writeCall(GL_CALL_DEBUG_MESSAGE_CALLBACK);
+    return m_Target->debugMessageCallback(callback, userParam);
+}
+
+void RecordingGlBackend::endFrame()
+{
+    writeCall(GL_CALL_END_FRAME);
+    m_Target->endFrame();
+}
+
+/* Replay */
+
+struct RecordingReader
+{
+    const unsigned char* data;
+    size_t size;
+    size_t position;
+    bool failed;
+
+    bool read(void* dst, size_t bytes)
+    {
+        if (failed || size - position < bytes) { failed = true; return false; }
+        memcpy(dst, data + position, bytes);
+        position += bytes;
+        return true;
+    }
+
+    GLint readInt()
+    {
+        GLint value = 0;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    GLfloat readFloat()
+    {
+        GLfloat value = 0;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    // Points into the recording, valid while it is loaded
+    const void* readBytes(GLint &length)
+    {
+        length = readInt();
+        if (failed || length < 0 || size - position < (size_t)length) { failed = true; length = 0; return NULL; }
+        const void* bytes = data + position;
+        position += length;
+        return bytes;
+    }
+
+    std::string readString()
+    {
+        GLint length;
+        const char* chars = (const char*)readBytes(length);
+        return chars ? std::string(chars, length) : std::string();
+    }
+};
+
+// Recorded names and uniform locations to the ones the replay backend uses
+struct ReplayNames
+{
+    std::map<GLuint, GLuint> buffers;
+    std::map<GLuint, GLuint> textures;
+    std::map<GLuint, GLuint> objects;                       // Programs and shaders
+    std::map<std::pair<GLuint, GLint>, GLint> locations;    // By recorded program
+    GLuint program;                                         // Recorded name in use
+
+    static GLuint find(const std::map<GLuint, GLuint> &names, GLuint name)
+    {
+        std::map<GLuint, GLuint>::const_iterator it = names.find(name);
+        return (it == names.end()) ? name : it->second;
+    }
+
+    GLint location(GLint recorded) const
+    {
+        if (recorded < 0) return recorded;
+        std::map<std::pair<GLuint, GLint>, GLint>::const_iterator it = locations.find(std::make_pair(program, recorded));
+        return (it == locations.end()) ? -1 : it->second;
+    }
+};
+
+int replayGlRecording(const char* path, GlBackend &backend)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+
+    std::vector<unsigned char> data;
+    unsigned char chunk[65536];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.insert(data.end(), chunk, chunk + got);
+    fclose(file);
+
+    RecordingReader in;
+    in.data = data.empty() ? NULL : &data[0];
+    in.size = data.size();
+    in.position = 0;
+    in.failed = false;
+    if (in.readInt() != GL_RECORDING_MAGIC || in.readInt() != GL_RECORDING_VERSION) return -1;
+
+    ReplayNames names;
+    names.program = 0;
+    std::vector<GLint> ints;
+    std::vector<GLfloat> floats;
+    std::vector<char> scratch;
+    int frames = 0;
+
+    while (in.position < in.size && !in.failed)
+    {
+        unsigned char call;
+        in.read(&call, 1);
+
+        switch (call)
+        {
+            case GL_CALL_ACTIVE_TEXTURE:
+                backend.activeTexture(in.readInt());
+                break;
+            case GL_CALL_ATTACH_SHADER:
+            {
+                GLuint program = in.readInt();
+                GLuint shader = in.readInt();
+                backend.attachShader(ReplayNames::find(names.objects, program), ReplayNames::find(names.objects, shader));
+                break;
+            }
+            case GL_CALL_BIND_ATTRIB_LOCATION:
+            {
+                GLuint program = in.readInt();
+                GLuint index = in.readInt();
+                std::string name = in.readString();
+                backend.bindAttribLocation(ReplayNames::find(names.objects, program), index, name.c_str());
+                break;
+            }
+            case GL_CALL_BIND_BUFFER:
+            {
+                GLenum target = in.readInt();
+                backend.bindBuffer(target, ReplayNames::find(names.buffers, in.readInt()));
+                break;
+            }
+            case GL_CALL_BIND_TEXTURE:
+            {
+                GLenum target = in.readInt();
+                backend.bindTexture(target, ReplayNames::find(names.textures, in.readInt()));
+                break;
+            }
+            case GL_CALL_BUFFER_DATA:
+            {
+                GLenum target = in.readInt();
+                GLenum usage = in.readInt();
+                GLint size = in.readInt();
+                const void* bytes = NULL;
+                if (in.readInt()) bytes = in.readBytes(size);
+                backend.bufferData(target, size, bytes, usage);
+                break;
+            }
+            case GL_CALL_BUFFER_SUB_DATA:
+            {
+                GLenum target = in.readInt();
+                GLintptr offset = in.readInt();
+                GLint size;
+                const void* bytes = in.readBytes(size);
+                backend.bufferSubData(target, offset, size, bytes);
+                break;
+            }
+            case GL_CALL_CLEAR:
+                backend.clear(in.readInt());
+                break;
+            case GL_CALL_CLEAR_COLOR:
+            {
+                GLfloat color[4];
+                for (int i = 0 ; i < 4 ; i++) color[i] = in.readFloat();
+                backend.clearColor(color[0], color[1], color[2], color[3]);
+                break;
+            }
+            case GL_CALL_COMPILE_SHADER:
+                backend.compileShader(ReplayNames::find(names.objects, in.readInt()));
+                break;
+            case GL_CALL_COMPRESSED_TEX_IMAGE_2D:
+            {
+                GLint args[6];
+                for (int i = 0 ; i < 6 ; i++) args[i] = in.readInt();
+                GLint size;
+                const void* bytes = in.readBytes(size);
+                backend.compressedTexImage2D(args[0], args[1], args[2], args[3], args[4], args[5], size, bytes);
+                break;
+            }
+            case GL_CALL_CREATE_PROGRAM:
+            {
+                GLuint recorded = in.readInt();
+                names.objects[recorded] = backend.createProgram();
+                break;
+            }
+            case GL_CALL_CREATE_SHADER:
+            {
+                GLenum type = in.readInt();
+                GLuint recorded = in.readInt();
+                names.objects[recorded] = backend.createShader(type);
+                break;
+            }
+            case GL_CALL_DELETE_BUFFERS:
+            {
+                GLsizei n = in.readInt();
+                if (n < 0 || n > 65536) { in.failed = true; break; }
+                std::vector<GLuint> deleted(n);
+                for (int i = 0 ; i < n ; i++)
+                {
+                    GLuint recorded = in.readInt();
+                    deleted[i] = ReplayNames::find(names.buffers, recorded);
+                    names.buffers.erase(recorded);
+                }
+                if (n > 0) backend.deleteBuffers(n, &deleted[0]);
+                break;
+            }
+            case GL_CALL_DELETE_PROGRAM:
+                backend.deleteProgram(ReplayNames::find(names.objects, in.readInt()));
+                break;
+            case GL_CALL_DELETE_SHADER:
+                backend.deleteShader(ReplayNames::find(names.objects, in.readInt()));
+                break;
+            case GL_CALL_DEPTH_FUNC:
+                backend.depthFunc(in.readInt());
+                break;
+            case GL_CALL_DISABLE:
+                backend.disable(in.readInt());
+                break;
+            case GL_CALL_DISABLE_VERTEX_ATTRIB_ARRAY:
+                backend.disableVertexAttribArray(in.readInt());
+                break;
+            case GL_CALL_DRAW_ELEMENTS:
+            {
+                GLenum mode = in.readInt();
+                GLsizei count = in.readInt();
+                GLenum type = in.readInt();
+                size_t offset = (GLuint)in.readInt();
+                backend.drawElements(mode, count, type, (const void*)offset);
+                break;
+            }
+            case GL_CALL_ENABLE:
+                backend.enable(in.readInt());
+                break;
+            case GL_CALL_ENABLE_VERTEX_ATTRIB_ARRAY:
+                backend.enableVertexAttribArray(in.readInt());
+                break;
+            case GL_CALL_GEN_BUFFERS:
+            case GL_CALL_GEN_TEXTURES:
+            {
+                GLsizei n = in.readInt();
+                if (n < 0 || n > 65536) { in.failed = true; break; }
+                std::vector<GLuint> created(n);
+                if (n == 0) break;
+                if (call == GL_CALL_GEN_BUFFERS) backend.genBuffers(n, &created[0]);
+                else backend.genTextures(n, &created[0]);
+                std::map<GLuint, GLuint> &map = (call == GL_CALL_GEN_BUFFERS) ? names.buffers : names.textures;
+                for (int i = 0 ; i < n ; i++) map[(GLuint)in.readInt()] = created[i];
+                break;
+            }
+            case GL_CALL_GENERATE_MIPMAP:
+                backend.generateMipmap(in.readInt());
+                break;
+            case GL_CALL_GET_ERROR:
+                backend.getError();
+                break;
+            case GL_CALL_GET_INTEGERV:
+            {
+                // Room for the largest queries (binary format lists)
+                ints.resize(64);
+                backend.getIntegerv(in.readInt(), &ints[0]);
+                break;
+            }
+            case GL_CALL_GET_PROGRAM_BINARY:
+            case GL_CALL_GET_PROGRAM_INFO_LOG:
+            case GL_CALL_GET_SHADER_INFO_LOG:
+            {
+                GLuint object = ReplayNames::find(names.objects, in.readInt());
+                GLsizei size = in.readInt();
+                if (size < 0 || size > (64 << 20)) { in.failed = true; break; }
+                scratch.resize(size + 1);
+                GLsizei length = 0;
+                GLenum format = 0;
+                if (call == GL_CALL_GET_PROGRAM_BINARY) backend.getProgramBinary(object, size, &length, &format, &scratch[0]);
+                else if (call == GL_CALL_GET_PROGRAM_INFO_LOG) backend.getProgramInfoLog(object, size, &length, &scratch[0]);
+                else backend.getShaderInfoLog(object, size, &length, &scratch[0]);
+                break;
+            }
+            case GL_CALL_GET_PROGRAMIV:
+            case GL_CALL_GET_SHADERIV:
+            {
+                GLuint object = ReplayNames::find(names.objects, in.readInt());
+                GLenum pname = in.readInt();
+                GLint value = 0;
+                if (call == GL_CALL_GET_PROGRAMIV) backend.getProgramiv(object, pname, &value);
+                else backend.getShaderiv(object, pname, &value);
+                break;
+            }
+            case GL_CALL_GET_STRING:
+                backend.getString(in.readInt());
+                break;
+            case GL_CALL_GET_UNIFORM_LOCATION:
+            {
+                GLuint program = in.readInt();
+                GLint recorded = in.readInt();
+                std::string name = in.readString();
+                GLint location = backend.getUniformLocation(ReplayNames::find(names.objects, program), name.c_str());
+                if (recorded >= 0) names.locations[std::make_pair(program, recorded)] = location;
+                break;
+            }
+            case GL_CALL_LINK_PROGRAM:
+                backend.linkProgram(ReplayNames::find(names.objects, in.readInt()));
+                break;
+            case GL_CALL_PIXEL_STOREI:
+            {
+                GLenum pname = in.readInt();
+                backend.pixelStorei(pname, in.readInt());
+                break;
+            }
+            case GL_CALL_PROGRAM_BINARY:
+            {
+                GLuint program = ReplayNames::find(names.objects, in.readInt());
+                GLenum format = in.readInt();
+                GLint length;
+                const void* bytes = in.readBytes(length);
+                backend.programBinary(program, format, bytes, length);
+                break;
+            }
+            case GL_CALL_SHADER_SOURCE:
+            {
+                GLuint shader = ReplayNames::find(names.objects, in.readInt());
+                std::string source = in.readString();
+                const GLchar* string = source.c_str();
+                backend.shaderSource(shader, 1, &string, NULL);
+                break;
+            }
+            case GL_CALL_TEX_IMAGE_2D:
+            {
+                GLint args[8];
+                for (int i = 0 ; i < 8 ; i++) args[i] = in.readInt();
+                const void* bytes = NULL;
+                GLint size;
+                if (in.readInt()) bytes = in.readBytes(size);
+                backend.texImage2D(args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7], bytes);
+                break;
+            }
+            case GL_CALL_TEX_PARAMETERI:
+            {
+                GLenum target = in.readInt();
+                GLenum pname = in.readInt();
+                backend.texParameteri(target, pname, in.readInt());
+                break;
+            }
+            case GL_CALL_UNIFORM_1F:
+            {
+                GLint location = names.location(in.readInt());
+                backend.uniform1f(location, in.readFloat());
+                break;
+            }
+            case GL_CALL_UNIFORM_1IV:
+            case GL_CALL_UNIFORM_3FV:
+            case GL_CALL_UNIFORM_4FV:
+            case GL_CALL_UNIFORM_MATRIX_4FV:
+            {
+                GLint location = names.location(in.readInt());
+                GLsizei count = in.readInt();
+                GLboolean transpose = (call == GL_CALL_UNIFORM_MATRIX_4FV) ? (GLboolean)in.readInt() : GL_FALSE;
+                int components = (call == GL_CALL_UNIFORM_1IV) ? 1 : (call == GL_CALL_UNIFORM_3FV) ? 3 : (call == GL_CALL_UNIFORM_4FV) ? 4 : 16;
+                if (count <= 0 || count > 1024) { in.failed = true; break; }
+                ints.resize(count*components);
+                in.read(&ints[0], ints.size()*sizeof(GLint));
+                floats.resize(ints.size());
+                memcpy(&floats[0], &ints[0], ints.size()*sizeof(GLint));
+                if (call == GL_CALL_UNIFORM_1IV) backend.uniform1iv(location, count, &ints[0]);
+                else if (call == GL_CALL_UNIFORM_3FV) backend.uniform3fv(location, count, &floats[0]);
+                else if (call == GL_CALL_UNIFORM_4FV) backend.uniform4fv(location, count, &floats[0]);
+                else backend.uniformMatrix4fv(location, count, transpose, &floats[0]);
+                break;
+            }
+            case GL_CALL_USE_PROGRAM:
+                names.program = in.readInt();
+                backend.useProgram(ReplayNames::find(names.objects, names.program));
+                break;
+            case GL_CALL_VERTEX_ATTRIB_POINTER:
+            {
+                GLint args[6];
+                for (int i = 0 ; i < 6 ; i++) args[i] = in.readInt();
+                size_t offset = (GLuint)args[5];
+                backend.vertexAttribPointer(args[0], args[1], args[2], (GLboolean)args[3], args[4], (const void*)offset);
+                break;
+            }
+            case GL_CALL_VIEWPORT:
+            {
+                GLint args[4];
+                for (int i = 0 ; i < 4 ; i++) args[i] = in.readInt();
+                backend.viewport(args[0], args[1], args[2], args[3]);
+                break;
+            }
+            case GL_CALL_DEBUG_MESSAGE_CALLBACK:
+                backend.debugMessageCallback(NULL, NULL);
+                break;
+            case GL_CALL_END_FRAME:
+                backend.endFrame();
+                frames++;
+                break;
+            default:
+                in.failed = true;
+                break;
+        }
+    }
+
+    return in.failed ? -1 : frames;
+}
@@ -0,0 +1,293 @@
+#ifndef GLBACKEND_H
+#define GLBACKEND_H
+
+#include <stdio.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+// Every GL call of the renderer and the loaders goes through gGL, so the
+// same code can draw on a device, run headless on Linux for benchmarks, or
+// be captured to a file and replayed.  Methods mirror the GLES2 entry
+// points of the same name.  Pointer arguments of vertexAttribPointer and
+// drawElements are always offsets into the bound buffers.
+
+class GlBackend
+{
+public:
+    virtual ~GlBackend() {}
+
+    virtual void activeTexture(GLenum texture) = 0;
+    virtual void attachShader(GLuint program, GLuint shader) = 0;
+    virtual void bindAttribLocation(GLuint program, GLuint index, const GLchar* name) = 0;
+    virtual void bindBuffer(GLenum target, GLuint buffer) = 0;
+    virtual void bindTexture(GLenum target, GLuint texture) = 0;
+    virtual void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) = 0;
+    virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) = 0;
+    virtual void clear(GLbitfield mask) = 0;
+    virtual void clearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) = 0;
+    virtual void compileShader(GLuint shader) = 0;
+    virtual void compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void* data) = 0;
+    virtual GLuint createProgram() = 0;
+    virtual GLuint createShader(GLenum type) = 0;
+    virtual void deleteBuffers(GLsizei n, const GLuint* buffers) = 0;
+    virtual void deleteProgram(GLuint program) = 0;
+    virtual void deleteShader(GLuint shader) = 0;
+    virtual void depthFunc(GLenum func) = 0;
+    virtual void disable(GLenum cap) = 0;
+    virtual void disableVertexAttribArray(GLuint index) = 0;
+    virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) = 0;
+    virtual void enable(GLenum cap) = 0;
+    virtual void enableVertexAttribArray(GLuint index) = 0;
+    virtual void genBuffers(GLsizei n, GLuint* buffers) = 0;
+    virtual void generateMipmap(GLenum target) = 0;
+    virtual void genTextures(GLsizei n, GLuint* textures) = 0;
+    virtual GLenum getError() = 0;
+    virtual void getIntegerv(GLenum pname, GLint* data) = 0;
+    virtual void getProgramBinary(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary) = 0;
+    virtual void getProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog) = 0;
+    virtual void getProgramiv(GLuint program, GLenum pname, GLint* params) = 0;
+    virtual void getShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog) = 0;
+    virtual void getShaderiv(GLuint shader, GLenum pname, GLint* params) = 0;
+    virtual const GLubyte* getString(GLenum name) = 0;
+    virtual GLint getUniformLocation(GLuint program, const GLchar* name) = 0;
+    virtual void linkProgram(GLuint program) = 0;
+    virtual void pixelStorei(GLenum pname, GLint param) = 0;
+    virtual void programBinary(GLuint program, GLenum binaryFormat, const void* binary, GLint length) = 0;
+    virtual void shaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length) = 0;
+    virtual void texImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels) = 0;
+    virtual void texParameteri(GLenum target, GLenum pname, GLint param) = 0;
+    virtual void uniform1f(GLint location, GLfloat v0) = 0;
+    virtual void uniform1iv(GLint location, GLsizei count, const GLint* value) = 0;
+    virtual void uniform3fv(GLint location, GLsizei count, const GLfloat* value) = 0;
+    virtual void uniform4fv(GLint location, GLsizei count, const GLfloat* value) = 0;
+    virtual void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) = 0;
+    virtual void useProgram(GLuint program) = 0;
+    virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer) = 0;
+    virtual void viewport(GLint x, GLint y, GLsizei width, GLsizei height) = 0;
+
+    // KHR_debug glDebugMessageCallbackKHR, false when the driver lacks it
+    virtual bool debugMessageCallback(GLDEBUGPROCKHR callback, const void* userParam) = 0;
+
+    // Marks the end of a rendered frame
+    virtual void endFrame() {}
+};
+
+// Backend the renderer uses.  On Android it starts as the GLES2 one;
+// host tools define it themselves.
+extern GlBackend* gGL;
+
+// The backend calling the real GLES2 library (glbackend_gles.cpp)
+GlBackend* getGlesBackend();
+
+// One entry per GlBackend method, used by the recording format and the
+// call counters
+enum GlCall
+{
+    GL_CALL_ACTIVE_TEXTURE,
+    GL_CALL_ATTACH_SHADER,
+    GL_CALL_BIND_ATTRIB_LOCATION,
+    GL_CALL_BIND_BUFFER,
+    GL_CALL_BIND_TEXTURE,
+    GL_CALL_BUFFER_DATA,
+    GL_CALL_BUFFER_SUB_DATA,
+    GL_CALL_CLEAR,
+    GL_CALL_CLEAR_COLOR,
+    GL_CALL_COMPILE_SHADER,
+    GL_CALL_COMPRESSED_TEX_IMAGE_2D,
+    GL_CALL_CREATE_PROGRAM,
+    GL_CALL_CREATE_SHADER,
+    GL_CALL_DELETE_BUFFERS,
+    GL_CALL_DELETE_PROGRAM,
+    GL_CALL_DELETE_SHADER,
+    GL_CALL_DEPTH_FUNC,
+    GL_CALL_DISABLE,
+    GL_CALL_DISABLE_VERTEX_ATTRIB_ARRAY,
+    GL_CALL_DRAW_ELEMENTS,
+    GL_CALL_ENABLE,
+    GL_CALL_ENABLE_VERTEX_ATTRIB_ARRAY,
+    GL_CALL_GEN_BUFFERS,
+    GL_CALL_GENERATE_MIPMAP,
+    GL_CALL_GEN_TEXTURES,
+    GL_CALL_GET_ERROR,
+    GL_CALL_GET_INTEGERV,
+    GL_CALL_GET_PROGRAM_BINARY,
+    GL_CALL_GET_PROGRAM_INFO_LOG,
+    GL_CALL_GET_PROGRAMIV,
+    GL_CALL_GET_SHADER_INFO_LOG,
+    GL_CALL_GET_SHADERIV,
+    GL_CALL_GET_STRING,
+    GL_CALL_GET_UNIFORM_LOCATION,
+    GL_CALL_LINK_PROGRAM,
+    GL_CALL_PIXEL_STOREI,
+    GL_CALL_PROGRAM_BINARY,
+    GL_CALL_SHADER_SOURCE,
+    GL_CALL_TEX_IMAGE_2D,
+    GL_CALL_TEX_PARAMETERI,
+    GL_CALL_UNIFORM_1F,
+    GL_CALL_UNIFORM_1IV,
+    GL_CALL_UNIFORM_3FV,
+    GL_CALL_UNIFORM_4FV,
+    GL_CALL_UNIFORM_MATRIX_4FV,
+    GL_CALL_USE_PROGRAM,
+    GL_CALL_VERTEX_ATTRIB_POINTER,
+    GL_CALL_VIEWPORT,
+    GL_CALL_DEBUG_MESSAGE_CALLBACK,
+    GL_CALL_END_FRAME,
+    GL_NUM_CALLS
+};
+
+const char* getGlCallName(int call);
+
+// Does nothing but count calls.  Object names are handed out in sequence,
+// shaders compile and programs link, and queries return zeros.
+class NullGlBackend : public GlBackend
+{
+public:
+    NullGlBackend();
+
+    void resetCounts();
+    int getCount(int call) const { return m_Counts[call]; }
+    int getTotalCount() const;
+    int getFrames() const { return m_Counts[GL_CALL_END_FRAME]; }
+
+    virtual void activeTexture(GLenum texture);
+    virtual void attachShader(GLuint program, GLuint shader);
+    virtual void bindAttribLocation(GLuint program, GLuint index, const GLchar* name);
+    virtual void bindBuffer(GLenum target, GLuint buffer);
+    virtual void bindTexture(GLenum target, GLuint texture);
+    virtual void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+    virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+    virtual void clear(GLbitfield mask);
+    virtual void clearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+    virtual void compileShader(GLuint shader);
+    virtual void compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void* data);
+    virtual GLuint createProgram();
+    virtual GLuint createShader(GLenum type);
+    virtual void deleteBuffers(GLsizei n, const GLuint* buffers);
+    virtual void deleteProgram(GLuint program);
+    virtual void deleteShader(GLuint shader);
+    virtual void depthFunc(GLenum func);
+    virtual void disable(GLenum cap);
+    virtual void disableVertexAttribArray(GLuint index);
+    virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices);
+    virtual void enable(GLenum cap);
+    virtual void enableVertexAttribArray(GLuint index);
+    virtual void genBuffers(GLsizei n, GLuint* buffers);
+    virtual void generateMipmap(GLenum target);
+    virtual void genTextures(GLsizei n, GLuint* textures);
+    virtual GLenum getError();
+    virtual void getIntegerv(GLenum pname, GLint* data);
+    virtual void getProgramBinary(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+    virtual void getProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+    virtual void getProgramiv(GLuint program, GLenum pname, GLint* params);
+    virtual void getShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+    virtual void getShaderiv(GLuint shader, GLenum pname, GLint* params);
+    virtual const GLubyte* getString(GLenum name);
+    virtual GLint getUniformLocation(GLuint program, const GLchar* name);
+    virtual void linkProgram(GLuint program);
+    virtual void pixelStorei(GLenum pname, GLint param);
+    virtual void programBinary(GLuint program, GLenum binaryFormat, const void* binary, GLint length);
+    virtual void shaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length);
+    virtual void texImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels);
+    virtual void texParameteri(GLenum target, GLenum pname, GLint param);
+    virtual void uniform1f(GLint location, GLfloat v0);
+    virtual void uniform1iv(GLint location, GLsizei count, const GLint* value);
+    virtual void uniform3fv(GLint location, GLsizei count, const GLfloat* value);
+    virtual void uniform4fv(GLint location, GLsizei count, const GLfloat* value);
+    virtual void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+    virtual void useProgram(GLuint program);
+    virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+    virtual void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    virtual bool debugMessageCallback(GLDEBUGPROCKHR callback, const void* userParam);
+    virtual void endFrame();
+
+private:
+    int m_Counts[GL_NUM_CALLS];
+    GLuint m_NextName;
+};
+
+// Passes every call on to another backend and appends it, with the data
+// it uploads and the names it gets back, to a file that replayGlRecording
+// can play into any backend.  Program binaries restored from the program
+// cache are only valid on the driver that made them, and debug callbacks
+// are not replayed.
+class RecordingGlBackend : public GlBackend
+{
+public:
+    explicit RecordingGlBackend(GlBackend* target);
+    virtual ~RecordingGlBackend();
+
+    bool open(const char* path);
+    void close();
+    bool isOpen() const { return m_File != NULL; }
+    GlBackend* getTarget() const { return m_Target; }
+
+    virtual void activeTexture(GLenum texture);
+    virtual void attachShader(GLuint program, GLuint shader);
+    virtual void bindAttribLocation(GLuint program, GLuint index, const GLchar* name);
+    virtual void bindBuffer(GLenum target, GLuint buffer);
+    virtual void bindTexture(GLenum target, GLuint texture);
+    virtual void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+    virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+    virtual void clear(GLbitfield mask);
+    virtual void clearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+    virtual void compileShader(GLuint shader);
+    virtual void compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void* data);
+    virtual GLuint createProgram();
+    virtual GLuint createShader(GLenum type);
+    virtual void deleteBuffers(GLsizei n, const GLuint* buffers);
+    virtual void deleteProgram(GLuint program);
+    virtual void deleteShader(GLuint shader);
+    virtual void depthFunc(GLenum func);
+    virtual void disable(GLenum cap);
+    virtual void disableVertexAttribArray(GLuint index);
+    virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices);
+    virtual void enable(GLenum cap);
+    virtual void enableVertexAttribArray(GLuint index);
+    virtual void genBuffers(GLsizei n, GLuint* buffers);
+    virtual void generateMipmap(GLenum target);
+    virtual void genTextures(GLsizei n, GLuint* textures);
+    virtual GLenum getError();
+    virtual void getIntegerv(GLenum pname, GLint* data);
+    virtual void getProgramBinary(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+    virtual void getProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+    virtual void getProgramiv(GLuint program, GLenum pname, GLint* params);
+    virtual void getShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+    virtual void getShaderiv(GLuint shader, GLenum pname, GLint* params);
+    virtual const GLubyte* getString(GLenum name);
+    virtual GLint getUniformLocation(GLuint program, const GLchar* name);
+    virtual void linkProgram(GLuint program);
+    virtual void pixelStorei(GLenum pname, GLint param);
+    virtual void programBinary(GLuint program, GLenum binaryFormat, const void* binary, GLint length);
+    virtual void shaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length);
+    virtual void texImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels);
+    virtual void texParameteri(GLenum target, GLenum pname, GLint param);
+    virtual void uniform1f(GLint location, GLfloat v0);
+    virtual void uniform1iv(GLint location, GLsizei count, const GLint* value);
+    virtual void uniform3fv(GLint location, GLsizei count, const GLfloat* value);
+    virtual void uniform4fv(GLint location, GLsizei count, const GLfloat* value);
+    virtual void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+    virtual void useProgram(GLuint program);
+    virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+    virtual void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    virtual bool debugMessageCallback(GLDEBUGPROCKHR callback, const void* userParam);
+    virtual void endFrame();
+
+private:
+    void writeCall(int call);
+    void writeInts(const GLint* values, int count);
+    void writeBytes(const void* data, size_t size);
+    void writeString(const char* str);
+
+    GlBackend* m_Target;
+    FILE* m_File;
+    GLint m_UnpackAlignment;
+};
+
+// Plays a recording into backend, mapping the recorded object names and
+// uniform locations to the ones backend hands out.  Returns the number of
+// frames played, or -1 if the file is missing or malformed.
+int replayGlRecording(const char* path, GlBackend &backend);
+
+#endif
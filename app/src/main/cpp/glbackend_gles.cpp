@@ -0,0 +1,103 @@
+#include "glbackend.h"
+
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+
+// Straight calls into the GLES2 library.  The OES program binary and
+// KHR_debug entry points are looked up on first use.
+class GlesBackend : public GlBackend
+{
+public:
+    GlesBackend() : m_GetProgramBinary(NULL), m_ProgramBinary(NULL), m_DebugMessageCallback(NULL) {}
+
+    virtual void activeTexture(GLenum texture) { glActiveTexture(texture); }
+    virtual void attachShader(GLuint program, GLuint shader) { glAttachShader(program, shader); }
+    virtual void bindAttribLocation(GLuint program, GLuint index, const GLchar* name) { glBindAttribLocation(program, index, name); }
+    virtual void bindBuffer(GLenum target, GLuint buffer) { glBindBuffer(target, buffer); }
+    virtual void bindTexture(GLenum target, GLuint texture) { glBindTexture(target, texture); }
+    virtual void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) { glBufferData(target, size, data, usage); }
+    virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) { glBufferSubData(target, offset, size, data); }
+    virtual void clear(GLbitfield mask) { glClear(mask); }
+    virtual void clearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) { glClearColor(red, green, blue, alpha); }
+    virtual void compileShader(GLuint shader) { glCompileShader(shader); }
+    virtual void compressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void* data)
+        { glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data); }
+    virtual GLuint createProgram() { return glCreateProgram(); }
+    virtual GLuint createShader(GLenum type) { return glCreateShader(type); }
+    virtual void deleteBuffers(GLsizei n, const GLuint* buffers) { glDeleteBuffers(n, buffers); }
+    virtual void deleteProgram(GLuint program) { glDeleteProgram(program); }
+    virtual void deleteShader(GLuint shader) { glDeleteShader(shader); }
+    virtual void depthFunc(GLenum func) { glDepthFunc(func); }
+    virtual void disable(GLenum cap) { glDisable(cap); }
+    virtual void disableVertexAttribArray(GLuint index) { glDisableVertexAttribArray(index); }
+    virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) { glDrawElements(mode, count, type, indices); }
+    virtual void enable(GLenum cap) { glEnable(cap); }
+    virtual void enableVertexAttribArray(GLuint index) { glEnableVertexAttribArray(index); }
+    virtual void genBuffers(GLsizei n, GLuint* buffers) { glGenBuffers(n, buffers); }
+    virtual void generateMipmap(GLenum target) { glGenerateMipmap(target); }
+    virtual void genTextures(GLsizei n, GLuint* textures) { glGenTextures(n, textures); }
+    virtual GLenum getError() { return glGetError(); }
+    virtual void getIntegerv(GLenum pname, GLint* data) { glGetIntegerv(pname, data); }
+    virtual void getProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog) { glGetProgramInfoLog(program, bufSize, length, infoLog); }
+    virtual void getProgramiv(GLuint program, GLenum pname, GLint* params) { glGetProgramiv(program, pname, params); }
+    virtual void getShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog) { glGetShaderInfoLog(shader, bufSize, length, infoLog); }
+    virtual void getShaderiv(GLuint shader, GLenum pname, GLint* params) { glGetShaderiv(shader, pname, params); }
+    virtual const GLubyte* getString(GLenum name) { return glGetString(name); }
+    virtual GLint getUniformLocation(GLuint program, const GLchar* name) { return glGetUniformLocation(program, name); }
+    virtual void linkProgram(GLuint program) { glLinkProgram(program); }
+    virtual void pixelStorei(GLenum pname, GLint param) { glPixelStorei(pname, param); }
+    virtual void shaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length) { glShaderSource(shader, count, string, length); }
+    virtual void texImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+        { glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels); }
+    virtual void texParameteri(GLenum target, GLenum pname, GLint param) { glTexParameteri(target, pname, param); }
+    virtual void uniform1f(GLint location, GLfloat v0) { glUniform1f(location, v0); }
+    virtual void uniform1iv(GLint location, GLsizei count, const GLint* value) { glUniform1iv(location, count, value); }
+    virtual void uniform3fv(GLint location, GLsizei count, const GLfloat* value) { glUniform3fv(location, count, value); }
+    virtual void uniform4fv(GLint location, GLsizei count, const GLfloat* value) { glUniform4fv(location, count, value); }
+    virtual void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) { glUniformMatrix4fv(location, count, transpose, value); }
+    virtual void useProgram(GLuint program) { glUseProgram(program); }
+    virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer)
+        { glVertexAttribPointer(index, size, type, normalized, stride, pointer); }
+    virtual void viewport(GLint x, GLint y, GLsizei width, GLsizei height) { glViewport(x, y, width, height); }
+
+    virtual void getProgramBinary(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary)
+    {
+        if (!m_GetProgramBinary)
+            m_GetProgramBinary = (PFNGLGETPROGRAMBINARYOESPROC) eglGetProcAddress("glGetProgramBinaryOES");
+        if (m_GetProgramBinary)
+            m_GetProgramBinary(program, bufSize, length, binaryFormat, binary);
+        else if (length)
+            *length = 0;
+    }
+
+    virtual void programBinary(GLuint program, GLenum binaryFormat, const void* binary, GLint length)
+    {
+        if (!m_ProgramBinary)
+            m_ProgramBinary = (PFNGLPROGRAMBINARYOESPROC) eglGetProcAddress("glProgramBinaryOES");
+        if (m_ProgramBinary)
+            m_ProgramBinary(program, binaryFormat, binary, length);
+    }
+
+    virtual bool debugMessageCallback(GLDEBUGPROCKHR callback, const void* userParam)
+    {
+        if (!m_DebugMessageCallback)
+            m_DebugMessageCallback = (PFNGLDEBUGMESSAGECALLBACKKHRPROC) eglGetProcAddress("glDebugMessageCallbackKHR");
+        if (!m_DebugMessageCallback) return false;
+        m_DebugMessageCallback(callback, userParam);
+        return true;
+    }
+
+private:
+    PFNGLGETPROGRAMBINARYOESPROC m_GetProgramBinary;
+    PFNGLPROGRAMBINARYOESPROC m_ProgramBinary;
+    PFNGLDEBUGMESSAGECALLBACKKHRPROC m_DebugMessageCallback;
+};
+
+static GlesBackend gGlesBackend;
+
+GlBackend* gGL = &gGlesBackend;
+
+GlBackend* getGlesBackend()
+{
+    return &gGlesBackend;
+}
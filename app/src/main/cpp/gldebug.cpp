@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "gldebug.h"
+#include "glbackend.h"
+
+#include <GLES2/gl2ext.h>
+
+#include <android/log.h>
+
+#define  LOG_TAG    "libgl2jni"
+#define  LOGI(...)  __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
+#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+
+static int gDebugFrame = 0;
+static int gSampleFrames = (GL_DEBUG_LEVEL >= 2) ? 1 : GL_DEBUG_SAMPLE_FRAMES;
+static bool gHasDebugCallback = false;
+
+// Last checked call site, which is what a synchronous callback follows
+static const char* gLastFile = "";
+static int gLastLine = 0;
+
+void checkGlError(const char* file, int line)
+{
+    if (gHasDebugCallback)
+    {
+        gLastFile = file;
+        gLastLine = line;
+        return;
+    }
+    if (gDebugFrame % gSampleFrames) return;
+
+    for (GLint error = gGL->getError(); error ; error = gGL->getError())
+    {
+        LOGE("Error (0x%x) at %s %d\n", error, file, line);
+    }
+}
+
+static void GL_APIENTRY debugMessage(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+{
+    if (severity == GL_DEBUG_SEVERITY_NOTIFICATION_KHR) return;
+
+    if (type == GL_DEBUG_TYPE_ERROR_KHR)
+        LOGE("GL error 0x%x after %s %d: %s\n", id, gLastFile, gLastLine, message);
+    else
+        LOGI("GL debug 0x%x (type 0x%x) after %s %d: %s\n", id, type, gLastFile, gLastLine, message);
+}
+
+void initGlDebug()
+{
+    gHasDebugCallback = false;
+    if (GL_DEBUG_LEVEL < 2) return;
+
+    const char* extensions = (const char*) gGL->getString(GL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "GL_KHR_debug")) return;
+    if (!gGL->debugMessageCallback(debugMessage, NULL)) return;
+
+    // Synchronous, so messages arrive right after the offending call
+    gGL->enable(GL_DEBUG_OUTPUT_KHR);
+    gGL->enable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+    gHasDebugCallback = true;
+    LOGI("Using KHR_debug for GL errors\n");
+}
+
+void endGlDebugFrame()
+{
+    gDebugFrame++;
+}
+
+void setGlErrorSampling(int frames)
+{
+    gSampleFrames = (frames > 1) ? frames : 1;
+}
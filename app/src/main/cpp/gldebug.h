@@ -0,0 +1,44 @@
+#ifndef GLDEBUG_H
+#define GLDEBUG_H
+
+// GL error instrumentation, selected at build time with GL_DEBUG_LEVEL:
+//
+//   0  CHK compiles to nothing.  Default for release (NDEBUG) builds.
+//   1  CHK drains glGetError only every GL_DEBUG_SAMPLE_FRAMES frames, so
+//      a production build can still report errors without a driver
+//      round-trip after every call.
+//   2  Default for debug builds.  Uses a KHR_debug callback when the
+//      driver has one (CHK then only notes where the last call was made)
+//      and checks glGetError after every call otherwise.
+//
+// Pass -DGL_DEBUG_LEVEL=n to CMake to override the default.
+
+#ifndef GL_DEBUG_LEVEL
+#ifdef NDEBUG
+#define GL_DEBUG_LEVEL 0
+#else
+#define GL_DEBUG_LEVEL 2
+#endif
+#endif
+
+#define GL_DEBUG_SAMPLE_FRAMES 60
+
+#if GL_DEBUG_LEVEL > 0
+#define CHK checkGlError(__FILE__,__LINE__)
+#else
+#define CHK ((void)0)
+#endif
+
+void checkGlError(const char* file, int line);
+
+// Installs the KHR_debug callback if the level and the driver allow it.
+// Must be called on the GL thread after every context creation.
+void initGlDebug();
+
+// Advances the frame counter the sampling mode checks against
+void endGlDebugFrame();
+
+// Changes how many frames apart errors are checked (1 checks every frame)
+void setGlErrorSampling(int frames);
+
+#endif
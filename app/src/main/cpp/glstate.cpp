@@ -0,0 +1,283 @@
+#include <string.h>
+
+#include "glstate.h"
+#include "glbackend.h"
+
+// -1 (or an unknown flag) marks state never set since the context was made
+struct VertexAttribState
+{
+    int enabled;
+    GLuint buffer;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+    size_t offset;
+    bool known;
+};
+
+struct GlState
+{
+    GLuint program;
+    GLuint arrayBuffer;
+    GLuint elementBuffer;
+    GLenum activeUnit;
+    GLuint textures[GLSTATE_MAX_TEXTURE_UNITS];
+    int depthTest;
+    int cullFace;
+    int blend;
+    GLenum depthFunc;
+    GLfloat clearColor[4];
+    GLint viewport[4];
+    GLint unpackAlignment;
+    bool programKnown;
+    bool arrayBufferKnown;
+    bool elementBufferKnown;
+    bool activeUnitKnown;
+    bool texturesKnown[GLSTATE_MAX_TEXTURE_UNITS];
+    bool depthFuncKnown;
+    bool clearColorKnown;
+    bool viewportKnown;
+    bool unpackAlignmentKnown;
+    VertexAttribState attribs[GLSTATE_MAX_ATTRIBS];
+};
+
+static GlState gState;
+static GlStateStats gStats;
+
+void resetGlState()
+{
+    memset(&gState, 0, sizeof(gState));
+    gState.depthTest = -1;
+    gState.cullFace = -1;
+    gState.blend = -1;
+    for (int i = 0 ; i < GLSTATE_MAX_ATTRIBS ; i++)
+        gState.attribs[i].enabled = -1;
+}
+
+GlStateStats& getGlStateStats()
+{
+    return gStats;
+}
+
+// Counts the call and tells whether it has to reach the driver
+static bool changed(bool same)
+{
+    if (same) gStats.skipped++;
+    else gStats.issued++;
+    return !same;
+}
+
+void cachedUseProgram(GLuint program)
+{
+    if (!changed(gState.programKnown && gState.program == program)) return;
+    gGL->useProgram(program);
+    gState.program = program;
+    gState.programKnown = true;
+}
+
+void cachedBindBuffer(GLenum target, GLuint buffer)
+{
+    if (target == GL_ARRAY_BUFFER)
+    {
+        if (!changed(gState.arrayBufferKnown && gState.arrayBuffer == buffer)) return;
+        gState.arrayBuffer = buffer;
+        gState.arrayBufferKnown = true;
+    }
+    else if (target == GL_ELEMENT_ARRAY_BUFFER)
+    {
+        if (!changed(gState.elementBufferKnown && gState.elementBuffer == buffer)) return;
+        gState.elementBuffer = buffer;
+        gState.elementBufferKnown = true;
+    }
+    else
+    {
+        gStats.issued++;
+    }
+    gGL->bindBuffer(target, buffer);
+}
+
+void cachedDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+    gStats.issued++;
+    gGL->deleteBuffers(n, buffers);
+
+    // Deleting a bound buffer unbinds it
+    for (int i = 0 ; i < n ; i++)
+    {
+        if (buffers[i] == 0) continue;
+        if (gState.arrayBuffer == buffers[i]) gState.arrayBuffer = 0;
+        if (gState.elementBuffer == buffers[i]) gState.elementBuffer = 0;
+        for (int a = 0 ; a < GLSTATE_MAX_ATTRIBS ; a++)
+        {
+            if (gState.attribs[a].buffer == buffers[i])
+                gState.attribs[a].known = false;
+        }
+    }
+}
+
+void cachedActiveTexture(GLenum unit)
+{
+    if (!changed(gState.activeUnitKnown && gState.activeUnit == unit)) return;
+    gGL->activeTexture(unit);
+    gState.activeUnit = unit;
+    gState.activeUnitKnown = true;
+}
+
+void cachedBindTexture(GLenum target, GLuint texture)
+{
+    // The active unit is GL_TEXTURE0 on a new context
+    int unit = gState.activeUnitKnown ? (int)(gState.activeUnit - GL_TEXTURE0) : 0;
+    if (target != GL_TEXTURE_2D || unit < 0 || unit >= GLSTATE_MAX_TEXTURE_UNITS)
+    {
+        gStats.issued++;
+        gGL->bindTexture(target, texture);
+        return;
+    }
+
+    if (!changed(gState.texturesKnown[unit] && gState.textures[unit] == texture)) return;
+    gGL->bindTexture(target, texture);
+    gState.textures[unit] = texture;
+    gState.texturesKnown[unit] = true;
+}
+
+static int* capabilityState(GLenum cap)
+{
+    switch (cap)
+    {
+        case GL_DEPTH_TEST: return &gState.depthTest;
+        case GL_CULL_FACE: return &gState.cullFace;
+        case GL_BLEND: return &gState.blend;
+    }
+    return NULL;
+}
+
+void cachedEnable(GLenum cap)
+{
+    int* state = capabilityState(cap);
+    if (state)
+    {
+        if (!changed(*state == 1)) return;
+        *state = 1;
+    }
+    else
+    {
+        gStats.issued++;
+    }
+    gGL->enable(cap);
+}
+
+void cachedDisable(GLenum cap)
+{
+    int* state = capabilityState(cap);
+    if (state)
+    {
+        if (!changed(*state == 0)) return;
+        *state = 0;
+    }
+    else
+    {
+        gStats.issued++;
+    }
+    gGL->disable(cap);
+}
+
+void cachedDepthFunc(GLenum func)
+{
+    if (!changed(gState.depthFuncKnown && gState.depthFunc == func)) return;
+    gGL->depthFunc(func);
+    gState.depthFunc = func;
+    gState.depthFuncKnown = true;
+}
+
+void cachedClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+    GLfloat color[4] = {red, green, blue, alpha};
+    if (!changed(gState.clearColorKnown && memcmp(gState.clearColor, color, sizeof(color)) == 0)) return;
+    gGL->clearColor(red, green, blue, alpha);
+    memcpy(gState.clearColor, color, sizeof(color));
+    gState.clearColorKnown = true;
+}
+
+void cachedViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint viewport[4] = {x, y, width, height};
+    if (!changed(gState.viewportKnown && memcmp(gState.viewport, viewport, sizeof(viewport)) == 0)) return;
+    gGL->viewport(x, y, width, height);
+    memcpy(gState.viewport, viewport, sizeof(viewport));
+    gState.viewportKnown = true;
+}
+
+void cachedPixelStorei(GLenum name, GLint param)
+{
+    if (name != GL_UNPACK_ALIGNMENT)
+    {
+        gStats.issued++;
+        gGL->pixelStorei(name, param);
+        return;
+    }
+
+    if (!changed(gState.unpackAlignmentKnown && gState.unpackAlignment == param)) return;
+    gGL->pixelStorei(name, param);
+    gState.unpackAlignment = param;
+    gState.unpackAlignmentKnown = true;
+}
+
+void cachedEnableVertexAttribArray(GLuint index)
+{
+    if (index >= GLSTATE_MAX_ATTRIBS)
+    {
+        gStats.issued++;
+        gGL->enableVertexAttribArray(index);
+        return;
+    }
+
+    if (!changed(gState.attribs[index].enabled == 1)) return;
+    gGL->enableVertexAttribArray(index);
+    gState.attribs[index].enabled = 1;
+}
+
+void cachedDisableVertexAttribArray(GLuint index)
+{
+    if (index >= GLSTATE_MAX_ATTRIBS)
+    {
+        gStats.issued++;
+        gGL->disableVertexAttribArray(index);
+        return;
+    }
+
+    if (!changed(gState.attribs[index].enabled == 0)) return;
+    gGL->disableVertexAttribArray(index);
+    gState.attribs[index].enabled = 0;
+}
+
+void cachedVertexAttribPointer(GLuint index, GLuint buffer, GLint size, GLenum type, GLboolean normalized, GLsizei stride, size_t offset)
+{
+    if (index >= GLSTATE_MAX_ATTRIBS)
+    {
+        cachedBindBuffer(GL_ARRAY_BUFFER, buffer);
+        gStats.issued++;
+        gGL->vertexAttribPointer(index, size, type, normalized, stride, (const void*)offset);
+        return;
+    }
+
+    VertexAttribState &attrib = gState.attribs[index];
+    if (attrib.known && attrib.buffer == buffer && attrib.size == size && attrib.type == type &&
+        attrib.normalized == normalized && attrib.stride == stride && attrib.offset == offset)
+    {
+        // Neither the bind nor the pointer call is needed
+        gStats.skipped += 2;
+        return;
+    }
+
+    cachedBindBuffer(GL_ARRAY_BUFFER, buffer);
+    gStats.issued++;
+    gGL->vertexAttribPointer(index, size, type, normalized, stride, (const void*)offset);
+    attrib.buffer = buffer;
+    attrib.size = size;
+    attrib.type = type;
+    attrib.normalized = normalized;
+    attrib.stride = stride;
+    attrib.offset = offset;
+    attrib.known = true;
+}
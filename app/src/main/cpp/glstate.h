@@ -0,0 +1,50 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <GLES2/gl2.h>
+
+// Shadow copy of the GL state the renderer changes.  The cached* calls
+// compare against what was last set and only reach the driver when the
+// state actually changes.  Everything that binds or enables must go
+// through them, otherwise the shadow goes stale; calls that do not change
+// bindings (draws, uploads, uniforms) are made directly.  GL thread only.
+
+#define GLSTATE_MAX_ATTRIBS         8
+#define GLSTATE_MAX_TEXTURE_UNITS   32
+
+struct GlStateStats
+{
+    int issued;                         // Calls passed on to the driver
+    int skipped;                        // Calls dropped as no-ops
+};
+
+// Forgets the shadowed state.  Must be called whenever a context is created
+// since nothing is known about it yet.
+void resetGlState();
+
+GlStateStats& getGlStateStats();
+
+void cachedUseProgram(GLuint program);
+void cachedBindBuffer(GLenum target, GLuint buffer);
+
+// Deletes buffers and forgets the bindings that referred to them, since the
+// names may be handed out again
+void cachedDeleteBuffers(GLsizei n, const GLuint* buffers);
+
+void cachedActiveTexture(GLenum unit);
+void cachedBindTexture(GLenum target, GLuint texture);
+void cachedEnable(GLenum cap);
+void cachedDisable(GLenum cap);
+void cachedDepthFunc(GLenum func);
+void cachedClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void cachedViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void cachedPixelStorei(GLenum name, GLint param);
+
+void cachedEnableVertexAttribArray(GLuint index);
+void cachedDisableVertexAttribArray(GLuint index);
+
+// Binds buffer to GL_ARRAY_BUFFER and points the attribute at offset in it.
+// Both are skipped when the attribute already reads from there.
+void cachedVertexAttribPointer(GLuint index, GLuint buffer, GLint size, GLenum type, GLboolean normalized, GLsizei stride, size_t offset);
+
+#endif
@@ -0,0 +1,172 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+
+#include "jobs.h"
+
+#define MAX_JOB_THREADS 8
+
+struct JobBatch
+{
+    const std::function<void(int)>* func;
+    std::atomic<int> next;              // Next index to hand out
+    std::atomic<int> users;             // Workers currently running the batch
+    int count;
+    std::function<void(int)> owned;     // Function of a startJob batch
+};
+
+// The pool is never destroyed: its workers are detached and may still be
+// waiting on the condition variable while static destructors run at exit.
+struct JobPool
+{
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<JobBatch*> queue;
+    int numWorkers;
+};
+
+static JobPool* gJobPool = NULL;
+static std::once_flag gJobStart;
+
+// Runs indices of the batch until none are left
+static void runBatch(JobBatch* batch)
+{
+    for (;;)
+    {
+        int i = batch->next.fetch_add(1);
+        if (i >= batch->count) break;
+        (*batch->func)(i);
+    }
+}
+
+static void workerLoop(JobPool* pool)
+{
+    for (;;)
+    {
+        JobBatch* batch;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->available.wait(lock, [pool] { return !pool->queue.empty(); });
+            batch = pool->queue.front();
+
+            // Once every index was handed out the batch leaves the queue;
+            // its owner still waits for the in-flight ones to complete
+            if (batch->next.load() >= batch->count)
+            {
+                pool->queue.pop_front();
+                continue;
+            }
+            batch->users.fetch_add(1);
+        }
+        runBatch(batch);
+        batch->users.fetch_sub(1);
+    }
+}
+
+static void startWorkers()
+{
+    int cores = (int)std::thread::hardware_concurrency();
+    int workers = cores > 1 ? cores - 1 : 0;
+    if (workers > MAX_JOB_THREADS - 1) workers = MAX_JOB_THREADS - 1;
+
+    gJobPool = new JobPool();
+    gJobPool->numWorkers = workers;
+    for (int i = 0 ; i < workers ; i++)
+    {
+        std::thread(workerLoop, gJobPool).detach();
+    }
+}
+
+int getJobThreadCount()
+{
+    std::call_once(gJobStart, startWorkers);
+    return gJobPool->numWorkers + 1;
+}
+
+// Runs what is left of a queued batch on the calling thread, takes it out
+// of the queue and waits for the workers still running it
+static void finishBatch(JobBatch* batch)
+{
+    runBatch(batch);
+
+    {
+        std::lock_guard<std::mutex> lock(gJobPool->mutex);
+        for (std::deque<JobBatch*>::iterator it = gJobPool->queue.begin() ; it != gJobPool->queue.end() ; ++it)
+        {
+            if (*it == batch)
+            {
+                gJobPool->queue.erase(it);
+                break;
+            }
+        }
+    }
+
+    // The batch is out of the queue, so no new worker can join.  Wait for
+    // the ones still finishing the indices they picked up.
+    while (batch->users.load() > 0)
+        std::this_thread::yield();
+}
+
+void parallelFor(int count, const std::function<void(int)>& func)
+{
+    if (count <= 0) return;
+    if (count == 1 || getJobThreadCount() == 1)
+    {
+        for (int i = 0 ; i < count ; i++) func(i);
+        return;
+    }
+
+    JobBatch batch;
+    batch.func = &func;
+    batch.next = 0;
+    batch.users = 0;
+    batch.count = count;
+
+    {
+        std::lock_guard<std::mutex> lock(gJobPool->mutex);
+        gJobPool->queue.push_back(&batch);
+    }
+    gJobPool->available.notify_all();
+
+    finishBatch(&batch);
+}
+
+JobHandle startJob(const std::function<void()>& func)
+{
+    getJobThreadCount();
+
+    JobBatch* batch = new JobBatch();
+    batch->owned = [func](int) { func(); };
+    batch->func = &batch->owned;
+    batch->next = 0;
+    batch->users = 0;
+    batch->count = 1;
+
+    if (gJobPool->numWorkers > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(gJobPool->mutex);
+            gJobPool->queue.push_back(batch);
+        }
+        gJobPool->available.notify_one();
+    }
+    return batch;
+}
+
+void waitJob(JobHandle job)
+{
+    finishBatch(job);
+    delete job;
+}
+
+bool isJobDone(JobHandle job)
+{
+    if (gJobPool->numWorkers == 0)
+        runBatch(job);
+
+    // Workers count themselves in before taking the index, so once it is
+    // taken and nobody is in the batch the function has returned
+    return job->next.load() >= job->count && job->users.load() == 0;
+}
@@ -0,0 +1,31 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <functional>
+
+// A small pool of worker threads shared by the loaders and the renderer.
+// The pool starts on first use with one worker per extra CPU core.
+
+// Runs func(i) for every i in [0, count) across the pool and returns once
+// all of them finished.  The calling thread executes jobs too, so this may
+// be called from inside a job without deadlocking.
+void parallelFor(int count, const std::function<void(int)>& func);
+
+// Number of threads parallelFor spreads work over, including the caller
+int getJobThreadCount();
+
+struct JobBatch;
+typedef JobBatch* JobHandle;
+
+// Queues func to run on a worker while the caller goes on.  Every job must
+// be passed to waitJob exactly once, which runs it on the calling thread if
+// no worker picked it up yet.
+JobHandle startJob(const std::function<void()>& func);
+void waitJob(JobHandle job);
+
+// Returns true once the job has run, so the caller can pick up its results
+// with waitJob without blocking.  Without workers nothing else would run
+// it, so it runs here on the first call.
+bool isJobDone(JobHandle job);
+
+#endif
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "map.h"
+
+bool parseMap(std::vector<MapItem> &items, const char* text, int size)
+{
+    int start = 0;
+    while (start < size)
+    {
+        int end = start;
+        while (end < size && text[end] != '\n') end++;
+        std::string line(text + start, end - start);
+        start = end + 1;
+
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+
+        MapItem item;
+        if (sscanf(line.c_str(), "%d %f %f %f", &item.model_id, &item.position[0], &item.position[1], &item.position[2]) != 4)
+            return false;
+        items.push_back(item);
+    }
+    return true;
+}
+
+void mapItemMatrix(float* matrix, const float* position)
+{
+    memset(matrix, 0, sizeof(float)*16);
+    matrix[0] = ITEM_SCALE;
+    matrix[5] = ITEM_SCALE;
+    matrix[10] = ITEM_SCALE;
+    matrix[12] = position[0];
+    matrix[13] = position[1];
+    matrix[14] = position[2];
+    matrix[15] = 1.0f;
+}
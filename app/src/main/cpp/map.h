@@ -0,0 +1,36 @@
+#ifndef MAP_H
+#define MAP_H
+
+// Map layout shared by the game and the offline tools.
+//
+// A map file is plain text, one placed item per line:
+//
+//   # comment
+//   <model id> <x> <y> <z>
+//
+// Model ids follow the order the models are loaded in (0 is the preloaded
+// tire, then GL2JNIView.MODELS_NAMES).  Items are drawn at ITEM_SCALE and
+// are numbered in file order.
+
+#include <vector>
+
+#define ITEM_SCALE          0.1f
+
+// The grid of map sections GetMapSection maps (x, z) positions to
+#define MAP_SECTIONS        10
+#define MAP_ORIGIN          10.0f
+#define MAP_SECTION_SIZE    2.0f
+
+struct MapItem
+{
+    int model_id;
+    float position[3];
+};
+
+// Appends the items of a map file.  Returns false on a malformed line.
+bool parseMap(std::vector<MapItem> &items, const char* text, int size);
+
+// Model matrix of an item, column-major
+void mapItemMatrix(float* matrix, const float* position);
+
+#endif
@@ -0,0 +1,470 @@
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "meshopt.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// Vertex welding
+
+static inline long long quantize(float value, float inverseEpsilon)
+{
+    return (long long)floor((double)value * inverseEpsilon + 0.5);
+}
+
+static unsigned int hashVertex(const float* vertex, int stride, float inverseEpsilon)
+{
+    // FNV-1a over the quantized components
+    unsigned int hash = 2166136261u;
+    for (int k = 0 ; k < stride ; k++)
+    {
+        unsigned long long q = (unsigned long long)quantize(vertex[k], inverseEpsilon);
+        for (int b = 0 ; b < 8 ; b++)
+        {
+            hash ^= (q >> (b*8)) & 0xFF;
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+}
+
+static bool sameVertex(const float* a, const float* b, int stride, float inverseEpsilon)
+{
+    for (int k = 0 ; k < stride ; k++)
+    {
+        if (quantize(a[k], inverseEpsilon) != quantize(b[k], inverseEpsilon)) return false;
+    }
+    return true;
+}
+
+int weldVertices(unsigned int* remap, float* vertices, int numVertices, int stride, float epsilon)
+{
+    float inverseEpsilon = 1.0f / epsilon;
+
+    // Open addressing table of unique vertex indices, at most half full
+    unsigned int tableSize = 1;
+    while (tableSize < (unsigned int)numVertices*2) tableSize *= 2;
+    std::vector<int> table(tableSize, -1);
+
+    int unique = 0;
+    for (int v = 0 ; v < numVertices ; v++)
+    {
+        const float* vertex = &vertices[v*stride];
+        unsigned int slot = hashVertex(vertex, stride, inverseEpsilon) & (tableSize - 1);
+
+        for (;;)
+        {
+            int entry = table[slot];
+            if (entry < 0)
+            {
+                // First occurrence, compact it down to the next unique slot
+                if (unique != v)
+                    memmove(&vertices[unique*stride], vertex, stride*sizeof(float));
+                table[slot] = unique;
+                remap[v] = unique++;
+                break;
+            }
+            if (sameVertex(&vertices[entry*stride], vertex, stride, inverseEpsilon))
+            {
+                remap[v] = entry;
+                break;
+            }
+            slot = (slot + 1) & (tableSize - 1);
+        }
+    }
+
+    return unique;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Vertex cache
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, int numIndices, int numVertices, int cacheSize)
+{
+    VertexCacheStats stats = {0, 0, 0};
+
+    // Timestamp of the moment each vertex entered the FIFO; it is still
+    // cached while fewer than cacheSize misses happened since then.
+    std::vector<int> entered(numVertices, -cacheSize-1);
+    std::vector<bool> used(numVertices, false);
+    int referenced = 0;
+
+    for (int i = 0 ; i < numIndices ; i++)
+    {
+        unsigned int v = indices[i];
+        if (!used[v])
+        {
+            used[v] = true;
+            referenced++;
+        }
+        if (stats.misses - entered[v] > cacheSize)
+        {
+            entered[v] = stats.misses;
+            stats.misses++;
+        }
+    }
+
+    if (numIndices) stats.acmr = (float)stats.misses / (numIndices/3);
+    if (referenced) stats.atvr = (float)stats.misses / referenced;
+
+    return stats;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Forsyth vertex cache optimization
+
+#define FORSYTH_CACHE_SIZE      32
+#define FORSYTH_MAX_VALENCE     64
+
+static float gCacheScoreTable[FORSYTH_CACHE_SIZE];
+static float gValenceScoreTable[FORSYTH_MAX_VALENCE];
+static bool gScoreTablesReady = false;
+
+static void buildScoreTables()
+{
+    const float cache_decay_power = 1.5f;
+    const float last_triangle_score = 0.75f;
+    const float valence_boost_scale = 2.0f;
+    const float valence_boost_power = 0.5f;
+
+    for (int i = 0 ; i < FORSYTH_CACHE_SIZE ; i++)
+    {
+        if (i < 3)
+        {
+            // The vertices of the triangle just drawn get a fixed score so
+            // that the next triangle does not simply reuse the same edge
+            gCacheScoreTable[i] = last_triangle_score;
+        }
+        else
+        {
+            float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            gCacheScoreTable[i] = powf(1.0f - (i - 3) * scaler, cache_decay_power);
+        }
+    }
+
+    gValenceScoreTable[0] = 0;
+    for (int i = 1 ; i < FORSYTH_MAX_VALENCE ; i++)
+    {
+        gValenceScoreTable[i] = valence_boost_scale * powf((float)i, -valence_boost_power);
+    }
+
+    gScoreTablesReady = true;
+}
+
+static inline float vertexScore(int cachePosition, int remainingTriangles)
+{
+    if (remainingTriangles == 0) return -1.0f;
+
+    float score = (cachePosition >= 0) ? gCacheScoreTable[cachePosition] : 0.0f;
+    return score + gValenceScoreTable[std::min(remainingTriangles, FORSYTH_MAX_VALENCE-1)];
+}
+
+void optimizeVertexCache(unsigned int* dst, const unsigned int* indices, int numIndices, int numVertices)
+{
+    if (!gScoreTablesReady) buildScoreTables();
+
+    int numTriangles = numIndices / 3;
+    if (numTriangles == 0) return;
+
+    // Vertex -> triangle adjacency in compact form
+    std::vector<int> triangleCount(numVertices, 0);
+    for (int i = 0 ; i < numTriangles*3 ; i++) triangleCount[indices[i]]++;
+
+    std::vector<int> adjacencyOffset(numVertices + 1, 0);
+    for (int v = 0 ; v < numVertices ; v++) adjacencyOffset[v+1] = adjacencyOffset[v] + triangleCount[v];
+
+    std::vector<int> adjacency(numTriangles*3);
+    std::vector<int> remaining(numVertices, 0);
+    for (int t = 0 ; t < numTriangles ; t++)
+    {
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            unsigned int v = indices[t*3+k];
+            adjacency[adjacencyOffset[v] + remaining[v]++] = t;
+        }
+    }
+
+    std::vector<int> cachePosition(numVertices, -1);
+    std::vector<float> vScore(numVertices);
+    for (int v = 0 ; v < numVertices ; v++) vScore[v] = vertexScore(-1, remaining[v]);
+
+    std::vector<float> tScore(numTriangles);
+    std::vector<bool> emitted(numTriangles, false);
+    for (int t = 0 ; t < numTriangles ; t++)
+    {
+        tScore[t] = vScore[indices[t*3]] + vScore[indices[t*3+1]] + vScore[indices[t*3+2]];
+    }
+
+    int cache[FORSYTH_CACHE_SIZE + 3];
+    int cacheCount = 0;
+    int newCache[FORSYTH_CACHE_SIZE + 3];
+
+    int bestTriangle = 0;
+    for (int t = 1 ; t < numTriangles ; t++)
+    {
+        if (tScore[t] > tScore[bestTriangle]) bestTriangle = t;
+    }
+
+    int scanCursor = 0;
+    int output = 0;
+
+    while (bestTriangle >= 0)
+    {
+        emitted[bestTriangle] = true;
+
+        // Emit the triangle and push its vertices to the front of the cache
+        int newCount = 0;
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            unsigned int v = indices[bestTriangle*3+k];
+            dst[output++] = v;
+            newCache[newCount++] = v;
+
+            // Drop the triangle from the vertex's list of unemitted triangles
+            int* begin = &adjacency[adjacencyOffset[v]];
+            int* end = begin + remaining[v];
+            int* found = std::find(begin, end, bestTriangle);
+            *found = *(end - 1);
+            remaining[v]--;
+        }
+
+        for (int i = 0 ; i < cacheCount ; i++)
+        {
+            int v = cache[i];
+            if (v != (int)indices[bestTriangle*3] && v != (int)indices[bestTriangle*3+1] && v != (int)indices[bestTriangle*3+2])
+                newCache[newCount++] = v;
+        }
+
+        // Vertices pushed beyond the cache size fall out and are re-scored
+        for (int i = FORSYTH_CACHE_SIZE ; i < newCount ; i++)
+        {
+            cachePosition[newCache[i]] = -1;
+            vScore[newCache[i]] = vertexScore(-1, remaining[newCache[i]]);
+        }
+        cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+        memcpy(cache, newCache, cacheCount*sizeof(int));
+
+        // Update the scores of the cached vertices and of their triangles,
+        // and pick the next triangle among those
+        for (int i = 0 ; i < cacheCount ; i++)
+        {
+            int v = cache[i];
+            cachePosition[v] = i;
+            vScore[v] = vertexScore(i, remaining[v]);
+        }
+
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (int i = 0 ; i < cacheCount ; i++)
+        {
+            int v = cache[i];
+            for (int a = 0 ; a < remaining[v] ; a++)
+            {
+                int t = adjacency[adjacencyOffset[v] + a];
+                float score = vScore[indices[t*3]] + vScore[indices[t*3+1]] + vScore[indices[t*3+2]];
+                tScore[t] = score;
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        // Nothing left around the cache, continue with the next unemitted triangle
+        if (bestTriangle < 0)
+        {
+            while (scanCursor < numTriangles && emitted[scanCursor]) scanCursor++;
+            if (scanCursor < numTriangles) bestTriangle = scanCursor;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Overdraw
+
+struct OverdrawCluster
+{
+    int firstTriangle;
+    int numTriangles;
+    float sortKey;
+};
+
+static bool clusterGreater(const OverdrawCluster &a, const OverdrawCluster &b)
+{
+    return a.sortKey > b.sortKey;
+}
+
+void optimizeOverdraw(unsigned int* dst, const unsigned int* indices, int numIndices, const float* positions, int numVertices)
+{
+    int numTriangles = numIndices / 3;
+    if (numTriangles == 0) return;
+
+    // Hard cluster boundaries: triangles whose three vertices all miss the
+    // cache.  Reordering at those points costs nothing in cache efficiency.
+    std::vector<OverdrawCluster> clusters;
+    std::vector<int> entered(numVertices, -VERTEX_CACHE_SIZE-1);
+    int misses = 0;
+    for (int t = 0 ; t < numTriangles ; t++)
+    {
+        int triangleMisses = 0;
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            unsigned int v = indices[t*3+k];
+            if (misses - entered[v] > VERTEX_CACHE_SIZE)
+            {
+                entered[v] = misses;
+                misses++;
+                triangleMisses++;
+            }
+        }
+
+        if (t == 0 || triangleMisses == 3)
+        {
+            OverdrawCluster cluster = {t, 0, 0};
+            clusters.push_back(cluster);
+        }
+        clusters.back().numTriangles++;
+    }
+
+    float meshCenter[3] = {0, 0, 0};
+    for (int v = 0 ; v < numVertices ; v++)
+    {
+        meshCenter[0] += positions[v*3];
+        meshCenter[1] += positions[v*3+1];
+        meshCenter[2] += positions[v*3+2];
+    }
+    for (int k = 0 ; k < 3 ; k++) meshCenter[k] /= (numVertices ? numVertices : 1);
+
+    // Sort key is how far the cluster sits out along its own average normal,
+    // the view-independent ordering from Sander et al. 2007
+    for (size_t c = 0 ; c < clusters.size() ; c++)
+    {
+        float center[3] = {0, 0, 0};
+        float normal[3] = {0, 0, 0};
+        float area = 0;
+
+        for (int t = clusters[c].firstTriangle ; t < clusters[c].firstTriangle + clusters[c].numTriangles ; t++)
+        {
+            const float* p0 = &positions[indices[t*3]*3];
+            const float* p1 = &positions[indices[t*3+1]*3];
+            const float* p2 = &positions[indices[t*3+2]*3];
+
+            float e1[3] = {p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2]};
+            float e2[3] = {p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2]};
+            float n[3] = {e1[1]*e2[2]-e1[2]*e2[1], e1[2]*e2[0]-e1[0]*e2[2], e1[0]*e2[1]-e1[1]*e2[0]};
+            float a = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+
+            for (int k = 0 ; k < 3 ; k++)
+            {
+                center[k] += (p0[k] + p1[k] + p2[k]) * (a / 3.0f);
+                normal[k] += n[k];
+            }
+            area += a;
+        }
+
+        float normalLength = sqrtf(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+        if (area > 0) for (int k = 0 ; k < 3 ; k++) center[k] /= area;
+        if (normalLength > 0) for (int k = 0 ; k < 3 ; k++) normal[k] /= normalLength;
+
+        clusters[c].sortKey = (center[0]-meshCenter[0])*normal[0] +
+                              (center[1]-meshCenter[1])*normal[1] +
+                              (center[2]-meshCenter[2])*normal[2];
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), clusterGreater);
+
+    int output = 0;
+    for (size_t c = 0 ; c < clusters.size() ; c++)
+    {
+        memcpy(&dst[output], &indices[clusters[c].firstTriangle*3], clusters[c].numTriangles*3*sizeof(unsigned int));
+        output += clusters[c].numTriangles*3;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Vertex fetch
+
+int optimizeVertexFetchRemap(unsigned int* remap, const unsigned int* indices, int numIndices, int numVertices)
+{
+    memset(remap, 0xFF, numVertices*sizeof(unsigned int));
+
+    int next = 0;
+    for (int i = 0 ; i < numIndices ; i++)
+    {
+        if (remap[indices[i]] == ~0u) remap[indices[i]] = next++;
+    }
+
+    return next;
+}
+
+void remapIndices(unsigned int* indices, int numIndices, const unsigned int* remap)
+{
+    for (int i = 0 ; i < numIndices ; i++)
+    {
+        indices[i] = remap[indices[i]];
+    }
+}
+
+void remapVertexAttribute(float* data, int components, int numVertices, const unsigned int* remap)
+{
+    std::vector<float> source(data, data + numVertices*components);
+    for (int v = 0 ; v < numVertices ; v++)
+    {
+        if (remap[v] == ~0u) continue;
+        memcpy(&data[remap[v]*components], &source[v*components], components*sizeof(float));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Index ranges
+
+void splitIndexRanges(std::vector<IndexRange> &ranges, std::vector<unsigned int> &rangeVertices,
+                      unsigned int* indices, int numIndices, int numVertices, int maxVertices)
+{
+    ranges.clear();
+    rangeVertices.clear();
+
+    // Local index of every source vertex within the current range, valid
+    // when stamped with the current range number
+    std::vector<unsigned int> local(numVertices);
+    std::vector<int> stamp(numVertices, -1);
+
+    IndexRange range = {0, 0, 0, 0};
+    for (int t = 0 ; t < numIndices/3 ; t++)
+    {
+        int current = (int)ranges.size();
+        int missing = 0;
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            if (stamp[indices[t*3+k]] != current) missing++;
+        }
+
+        if (range.numVertices + missing > maxVertices)
+        {
+            ranges.push_back(range);
+            range.indexOffset += range.numIndices;
+            range.vertexOffset += range.numVertices;
+            range.numIndices = 0;
+            range.numVertices = 0;
+            current++;
+        }
+
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            unsigned int v = indices[t*3+k];
+            if (stamp[v] != current)
+            {
+                stamp[v] = current;
+                local[v] = range.numVertices++;
+                rangeVertices.push_back(v);
+            }
+            indices[t*3+k] = local[v];
+        }
+        range.numIndices += 3;
+    }
+
+    if (range.numIndices) ranges.push_back(range);
+}
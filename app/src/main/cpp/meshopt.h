@@ -0,0 +1,68 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+// Post-import mesh optimizations.  All functions work on plain triangle
+// lists with 32-bit indices relative to the first vertex of the mesh, so
+// they can run on any model before its buffers are created.
+
+#include <vector>
+
+#define VERTEX_CACHE_SIZE 16            // FIFO size used to report ACMR/ATVR
+
+struct VertexCacheStats
+{
+    int misses;                         // Vertex shader invocations
+    float acmr;                         // Average cache misses per triangle (0.5 best, 3 worst)
+    float atvr;                         // Average transformed vertices per vertex (1.0 best)
+};
+
+// Collapses vertices whose attribute tuples (stride floats each) are equal
+// once every component is quantized to a multiple of epsilon.  Fills remap
+// with the new index of every vertex and moves the unique vertices to the
+// front of the array, keeping their first-occurrence order.  Returns the
+// number of unique vertices.
+int weldVertices(unsigned int* remap, float* vertices, int numVertices, int stride, float epsilon);
+
+// Simulates a FIFO post-transform cache of the given size over the index list
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, int numIndices, int numVertices, int cacheSize);
+
+// Reorders triangles for the post-transform cache (Tom Forsyth's linear-speed
+// vertex cache optimization).  dst and indices must not overlap.
+void optimizeVertexCache(unsigned int* dst, const unsigned int* indices, int numIndices, int numVertices);
+
+// Splits a cache-optimized triangle list into clusters where the cache runs
+// cold and orders the clusters so that outward facing clusters near the
+// silhouette are drawn first, which lets early-z reject more of the rest.
+// positions holds 3 floats per vertex.  dst and indices must not overlap.
+void optimizeOverdraw(unsigned int* dst, const unsigned int* indices, int numIndices, const float* positions, int numVertices);
+
+// Builds a remap table that renumbers vertices in the order the index list
+// first uses them.  Unreferenced vertices map to ~0u.  Returns the number of
+// referenced vertices.
+int optimizeVertexFetchRemap(unsigned int* remap, const unsigned int* indices, int numIndices, int numVertices);
+
+// Rewrites an index list in place through a remap table
+void remapIndices(unsigned int* indices, int numIndices, const unsigned int* remap);
+
+// Moves per-vertex attributes of the given width (in floats) through a remap
+// table in place.  Vertices mapped to ~0u are dropped.
+void remapVertexAttribute(float* data, int components, int numVertices, const unsigned int* remap);
+
+// A run of triangles drawn from its own contiguous block of vertices
+struct IndexRange
+{
+    int indexOffset;
+    int numIndices;
+    int vertexOffset;                   // First vertex of the block
+    int numVertices;
+};
+
+// Splits an index list into consecutive ranges that each reference at most
+// maxVertices distinct vertices.  rangeVertices receives, block after block,
+// the source vertex of every vertex in each range's block, and indices are
+// rewritten in place relative to their range's block.  Shared vertices on
+// range borders end up duplicated.
+void splitIndexRanges(std::vector<IndexRange> &ranges, std::vector<unsigned int> &rangeVertices,
+                      unsigned int* indices, int numIndices, int numVertices, int maxVertices);
+
+#endif
@@ -0,0 +1,217 @@
+#include <math.h>
+#include <string.h>
+
+#include "occlusion.h"
+#include "simd.h"
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+{
+    m_Width = (width + 3) & ~3;
+    m_Height = height;
+    m_Depth.resize(m_Width*m_Height);
+    clear();
+}
+
+void OcclusionBuffer::clear()
+{
+    for (size_t i = 0 ; i < m_Depth.size() ; i++)
+        m_Depth[i] = 1.0f;
+    memset(&stats, 0, sizeof(stats));
+}
+
+static inline void transformPoint(float* out, const float* m, float x, float y, float z)
+{
+    for (int k = 0 ; k < 4 ; k++)
+        out[k] = m[k]*x + m[4+k]*y + m[8+k]*z + m[12+k];
+}
+
+// Distance in front of the near plane (z >= -w) in clip space
+static inline float nearDistance(const float* v)
+{
+    return v[2] + v[3];
+}
+
+void OcclusionBuffer::drawMesh(const float* mvp, const float* positions, int numVertices, const unsigned int* indices, int numIndices)
+{
+    m_Clip.resize(numVertices*4);
+    for (int v = 0 ; v < numVertices ; v++)
+        transformPoint(&m_Clip[v*4], mvp, positions[v*3], positions[v*3+1], positions[v*3+2]);
+
+    for (int i = 0 ; i + 2 < numIndices ; i += 3)
+    {
+        const float* v[3] = {&m_Clip[indices[i]*4], &m_Clip[indices[i+1]*4], &m_Clip[indices[i+2]*4]};
+
+        // Trivially reject triangles fully outside one of the side planes
+        bool outside = false;
+        for (int axis = 0 ; axis < 2 && !outside ; axis++)
+        {
+            outside = (v[0][axis] > v[0][3] && v[1][axis] > v[1][3] && v[2][axis] > v[2][3]) ||
+                      (v[0][axis] < -v[0][3] && v[1][axis] < -v[1][3] && v[2][axis] < -v[2][3]);
+        }
+        if (outside) continue;
+
+        float d[3] = {nearDistance(v[0]), nearDistance(v[1]), nearDistance(v[2])};
+        if (d[0] < 0 && d[1] < 0 && d[2] < 0) continue;
+        if (d[0] >= 0 && d[1] >= 0 && d[2] >= 0)
+        {
+            drawTriangle(v[0], v[1], v[2]);
+            continue;
+        }
+
+        // Clip against the near plane, which leaves a triangle or a quad
+        float polygon[4][4];
+        int count = 0;
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            int next = (k+1) % 3;
+            if (d[k] >= 0)
+                memcpy(polygon[count++], v[k], sizeof(float)*4);
+            if ((d[k] >= 0) != (d[next] >= 0))
+            {
+                float t = d[k] / (d[k] - d[next]);
+                for (int c = 0 ; c < 4 ; c++)
+                    polygon[count][c] = v[k][c] + (v[next][c] - v[k][c])*t;
+                count++;
+            }
+        }
+        for (int k = 1 ; k + 1 < count ; k++)
+            drawTriangle(polygon[0], polygon[k], polygon[k+1]);
+    }
+}
+
+void OcclusionBuffer::drawTriangle(const float* c0, const float* c1, const float* c2)
+{
+    // Screen space, pixel centers at half integers
+    float x[3], y[3], z[3];
+    const float* c[3] = {c0, c1, c2};
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        float inverse_w = 1.0f / c[k][3];
+        x[k] = (c[k][0]*inverse_w*0.5f + 0.5f) * m_Width;
+        y[k] = (c[k][1]*inverse_w*0.5f + 0.5f) * m_Height;
+        z[k] = c[k][2]*inverse_w;
+    }
+
+    float area = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]);
+    if (fabsf(area) < 1e-6f) return;
+    if (area < 0)
+    {
+        float t;
+        t = x[1]; x[1] = x[2]; x[2] = t;
+        t = y[1]; y[1] = y[2]; y[2] = t;
+        t = z[1]; z[1] = z[2]; z[2] = t;
+        area = -area;
+    }
+
+    int min_x = (int)floorf(fminf(x[0], fminf(x[1], x[2])));
+    int max_x = (int)ceilf(fmaxf(x[0], fmaxf(x[1], x[2])));
+    int min_y = (int)floorf(fminf(y[0], fminf(y[1], y[2])));
+    int max_y = (int)ceilf(fmaxf(y[0], fmaxf(y[1], y[2])));
+    if (min_x < 0) min_x = 0;
+    if (min_y < 0) min_y = 0;
+    if (max_x > m_Width) max_x = m_Width;
+    if (max_y > m_Height) max_y = m_Height;
+    if (min_x >= max_x || min_y >= max_y) return;
+    min_x &= ~3;
+
+    stats.occluderTriangles++;
+
+    // Edge functions e = a*px + b*py + c, positive inside, and the depth plane
+    float a[3], b[3], cst[3];
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        int i = (k+1) % 3, j = (k+2) % 3;
+        a[k] = y[i] - y[j];
+        b[k] = x[j] - x[i];
+        cst[k] = x[i]*y[j] - x[j]*y[i];
+    }
+    float inverse_area = 1.0f / area;
+    float dzdx = (a[0]*z[0] + a[1]*z[1] + a[2]*z[2]) * inverse_area;
+    float dzdy = (b[0]*z[0] + b[1]*z[1] + b[2]*z[2]) * inverse_area;
+    float z_origin = (cst[0]*z[0] + cst[1]*z[1] + cst[2]*z[2]) * inverse_area;
+
+    Float4 lane = float4Set(0.5f, 1.5f, 2.5f, 3.5f);
+    Float4 zero = float4Set1(0.0f);
+    Float4 step_e0 = float4Set1(a[0]*4), step_e1 = float4Set1(a[1]*4), step_e2 = float4Set1(a[2]*4);
+    Float4 step_z = float4Set1(dzdx*4);
+
+    for (int py = min_y ; py < max_y ; py++)
+    {
+        float cy = py + 0.5f;
+        Float4 px = float4Add(float4Set1((float)min_x), lane);
+        Float4 e0 = float4Madd(px, float4Set1(a[0]), float4Set1(b[0]*cy + cst[0]));
+        Float4 e1 = float4Madd(px, float4Set1(a[1]), float4Set1(b[1]*cy + cst[1]));
+        Float4 e2 = float4Madd(px, float4Set1(a[2]), float4Set1(b[2]*cy + cst[2]));
+        Float4 depth = float4Madd(px, float4Set1(dzdx), float4Set1(dzdy*cy + z_origin));
+
+        float* row = &m_Depth[py*m_Width];
+        for (int bx = min_x ; bx < max_x ; bx += 4)
+        {
+            // Strictly inside only, so occluders never grow past their edges
+            Mask4 inside = mask4And(float4Less(zero, e0), mask4And(float4Less(zero, e1), float4Less(zero, e2)));
+            if (mask4Bits(inside))
+            {
+                Float4 old = float4Load(&row[bx]);
+                float4Store(&row[bx], float4Select(inside, float4Min(old, depth), old));
+            }
+            e0 = float4Add(e0, step_e0);
+            e1 = float4Add(e1, step_e1);
+            e2 = float4Add(e2, step_e2);
+            depth = float4Add(depth, step_z);
+        }
+    }
+}
+
+bool OcclusionBuffer::testBox(const float* mvp, const float* box)
+{
+    stats.testedBoxes++;
+
+    float min_x = 1e30f, max_x = -1e30f, min_y = 1e30f, max_y = -1e30f, min_z = 1e30f;
+    for (int corner = 0 ; corner < 8 ; corner++)
+    {
+        float clip[4];
+        transformPoint(clip, mvp, box[(corner & 1) ? 3 : 0], box[(corner & 2) ? 4 : 1], box[(corner & 4) ? 5 : 2]);
+        if (nearDistance(clip) <= 0) return true;
+
+        float inverse_w = 1.0f / clip[3];
+        float sx = (clip[0]*inverse_w*0.5f + 0.5f) * m_Width;
+        float sy = (clip[1]*inverse_w*0.5f + 0.5f) * m_Height;
+        float sz = clip[2]*inverse_w;
+        min_x = fminf(min_x, sx); max_x = fmaxf(max_x, sx);
+        min_y = fminf(min_y, sy); max_y = fmaxf(max_y, sy);
+        min_z = fminf(min_z, sz);
+    }
+
+    // Every pixel the box may touch, clamped to the screen
+    int x0 = (int)floorf(min_x), x1 = (int)ceilf(max_x);
+    int y0 = (int)floorf(min_y), y1 = (int)ceilf(max_y);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > m_Width) x1 = m_Width;
+    if (y1 > m_Height) y1 = m_Height;
+    if (x0 >= x1 || y0 >= y1) return true;
+
+    // The box is visible as soon as one pixel it covers is not nearer than
+    // its nearest point
+    Float4 box_depth = float4Set1(min_z);
+    Float4 lane = float4Set(0, 1, 2, 3);
+    Float4 first = float4Set1((float)x0 - 0.5f);
+    Float4 last = float4Set1((float)x1 - 0.5f);
+    int start = x0 & ~3;
+    for (int py = y0 ; py < y1 ; py++)
+    {
+        const float* row = &m_Depth[py*m_Width];
+        for (int bx = start ; bx < x1 ; bx += 4)
+        {
+            Float4 px = float4Add(float4Set1((float)bx), lane);
+            Mask4 in_range = mask4And(float4Less(first, px), float4Less(px, last));
+            Mask4 hidden = float4Less(float4Load(&row[bx]), box_depth);
+            int range_bits = mask4Bits(in_range);
+            if ((mask4Bits(hidden) & range_bits) != range_bits)
+                return true;
+        }
+    }
+
+    stats.occludedBoxes++;
+    return false;
+}
@@ -0,0 +1,58 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+// Software occlusion culling.  Occluder meshes are rasterized on the CPU
+// into a small depth buffer, four pixels per SIMD step, and bounding boxes
+// are then tested against it before anything is submitted to GL.  The code
+// has no GL or Android dependencies so it runs headless on Linux (see
+// tools/occlusion_bench.cpp).
+//
+// Depth is the NDC z of a column-major Projection * View * Model matrix as
+// produced by glm, -1 at the near plane and 1 at the far plane.
+
+#include <vector>
+
+#define OCCLUSION_WIDTH  256
+#define OCCLUSION_HEIGHT 128
+
+struct OcclusionStats
+{
+    int occluderTriangles;              // Triangles that reached the rasterizer
+    int testedBoxes;
+    int occludedBoxes;
+};
+
+class OcclusionBuffer
+{
+public:
+    // width is rounded up to a multiple of 4
+    OcclusionBuffer(int width, int height);
+
+    void clear();
+
+    // Rasterizes the triangles of an indexed mesh with 3 floats per vertex.
+    // Both faces are drawn, so winding does not matter.  Occluders must not
+    // be bigger than what they stand for or they hide visible objects.
+    void drawMesh(const float* mvp, const float* positions, int numVertices, const unsigned int* indices, int numIndices);
+
+    // Returns false when the box (min x, y, z then max x, y, z, transformed
+    // by mvp) is hidden behind what was drawn.  Boxes crossing the near
+    // plane are always visible.
+    bool testBox(const float* mvp, const float* box);
+
+    int getWidth() const { return m_Width; }
+    int getHeight() const { return m_Height; }
+    const float* getDepth() const { return &m_Depth[0]; }
+
+    OcclusionStats stats;
+
+private:
+    void drawTriangle(const float* v0, const float* v1, const float* v2);
+
+    int m_Width;
+    int m_Height;
+    std::vector<float> m_Depth;
+    std::vector<float> m_Clip;          // Clip space positions of the current mesh
+};
+
+#endif
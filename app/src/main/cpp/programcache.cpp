@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "programcache.h"
+#include "glbackend.h"
+
+#include <GLES2/gl2ext.h>
+
+#include <android/log.h>
+
+#define  LOG_TAG    "libgl2jni"
+#define  LOGI(...)  __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
+#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+
+#define PROGRAM_CACHE_MAGIC     0x4E494250      // "PBIN"
+#define PROGRAM_CACHE_VERSION   1
+
+// Layout of the header written in front of every cached binary
+struct ProgramCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binaryLength;
+};
+
+static char gCacheDir[256] = {0};
+static uint64_t gDriverHash = 0;
+
+static bool gHasProgramBinary = false;
+
+// 64-bit FNV-1a, chained through the seed so several strings can be hashed
+static uint64_t hashString(uint64_t hash, const char* str)
+{
+    if (!str) return hash;
+    for (const unsigned char* p = (const unsigned char*)str ; *p ; p++)
+    {
+        hash ^= *p;
+        hash *= 0x100000001B3ULL;
+    }
+    // Separator so that ("ab","c") and ("a","bc") hash differently
+    hash ^= 0xFF;
+    hash *= 0x100000001B3ULL;
+    return hash;
+}
+
+static uint64_t programKey(const char* pVertexSource, const char* pFragmentSource)
+{
+    uint64_t key = gDriverHash;
+    key = hashString(key, pVertexSource);
+    key = hashString(key, pFragmentSource);
+    return key;
+}
+
+static void cacheFileName(char* path, size_t size, uint64_t key)
+{
+    snprintf(path, size, "%s/program_%016llx.bin", gCacheDir, (unsigned long long)key);
+}
+
+void setProgramCacheDir(const char* directory)
+{
+    strncpy(gCacheDir, directory, sizeof(gCacheDir)-1);
+    gCacheDir[sizeof(gCacheDir)-1] = 0;
+}
+
+void initProgramCache()
+{
+    const char* extensions = (const char*) gGL->getString(GL_EXTENSIONS);
+    gHasProgramBinary = extensions && strstr(extensions, "GL_OES_get_program_binary");
+
+    // A driver update must invalidate every stored binary
+    gDriverHash = 0xCBF29CE484222325ULL;
+    gDriverHash = hashString(gDriverHash, (const char*) gGL->getString(GL_VENDOR));
+    gDriverHash = hashString(gDriverHash, (const char*) gGL->getString(GL_RENDERER));
+    gDriverHash = hashString(gDriverHash, (const char*) gGL->getString(GL_VERSION));
+
+    GLint num_formats = 0;
+    if (gHasProgramBinary)
+        gGL->getIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+    if (num_formats <= 0)
+        gHasProgramBinary = false;
+
+    LOGI("Program binary cache %s\n", (gHasProgramBinary && gCacheDir[0]) ? "enabled" : "disabled");
+}
+
+GLuint loadCachedProgram(const char* pVertexSource, const char* pFragmentSource)
+{
+    if (!gHasProgramBinary || !gCacheDir[0]) return 0;
+
+    uint64_t key = programKey(pVertexSource, pFragmentSource);
+    char path[300];
+    cacheFileName(path, sizeof(path), key);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+
+    ProgramCacheHeader header;
+    void* binary = NULL;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 header.magic == PROGRAM_CACHE_MAGIC &&
+                 header.version == PROGRAM_CACHE_VERSION &&
+                 header.key == key &&
+                 header.binaryLength > 0;
+    if (valid)
+    {
+        binary = malloc(header.binaryLength);
+        valid = binary && fread(binary, header.binaryLength, 1, file) == 1;
+    }
+    fclose(file);
+
+    GLuint program = 0;
+    if (valid)
+    {
+        program = gGL->createProgram();
+        gGL->programBinary(program, header.binaryFormat, binary, header.binaryLength);
+        GLint linkStatus = GL_FALSE;
+        gGL->getProgramiv(program, GL_LINK_STATUS, &linkStatus);
+        if (linkStatus != GL_TRUE)
+        {
+            gGL->deleteProgram(program);
+            program = 0;
+        }
+    }
+    free(binary);
+
+    if (!program)
+    {
+        // Stale or corrupt entry, the caller compiles from source and stores a fresh one
+        LOGI("Discarding cached program %s\n", path);
+        remove(path);
+    }
+
+    return program;
+}
+
+void storeCachedProgram(GLuint program, const char* pVertexSource, const char* pFragmentSource)
+{
+    if (!gHasProgramBinary || !gCacheDir[0] || !program) return;
+
+    GLint length = 0;
+    gGL->getProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) return;
+
+    void* binary = malloc(length);
+    if (!binary) return;
+
+    ProgramCacheHeader header;
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = programKey(pVertexSource, pFragmentSource);
+
+    GLsizei written = 0;
+    GLenum format = 0;
+    gGL->getProgramBinary(program, length, &written, &format, binary);
+    header.binaryFormat = format;
+    header.binaryLength = written;
+
+    if (written > 0)
+    {
+        char path[300];
+        char temp_path[310];
+        cacheFileName(path, sizeof(path), header.key);
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+        // Write to a temporary name first so a killed process never leaves a truncated entry
+        FILE* file = fopen(temp_path, "wb");
+        if (file)
+        {
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                      fwrite(binary, written, 1, file) == 1;
+            ok = (fclose(file) == 0) && ok;
+            if (ok) ok = rename(temp_path, path) == 0;
+            if (!ok) remove(temp_path);
+        }
+    }
+
+    free(binary);
+}
@@ -0,0 +1,24 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <GLES2/gl2.h>
+
+// Sets the directory where linked program binaries are stored between
+// launches.  Until this is called (or when GL_OES_get_program_binary is not
+// exposed by the driver) the cache is disabled and programs are always
+// compiled from source.
+void setProgramCacheDir(const char* directory);
+
+// Looks up the extension entry points and the driver identity for the
+// current context.  Must be called on the GL thread after context creation.
+void initProgramCache();
+
+// Returns a linked program restored from the cache, or 0 when there is no
+// entry for these sources on this driver or the stored binary is rejected.
+GLuint loadCachedProgram(const char* pVertexSource, const char* pFragmentSource);
+
+// Saves the binary of a freshly linked program so later launches can skip
+// compiling it.
+void storeCachedProgram(GLuint program, const char* pVertexSource, const char* pFragmentSource);
+
+#endif
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pvs.h"
+
+void initPvs(PvsData &pvs, int sections, int numItems, float origin, float sectionSize,
+             float minEyeHeight, float maxEyeHeight)
+{
+    pvs.header.magic = PVS_MAGIC;
+    pvs.header.sections = sections;
+    pvs.header.numItems = numItems;
+    pvs.header.origin = origin;
+    pvs.header.sectionSize = sectionSize;
+    pvs.header.minEyeHeight = minEyeHeight;
+    pvs.header.maxEyeHeight = maxEyeHeight;
+    pvs.sectionWords = (sections*sections + 31) / 32;
+    pvs.itemWords = (numItems + 31) / 32;
+    pvs.sectionBits.assign(sections*sections*pvs.sectionWords, 0);
+    pvs.itemBits.assign(sections*sections*pvs.itemWords, 0);
+}
+
+bool loadPvs(PvsData &pvs, const void* data, int size)
+{
+    if (size < (int)sizeof(PvsHeader)) return false;
+
+    PvsHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != PVS_MAGIC || header.sections <= 0 || header.numItems < 0) return false;
+
+    initPvs(pvs, header.sections, header.numItems, header.origin, header.sectionSize,
+            header.minEyeHeight, header.maxEyeHeight);
+
+    size_t section_bytes = pvs.sectionBits.size()*sizeof(unsigned int);
+    size_t item_bytes = pvs.itemBits.size()*sizeof(unsigned int);
+    if ((size_t)size < sizeof(header) + section_bytes + item_bytes) return false;
+
+    const char* bits = (const char*)data + sizeof(header);
+    if (section_bytes) memcpy(&pvs.sectionBits[0], bits, section_bytes);
+    if (item_bytes) memcpy(&pvs.itemBits[0], bits + section_bytes, item_bytes);
+    return true;
+}
+
+bool writePvs(const PvsData &pvs, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    bool ok = fwrite(&pvs.header, sizeof(pvs.header), 1, file) == 1;
+    if (ok && !pvs.sectionBits.empty())
+        ok = fwrite(&pvs.sectionBits[0], sizeof(unsigned int), pvs.sectionBits.size(), file) == pvs.sectionBits.size();
+    if (ok && !pvs.itemBits.empty())
+        ok = fwrite(&pvs.itemBits[0], sizeof(unsigned int), pvs.itemBits.size(), file) == pvs.itemBits.size();
+    return (fclose(file) == 0) && ok;
+}
+
+static int sectionIndex(const PvsData &pvs, int x_id, int y_id)
+{
+    if (x_id < 0 || y_id < 0 || x_id >= pvs.header.sections || y_id >= pvs.header.sections) return -1;
+    return x_id*pvs.header.sections + y_id;
+}
+
+const unsigned int* pvsSectionRow(const PvsData &pvs, int x_id, int y_id)
+{
+    int section = sectionIndex(pvs, x_id, y_id);
+    return (section < 0) ? NULL : &pvs.sectionBits[section*pvs.sectionWords];
+}
+
+const unsigned int* pvsItemRow(const PvsData &pvs, int x_id, int y_id)
+{
+    int section = sectionIndex(pvs, x_id, y_id);
+    if (section < 0 || pvs.itemWords == 0) return NULL;
+    return &pvs.itemBits[section*pvs.itemWords];
+}
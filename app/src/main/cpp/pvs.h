@@ -0,0 +1,60 @@
+#ifndef PVS_H
+#define PVS_H
+
+// Potentially visible sets of the map sections, baked offline by
+// tools/pvs_bake.cpp.  For every section there is one bit per section and
+// one bit per map item telling whether it may be seen from anywhere inside
+// that section, for eyes between the baked heights.
+//
+// File layout, little endian:
+//   PvsHeader
+//   sections x sections rows of sectionWords 32-bit words (section bits)
+//   sections x sections rows of itemWords 32-bit words (item bits)
+// Rows are ordered x_id * sections + y_id like game_map[x_id][y_id].
+
+#include <vector>
+
+#define PVS_MAGIC   0x32535650          // "PVS2"
+
+struct PvsHeader
+{
+    unsigned int magic;
+    int sections;                       // Sections along each side
+    int numItems;
+    float origin;                       // Same grid as GetMapSection
+    float sectionSize;
+    float minEyeHeight;                 // Range of eye heights the rays were cast from
+    float maxEyeHeight;
+};
+
+struct PvsData
+{
+    PvsHeader header;
+    int sectionWords;
+    int itemWords;
+    std::vector<unsigned int> sectionBits;
+    std::vector<unsigned int> itemBits;
+};
+
+// Sets up an empty PVS for the given grid
+void initPvs(PvsData &pvs, int sections, int numItems, float origin, float sectionSize,
+             float minEyeHeight, float maxEyeHeight);
+
+bool loadPvs(PvsData &pvs, const void* data, int size);
+bool writePvs(const PvsData &pvs, const char* path);
+
+// Rows of one section, NULL outside the grid
+const unsigned int* pvsSectionRow(const PvsData &pvs, int x_id, int y_id);
+const unsigned int* pvsItemRow(const PvsData &pvs, int x_id, int y_id);
+
+inline bool pvsTest(const unsigned int* row, int i)
+{
+    return (row[i >> 5] >> (i & 31)) & 1;
+}
+
+inline void pvsSet(unsigned int* row, int i)
+{
+    row[i >> 5] |= 1u << (i & 31);
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "renderqueue.h"
+
+uint64_t makeSortKey(int layer, int program, int material, int buffer, float depth)
+{
+    // The bits of a non-negative float sort like the float itself
+    if (!(depth > 0)) depth = 0;
+    uint32_t depth_bits;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+    if (layer == RENDER_LAYER_TRANSPARENT) depth_bits = ~depth_bits;
+
+    return ((uint64_t)(layer & 0xF) << SORT_KEY_LAYER_SHIFT) |
+           ((uint64_t)(program & 0x3F) << SORT_KEY_PROGRAM_SHIFT) |
+           ((uint64_t)(material & 0x3FF) << SORT_KEY_MATERIAL_SHIFT) |
+           ((uint64_t)(buffer & 0xFFF) << SORT_KEY_BUFFER_SHIFT) |
+           depth_bits;
+}
+
+void RenderQueue::clear()
+{
+    m_Keys.clear();
+    m_Items.clear();
+}
+
+void RenderQueue::push(uint64_t key, int item)
+{
+    m_Keys.push_back(key);
+    m_Items.push_back(item);
+}
+
+void RenderQueue::sort()
+{
+    int count = (int)m_Keys.size();
+    if (count < 2) return;
+
+    // One histogram per byte, all gathered in a single pass
+    int histogram[8][256];
+    memset(histogram, 0, sizeof(histogram));
+    for (int i = 0 ; i < count ; i++)
+    {
+        uint64_t key = m_Keys[i];
+        for (int pass = 0 ; pass < 8 ; pass++)
+            histogram[pass][(key >> (pass*8)) & 0xFF]++;
+    }
+
+    m_SortedKeys.resize(count);
+    m_SortedItems.resize(count);
+    for (int pass = 0 ; pass < 8 ; pass++)
+    {
+        int* counts = histogram[pass];
+        int shift = pass*8;
+        if (counts[(m_Keys[0] >> shift) & 0xFF] == count) continue;
+
+        int offset = 0;
+        for (int digit = 0 ; digit < 256 ; digit++)
+        {
+            int n = counts[digit];
+            counts[digit] = offset;
+            offset += n;
+        }
+
+        for (int i = 0 ; i < count ; i++)
+        {
+            int slot = counts[(m_Keys[i] >> shift) & 0xFF]++;
+            m_SortedKeys[slot] = m_Keys[i];
+            m_SortedItems[slot] = m_Items[i];
+        }
+        m_Keys.swap(m_SortedKeys);
+        m_Items.swap(m_SortedItems);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <stdint.h>
+#include <vector>
+
+// Draw submissions are tagged with a 64-bit key and sorted once per frame,
+// so that draws sharing a program, a texture set or a vertex buffer end up
+// next to each other and the state they share is bound once per run.
+//
+//   63..60  layer       RENDER_LAYER_*, drawn in increasing order
+//   59..54  program     shader feature bits of the variant
+//   53..44  material    texture set
+//   43..32  buffer      vertex/index buffer set (the model id)
+//   31..0   depth       view distance, front-to-back in the opaque layer
+//                       and back-to-front in the transparent one
+
+#define RENDER_LAYER_OPAQUE         0
+#define RENDER_LAYER_TRANSPARENT    1
+
+#define SORT_KEY_LAYER_SHIFT        60
+#define SORT_KEY_PROGRAM_SHIFT      54
+#define SORT_KEY_MATERIAL_SHIFT     44
+#define SORT_KEY_BUFFER_SHIFT       32
+
+uint64_t makeSortKey(int layer, int program, int material, int buffer, float depth);
+
+inline int sortKeyLayer(uint64_t key) { return (int)(key >> SORT_KEY_LAYER_SHIFT) & 0xF; }
+inline int sortKeyProgram(uint64_t key) { return (int)(key >> SORT_KEY_PROGRAM_SHIFT) & 0x3F; }
+inline int sortKeyMaterial(uint64_t key) { return (int)(key >> SORT_KEY_MATERIAL_SHIFT) & 0x3FF; }
+inline int sortKeyBuffer(uint64_t key) { return (int)(key >> SORT_KEY_BUFFER_SHIFT) & 0xFFF; }
+
+// Keys and the items they draw, sorted with an LSD radix sort
+class RenderQueue
+{
+public:
+    void clear();
+    void push(uint64_t key, int item);
+
+    // Stable sort by key.  Byte passes in which every key has the same
+    // digit are skipped, so the usual frame with one layer and a handful
+    // of programs costs only the depth and buffer passes.
+    void sort();
+
+    int size() const { return (int)m_Keys.size(); }
+    uint64_t getKey(int i) const { return m_Keys[i]; }
+    int getItem(int i) const { return m_Items[i]; }
+
+private:
+    std::vector<uint64_t> m_Keys;
+    std::vector<int> m_Items;
+    std::vector<uint64_t> m_SortedKeys;
+    std::vector<int> m_SortedItems;
+};
+
+#endif
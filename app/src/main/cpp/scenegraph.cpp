@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "scenegraph.h"
+
+// world = parent * local, both affine or not
+static void multiplyMatrices(float* dst, const float* a, const float* b)
+{
+    for (int c = 0 ; c < 4 ; c++)
+    {
+        for (int r = 0 ; r < 4 ; r++)
+            dst[c*4+r] = a[r]*b[c*4] + a[4+r]*b[c*4+1] + a[8+r]*b[c*4+2] + a[12+r]*b[c*4+3];
+    }
+}
+
+SceneGraph::SceneGraph()
+    : m_FirstDirty(0)
+{
+}
+
+int SceneGraph::createNode(int parent, const float* local, int userData)
+{
+    int slot = (int)m_Parents.size();
+    int parent_slot = (parent == SCENE_NO_PARENT) ? SCENE_NO_PARENT : m_Slots[parent];
+
+    int handle;
+    if (!m_FreeHandles.empty())
+    {
+        handle = m_FreeHandles.back();
+        m_FreeHandles.pop_back();
+        m_Slots[handle] = slot;
+    }
+    else
+    {
+        handle = (int)m_Slots.size();
+        m_Slots.push_back(slot);
+    }
+
+    m_Parents.push_back(parent_slot);
+    m_ChildCounts.push_back(0);
+    m_Local.insert(m_Local.end(), local, local + 16);
+    m_World.resize(m_World.size() + 16);
+    m_Dirty.push_back(0);
+    m_UserData.push_back(userData);
+    m_Handles.push_back(handle);
+
+    if (parent_slot == SCENE_NO_PARENT)
+    {
+        memcpy(&m_World[slot*16], local, 16*sizeof(float));
+    }
+    else
+    {
+        m_ChildCounts[parent_slot]++;
+        multiplyMatrices(&m_World[slot*16], &m_World[parent_slot*16], local);
+    }
+    return handle;
+}
+
+void SceneGraph::destroyNode(int node)
+{
+    int slot = m_Slots[node];
+    if (m_Parents[slot] != SCENE_NO_PARENT)
+        m_ChildCounts[m_Parents[slot]]--;
+
+    // Shifting the later nodes down keeps them in order.  Parents after the
+    // removed slot move with them; none can be the removed node itself.
+    m_Parents.erase(m_Parents.begin() + slot);
+    m_ChildCounts.erase(m_ChildCounts.begin() + slot);
+    m_Local.erase(m_Local.begin() + slot*16, m_Local.begin() + (slot+1)*16);
+    m_World.erase(m_World.begin() + slot*16, m_World.begin() + (slot+1)*16);
+    m_Dirty.erase(m_Dirty.begin() + slot);
+    m_UserData.erase(m_UserData.begin() + slot);
+    m_Handles.erase(m_Handles.begin() + slot);
+
+    for (size_t s = slot ; s < m_Parents.size() ; s++)
+    {
+        if (m_Parents[s] > slot) m_Parents[s]--;
+        m_Slots[m_Handles[s]] = (int)s;
+    }
+    m_Slots[node] = -1;
+    m_FreeHandles.push_back(node);
+    if (m_FirstDirty > slot) m_FirstDirty = slot;
+}
+
+void SceneGraph::setLocal(int node, const float* local)
+{
+    int slot = m_Slots[node];
+    memcpy(&m_Local[slot*16], local, 16*sizeof(float));
+    if (!m_Dirty[slot])
+    {
+        m_Dirty[slot] = 1;
+        if (slot < m_FirstDirty) m_FirstDirty = slot;
+    }
+}
+
+int SceneGraph::getParent(int node) const
+{
+    int parent_slot = m_Parents[m_Slots[node]];
+    return (parent_slot == SCENE_NO_PARENT) ? SCENE_NO_PARENT : m_Handles[parent_slot];
+}
+
+int SceneGraph::update(std::vector<int>* changed)
+{
+    int count = 0;
+    int num_nodes = (int)m_Parents.size();
+
+    // A node is recomputed when it or its parent was, which the parent
+    // records in its own flag on the way through
+    for (int slot = m_FirstDirty ; slot < num_nodes ; slot++)
+    {
+        int parent = m_Parents[slot];
+        if (parent != SCENE_NO_PARENT && m_Dirty[parent])
+            m_Dirty[slot] = 1;
+        if (!m_Dirty[slot]) continue;
+
+        if (parent == SCENE_NO_PARENT)
+            memcpy(&m_World[slot*16], &m_Local[slot*16], 16*sizeof(float));
+        else
+            multiplyMatrices(&m_World[slot*16], &m_World[parent*16], &m_Local[slot*16]);
+
+        if (changed) changed->push_back(m_Handles[slot]);
+        count++;
+    }
+
+    for (int slot = m_FirstDirty ; slot < num_nodes ; slot++)
+        m_Dirty[slot] = 0;
+    m_FirstDirty = num_nodes;
+    return count;
+}
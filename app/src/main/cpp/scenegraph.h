@@ -0,0 +1,61 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <vector>
+
+// Transform hierarchy.  Nodes are kept in arrays sorted parent-before-child,
+// so a single forward pass sees every parent's world matrix before its
+// children need it.  Setting a local matrix only flags the node; update()
+// then recomputes the flagged nodes and their subtrees and leaves the rest
+// alone.  Matrices are 4x4 column-major floats, as glm stores them.
+//
+// Nodes are referred to by handles that stay valid while the arrays are
+// reordered underneath.
+
+#define SCENE_NO_PARENT -1
+
+class SceneGraph
+{
+public:
+    SceneGraph();
+
+    // Adds a node under parent (or SCENE_NO_PARENT) and returns its handle.
+    // Its world matrix is valid right away, as long as the parent's is.
+    int createNode(int parent, const float* local, int userData);
+
+    // Removes a node that has no children left
+    void destroyNode(int node);
+
+    void setLocal(int node, const float* local);
+    const float* getLocal(int node) const { return &m_Local[m_Slots[node]*16]; }
+
+    // As of the last update
+    const float* getWorld(int node) const { return &m_World[m_Slots[node]*16]; }
+
+    int getParent(int node) const;
+    int getChildCount(int node) const { return m_ChildCounts[m_Slots[node]]; }
+    int getUserData(int node) const { return m_UserData[m_Slots[node]]; }
+    void setUserData(int node, int userData) { m_UserData[m_Slots[node]] = userData; }
+    int getNodeCount() const { return (int)m_Parents.size(); }
+
+    // Recomputes the world matrices of the nodes whose local matrix changed
+    // and of everything below them.  Appends the handles of those nodes to
+    // changed when given and returns how many there were.
+    int update(std::vector<int>* changed);
+
+private:
+    // One entry per node, in parent-before-child order
+    std::vector<int> m_Parents;         // Slot of the parent, SCENE_NO_PARENT for roots
+    std::vector<int> m_ChildCounts;
+    std::vector<float> m_Local;         // 16 floats per node
+    std::vector<float> m_World;
+    std::vector<unsigned char> m_Dirty;
+    std::vector<int> m_UserData;
+    std::vector<int> m_Handles;         // Handle of each slot
+
+    std::vector<int> m_Slots;           // Slot of each handle, -1 when free
+    std::vector<int> m_FreeHandles;
+    int m_FirstDirty;                   // No slot before it is flagged
+};
+
+#endif
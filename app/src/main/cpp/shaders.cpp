@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "shaders.h"
+#include "programcache.h"
+#include "glbackend.h"
+#include "gldebug.h"
+
+#include <android/log.h>
+
+#define  LOG_TAG    "libgl2jni"
+#define  LOGI(...)  __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
+#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+
+static const char* gAttribNames[NUM_ATTRIBS] =
+{
+    "vPosition",
+    "vNormal",
+    "vColor",
+    "vTextureUV",
+    "vUseTexture",
+    "vSamplerID",
+    "vInstance",
+};
+
+#define STRINGIFY_VALUE(x)  #x
+#define STRINGIFY(x)        STRINGIFY_VALUE(x)
+
+static const char* gFeatureDefines[] =
+{
+    "#define TEXTURED\n",
+    "#define VERTEX_COLOR\n",
+    "#define SPECULAR\n",
+    "#define FOG\n",
+    "#define PER_VERTEX_LIGHTING\n",
+    "#define INSTANCED\n#define MAX_INSTANCES " STRINGIFY(SHADER_MAX_INSTANCES) "\n",
+};
+
+static const char gVertexShaderBody[] =
+    "attribute vec3 vPosition;\n"
+    "attribute vec3 vNormal;\n"
+    "#ifdef VERTEX_COLOR\n"
+    "attribute vec3 vColor;\n"
+    "varying vec3 fragmentColor;\n"
+    "#endif\n"
+    "#ifdef TEXTURED\n"
+    "attribute vec2 vTextureUV;\n"
+    "attribute float vSamplerID;\n"
+    "varying float SamplerID;\n"
+    "varying vec2 UV;\n"
+    "#endif\n"
+    "#if defined(TEXTURED) && defined(VERTEX_COLOR)\n"
+    "attribute float vUseTexture;\n"
+    "varying float UseTexture;\n"
+    "#endif\n"
+    "uniform mediump vec3 LightPosition_worldspace;\n"
+    "uniform mat4 mvp;\n"
+    "uniform mat4 v;\n"
+    "#ifdef INSTANCED\n"
+    "attribute float vInstance;\n"
+    "uniform vec4 instanceRows[MAX_INSTANCES*3];\n"
+    "#else\n"
+    "uniform mat4 m;\n"
+    "#endif\n"
+    "#ifdef PER_VERTEX_LIGHTING\n"
+    "uniform float lightPower;\n"
+    "varying float DiffuseFactor;\n"
+    "#ifdef SPECULAR\n"
+    "varying float SpecularFactor;\n"
+    "#endif\n"
+    "#else\n"
+    "varying vec3 Normal_cameraspace;\n"
+    "varying vec3 Position_worldspace;\n"
+    "varying vec3 LightDirection_cameraspace;\n"
+    "#ifdef SPECULAR\n"
+    "varying vec3 EyeDirection_cameraspace;\n"
+    "#endif\n"
+    "#endif\n"
+    "#ifdef FOG\n"
+    "varying float FogDepth;\n"
+    "#endif\n"
+    "void main() {\n"
+    "  vec4 vPosition4 = vec4(vPosition,1.0);\n"
+    "#ifdef INSTANCED\n"
+    "  int row = int(vInstance)*3;\n"
+    "  vec4 r0 = instanceRows[row];\n"
+    "  vec4 r1 = instanceRows[row+1];\n"
+    "  vec4 r2 = instanceRows[row+2];\n"
+    "  mat4 model = mat4(r0.x, r1.x, r2.x, 0.0, r0.y, r1.y, r2.y, 0.0, r0.z, r1.z, r2.z, 0.0, r0.w, r1.w, r2.w, 1.0);\n"
+    "  gl_Position = mvp*model*vPosition4;\n"
+    "#else\n"
+    "  mat4 model = m;\n"
+    "  gl_Position = mvp*vPosition4;\n"
+    "#endif\n"
+    "  vec3 position_worldspace = (model*vPosition4).xyz;\n"
+    "  vec3 vertexPosition_cameraspace = (v*model*vPosition4).xyz;\n"
+    "  vec3 eyeDirection = vec3(0.0, 0.0, 0.0) - vertexPosition_cameraspace;\n"
+    "  vec3 LightPosition_cameraspace = (v*vec4(LightPosition_worldspace, 1.0)).xyz;\n"
+    "  vec3 lightDirection = LightPosition_cameraspace + eyeDirection;\n"
+    "  vec3 normal = (v*model*vec4(vNormal, 0.0)).xyz;\n"
+    "#ifdef PER_VERTEX_LIGHTING\n"
+    "  float distance = length(LightPosition_worldspace-position_worldspace);\n"
+    "  float attenuation = lightPower/(distance*distance);\n"
+    "  vec3 n = normalize(normal);\n"
+    "  vec3 l = normalize(lightDirection);\n"
+    "  DiffuseFactor = clamp(dot(n,l),0.0,1.0)*attenuation;\n"
+    "#ifdef SPECULAR\n"
+    "  vec3 E = normalize(eyeDirection);\n"
+    "  vec3 R = reflect(-l,n);\n"
+    "  SpecularFactor = pow(clamp(dot(E,R),0.0,1.0), 5.0)*attenuation;\n"
+    "#endif\n"
+    "#else\n"
+    "  Position_worldspace = position_worldspace;\n"
+    "  LightDirection_cameraspace = lightDirection;\n"
+    "  Normal_cameraspace = normal;\n"
+    "#ifdef SPECULAR\n"
+    "  EyeDirection_cameraspace = eyeDirection;\n"
+    "#endif\n"
+    "#endif\n"
+    "#ifdef FOG\n"
+    "  FogDepth = -vertexPosition_cameraspace.z;\n"
+    "#endif\n"
+    "#ifdef VERTEX_COLOR\n"
+    "  fragmentColor = vColor;\n"
+    "#endif\n"
+    "#ifdef TEXTURED\n"
+    "  UV = vTextureUV;\n"
+    "  SamplerID = vSamplerID;\n"
+    "#endif\n"
+    "#if defined(TEXTURED) && defined(VERTEX_COLOR)\n"
+    "  UseTexture = vUseTexture;\n"
+    "#endif\n"
+    "}\n";
+
+static const char gFragmentShaderBody[] =
+    "precision mediump float;\n"
+    "uniform mediump vec3 LightColor;\n"
+    "#ifdef VERTEX_COLOR\n"
+    "varying vec3 fragmentColor;\n"
+    "#endif\n"
+    "#ifdef TEXTURED\n"
+    "uniform sampler2D vSamplersArray[32];\n"
+    "varying float SamplerID;\n"
+    "varying vec2 UV;\n"
+    "#endif\n"
+    "#if defined(TEXTURED) && defined(VERTEX_COLOR)\n"
+    "varying float UseTexture;\n"
+    "#endif\n"
+    "#ifdef PER_VERTEX_LIGHTING\n"
+    "varying float DiffuseFactor;\n"
+    "#ifdef SPECULAR\n"
+    "varying float SpecularFactor;\n"
+    "#endif\n"
+    "#else\n"
+    "uniform mediump vec3 LightPosition_worldspace;\n"
+    "uniform float lightPower;\n"
+    "varying vec3 Position_worldspace;\n"
+    "varying vec3 Normal_cameraspace;\n"
+    "varying vec3 LightDirection_cameraspace;\n"
+    "#ifdef SPECULAR\n"
+    "varying vec3 EyeDirection_cameraspace;\n"
+    "#endif\n"
+    "#endif\n"
+    "#ifdef FOG\n"
+    "uniform vec3 FogColor;\n"
+    "uniform float FogDensity;\n"
+    "varying float FogDepth;\n"
+    "#endif\n"
+    "void main() {\n"
+    "#ifdef TEXTURED\n"
+    "  mediump int index = int(SamplerID);\n"
+    "#endif\n"
+    "#if defined(TEXTURED) && defined(VERTEX_COLOR)\n"
+    "  vec3 MaterialDiffuseColor = (1.0-UseTexture)*fragmentColor + UseTexture*texture2D(vSamplersArray[index],UV).rgb;\n"
+    "#elif defined(TEXTURED)\n"
+    "  vec3 MaterialDiffuseColor = texture2D(vSamplersArray[index],UV).rgb;\n"
+    "#else\n"
+    "  vec3 MaterialDiffuseColor = fragmentColor;\n"
+    "#endif\n"
+    "  vec3 MaterialAmbientColor = vec3(0.1, 0.1, 0.1)*MaterialDiffuseColor;\n"
+    "  vec3 MaterialSpecularColor = vec3(0.3, 0.3, 0.3);\n"
+    "#ifdef PER_VERTEX_LIGHTING\n"
+    "  vec3 color = MaterialAmbientColor + MaterialDiffuseColor*LightColor*DiffuseFactor;\n"
+    "#ifdef SPECULAR\n"
+    "  color += MaterialSpecularColor*LightColor*SpecularFactor;\n"
+    "#endif\n"
+    "#else\n"
+    "  float distance = length(LightPosition_worldspace-Position_worldspace);\n"
+    "  float attenuation = lightPower/(distance*distance);\n"
+    "  vec3 n = normalize(Normal_cameraspace);\n"
+    "  vec3 l = normalize(LightDirection_cameraspace);\n"
+    "  float cosTheta = clamp(dot(n,l),0.0,1.0);\n"
+    "  vec3 color = MaterialAmbientColor + MaterialDiffuseColor*LightColor*cosTheta*attenuation;\n"
+    "#ifdef SPECULAR\n"
+    "  vec3 E = normalize(EyeDirection_cameraspace);\n"
+    "  vec3 R = reflect(-l,n);\n"
+    "  float cosAlpha = clamp(dot(E,R),0.0,1.0);\n"
+    "  color += MaterialSpecularColor*LightColor*pow(cosAlpha, 5.0)*attenuation;\n"
+    "#endif\n"
+    "#endif\n"
+    "#ifdef FOG\n"
+    "  float fog = clamp(exp2(-FogDensity*FogDepth*FogDepth), 0.0, 1.0);\n"
+    "  color = mix(FogColor, color, fog);\n"
+    "#endif\n"
+    "  gl_FragColor = vec4(color, 1.0);\n"
+    "}\n";
+
+static ShaderProgram gShaderPrograms[SHADER_NUM_VARIANTS];
+static bool gShaderProgramBuilt[SHADER_NUM_VARIANTS];
+
+GLuint loadShader(GLenum shaderType, const char* pSource)
+{
+    GLuint shader = gGL->createShader(shaderType); CHK;
+    if (shader)
+    {
+        gGL->shaderSource(shader, 1, &pSource, NULL); CHK;
+        gGL->compileShader(shader); CHK;
+        GLint compiled = 0;
+        gGL->getShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled)
+        {
+            GLint infoLen = 0;
+            gGL->getShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen); CHK;
+            if (infoLen)
+            {
+                char* buf = (char*) malloc(infoLen);
+                if (buf)
+                {
+                    gGL->getShaderInfoLog(shader, infoLen, NULL, buf); CHK;
+                    LOGE("Could not compile shader %d:\n%s\n",shaderType, buf);
+                    free(buf);
+                }
+                gGL->deleteShader(shader); CHK;
+                shader = 0;
+            }
+        }
+    }
+    return shader;
+}
+
+GLuint createProgram(const char* pVertexSource, const char* pFragmentSource)
+{
+    GLuint vertexShader = loadShader(GL_VERTEX_SHADER, pVertexSource);
+    if (!vertexShader) return 0;
+
+    GLuint pixelShader = loadShader(GL_FRAGMENT_SHADER, pFragmentSource);
+    if (!pixelShader) return 0;
+
+    GLuint program = gGL->createProgram(); CHK;
+    if (program)
+    {
+        gGL->attachShader(program, vertexShader); CHK;
+        gGL->attachShader(program, pixelShader); CHK;
+        for (int i = 0 ; i < NUM_ATTRIBS ; i++)
+        {
+            gGL->bindAttribLocation(program, i, gAttribNames[i]); CHK;
+        }
+        gGL->linkProgram(program); CHK;
+        GLint linkStatus = GL_FALSE;
+        gGL->getProgramiv(program, GL_LINK_STATUS, &linkStatus); CHK;
+        if (linkStatus != GL_TRUE)
+        {
+            GLint bufLength = 0;
+            gGL->getProgramiv(program, GL_INFO_LOG_LENGTH, &bufLength); CHK;
+            if (bufLength)
+            {
+                char* buf = (char*) malloc(bufLength);
+                if (buf)
+                {
+                    gGL->getProgramInfoLog(program, bufLength, NULL, buf); CHK;
+                    LOGE("Could not link program:\n%s\n", buf);
+                    free(buf);
+                }
+            }
+            gGL->deleteProgram(program); CHK;
+            program = 0;
+        }
+    }
+    gGL->deleteShader(vertexShader); CHK;
+    gGL->deleteShader(pixelShader); CHK;
+    return program;
+}
+
+// Prepends the version line and one #define per feature bit to a shader body.
+static char* buildShaderSource(int features, const char* body)
+{
+    static const char version[] = "#version 100\n";
+    size_t length = strlen(version) + strlen(body) + 1;
+    for (int i = 0 ; i < (int)(sizeof(gFeatureDefines)/sizeof(gFeatureDefines[0])) ; i++)
+    {
+        if (features & (1 << i)) length += strlen(gFeatureDefines[i]);
+    }
+
+    char* source = (char*) malloc(length);
+    strcpy(source, version);
+    for (int i = 0 ; i < (int)(sizeof(gFeatureDefines)/sizeof(gFeatureDefines[0])) ; i++)
+    {
+        if (features & (1 << i)) strcat(source, gFeatureDefines[i]);
+    }
+    strcat(source, body);
+    return source;
+}
+
+ShaderProgram* getShaderProgram(int features)
+{
+    // A variant without any color source would have nothing to light
+    if (!(features & (SHADER_TEXTURED | SHADER_VERTEX_COLOR)))
+        features |= SHADER_VERTEX_COLOR;
+    features &= SHADER_NUM_VARIANTS - 1;
+
+    ShaderProgram &shader = gShaderPrograms[features];
+    if (gShaderProgramBuilt[features])
+        return shader.program ? &shader : NULL;
+
+    gShaderProgramBuilt[features] = true;
+
+    char* vertex_source = buildShaderSource(features, gVertexShaderBody);
+    char* fragment_source = buildShaderSource(features, gFragmentShaderBody);
+    shader.program = loadCachedProgram(vertex_source, fragment_source);
+    if (!shader.program)
+    {
+        shader.program = createProgram(vertex_source, fragment_source);
+        storeCachedProgram(shader.program, vertex_source, fragment_source);
+    }
+    free(vertex_source);
+    free(fragment_source);
+
+    if (!shader.program)
+    {
+        LOGE("Could not create shader variant 0x%x\n", features);
+        return NULL;
+    }
+
+    shader.features = features;
+    shader.mvp = gGL->getUniformLocation(shader.program, "mvp"); CHK;
+    shader.v = gGL->getUniformLocation(shader.program, "v"); CHK;
+    shader.m = gGL->getUniformLocation(shader.program, "m"); CHK;
+    shader.lightPos = gGL->getUniformLocation(shader.program, "LightPosition_worldspace"); CHK;
+    shader.lightPower = gGL->getUniformLocation(shader.program, "lightPower"); CHK;
+    shader.lightColor = gGL->getUniformLocation(shader.program, "LightColor"); CHK;
+    shader.samplersArray = gGL->getUniformLocation(shader.program, "vSamplersArray"); CHK;
+    shader.fogColor = gGL->getUniformLocation(shader.program, "FogColor"); CHK;
+    shader.fogDensity = gGL->getUniformLocation(shader.program, "FogDensity"); CHK;
+    shader.instanceRows = gGL->getUniformLocation(shader.program, "instanceRows"); CHK;
+
+    LOGI("Built shader variant 0x%x\n", features);
+
+    return &shader;
+}
+
+void resetShaderPrograms()
+{
+    memset(gShaderPrograms, 0, sizeof(gShaderPrograms));
+    memset(gShaderProgramBuilt, 0, sizeof(gShaderProgramBuilt));
+}
@@ -0,0 +1,67 @@
+#ifndef SHADERS_H
+#define SHADERS_H
+
+#include <GLES2/gl2.h>
+
+// Feature bits that select a specialized variant of the scene shader.
+// Each bit is injected into the GLSL source as a #define, so a variant
+// only carries the ALU work its materials actually need.
+#define SHADER_TEXTURED             0x01    // Samples vSamplersArray with the vertex UVs
+#define SHADER_VERTEX_COLOR         0x02    // Uses the per-vertex material color
+#define SHADER_SPECULAR             0x04    // Adds the Phong specular term
+#define SHADER_FOG                  0x08    // Blends towards gFogColor with distance
+#define SHADER_PER_VERTEX_LIGHTING  0x10    // Gouraud lighting instead of per-fragment
+#define SHADER_INSTANCED            0x20    // Model matrix from instanceRows[vInstance]
+
+#define SHADER_NUM_VARIANTS         64
+
+// Instances an instanced variant can draw per call.  Each one takes three
+// vec4 uniforms (the rows of an affine model matrix), which with the other
+// uniforms stays within the 128 vectors every GLES2 device guarantees.
+#define SHADER_MAX_INSTANCES        32
+
+// Attribute locations are bound before linking so that every variant
+// reads the vertex buffers through the same slots.
+#define ATTRIB_POSITION     0
+#define ATTRIB_NORMAL       1
+#define ATTRIB_COLOR        2
+#define ATTRIB_TEXTURE_UV   3
+#define ATTRIB_USE_TEXTURE  4
+#define ATTRIB_SAMPLER_ID   5
+#define ATTRIB_INSTANCE     6   // Copy number in an instanced vertex buffer
+#define NUM_ATTRIBS         7
+
+// Attributes every model buffer set provides
+#define NUM_MODEL_ATTRIBS   6
+
+// A linked variant and the uniform locations it exposes (-1 when the
+// variant compiled the uniform away).  Instanced variants take the
+// view-projection matrix in mvp and have no m.
+struct ShaderProgram
+{
+    GLuint program;
+    int features;
+    GLint mvp;
+    GLint v;
+    GLint m;
+    GLint lightPos;
+    GLint lightPower;
+    GLint lightColor;
+    GLint samplersArray;
+    GLint fogColor;
+    GLint fogDensity;
+    GLint instanceRows;
+};
+
+// Returns the variant for the given feature bits, compiling and linking it
+// on first use.  Returns NULL if the variant failed to build.
+ShaderProgram* getShaderProgram(int features);
+
+// Forgets every cached variant.  Called when the GL context is (re)created
+// since the old program names are no longer valid.
+void resetShaderPrograms();
+
+GLuint loadShader(GLenum shaderType, const char* pSource);
+GLuint createProgram(const char* pVertexSource, const char* pFragmentSource);
+
+#endif
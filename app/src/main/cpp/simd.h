@@ -0,0 +1,119 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Minimal 4-wide float vector over NEON, SSE or plain scalars, so that the
+// batched CPU passes (culling, transforms, ...) compile for every ABI the
+// app ships and for the Linux host tools.  Define SIMD_FORCE_SCALAR to
+// check the vector paths against the scalar fallback.
+
+#if defined(SIMD_FORCE_SCALAR)
+#include <math.h>
+#define SIMD_SCALAR 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+#elif defined(__SSE2__) || defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_SSE 1
+#else
+#include <math.h>
+#define SIMD_SCALAR 1
+#endif
+
+#if defined(SIMD_NEON)
+typedef float32x4_t Float4;
+typedef uint32x4_t Mask4;
+
+inline Float4 float4Load(const float* p) { return vld1q_f32(p); }
+inline void float4Store(float* p, Float4 a) { vst1q_f32(p, a); }
+inline Float4 float4Set1(float a) { return vdupq_n_f32(a); }
+inline Float4 float4Set(float a, float b, float c, float d) { float v[4] = {a, b, c, d}; return vld1q_f32(v); }
+inline Float4 float4Add(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+inline Float4 float4Sub(Float4 a, Float4 b) { return vsubq_f32(a, b); }
+inline Float4 float4Mul(Float4 a, Float4 b) { return vmulq_f32(a, b); }
+inline Float4 float4Madd(Float4 a, Float4 b, Float4 c) { return vmlaq_f32(c, a, b); }
+inline Float4 float4Min(Float4 a, Float4 b) { return vminq_f32(a, b); }
+inline Float4 float4Max(Float4 a, Float4 b) { return vmaxq_f32(a, b); }
+inline Float4 float4Abs(Float4 a) { return vabsq_f32(a); }
+inline Mask4 float4Less(Float4 a, Float4 b) { return vcltq_f32(a, b); }
+inline Mask4 float4GreaterEqual(Float4 a, Float4 b) { return vcgeq_f32(a, b); }
+inline Mask4 mask4And(Mask4 a, Mask4 b) { return vandq_u32(a, b); }
+inline Mask4 mask4Or(Mask4 a, Mask4 b) { return vorrq_u32(a, b); }
+inline Mask4 mask4True() { return vdupq_n_u32(0xFFFFFFFF); }
+inline Float4 float4Select(Mask4 m, Float4 a, Float4 b) { return vbslq_f32(m, a, b); }
+inline int mask4Bits(Mask4 m)
+{
+    uint32_t v[4];
+    vst1q_u32(v, m);
+    return (v[0] & 1) | (v[1] & 2) | (v[2] & 4) | (v[3] & 8);
+}
+inline void float4Transpose(Float4 &a, Float4 &b, Float4 &c, Float4 &d)
+{
+    float32x4x2_t ab = vtrnq_f32(a, b);
+    float32x4x2_t cd = vtrnq_f32(c, d);
+    a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+#elif defined(SIMD_SSE)
+typedef __m128 Float4;
+typedef __m128 Mask4;
+
+inline Float4 float4Load(const float* p) { return _mm_loadu_ps(p); }
+inline void float4Store(float* p, Float4 a) { _mm_storeu_ps(p, a); }
+inline Float4 float4Set1(float a) { return _mm_set1_ps(a); }
+inline Float4 float4Set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+inline Float4 float4Add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+inline Float4 float4Sub(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+inline Float4 float4Mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+inline Float4 float4Madd(Float4 a, Float4 b, Float4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+inline Float4 float4Min(Float4 a, Float4 b) { return _mm_min_ps(a, b); }
+inline Float4 float4Max(Float4 a, Float4 b) { return _mm_max_ps(a, b); }
+inline Float4 float4Abs(Float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline Mask4 float4Less(Float4 a, Float4 b) { return _mm_cmplt_ps(a, b); }
+inline Mask4 float4GreaterEqual(Float4 a, Float4 b) { return _mm_cmpge_ps(a, b); }
+inline Mask4 mask4And(Mask4 a, Mask4 b) { return _mm_and_ps(a, b); }
+inline Mask4 mask4Or(Mask4 a, Mask4 b) { return _mm_or_ps(a, b); }
+inline Mask4 mask4True() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+inline Float4 float4Select(Mask4 m, Float4 a, Float4 b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+inline int mask4Bits(Mask4 m) { return _mm_movemask_ps(m); }
+inline void float4Transpose(Float4 &a, Float4 &b, Float4 &c, Float4 &d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+#else
+struct Float4 { float v[4]; };
+struct Mask4 { int v[4]; };
+
+inline Float4 float4Load(const float* p) { Float4 r = {{p[0], p[1], p[2], p[3]}}; return r; }
+inline void float4Store(float* p, Float4 a) { p[0] = a.v[0]; p[1] = a.v[1]; p[2] = a.v[2]; p[3] = a.v[3]; }
+inline Float4 float4Set1(float a) { Float4 r = {{a, a, a, a}}; return r; }
+inline Float4 float4Set(float a, float b, float c, float d) { Float4 r = {{a, b, c, d}}; return r; }
+
+#define SIMD_SCALAR_OP(name, expr) \
+    inline Float4 name(Float4 a, Float4 b) { Float4 r; for (int i = 0 ; i < 4 ; i++) r.v[i] = (expr); return r; }
+SIMD_SCALAR_OP(float4Add, a.v[i] + b.v[i])
+SIMD_SCALAR_OP(float4Sub, a.v[i] - b.v[i])
+SIMD_SCALAR_OP(float4Mul, a.v[i] * b.v[i])
+SIMD_SCALAR_OP(float4Min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+SIMD_SCALAR_OP(float4Max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef SIMD_SCALAR_OP
+
+inline Float4 float4Madd(Float4 a, Float4 b, Float4 c) { return float4Add(float4Mul(a, b), c); }
+inline Float4 float4Abs(Float4 a) { Float4 r; for (int i = 0 ; i < 4 ; i++) r.v[i] = fabsf(a.v[i]); return r; }
+inline Mask4 float4Less(Float4 a, Float4 b) { Mask4 r; for (int i = 0 ; i < 4 ; i++) r.v[i] = a.v[i] < b.v[i] ? -1 : 0; return r; }
+inline Mask4 float4GreaterEqual(Float4 a, Float4 b) { Mask4 r; for (int i = 0 ; i < 4 ; i++) r.v[i] = a.v[i] >= b.v[i] ? -1 : 0; return r; }
+inline Mask4 mask4And(Mask4 a, Mask4 b) { Mask4 r; for (int i = 0 ; i < 4 ; i++) r.v[i] = a.v[i] & b.v[i]; return r; }
+inline Mask4 mask4Or(Mask4 a, Mask4 b) { Mask4 r; for (int i = 0 ; i < 4 ; i++) r.v[i] = a.v[i] | b.v[i]; return r; }
+inline Mask4 mask4True() { Mask4 r = {{-1, -1, -1, -1}}; return r; }
+inline Float4 float4Select(Mask4 m, Float4 a, Float4 b) { Float4 r; for (int i = 0 ; i < 4 ; i++) r.v[i] = m.v[i] ? a.v[i] : b.v[i]; return r; }
+inline int mask4Bits(Mask4 m) { return (m.v[0] & 1) | (m.v[1] & 2) | (m.v[2] & 4) | (m.v[3] & 8); }
+inline void float4Transpose(Float4 &a, Float4 &b, Float4 &c, Float4 &d)
+{
+    Float4 r[4] = {a, b, c, d};
+    for (int i = 0 ; i < 4 ; i++)
+    {
+        a.v[i] = r[i].v[0]; b.v[i] = r[i].v[1]; c.v[i] = r[i].v[2]; d.v[i] = r[i].v[3];
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,271 @@
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+
+#include "simplify.h"
+
+// Symmetric 4x4 error quadric, upper triangle only
+struct Quadric
+{
+    double a2, ab, ac, ad;
+    double     b2, bc, bd;
+    double         c2, cd;
+    double             d2;
+};
+
+static void addPlane(Quadric &q, double a, double b, double c, double d, double weight)
+{
+    q.a2 += weight*a*a; q.ab += weight*a*b; q.ac += weight*a*c; q.ad += weight*a*d;
+    q.b2 += weight*b*b; q.bc += weight*b*c; q.bd += weight*b*d;
+    q.c2 += weight*c*c; q.cd += weight*c*d;
+    q.d2 += weight*d*d;
+}
+
+static void addQuadric(Quadric &q, const Quadric &r)
+{
+    q.a2 += r.a2; q.ab += r.ab; q.ac += r.ac; q.ad += r.ad;
+    q.b2 += r.b2; q.bc += r.bc; q.bd += r.bd;
+    q.c2 += r.c2; q.cd += r.cd;
+    q.d2 += r.d2;
+}
+
+static double evaluateQuadric(const Quadric &q, const float* p)
+{
+    double x = p[0], y = p[1], z = p[2];
+    return x*x*q.a2 + 2*x*y*q.ab + 2*x*z*q.ac + 2*x*q.ad +
+           y*y*q.b2 + 2*y*z*q.bc + 2*y*q.bd +
+           z*z*q.c2 + 2*z*q.cd +
+           q.d2;
+}
+
+static void triangleNormal(const float* p0, const float* p1, const float* p2, double* n)
+{
+    double e1[3] = {p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2]};
+    double e2[3] = {p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2]};
+    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+}
+
+struct Collapse
+{
+    double cost;
+    unsigned int from;
+    unsigned int to;
+    unsigned int fromVersion;
+    unsigned int toVersion;
+
+    bool operator<(const Collapse &other) const { return cost > other.cost; }
+};
+
+struct SimplifyState
+{
+    const float* positions;
+    std::vector<unsigned int> triangles;
+    std::vector<bool> alive;
+    std::vector< std::vector<int> > vertexTriangles;
+    std::vector<Quadric> quadrics;
+    std::vector<bool> locked;
+    std::vector<unsigned int> version;
+    std::priority_queue<Collapse> heap;
+};
+
+static void pushCollapse(SimplifyState &state, unsigned int from, unsigned int to)
+{
+    if (state.locked[from] || from == to) return;
+
+    Quadric q = state.quadrics[from];
+    addQuadric(q, state.quadrics[to]);
+
+    Collapse collapse;
+    collapse.cost = evaluateQuadric(q, &state.positions[to*3]);
+    collapse.from = from;
+    collapse.to = to;
+    collapse.fromVersion = state.version[from];
+    collapse.toVersion = state.version[to];
+    state.heap.push(collapse);
+}
+
+// Rejects collapses that would flip any of the triangles around "from"
+static bool collapseFlips(const SimplifyState &state, unsigned int from, unsigned int to)
+{
+    const std::vector<int> &tris = state.vertexTriangles[from];
+    for (size_t i = 0 ; i < tris.size() ; i++)
+    {
+        int t = tris[i];
+        if (!state.alive[t]) continue;
+
+        const unsigned int* tri = &state.triangles[t*3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to) continue;
+
+        const float* p[3];
+        const float* q[3];
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            p[k] = &state.positions[tri[k]*3];
+            q[k] = (tri[k] == from) ? &state.positions[to*3] : p[k];
+        }
+
+        double before[3], after[3];
+        triangleNormal(p[0], p[1], p[2], before);
+        triangleNormal(q[0], q[1], q[2], after);
+        if (before[0]*after[0] + before[1]*after[1] + before[2]*after[2] <= 0) return true;
+    }
+    return false;
+}
+
+int simplifyMesh(unsigned int* dst, const unsigned int* indices, int numIndices,
+                 const float* positions, int numVertices, int targetIndices, float maxError)
+{
+    int numTriangles = numIndices / 3;
+    if (numTriangles == 0 || numVertices == 0) return 0;
+
+    // Work on a copy scaled to unit extent so maxError does not depend on
+    // the units the model was authored in
+    float lo[3] = {positions[0], positions[1], positions[2]};
+    float hi[3] = {positions[0], positions[1], positions[2]};
+    for (int v = 0 ; v < numVertices*3 ; v++)
+    {
+        if (positions[v] < lo[v%3]) lo[v%3] = positions[v];
+        if (positions[v] > hi[v%3]) hi[v%3] = positions[v];
+    }
+    float extent = fmaxf(hi[0]-lo[0], fmaxf(hi[1]-lo[1], hi[2]-lo[2]));
+    float scale = (extent > 0) ? 1.0f/extent : 1.0f;
+    std::vector<float> scaled(numVertices*3);
+    for (int v = 0 ; v < numVertices*3 ; v++)
+        scaled[v] = (positions[v]-lo[v%3])*scale;
+
+    SimplifyState state;
+    state.positions = &scaled[0];
+    state.triangles.assign(indices, indices + numTriangles*3);
+    state.alive.assign(numTriangles, true);
+    state.vertexTriangles.resize(numVertices);
+    state.locked.assign(numVertices, false);
+    state.version.assign(numVertices, 0);
+
+    Quadric zero;
+    memset(&zero, 0, sizeof(zero));
+    state.quadrics.assign(numVertices, zero);
+
+    // Plane quadrics weighted by triangle area
+    for (int t = 0 ; t < numTriangles ; t++)
+    {
+        const unsigned int* tri = &state.triangles[t*3];
+        double n[3];
+        const float* p = &state.positions[tri[0]*3];
+        triangleNormal(p, &state.positions[tri[1]*3], &state.positions[tri[2]*3], n);
+        double length = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if (length > 0)
+        {
+            n[0] /= length; n[1] /= length; n[2] /= length;
+            double d = -(n[0]*p[0] + n[1]*p[1] + n[2]*p[2]);
+            for (int k = 0 ; k < 3 ; k++)
+                addPlane(state.quadrics[tri[k]], n[0], n[1], n[2], d, length*0.5);
+        }
+
+        for (int k = 0 ; k < 3 ; k++)
+            state.vertexTriangles[tri[k]].push_back(t);
+    }
+
+    // Lock the vertices of edges used by exactly one triangle (open borders,
+    // seams) or by more than two (non-manifold)
+    std::unordered_map<unsigned long long, int> edgeUse;
+    for (int t = 0 ; t < numTriangles*3 ; t++)
+    {
+        unsigned int a = state.triangles[t];
+        unsigned int b = state.triangles[(t % 3 == 2) ? t - 2 : t + 1];
+        unsigned long long key = (a < b) ? ((unsigned long long)a << 32 | b) : ((unsigned long long)b << 32 | a);
+        edgeUse[key]++;
+    }
+    for (std::unordered_map<unsigned long long, int>::iterator it = edgeUse.begin() ; it != edgeUse.end() ; ++it)
+    {
+        if (it->second != 2)
+        {
+            state.locked[(unsigned int)(it->first >> 32)] = true;
+            state.locked[(unsigned int)(it->first & 0xFFFFFFFF)] = true;
+        }
+    }
+
+    for (int t = 0 ; t < numTriangles ; t++)
+    {
+        const unsigned int* tri = &state.triangles[t*3];
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            pushCollapse(state, tri[k], tri[(k+1)%3]);
+            pushCollapse(state, tri[(k+1)%3], tri[k]);
+        }
+    }
+
+    int liveTriangles = numTriangles;
+    while (liveTriangles*3 > targetIndices && !state.heap.empty())
+    {
+        Collapse collapse = state.heap.top();
+        state.heap.pop();
+
+        if (collapse.fromVersion != state.version[collapse.from] || collapse.toVersion != state.version[collapse.to])
+            continue;
+        if (collapse.cost > maxError)
+            break;
+        if (collapseFlips(state, collapse.from, collapse.to))
+            continue;
+
+        unsigned int from = collapse.from;
+        unsigned int to = collapse.to;
+
+        // Move the triangles of "from" over to "to", dropping the ones that
+        // shared the collapsed edge
+        std::vector<int> &tris = state.vertexTriangles[from];
+        for (size_t i = 0 ; i < tris.size() ; i++)
+        {
+            int t = tris[i];
+            if (!state.alive[t]) continue;
+
+            unsigned int* tri = &state.triangles[t*3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+            {
+                state.alive[t] = false;
+                liveTriangles--;
+                continue;
+            }
+            for (int k = 0 ; k < 3 ; k++)
+            {
+                if (tri[k] == from) tri[k] = to;
+            }
+            state.vertexTriangles[to].push_back(t);
+        }
+        tris.clear();
+
+        addQuadric(state.quadrics[to], state.quadrics[from]);
+        state.version[from]++;
+        state.version[to]++;
+
+        // Re-queue every edge around the merged vertex with its new cost
+        const std::vector<int> &merged = state.vertexTriangles[to];
+        for (size_t i = 0 ; i < merged.size() ; i++)
+        {
+            int t = merged[i];
+            if (!state.alive[t]) continue;
+
+            const unsigned int* tri = &state.triangles[t*3];
+            for (int k = 0 ; k < 3 ; k++)
+            {
+                if (tri[k] == to) continue;
+                pushCollapse(state, tri[k], to);
+                pushCollapse(state, to, tri[k]);
+            }
+        }
+    }
+
+    int output = 0;
+    for (int t = 0 ; t < numTriangles ; t++)
+    {
+        if (!state.alive[t]) continue;
+        dst[output++] = state.triangles[t*3];
+        dst[output++] = state.triangles[t*3+1];
+        dst[output++] = state.triangles[t*3+2];
+    }
+    return output;
+}
@@ -0,0 +1,21 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+// Quadric error metric mesh simplification (Garland & Heckbert 1997) used to
+// build the LOD chain of every model at load time.
+//
+// Collapses are half-edge collapses onto existing vertices, so the
+// simplified index list reuses the original vertex buffer.  Vertices on
+// border edges are never moved.  Since the loader welds vertices on their
+// full attribute tuple, UV seams, normal creases and material borders all
+// show up as border edges in the index list and are preserved.
+
+// Writes a simplified copy of the triangle list to dst (which must hold
+// numIndices entries) and returns its index count.  Stops when the list is
+// down to targetIndices or when the next collapse would cost more than
+// maxError, measured as area weighted squared distance to the original
+// surface with the mesh scaled to unit extent.
+int simplifyMesh(unsigned int* dst, const unsigned int* indices, int numIndices,
+                 const float* positions, int numVertices, int targetIndices, float maxError);
+
+#endif
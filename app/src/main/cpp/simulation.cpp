@@ -0,0 +1,132 @@
+#include <string.h>
+#include <stdint.h>
+
+#include <chrono>
+
+#include "simulation.h"
+
+Simulation::Simulation(int hz, size_t stateSize, const StepFunc& step)
+    : m_Step(step)
+    , m_StateSize(stateSize)
+    , m_TickNsec(1000000000LL/hz)
+    , m_Stopping(false)
+    , m_Previous(stateSize)
+    , m_Current(stateSize)
+    , m_CurrentTime(0)
+{
+    memset(m_Inputs, 0, sizeof(m_Inputs));
+    memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+Simulation::~Simulation()
+{
+    stop();
+}
+
+int64_t Simulation::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Simulation::start(const void* state)
+{
+    stop();
+
+    memcpy(&m_Previous[0], state, m_StateSize);
+    memcpy(&m_Current[0], state, m_StateSize);
+    memset(m_Inputs, 0, sizeof(m_Inputs));
+    m_CurrentTime = now();
+    m_Stopping = false;
+    m_Thread = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop()
+{
+    if (!m_Thread.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stopping = true;
+    }
+    m_Wake.notify_one();
+    m_Thread.join();
+}
+
+void Simulation::addInput(const float* inputs, int count)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (int i = 0 ; i < count && i < SIMULATION_MAX_INPUTS ; i++)
+        m_Inputs[i] += inputs[i];
+}
+
+float Simulation::getSnapshots(void* previous, void* current)
+{
+    int64_t present = now() - m_TickNsec;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    memcpy(previous, &m_Previous[0], m_StateSize);
+    memcpy(current, &m_Current[0], m_StateSize);
+
+    float t = (float)(present - (m_CurrentTime - m_TickNsec))/(float)m_TickNsec;
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    return t;
+}
+
+SimulationStats Simulation::getStats()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Stats;
+}
+
+void Simulation::run()
+{
+    std::vector<unsigned char> state(m_Current);
+    float dt = (float)m_TickNsec/1000000000.0f;
+    int64_t next_tick;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        next_tick = m_CurrentTime + m_TickNsec;
+    }
+
+    for (;;)
+    {
+        int ticks = 0;
+        while (next_tick <= now())
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if (m_Stopping) return;
+
+            // Skip the ticks a long stall (a debugger, a slow step) left
+            // behind rather than replaying them all at once
+            if (ticks == SIMULATION_MAX_CATCHUP)
+            {
+                int64_t behind = (now() - next_tick)/m_TickNsec + 1;
+                m_Stats.dropped += (unsigned int)behind;
+                next_tick += behind*m_TickNsec;
+                break;
+            }
+
+            float inputs[SIMULATION_MAX_INPUTS];
+            memcpy(inputs, m_Inputs, sizeof(inputs));
+            memset(m_Inputs, 0, sizeof(m_Inputs));
+            lock.unlock();
+
+            m_Step(&state[0], inputs, dt);
+
+            lock.lock();
+            m_Previous.swap(m_Current);
+            memcpy(&m_Current[0], &state[0], m_StateSize);
+            m_CurrentTime = next_tick;
+            m_Stats.ticks++;
+            next_tick += m_TickNsec;
+            ticks++;
+        }
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if (m_Stopping) break;
+        m_Wake.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(next_tick)),
+                          [this] { return m_Stopping; });
+        if (m_Stopping) break;
+    }
+}
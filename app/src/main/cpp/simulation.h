@@ -0,0 +1,74 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Fixed-timestep simulation on its own thread.  The state is a plain struct
+// of stateSize bytes that only the thread's step function writes; after
+// every tick a copy is published, and the renderer reads the last two
+// copies and blends between them, so drawing never waits for a tick and a
+// tick never depends on the frame rate.  Ticks are always 1/hz seconds
+// long and consume the input summed up since the previous tick, so the
+// same input sequence gives the same states.
+
+#define SIMULATION_MAX_INPUTS   8
+#define SIMULATION_MAX_CATCHUP  12      // Ticks run back to back before the rest of the time due is dropped
+
+struct SimulationStats
+{
+    unsigned int ticks;
+    unsigned int dropped;               // Ticks skipped to catch up with the clock
+};
+
+class Simulation
+{
+public:
+    typedef std::function<void(void* state, const float* inputs, float dt)> StepFunc;
+
+    Simulation(int hz, size_t stateSize, const StepFunc& step);
+    ~Simulation();
+
+    // Starts ticking from state, the first tick is due 1/hz seconds later
+    void start(const void* state);
+    void stop();
+    bool isRunning() const { return m_Thread.joinable(); }
+
+    // Adds to the inputs the next tick consumes.  Inputs are deltas, so
+    // several frames of them add up.
+    void addInput(const float* inputs, int count);
+
+    // Copies the two latest published states and returns how far in [0, 1]
+    // the present lies between them.  The present is held one tick back so
+    // it normally falls between two published states.
+    float getSnapshots(void* previous, void* current);
+
+    SimulationStats getStats();
+
+private:
+    void run();
+
+    int64_t now() const;
+
+    StepFunc m_Step;
+    size_t m_StateSize;
+    int64_t m_TickNsec;
+
+    std::thread m_Thread;
+    std::mutex m_Mutex;                 // Guards everything below
+    std::condition_variable m_Wake;
+    bool m_Stopping;
+    std::vector<unsigned char> m_Previous;
+    std::vector<unsigned char> m_Current;
+    int64_t m_CurrentTime;              // Clock time the current state belongs to
+    float m_Inputs[SIMULATION_MAX_INPUTS];
+    SimulationStats m_Stats;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include <float.h>
+#include <stddef.h>
+
+#include "staticbatch.h"
+
+static void transformPoint(float* dst, const float* m, const float* p)
+{
+    for (int k = 0 ; k < 3 ; k++)
+        dst[k] = m[k]*p[0] + m[4+k]*p[1] + m[8+k]*p[2] + m[12+k];
+}
+
+// Normals go through the same 3x3 part as the positions.  With a uniform
+// scale that only changes their length, which the shaders normalize away.
+static void transformVector(float* dst, const float* m, const float* v)
+{
+    for (int k = 0 ; k < 3 ; k++)
+        dst[k] = m[k]*v[0] + m[4+k]*v[1] + m[8+k]*v[2];
+}
+
+// Returns the batch the model's vertices can still be added to, opening a
+// new one when there is none for its state or the last one is full
+static BatchGeometry& openBatch(std::vector<BatchGeometry> &batches, size_t first, const BatchSourceModel &model)
+{
+    for (size_t b = batches.size() ; b > first ; b--)
+    {
+        BatchGeometry &batch = batches[b-1];
+        if (batch.features != model.features || batch.material != model.material) continue;
+        if (batch.positions.size()/3 + model.numVertices <= STATIC_BATCH_MAX_VERTICES) return batch;
+        break;
+    }
+
+    batches.push_back(BatchGeometry());
+    BatchGeometry &batch = batches.back();
+    batch.features = model.features;
+    batch.material = model.material;
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        batch.box[k] = FLT_MAX;
+        batch.box[k+3] = -FLT_MAX;
+    }
+    return batch;
+}
+
+void buildStaticBatches(std::vector<BatchGeometry> &batches, const BatchSourceModel* models,
+                        const BatchInstance* instances, int count)
+{
+    size_t first = batches.size();
+    for (int i = 0 ; i < count ; i++)
+    {
+        const BatchInstance &instance = instances[i];
+        const BatchSourceModel &model = models[instance.model];
+        if (model.numVertices == 0 || model.numVertices > STATIC_BATCH_MAX_VERTICES) continue;
+
+        BatchGeometry &batch = openBatch(batches, first, model);
+        int base = (int)batch.positions.size()/3;
+
+        batch.positions.resize((base + model.numVertices)*3);
+        batch.normals.resize((base + model.numVertices)*3);
+        for (int v = 0 ; v < model.numVertices ; v++)
+        {
+            float* position = &batch.positions[(base+v)*3];
+            transformPoint(position, instance.matrix, &model.positions[v*3]);
+            transformVector(&batch.normals[(base+v)*3], instance.matrix, &model.normals[v*3]);
+            for (int k = 0 ; k < 3 ; k++)
+            {
+                if (position[k] < batch.box[k]) batch.box[k] = position[k];
+                if (position[k] > batch.box[k+3]) batch.box[k+3] = position[k];
+            }
+        }
+
+        batch.colors.insert(batch.colors.end(), model.colors, model.colors + model.numVertices*3);
+        batch.uvs.insert(batch.uvs.end(), model.uvs, model.uvs + model.numVertices*2);
+        batch.useTextures.insert(batch.useTextures.end(), model.useTextures, model.useTextures + model.numVertices);
+        batch.samplers.insert(batch.samplers.end(), model.samplers, model.samplers + model.numVertices);
+
+        size_t index_base = batch.indices.size();
+        batch.indices.resize(index_base + model.numIndices);
+        for (int k = 0 ; k < model.numIndices ; k++)
+            batch.indices[index_base+k] = (unsigned short)(model.indices[k] + base);
+    }
+}
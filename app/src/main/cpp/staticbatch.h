@@ -0,0 +1,58 @@
+#ifndef STATICBATCH_H
+#define STATICBATCH_H
+
+// Static batching: copies of models that never move are transformed to
+// world space once and merged into a few large meshes, one per program and
+// texture set, so a whole block of props is drawn with a handful of calls.
+// Building only reads its inputs, so it can run on a worker thread.
+
+#include <vector>
+
+#define STATIC_BATCH_MAX_VERTICES   65536   // Batches are split to keep 16-bit indices
+
+// A model's vertex attributes and full-detail triangles, as laid out in the
+// global arrays (positions, normals and colors hold 3 floats per vertex,
+// uvs 2, useTextures and samplers 1)
+struct BatchSourceModel
+{
+    const float* positions;
+    const float* normals;
+    const float* colors;
+    const float* uvs;
+    const float* useTextures;
+    const float* samplers;
+    const unsigned int* indices;
+    int numVertices;
+    int numIndices;
+    int features;                       // Shader feature bits
+    int material;                       // Texture set
+};
+
+struct BatchInstance
+{
+    int model;
+    float matrix[16];                   // Column-major, translation, rotation and uniform scale
+};
+
+// One merged mesh, in world space, and the state it is drawn with
+struct BatchGeometry
+{
+    int features;
+    int material;
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> colors;
+    std::vector<float> uvs;
+    std::vector<float> useTextures;
+    std::vector<float> samplers;
+    std::vector<unsigned short> indices;
+    float box[6];                       // min xyz, max xyz
+};
+
+// Appends the merged meshes of the instances to batches.  Instances sharing
+// features and material end up in the same mesh, in the order given, until
+// it would pass STATIC_BATCH_MAX_VERTICES.
+void buildStaticBatches(std::vector<BatchGeometry> &batches, const BatchSourceModel* models,
+                        const BatchInstance* instances, int count);
+
+#endif
@@ -0,0 +1,82 @@
+#include <string.h>
+
+#include "streambuffer.h"
+#include "glbackend.h"
+#include "glstate.h"
+#include "gldebug.h"
+
+StreamBuffer::StreamBuffer()
+    : m_Target(GL_ARRAY_BUFFER)
+    , m_FrameSize(0)
+    , m_Offset(0)
+    , m_Current(0)
+{
+    memset(m_Buffers, 0, sizeof(m_Buffers));
+    memset(m_Sizes, 0, sizeof(m_Sizes));
+    memset(m_Written, 0, sizeof(m_Written));
+    memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+void StreamBuffer::reset(GLenum target, size_t frameSize)
+{
+    m_Target = target;
+    m_FrameSize = frameSize;
+    m_Offset = 0;
+    m_Current = 0;
+    memset(&m_Stats, 0, sizeof(m_Stats));
+
+    gGL->genBuffers(STREAM_FRAMES_IN_FLIGHT, m_Buffers); CHK;
+    for (m_Current = STREAM_FRAMES_IN_FLIGHT-1 ; m_Current >= 0 ; m_Current--)
+        orphan();
+    m_Current = 0;
+}
+
+void StreamBuffer::orphan()
+{
+    cachedBindBuffer(m_Target, m_Buffers[m_Current]); CHK;
+    gGL->bufferData(m_Target, (GLsizeiptr)m_FrameSize, NULL, GL_STREAM_DRAW); CHK;
+    m_Sizes[m_Current] = m_FrameSize;
+    m_Written[m_Current] = false;
+    m_Offset = 0;
+}
+
+void StreamBuffer::beginFrame()
+{
+    memset(&m_Stats, 0, sizeof(m_Stats));
+    if (!m_Buffers[0]) return;
+
+    // Frames that streamed nothing leave their buffer as it was
+    m_Current = (m_Current + 1) % STREAM_FRAMES_IN_FLIGHT;
+    m_Offset = 0;
+    if (m_Written[m_Current] || m_Sizes[m_Current] != m_FrameSize)
+        orphan();
+}
+
+StreamAllocation StreamBuffer::append(const void* data, size_t size, size_t alignment)
+{
+    size_t offset = (m_Offset + alignment - 1)/alignment*alignment;
+    if (offset + size > m_FrameSize)
+    {
+        m_Stats.stalls++;
+        if (size > m_FrameSize)
+        {
+            // Buffers reset without space start doubling from this request
+            if (m_FrameSize == 0) m_FrameSize = size;
+            while (m_FrameSize < size)
+                m_FrameSize *= 2;
+        }
+        orphan();
+        offset = 0;
+    }
+
+    cachedBindBuffer(m_Target, m_Buffers[m_Current]); CHK;
+    gGL->bufferSubData(m_Target, (GLintptr)offset, (GLsizeiptr)size, data); CHK;
+    m_Offset = offset + size;
+    m_Written[m_Current] = true;
+
+    m_Stats.bytes += size;
+    m_Stats.allocations++;
+
+    StreamAllocation allocation = {m_Buffers[m_Current], offset};
+    return allocation;
+}
@@ -0,0 +1,69 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <stddef.h>
+#include <GLES2/gl2.h>
+
+// Per-frame transient geometry (HUD quads, skid marks, debug lines,
+// particles).  Each frame appends into one of STREAM_FRAMES_IN_FLIGHT
+// buffers, so the GPU can still be reading the previous frames' data while
+// this one is written.
+//
+// GLES2 has neither fences nor unsynchronized mapping, so reuse is made safe
+// by orphaning: a buffer is given fresh storage (glBufferData with NULL)
+// when its turn comes round, and the driver keeps the old storage alive for
+// draws still queued against it.  Writes then go in with glBufferSubData
+// into storage nothing else references.
+
+#define STREAM_FRAMES_IN_FLIGHT     3
+
+struct StreamStats
+{
+    size_t bytes;                       // Streamed this frame
+    int allocations;
+    int stalls;                         // Writes that found the buffer full, see append
+};
+
+// Where an append landed
+struct StreamAllocation
+{
+    GLuint buffer;
+    size_t offset;
+};
+
+class StreamBuffer
+{
+public:
+    StreamBuffer();
+
+    // Creates the buffers for target (GL_ARRAY_BUFFER or
+    // GL_ELEMENT_ARRAY_BUFFER), frameSize bytes each.  The old names are
+    // dropped without deleting them, for when the context is gone.
+    void reset(GLenum target, size_t frameSize);
+
+    // Moves on to the next buffer and orphans it
+    void beginFrame();
+
+    // Copies size bytes into the current buffer at a multiple of alignment
+    // and leaves it bound to the target.  When the frame's space runs out
+    // the buffer is orphaned again and filled from the start, which may
+    // make the driver allocate or wait; these are counted as stalls.
+    // Requests bigger than a frame grow every buffer.
+    StreamAllocation append(const void* data, size_t size, size_t alignment);
+
+    const StreamStats& getStats() const { return m_Stats; }
+
+private:
+    void orphan();
+
+    GLenum m_Target;
+    GLuint m_Buffers[STREAM_FRAMES_IN_FLIGHT];
+    size_t m_Sizes[STREAM_FRAMES_IN_FLIGHT];    // Storage each one was last given
+    bool m_Written[STREAM_FRAMES_IN_FLIGHT];    // Since that storage was given
+    size_t m_FrameSize;
+    size_t m_Offset;
+    int m_Current;
+    StreamStats m_Stats;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include <string.h>
 
 #include "texture.h"
+#include "glstate.h"
+#include "glbackend.h"
 
 #include <GLES2/gl2.h>
 
@@ -30,14 +32,14 @@ GLuint loadBMP(const char *buffer)
 	if (dataPos == 0) dataPos = 54;
 
 	GLuint textureID;
-	glGenTextures(1, &textureID);	
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, &buffer[dataPos]);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
-	glGenerateMipmap(GL_TEXTURE_2D);
+	gGL->genTextures(1, &textureID);	
+	cachedBindTexture(GL_TEXTURE_2D, textureID);
+	gGL->texImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, &buffer[dataPos]);
+	gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
+	gGL->generateMipmap(GL_TEXTURE_2D);
 
 	return textureID;
 }
@@ -83,9 +85,9 @@ GLuint loadDDS(const char* buffer)
 	}
 
 	GLuint textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
+	gGL->genTextures(1, &textureID);
+	cachedBindTexture(GL_TEXTURE_2D, textureID);
+	cachedPixelStorei(GL_UNPACK_ALIGNMENT,1);	
 	
 	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
 	unsigned int offset = 0;
@@ -93,7 +95,7 @@ GLuint loadDDS(const char* buffer)
 	for (unsigned int level = 0 ; level < mipMapCount && (width || height) ; ++level) 
 	{ 
 		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, size, buffer + offset); 
+		gGL->compressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, size, buffer + offset); 
 
 		offset += size; 
 		width  /= 2; 
@@ -154,14 +156,14 @@ GLuint loadTGA(const char* buffer)
 	}
 
 	GLuint textureID;
-	glGenTextures(1, &textureID);	
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, tgaFile.imageWidth, tgaFile.imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, tgaFile.imageData);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
+	gGL->genTextures(1, &textureID);	
+	cachedBindTexture(GL_TEXTURE_2D, textureID);
+	gGL->texImage2D(GL_TEXTURE_2D, 0,GL_RGB, tgaFile.imageWidth, tgaFile.imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, tgaFile.imageData);
+    gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gGL->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    gGL->generateMipmap(GL_TEXTURE_2D);
 
     delete[] tgaFile.imageData;
 
@@ -0,0 +1,189 @@
+// Headless benchmark for the sweep-and-prune broadphase.
+//
+// Drives car-sized boxes around a flat square at street speeds, stepping
+// at the simulation's 120 Hz, and reports the time per update of the
+// sweep-and-prune next to the same pairs found with the dynamic AABB tree
+// (move every proxy, then query with every box).  The square grows with
+// the count so the density of traffic stays the same.  The pairs are
+// checked against a brute force search on a few ticks.
+//
+//   g++ -O2 -std=c++11 -I.. broadphase_bench.cpp ../broadphase.cpp ../aabbtree.cpp ../cull.cpp -o broadphase_bench
+//   ./broadphase_bench [ticks] [counts...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "broadphase.h"
+
+#define TICK_SECONDS    (1.0f/120)
+#define AREA_PER_CAR    200.0f          // Square meters of street per car
+#define CAR_WIDTH       2.0f
+#define CAR_HEIGHT      1.5f
+#define CAR_LENGTH      4.5f
+#define CHECK_EVERY     100             // Ticks between brute force checks
+
+struct Car
+{
+    float x, z;
+    float vx, vz;
+};
+
+static float randomFloat(float min, float max)
+{
+    return min + (max - min)*(rand()/(float)RAND_MAX);
+}
+
+static Aabb carBox(const Car &car)
+{
+    // The box of the car turned along its heading
+    float speed = sqrtf(car.vx*car.vx + car.vz*car.vz);
+    float c = fabsf(car.vx/speed), s = fabsf(car.vz/speed);
+    float half_x = (c*CAR_LENGTH + s*CAR_WIDTH)*0.5f;
+    float half_z = (s*CAR_LENGTH + c*CAR_WIDTH)*0.5f;
+
+    Aabb box;
+    box.min[0] = car.x - half_x;
+    box.min[1] = 0;
+    box.min[2] = car.z - half_z;
+    box.max[0] = car.x + half_x;
+    box.max[1] = CAR_HEIGHT;
+    box.max[2] = car.z + half_z;
+    return box;
+}
+
+static bool overlap(const Aabb &a, const Aabb &b)
+{
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        if (a.min[k] > b.max[k] || a.max[k] < b.min[k]) return false;
+    }
+    return true;
+}
+
+static double millisecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Returns false when the pairs differ from a brute force search
+static bool run(int count, int ticks)
+{
+    srand(count);
+    float side = sqrtf(count*AREA_PER_CAR);
+    std::vector<Car> cars(count);
+    SweepAndPrune sap;
+    AabbTree tree;
+    std::vector<int> tree_proxies(count);
+    for (int i = 0 ; i < count ; i++)
+    {
+        Car &car = cars[i];
+        float heading = randomFloat(0, 2*(float)M_PI), speed = randomFloat(5, 15);
+        car.x = randomFloat(0, side);
+        car.z = randomFloat(0, side);
+        car.vx = cosf(heading)*speed;
+        car.vz = sinf(heading)*speed;
+        sap.createProxy(carBox(car), i);
+        tree_proxies[i] = tree.createProxy(carBox(car), i);
+    }
+
+    double sap_ms = 0, tree_ms = 0, max_sap_ms = 0;
+    long long pairs = 0, events = 0, swaps = 0;
+    std::vector<int> query;
+    bool correct = true;
+    for (int tick = 0 ; tick < ticks ; tick++)
+    {
+        for (int i = 0 ; i < count ; i++)
+        {
+            Car &car = cars[i];
+            car.x += car.vx*TICK_SECONDS;
+            car.z += car.vz*TICK_SECONDS;
+            if (car.x < 0 || car.x > side) car.vx = -car.vx;
+            if (car.z < 0 || car.z > side) car.vz = -car.vz;
+        }
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        for (int i = 0 ; i < count ; i++)
+            sap.moveProxy(i, carBox(cars[i]));
+        sap.update();
+        double ms = millisecondsSince(start);
+        sap_ms += ms;
+        if (ms > max_sap_ms) max_sap_ms = ms;
+        pairs += sap.getPairs().size();
+        events += sap.getBeganPairs().size() + sap.getEndedPairs().size();
+        swaps += sap.getSwapCount();
+
+        start = std::chrono::high_resolution_clock::now();
+        int tree_pairs = 0;
+        for (int i = 0 ; i < count ; i++)
+            tree.moveProxy(tree_proxies[i], carBox(cars[i]));
+        for (int i = 0 ; i < count ; i++)
+        {
+            query.clear();
+            tree.queryAabb(carBox(cars[i]), query);
+            for (size_t q = 0 ; q < query.size() ; q++)
+            {
+                int other = tree.getUserData(query[q]);
+                if (other > i && overlap(carBox(cars[i]), carBox(cars[other]))) tree_pairs++;
+            }
+        }
+        tree_ms += millisecondsSince(start);
+
+        if (tick % CHECK_EVERY == 0)
+        {
+            std::vector<BroadphasePair> expected;
+            for (int i = 0 ; i < count ; i++)
+            {
+                Aabb box = carBox(cars[i]);
+                for (int j = i + 1 ; j < count ; j++)
+                {
+                    if (!overlap(box, carBox(cars[j]))) continue;
+                    BroadphasePair pair = {i, j};
+                    expected.push_back(pair);
+                }
+            }
+            const std::vector<BroadphasePair> &found = sap.getPairs();
+            bool same = found.size() == expected.size() && (int)expected.size() == tree_pairs;
+            for (size_t p = 0 ; same && p < found.size() ; p++)
+                same = found[p].a == expected[p].a && found[p].b == expected[p].b;
+            if (!same)
+            {
+                printf("tick %d: %d pairs found, %d expected, %d from the tree\n", tick, (int)found.size(), (int)expected.size(), tree_pairs);
+                correct = false;
+            }
+        }
+    }
+
+    printf("%6d cars  %8.3f ms sap (max %.3f)  %8.3f ms tree  %7.1f pairs  %6.1f began/ended  %8.1f swaps\n", count,
+           sap_ms/ticks, max_sap_ms, tree_ms/ticks, (double)pairs/ticks, (double)events/ticks, (double)swaps/ticks);
+    return correct;
+}
+
+int main(int argc, char** argv)
+{
+    int ticks = (argc > 1) ? atoi(argv[1]) : 600;
+    std::vector<int> counts;
+    for (int a = 2 ; a < argc ; a++)
+        counts.push_back(atoi(argv[a]));
+    if (counts.empty())
+    {
+        counts.push_back(100);
+        counts.push_back(1000);
+        counts.push_back(10000);
+    }
+
+    printf("%d ticks at 120 Hz, times per tick\n", ticks);
+    bool correct = true;
+    for (size_t c = 0 ; c < counts.size() ; c++)
+        correct = run(counts[c], ticks) && correct;
+    if (!correct)
+    {
+        printf("Pairs differ from brute force\n");
+        return 1;
+    }
+    return 0;
+}
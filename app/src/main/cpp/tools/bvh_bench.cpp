@@ -0,0 +1,239 @@
+// Headless check and benchmark for the triangle BVH.
+//
+// Builds a BVH over a wavy terrain grid with loose triangles scattered
+// above it, then casts random rays and sweeps random spheres with every
+// query the BVH has and compares each answer with a loop over all the
+// triangles.  Reports the build time, the tree's size and depth, and the
+// time per query next to the brute force loop.
+//
+//   g++ -O2 -std=c++11 -I.. bvh_bench.cpp ../trianglebvh.cpp ../jobs.cpp -lpthread -o bvh_bench
+//   ./bvh_bench [grid size] [queries]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vector>
+#include <chrono>
+
+#include "trianglebvh.h"
+
+#define LOOSE_TRIANGLES     2000
+#define MAX_DISTANCE        1000.0f
+#define SWEEP_RADIUS        0.7f
+#define TOLERANCE           1e-3f
+
+static float randomFloat(float min, float max)
+{
+    return min + (max - min)*(rand()/(float)RAND_MAX);
+}
+
+static double microsecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Moller-Trumbore written out on its own, so the reference does not share
+// code with the BVH's triangle test
+static bool rayTriangle(const float* v0, const float* v1, const float* v2, const float* origin, const float* dir, float maxT, float &t)
+{
+    float e1[3], e2[3], s[3];
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        e1[k] = v1[k] - v0[k];
+        e2[k] = v2[k] - v0[k];
+        s[k] = origin[k] - v0[k];
+    }
+    float p[3] = {dir[1]*e2[2] - dir[2]*e2[1], dir[2]*e2[0] - dir[0]*e2[2], dir[0]*e2[1] - dir[1]*e2[0]};
+    float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+    if (fabsf(det) < 1e-12f) return false;
+
+    float inverse_det = 1.0f/det;
+    float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2])*inverse_det;
+    if (u < 0 || u > 1) return false;
+    float q[3] = {s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0]};
+    float v = (dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2])*inverse_det;
+    if (v < 0 || u + v > 1) return false;
+    t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2])*inverse_det;
+    return t >= 0 && t <= maxT;
+}
+
+struct Mesh
+{
+    std::vector<float> positions;
+    std::vector<unsigned int> indices;
+
+    int triangleCount() const { return (int)indices.size()/3; }
+    const float* vertex(int t, int v) const { return &positions[indices[t*3+v]*3]; }
+};
+
+static Mesh makeMesh(int size)
+{
+    Mesh mesh;
+    for (int z = 0 ; z <= size ; z++)
+    {
+        for (int x = 0 ; x <= size ; x++)
+        {
+            mesh.positions.push_back((float)x);
+            mesh.positions.push_back(sinf(x*0.1f)*cosf(z*0.13f)*3);
+            mesh.positions.push_back((float)z);
+        }
+    }
+    for (int z = 0 ; z < size ; z++)
+    {
+        for (int x = 0 ; x < size ; x++)
+        {
+            unsigned int a = z*(size+1) + x;
+            unsigned int quad[6] = {a, a+1, a+size+1, a+1, a+size+2, a+size+1};
+            mesh.indices.insert(mesh.indices.end(), quad, quad+6);
+        }
+    }
+    for (int i = 0 ; i < LOOSE_TRIANGLES ; i++)
+    {
+        unsigned int first = (unsigned int)mesh.positions.size()/3;
+        for (int v = 0 ; v < 3 ; v++)
+        {
+            mesh.positions.push_back(randomFloat(0, (float)size));
+            mesh.positions.push_back(randomFloat(-5, 5));
+            mesh.positions.push_back(randomFloat(0, (float)size));
+            mesh.indices.push_back(first + v);
+        }
+    }
+    return mesh;
+}
+
+static void randomRay(int size, float* origin, float* dir)
+{
+    origin[0] = randomFloat(0, (float)size);
+    origin[1] = 20;
+    origin[2] = randomFloat(0, (float)size);
+    dir[0] = randomFloat(-0.5f, 0.5f);
+    dir[1] = -1;
+    dir[2] = randomFloat(-0.5f, 0.5f);
+}
+
+int main(int argc, char** argv)
+{
+    int size = (argc > 1) ? atoi(argv[1]) : 256;
+    int queries = (argc > 2) ? atoi(argv[2]) : 400;
+    srand(size);
+
+    Mesh mesh = makeMesh(size);
+    int count = mesh.triangleCount();
+
+    TriangleBvh bvh;
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    bvh.build(&mesh.positions[0], &mesh.indices[0], count);
+    printf("%d triangles: %d nodes, depth %d, built in %.1f ms\n", count, bvh.getNodeCount(), bvh.getDepth(),
+           microsecondsSince(start)/1000);
+
+    int mismatches = 0;
+    double brute_us = 0, closest_us = 0, any_us = 0;
+    for (int q = 0 ; q < queries ; q++)
+    {
+        float origin[3], dir[3];
+        randomRay(size, origin, dir);
+        if (q % 4 == 0)
+        {
+            // Grazing rays cross many leaves
+            origin[1] = randomFloat(-2, 2);
+            dir[1] = randomFloat(-0.1f, 0.1f);
+        }
+
+        start = std::chrono::high_resolution_clock::now();
+        float best = MAX_DISTANCE;
+        int best_triangle = -1;
+        for (int t = 0 ; t < count ; t++)
+        {
+            float hit_t;
+            if (!rayTriangle(mesh.vertex(t, 0), mesh.vertex(t, 1), mesh.vertex(t, 2), origin, dir, best, hit_t)) continue;
+            best = hit_t;
+            best_triangle = t;
+        }
+        brute_us += microsecondsSince(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        RayHit hit;
+        bool found = bvh.raycast(origin, dir, MAX_DISTANCE, hit);
+        closest_us += microsecondsSince(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        bool blocked = bvh.raycastAny(origin, dir, MAX_DISTANCE);
+        any_us += microsecondsSince(start);
+
+        if (found != (best_triangle >= 0) || (found && fabsf(hit.t - best) > TOLERANCE) || blocked != found)
+        {
+            printf("ray %d: bvh %d at %f, any %d, brute force %d at %f\n", q, hit.triangle, hit.t, blocked, best_triangle, best);
+            mismatches++;
+        }
+    }
+    printf("raycast     %8.2f us   raycastAny %8.2f us   brute force %8.1f us\n",
+           closest_us/queries, any_us/queries, brute_us/queries);
+
+    // Every packet lane must agree with the same ray cast on its own,
+    // including lanes switched off with a negative maxT
+    double packet_us = 0;
+    for (int q = 0 ; q < queries/4 ; q++)
+    {
+        float origins[12], dirs[12], max_t[4];
+        for (int r = 0 ; r < 4 ; r++)
+        {
+            randomRay(size, &origins[r*3], &dirs[r*3]);
+            max_t[r] = (r == 3 && q % 2) ? -1 : MAX_DISTANCE;
+        }
+
+        start = std::chrono::high_resolution_clock::now();
+        RayHit hits[4];
+        bvh.raycastPacket(origins, dirs, max_t, hits);
+        packet_us += microsecondsSince(start);
+
+        for (int r = 0 ; r < 4 ; r++)
+        {
+            RayHit hit;
+            bool found = max_t[r] >= 0 && bvh.raycast(&origins[r*3], &dirs[r*3], max_t[r], hit);
+            if (found != (hits[r].triangle >= 0) || (found && hit.triangle != hits[r].triangle))
+            {
+                printf("packet %d lane %d: %d, on its own %d\n", q, r, hits[r].triangle, found ? hit.triangle : -1);
+                mismatches++;
+            }
+        }
+    }
+    printf("raycastPacket %6.2f us per 4 rays\n", packet_us/(queries/4));
+
+    // Sweeps against a one-triangle BVH per triangle, so only the culling
+    // of the tree is under test
+    int sweeps = queries/10 > 0 ? queries/10 : 1;
+    double sweep_us = 0;
+    for (int q = 0 ; q < sweeps ; q++)
+    {
+        float origin[3], dir[3];
+        randomRay(size, origin, dir);
+
+        start = std::chrono::high_resolution_clock::now();
+        RayHit hit;
+        bvh.sweepSphere(origin, dir, SWEEP_RADIUS, MAX_DISTANCE, hit);
+        sweep_us += microsecondsSince(start);
+
+        float best = MAX_DISTANCE;
+        for (int t = 0 ; t < count ; t++)
+        {
+            TriangleBvh single;
+            single.build(&mesh.positions[0], &mesh.indices[t*3], 1);
+            RayHit single_hit;
+            if (single.sweepSphere(origin, dir, SWEEP_RADIUS, best, single_hit)) best = single_hit.t;
+        }
+        if (fabsf((hit.triangle >= 0 ? hit.t : MAX_DISTANCE) - best) > TOLERANCE)
+        {
+            printf("sweep %d: bvh %f, brute force %f\n", q, hit.t, best);
+            mismatches++;
+        }
+    }
+    printf("sweepSphere %8.2f us\n", sweep_us/sweeps);
+
+    if (mismatches)
+    {
+        printf("%d queries differ from brute force\n", mismatches);
+        return 1;
+    }
+    return 0;
+}
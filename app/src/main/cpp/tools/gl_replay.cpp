@@ -0,0 +1,77 @@
+// Replays a GL call recording made on a device (see StartGlRecording in
+// gl_code.cpp) into the null backend and reports how many calls of each
+// kind every frame issued, plus the time the replay itself took.  With
+// -rerecord the replayed stream is also written back out through the
+// recorder, with the object names the null backend handed out.
+//
+//   g++ -O2 -std=c++11 -I.. gl_replay.cpp ../glbackend.cpp -o gl_replay
+//   adb shell run-as com.android.gl2jni cat cache/gl_recording.bin > gl_recording.bin
+//   ./gl_replay [-rerecord out.bin] gl_recording.bin [repeats]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "glbackend.h"
+
+GlBackend* gGL = NULL;
+
+int main(int argc, char** argv)
+{
+    const char* rerecord = NULL;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-rerecord") == 0)
+    {
+        rerecord = argv[arg+1];
+        arg += 2;
+    }
+    if (arg >= argc)
+    {
+        fprintf(stderr, "usage: %s [-rerecord out.bin] recording.bin [repeats]\n", argv[0]);
+        return 1;
+    }
+    const char* path = argv[arg];
+    int repeats = (arg + 1 < argc) ? atoi(argv[arg+1]) : 1;
+    if (repeats < 1) repeats = 1;
+
+    NullGlBackend null_backend;
+    int frames = 0;
+    double seconds = 0;
+    for (int r = 0 ; r < repeats ; r++)
+    {
+        null_backend.resetCounts();
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        frames = replayGlRecording(path, null_backend);
+        seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        if (frames < 0)
+        {
+            fprintf(stderr, "%s is not a valid recording\n", path);
+            return 1;
+        }
+    }
+
+    printf("%d frames, %d calls\n", frames, null_backend.getTotalCount());
+    for (int call = 0 ; call < GL_CALL_END_FRAME ; call++)
+    {
+        int count = null_backend.getCount(call);
+        if (count == 0) continue;
+        printf("  %-28s %9d  %8.1f per frame\n", getGlCallName(call), count, frames ? (double)count/frames : 0.0);
+    }
+    printf("Replay: %.3f ms per pass\n", seconds*1000.0/repeats);
+
+    if (rerecord)
+    {
+        NullGlBackend target;
+        RecordingGlBackend recorder(&target);
+        if (!recorder.open(rerecord) || replayGlRecording(path, recorder) < 0)
+        {
+            fprintf(stderr, "Could not rerecord to %s\n", rerecord);
+            return 1;
+        }
+        recorder.close();
+        printf("Rerecorded to %s\n", rerecord);
+    }
+    return 0;
+}
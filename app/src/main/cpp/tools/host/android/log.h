@@ -0,0 +1,15 @@
+#ifndef HOST_ANDROID_LOG_H
+#define HOST_ANDROID_LOG_H
+
+// The logging call of the NDK, the host tool that builds the native code
+// defines it
+
+enum
+{
+    ANDROID_LOG_INFO = 4,
+    ANDROID_LOG_ERROR = 6
+};
+
+int __android_log_print(int prio, const char* tag, const char* fmt, ...);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef HOST_JNI_H
+#define HOST_JNI_H
+
+// Just enough of JNI to call the GL2JNILib entry points of gl_code.cpp from
+// a host tool.  Java strings and arrays are plain structs the tool fills in
+// itself, and the environment hands their contents out without copying.
+
+#define JNIEXPORT
+#define JNICALL
+#define JNI_ABORT   2
+
+typedef unsigned char jboolean;
+typedef signed char jbyte;
+typedef int jint;
+typedef float jfloat;
+
+struct _jobject {};
+struct _jstring : _jobject
+{
+    const char* chars;
+};
+struct _jarray : _jobject
+{
+    void* elements;
+    jint length;                        // In elements
+};
+
+typedef _jobject* jobject;
+typedef _jstring* jstring;
+typedef _jarray* jbyteArray;
+typedef _jarray* jintArray;
+
+struct JNIEnv
+{
+    jint GetArrayLength(_jarray* array) { return array->length; }
+
+    jbyte* GetByteArrayElements(jbyteArray array, jboolean* isCopy)
+    {
+        if (isCopy) *isCopy = 0;
+        return (jbyte*)array->elements;
+    }
+    void ReleaseByteArrayElements(jbyteArray array, jbyte* elements, jint mode) {}
+
+    jint* GetIntArrayElements(jintArray array, jboolean* isCopy)
+    {
+        if (isCopy) *isCopy = 0;
+        return (jint*)array->elements;
+    }
+
+    const char* GetStringUTFChars(jstring string, jboolean* isCopy)
+    {
+        if (isCopy) *isCopy = 0;
+        return string->chars;
+    }
+    void ReleaseStringUTFChars(jstring string, const char* chars) {}
+};
+
+#endif
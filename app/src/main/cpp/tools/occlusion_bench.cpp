@@ -0,0 +1,194 @@
+// Headless benchmark for the software occlusion culler.
+//
+// Builds a synthetic town of box houses on a grid, walks a street-level
+// camera through it and reports, per frame, the time spent rasterizing the
+// nearby houses as occluders and testing every house against the buffer,
+// next to the number of draw calls that would be saved.
+//
+//   g++ -O2 -std=c++11 -I.. occlusion_bench.cpp ../occlusion.cpp -o occlusion_bench
+//   ./occlusion_bench [grid size] [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+#include <chrono>
+
+#include "occlusion.h"
+
+#define HOUSE_SIZE      8.0f
+#define HOUSE_HEIGHT    6.0f
+#define HOUSE_SPACING   14.0f
+#define OCCLUDER_RANGE  60.0f
+
+// Column-major matrices, laid out like glm's
+static void multiply(float* out, const float* a, const float* b)
+{
+    float r[16];
+    for (int c = 0 ; c < 4 ; c++)
+        for (int k = 0 ; k < 4 ; k++)
+            r[c*4+k] = a[k]*b[c*4] + a[4+k]*b[c*4+1] + a[8+k]*b[c*4+2] + a[12+k]*b[c*4+3];
+    memcpy(out, r, sizeof(r));
+}
+
+static void perspective(float* m, float fovy, float aspect, float near, float far)
+{
+    float t = tanf(fovy*0.5f);
+    memset(m, 0, sizeof(float)*16);
+    m[0] = 1.0f/(aspect*t);
+    m[5] = 1.0f/t;
+    m[10] = -(far+near)/(far-near);
+    m[11] = -1.0f;
+    m[14] = -2.0f*far*near/(far-near);
+}
+
+static void lookAt(float* m, const float* eye, const float* center)
+{
+    float f[3] = {center[0]-eye[0], center[1]-eye[1], center[2]-eye[2]};
+    float fl = sqrtf(f[0]*f[0] + f[1]*f[1] + f[2]*f[2]);
+    for (int k = 0 ; k < 3 ; k++) f[k] /= fl;
+    float s[3] = {-f[2], 0, f[0]};     // f x (0, 1, 0)
+    float sl = sqrtf(s[0]*s[0] + s[2]*s[2]);
+    s[0] /= sl; s[2] /= sl;
+    float u[3] = {s[1]*f[2]-s[2]*f[1], s[2]*f[0]-s[0]*f[2], s[0]*f[1]-s[1]*f[0]};
+
+    memset(m, 0, sizeof(float)*16);
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        m[k*4+0] = s[k];
+        m[k*4+1] = u[k];
+        m[k*4+2] = -f[k];
+    }
+    m[12] = -(s[0]*eye[0] + s[1]*eye[1] + s[2]*eye[2]);
+    m[13] = -(u[0]*eye[0] + u[1]*eye[1] + u[2]*eye[2]);
+    m[14] = f[0]*eye[0] + f[1]*eye[1] + f[2]*eye[2];
+    m[15] = 1.0f;
+}
+
+static void appendBox(std::vector<float> &positions, std::vector<unsigned int> &indices, const float* box)
+{
+    static const unsigned int faces[36] = {
+        0,1,3, 0,3,2, 4,6,7, 4,7,5, 0,4,5, 0,5,1,
+        2,3,7, 2,7,6, 0,2,6, 0,6,4, 1,5,7, 1,7,3 };
+    unsigned int base = (unsigned int)positions.size()/3;
+    for (int corner = 0 ; corner < 8 ; corner++)
+    {
+        positions.push_back(box[(corner & 1) ? 3 : 0]);
+        positions.push_back(box[(corner & 2) ? 4 : 1]);
+        positions.push_back(box[(corner & 4) ? 5 : 2]);
+    }
+    for (int i = 0 ; i < 36 ; i++)
+        indices.push_back(base + faces[i]);
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A wall right in front of the camera must hide a box behind it and not
+// one in front of it
+static bool selfCheck()
+{
+    float projection[16], view[16], vp[16];
+    float eye[3] = {0, 0, 0}, center[3] = {0, 0, -1};
+    perspective(projection, 1.5f, 2.0f, 0.1f, 100.0f);
+    lookAt(view, eye, center);
+    multiply(vp, projection, view);
+
+    std::vector<float> positions;
+    std::vector<unsigned int> indices;
+    float wall[6] = {-5, -5, -11, 5, 5, -10};
+    appendBox(positions, indices, wall);
+
+    OcclusionBuffer buffer(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+    buffer.drawMesh(vp, &positions[0], (int)positions.size()/3, &indices[0], (int)indices.size());
+
+    float behind[6] = {-1, -1, -30, 1, 1, -28};
+    float in_front[6] = {-1, -1, -6, 1, 1, -4};
+    float beside[6] = {20, -1, -30, 22, 1, -28};
+    return !buffer.testBox(vp, behind) && buffer.testBox(vp, in_front) && buffer.testBox(vp, beside);
+}
+
+int main(int argc, char** argv)
+{
+    int grid = (argc > 1) ? atoi(argv[1]) : 32;
+    int frames = (argc > 2) ? atoi(argv[2]) : 200;
+
+    if (!selfCheck())
+    {
+        printf("Self check failed\n");
+        return 1;
+    }
+
+    // Houses on both sides of streets running along z
+    std::vector<float> houses;
+    for (int gx = 0 ; gx < grid ; gx++)
+    {
+        for (int gz = 0 ; gz < grid ; gz++)
+        {
+            float x = gx*HOUSE_SPACING, z = gz*HOUSE_SPACING;
+            float box[6] = {x, 0, z, x+HOUSE_SIZE, HOUSE_HEIGHT, z+HOUSE_SIZE};
+            houses.insert(houses.end(), box, box + 6);
+        }
+    }
+    int num_houses = grid*grid;
+
+    float projection[16];
+    perspective(projection, 1.5f, 16.0f/9.0f, 0.1f, 1000.0f);
+
+    OcclusionBuffer buffer(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+    std::vector<float> positions;
+    std::vector<unsigned int> indices;
+
+    double raster_ms = 0, test_ms = 0;
+    long long occluders = 0, triangles = 0, occluded = 0;
+    float street_x = HOUSE_SIZE + (HOUSE_SPACING - HOUSE_SIZE)*0.5f;
+
+    for (int f = 0 ; f < frames ; f++)
+    {
+        // Walk down a street, looking slightly sideways
+        float t = (float)f / frames;
+        float eye[3] = {street_x, 1.7f, t*grid*HOUSE_SPACING*0.8f};
+        float center[3] = {eye[0] + 0.3f*sinf(t*20), 1.7f, eye[2] + 1.0f};
+        float view[16], vp[16];
+        lookAt(view, eye, center);
+        multiply(vp, projection, view);
+
+        positions.clear();
+        indices.clear();
+        for (int h = 0 ; h < num_houses ; h++)
+        {
+            const float* box = &houses[h*6];
+            float dx = (box[0]+box[3])*0.5f - eye[0], dz = (box[2]+box[5])*0.5f - eye[2];
+            if (dx*dx + dz*dz < OCCLUDER_RANGE*OCCLUDER_RANGE)
+            {
+                appendBox(positions, indices, box);
+                occluders++;
+            }
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        buffer.clear();
+        if (!indices.empty())
+            buffer.drawMesh(vp, &positions[0], (int)positions.size()/3, &indices[0], (int)indices.size());
+        raster_ms += elapsedMs(start);
+        triangles += buffer.stats.occluderTriangles;
+
+        start = std::chrono::steady_clock::now();
+        for (int h = 0 ; h < num_houses ; h++)
+        {
+            if (!buffer.testBox(vp, &houses[h*6])) occluded++;
+        }
+        test_ms += elapsedMs(start);
+    }
+
+    printf("%d houses, %dx%d depth buffer, %d frames\n", num_houses, buffer.getWidth(), buffer.getHeight(), frames);
+    printf("occluders/frame      %.1f (%.1f triangles rasterized)\n", (double)occluders/frames, (double)triangles/frames);
+    printf("raster ms/frame      %.3f\n", raster_ms/frames);
+    printf("test ms/frame        %.3f (%.1f ns per box)\n", test_ms/frames, test_ms*1e6/((double)frames*num_houses));
+    printf("draw calls saved     %.1f of %d per frame (%.1f%%)\n", (double)occluded/frames, num_houses, 100.0*occluded/((double)frames*num_houses));
+    return 0;
+}
@@ -0,0 +1,344 @@
+// Offline potentially visible set baker.
+//
+// Loads the models and a map file, then for every map section casts rays
+// from random points inside the section (at a few eye heights) against the
+// triangles of every placed item.  Items hit by a ray and the sections the
+// ray crosses before the hit are marked visible from that section.  Items
+// and sections around the section itself are always visible, which covers
+// what sparse sampling misses up close.  The result is written as bitsets
+// (see pvs.h) and loaded by the game with GL2JNILib.loadPVS.
+//
+//   g++ -O2 -std=c++11 -I.. pvs_bake.cpp ../pvs.cpp ../map.cpp ../aabbtree.cpp
+//       ../cull.cpp ../jobs.cpp ../3ds.cpp -lpthread -o pvs_bake
+//   ./pvs_bake [-points N] [-rays N] map.txt map.pvs tire.3ds wagen.3ds house.3ds ...
+//
+// Models must be listed in the order the game loads them, so that the
+// model ids of the map file match.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+#include <string>
+
+#include "3ds.h"
+#include "map.h"
+#include "pvs.h"
+#include "aabbtree.h"
+#include "jobs.h"
+
+#define DEFAULT_POINTS      32          // Sample points per section
+#define DEFAULT_RAYS        512         // Rays per sample point
+#define MAX_RAY_DISTANCE    1000.0f
+
+static const float gEyeHeights[] = {0.2f, 1.0f, 2.5f};
+#define NUM_EYE_HEIGHTS (int)(sizeof(gEyeHeights)/sizeof(gEyeHeights[0]))
+
+struct BakeModel
+{
+    std::vector<float> positions;       // 9 floats per triangle
+    float box[6];
+};
+
+// Loading progress the 3DS loader reports to the game
+volatile int gTotalBytes = 1;
+volatile int gLoadedBytes = 0;
+volatile unsigned char gLoadingPercent = 0;
+
+static std::vector<BakeModel> gModels;
+static std::vector<MapItem> gItems;
+static AabbTree gTree;
+static float gSceneBottom = 0;          // Height range of all items
+static float gSceneTop = 0;
+
+static bool readFile(std::vector<char> &data, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data.resize(size + 1);
+    bool ok = fread(&data[0], 1, size, file) == (size_t)size;
+    data[size] = 0;
+    data.resize(size);
+    fclose(file);
+    return ok;
+}
+
+static bool loadModel(BakeModel &model, const char* path)
+{
+    std::vector<char> data;
+    if (!readFile(data, path) || data.empty()) return false;
+
+    t3DModel source;
+    source.numOfObjects = 0;
+    source.numOfMaterials = 0;
+    CLoad3DS loader;
+    if (!loader.Import3DS(&source, &data[0])) return false;
+
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        model.box[k] = 1e30f;
+        model.box[k+3] = -1e30f;
+    }
+    for (int i = 0 ; i < source.numOfObjects ; i++)
+    {
+        const t3DObject &object = source.pObject[i];
+        for (int f = 0 ; f < object.numOfFaces ; f++)
+        {
+            for (int v = 0 ; v < 3 ; v++)
+            {
+                const CVector3 &p = object.pVerts[object.pFaces[f].vertIndex[v]];
+                float xyz[3] = {p.x, p.y, p.z};
+                for (int k = 0 ; k < 3 ; k++)
+                {
+                    model.positions.push_back(xyz[k]);
+                    if (xyz[k] < model.box[k]) model.box[k] = xyz[k];
+                    if (xyz[k] > model.box[k+3]) model.box[k+3] = xyz[k];
+                }
+            }
+        }
+    }
+    return !model.positions.empty();
+}
+
+// Moller-Trumbore, returns the hit distance or -1
+static float intersectTriangle(const float* origin, const float* dir, const float* v0, const float* v1, const float* v2)
+{
+    float e1[3] = {v1[0]-v0[0], v1[1]-v0[1], v1[2]-v0[2]};
+    float e2[3] = {v2[0]-v0[0], v2[1]-v0[1], v2[2]-v0[2]};
+    float p[3] = {dir[1]*e2[2]-dir[2]*e2[1], dir[2]*e2[0]-dir[0]*e2[2], dir[0]*e2[1]-dir[1]*e2[0]};
+    float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+    if (fabsf(det) < 1e-12f) return -1;
+
+    float inverse_det = 1.0f/det;
+    float s[3] = {origin[0]-v0[0], origin[1]-v0[1], origin[2]-v0[2]};
+    float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inverse_det;
+    if (u < 0 || u > 1) return -1;
+
+    float q[3] = {s[1]*e1[2]-s[2]*e1[1], s[2]*e1[0]-s[0]*e1[2], s[0]*e1[1]-s[1]*e1[0]};
+    float v = (dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2]) * inverse_det;
+    if (v < 0 || u + v > 1) return -1;
+
+    return (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) * inverse_det;
+}
+
+// Closest item hit by the ray, or -1.  Rays are moved into the item's
+// model space with the direction scaled along, so distances stay in world
+// units.
+static int castRay(const float* origin, const float* dir, float &distance)
+{
+    int closest = -1;
+    distance = MAX_RAY_DISTANCE;
+    gTree.queryRay(origin, dir, MAX_RAY_DISTANCE, [&](int proxy, float max_t) -> float
+    {
+        int item_id = gTree.getUserData(proxy);
+        const MapItem &item = gItems[item_id];
+        const BakeModel &model = gModels[item.model_id];
+
+        float local_origin[3], local_dir[3];
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            local_origin[k] = (origin[k] - item.position[k]) / ITEM_SCALE;
+            local_dir[k] = dir[k] / ITEM_SCALE;
+        }
+
+        const float* p = &model.positions[0];
+        for (size_t t = 0 ; t < model.positions.size() ; t += 9)
+        {
+            float hit = intersectTriangle(local_origin, local_dir, &p[t], &p[t+3], &p[t+6]);
+            if (hit > 0 && hit < max_t)
+            {
+                max_t = hit;
+                closest = item_id;
+            }
+        }
+        distance = max_t;
+        return max_t;
+    });
+    return closest;
+}
+
+// Same rounding as GetMapSection in gl_code.cpp
+static void sectionOf(const float* position, int &x_id, int &y_id)
+{
+    x_id = (int)floorf((position[0] - MAP_ORIGIN) / MAP_SECTION_SIZE);
+    y_id = (int)floorf((position[2] - MAP_ORIGIN) / MAP_SECTION_SIZE);
+}
+
+// Marks the sections the ray crosses up to distance, as long as it is low
+// enough to see anything standing in them
+static void markSections(unsigned int* row, const float* origin, const float* dir, float distance)
+{
+    float step = MAP_SECTION_SIZE * 0.25f;
+    for (float t = 0 ; t <= distance ; t += step)
+    {
+        float p[3] = {origin[0] + dir[0]*t, origin[1] + dir[1]*t, origin[2] + dir[2]*t};
+        if ((p[1] > gSceneTop && dir[1] >= 0) || (p[1] < gSceneBottom && dir[1] <= 0)) break;
+        int x_id, y_id;
+        sectionOf(p, x_id, y_id);
+        if (x_id < 0 || y_id < 0 || x_id >= MAP_SECTIONS || y_id >= MAP_SECTIONS)
+        {
+            // Past the grid on the ray's way out, nothing more to mark
+            if ((x_id < 0 && dir[0] <= 0) || (x_id >= MAP_SECTIONS && dir[0] >= 0) ||
+                (y_id < 0 && dir[2] <= 0) || (y_id >= MAP_SECTIONS && dir[2] >= 0)) break;
+            continue;
+        }
+        pvsSet(row, x_id*MAP_SECTIONS + y_id);
+    }
+}
+
+static float random01(unsigned int &state)
+{
+    state = state*1664525u + 1013904223u;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+static void bakeSection(PvsData &pvs, int section, int points, int rays)
+{
+    int x_id = section / MAP_SECTIONS;
+    int y_id = section % MAP_SECTIONS;
+    unsigned int* section_row = &pvs.sectionBits[section*pvs.sectionWords];
+    unsigned int* item_row = pvs.itemWords ? &pvs.itemBits[section*pvs.itemWords] : NULL;
+    unsigned int seed = 12345u + section*7919u;
+
+    float x0 = MAP_ORIGIN + x_id*MAP_SECTION_SIZE;
+    float z0 = MAP_ORIGIN + y_id*MAP_SECTION_SIZE;
+
+    // The section, its neighbors and everything touching them
+    Aabb near_box;
+    near_box.min[0] = x0 - MAP_SECTION_SIZE;
+    near_box.max[0] = x0 + 2*MAP_SECTION_SIZE;
+    near_box.min[1] = -1e30f;
+    near_box.max[1] = 1e30f;
+    near_box.min[2] = z0 - MAP_SECTION_SIZE;
+    near_box.max[2] = z0 + 2*MAP_SECTION_SIZE;
+    for (int dx = -1 ; dx <= 1 ; dx++)
+    {
+        for (int dy = -1 ; dy <= 1 ; dy++)
+        {
+            int nx = x_id + dx, ny = y_id + dy;
+            if (nx >= 0 && ny >= 0 && nx < MAP_SECTIONS && ny < MAP_SECTIONS)
+                pvsSet(section_row, nx*MAP_SECTIONS + ny);
+        }
+    }
+    std::vector<int> near_items;
+    gTree.queryAabb(near_box, near_items);
+    for (size_t i = 0 ; i < near_items.size() ; i++)
+        pvsSet(item_row, gTree.getUserData(near_items[i]));
+
+    for (int p = 0 ; p < points ; p++)
+    {
+        float origin[3] = {x0 + random01(seed)*MAP_SECTION_SIZE, gEyeHeights[p % NUM_EYE_HEIGHTS], z0 + random01(seed)*MAP_SECTION_SIZE};
+        for (int r = 0 ; r < rays ; r++)
+        {
+            // Uniform direction on the sphere
+            float z = random01(seed)*2.0f - 1.0f;
+            float angle = random01(seed)*6.2831853f;
+            float radius = sqrtf(1.0f - z*z);
+            float dir[3] = {radius*cosf(angle), z, radius*sinf(angle)};
+
+            float distance;
+            int item = castRay(origin, dir, distance);
+            if (item >= 0)
+                pvsSet(item_row, item);
+            markSections(section_row, origin, dir, distance);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int points = DEFAULT_POINTS;
+    int rays = DEFAULT_RAYS;
+    int arg = 1;
+    while (arg + 1 < argc && argv[arg][0] == '-')
+    {
+        if (!strcmp(argv[arg], "-points")) points = atoi(argv[arg+1]);
+        else if (!strcmp(argv[arg], "-rays")) rays = atoi(argv[arg+1]);
+        else break;
+        arg += 2;
+    }
+    if (argc - arg < 3)
+    {
+        printf("usage: %s [-points N] [-rays N] map.txt out.pvs model0.3ds [model1.3ds ...]\n", argv[0]);
+        return 1;
+    }
+
+    const char* map_path = argv[arg];
+    const char* out_path = argv[arg+1];
+    for (int m = arg + 2 ; m < argc ; m++)
+    {
+        BakeModel model;
+        if (!loadModel(model, argv[m]))
+        {
+            printf("Could not load %s\n", argv[m]);
+            return 1;
+        }
+        printf("Model %d: %s, %d triangles\n", (int)gModels.size(), argv[m], (int)model.positions.size()/9);
+        gModels.push_back(model);
+    }
+
+    std::vector<char> text;
+    if (!readFile(text, map_path) || !parseMap(gItems, text.empty() ? "" : &text[0], (int)text.size()))
+    {
+        printf("Could not read map %s\n", map_path);
+        return 1;
+    }
+
+    for (size_t i = 0 ; i < gItems.size() ; i++)
+    {
+        const MapItem &item = gItems[i];
+        if (item.model_id < 0 || item.model_id >= (int)gModels.size())
+        {
+            printf("Item %d uses unknown model %d\n", (int)i, item.model_id);
+            return 1;
+        }
+
+        float matrix[16], world_box[6];
+        mapItemMatrix(matrix, item.position);
+        transformBox(world_box, matrix, gModels[item.model_id].box);
+        Aabb box;
+        for (int k = 0 ; k < 3 ; k++)
+        {
+            box.min[k] = world_box[k];
+            box.max[k] = world_box[k+3];
+        }
+        gTree.createProxy(box, (int)i);
+
+        if (i == 0 || box.min[1] < gSceneBottom) gSceneBottom = box.min[1];
+        if (i == 0 || box.max[1] > gSceneTop) gSceneTop = box.max[1];
+    }
+
+    PvsData pvs;
+    float min_height = gEyeHeights[0], max_height = gEyeHeights[0];
+    for (int h = 1 ; h < NUM_EYE_HEIGHTS ; h++)
+    {
+        min_height = fminf(min_height, gEyeHeights[h]);
+        max_height = fmaxf(max_height, gEyeHeights[h]);
+    }
+    initPvs(pvs, MAP_SECTIONS, (int)gItems.size(), MAP_ORIGIN, MAP_SECTION_SIZE, min_height, max_height);
+    parallelFor(MAP_SECTIONS*MAP_SECTIONS, [&](int section) { bakeSection(pvs, section, points, rays); });
+
+    long long visible_items = 0, visible_sections = 0;
+    for (int s = 0 ; s < MAP_SECTIONS*MAP_SECTIONS ; s++)
+    {
+        for (int i = 0 ; i < pvs.header.numItems ; i++)
+            visible_items += pvsTest(&pvs.itemBits[s*pvs.itemWords], i);
+        for (int c = 0 ; c < MAP_SECTIONS*MAP_SECTIONS ; c++)
+            visible_sections += pvsTest(&pvs.sectionBits[s*pvs.sectionWords], c);
+    }
+    printf("%d items, %d sections: on average %.1f items and %.1f sections visible per section\n",
+           (int)gItems.size(), MAP_SECTIONS*MAP_SECTIONS,
+           (double)visible_items/(MAP_SECTIONS*MAP_SECTIONS), (double)visible_sections/(MAP_SECTIONS*MAP_SECTIONS));
+
+    if (!writePvs(pvs, out_path))
+    {
+        printf("Could not write %s\n", out_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,261 @@
+// Headless benchmark of the whole renderer on the null GL backend.
+//
+// Goes through the same JNI entry points the Java side calls, in the same
+// order: the tire for the loading screen, then every texture and model of
+// the game, then the loading screen until the game starts.  The game is
+// then rendered for a number of frames with the camera turning, and the
+// time per frame is reported with the GL calls each frame issued.  The
+// JPEGs are not decoded, every texture is a small grey placeholder.
+// Finally every model is unloaded and uploaded again, which has to reuse
+// the heap space it gave back.
+//
+// gl_code.cpp is compiled into this file, so the tool can tell when the
+// loading screen is done.  host/ stands in for the NDK's jni.h and log.h,
+// and glm comes from the NDK as in CMakeLists.txt.
+//
+//   g++ -O2 -std=c++11 -I.. -Ihost -I$NDK/sources/third_party/vulkan/src/libs render_bench.cpp \
+//       ../3ds.cpp ../texture.cpp ../shaders.cpp ../programcache.cpp ../meshopt.cpp ../jobs.cpp \
+//       ../simplify.cpp ../cull.cpp ../aabbtree.cpp ../occlusion.cpp ../map.cpp ../pvs.cpp \
+//       ../renderqueue.cpp ../glstate.cpp ../glbackend.cpp ../gldebug.cpp ../staticbatch.cpp \
+//       ../geometryheap.cpp ../streambuffer.cpp ../drawlist.cpp ../transform.cpp ../scenegraph.cpp \
+//       ../entities.cpp ../simulation.cpp ../trianglebvh.cpp ../broadphase.cpp -lpthread -o render_bench
+//   ./render_bench [-v] app/src/main/res/raw [frames] [map.txt] [map.pvs]
+
+#include <stdarg.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "../gl_code.cpp"
+
+#define BENCH_WIDTH             1280
+#define BENCH_HEIGHT            720
+#define BENCH_WARMUP_FRAMES     60      // Compile the variants and build the static batches
+#define BENCH_TURN              0.05f   // dx of a finger held right of center
+#define PLACEHOLDER_SIZE        4
+#define LOADING_FRAME_USEC      16667   // The loading screen animates in real time
+
+GlBackend* gGL = NULL;
+
+static bool gVerbose = false;
+
+int __android_log_print(int prio, const char* tag, const char* fmt, ...)
+{
+    if (!gVerbose && prio < ANDROID_LOG_ERROR) return 0;
+
+    va_list args;
+    va_start(args, fmt);
+    int written = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return written;
+}
+
+// The resources GL2JNIView loads, by the names it passes
+static const char* gTextureNames[] = {
+    "barrel.jpg", "bench.jpg", "cargo_wo.jpg",
+    "house_col", "house_nor", "house_spec",
+    "house2_col", "house2_nor", "house2_spec",
+    "tent_col", "tent_nor", "tent_spec",
+    "wagen_1.jpg", "ground_grass_3264_4062_small.jpg", "1.BMP", "2.BMP",
+};
+
+struct BenchModel
+{
+    const char* file;
+    const char* name;
+    bool external;
+};
+
+static const BenchModel gModels[] = {
+    {"wagen.3ds", "wagen", false},
+    {"house.3ds", "house", true},
+    {"house2.3ds", "house2", true},
+    {"model_barrel.3ds", "barrel", false},
+    {"model_bench.3ds", "bench", false},
+    {"model_box.3ds", "box", false},
+    {"tent.3ds", "tent", true},
+    {"mount.3ds", "mount", false},
+    {"tuktuk.3ds", "tuktuk", false},
+};
+
+static bool readFile(const char* path, std::vector<char> &data)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    fseek(file, 0, SEEK_END);
+    data.resize(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    bool read = data.empty() || fread(&data[0], 1, data.size(), file) == data.size();
+    fclose(file);
+    return read;
+}
+
+static void loadPlaceholderTexture(JNIEnv* env, const char* name)
+{
+    static jint pixels[PLACEHOLDER_SIZE*PLACEHOLDER_SIZE];
+    for (int i = 0 ; i < PLACEHOLDER_SIZE*PLACEHOLDER_SIZE ; i++)
+        pixels[i] = 0xFF808080;
+
+    _jstring string;
+    string.chars = name;
+    _jarray array;
+    array.elements = pixels;
+    array.length = PLACEHOLDER_SIZE*PLACEHOLDER_SIZE;
+    Java_com_android_gl2jni_GL2JNILib_loadRAW(env, NULL, &string, PLACEHOLDER_SIZE, PLACEHOLDER_SIZE, 0, &array);
+}
+
+static bool loadModelFile(JNIEnv* env, const char* directory, const BenchModel &model)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", directory, model.file);
+    std::vector<char> data;
+    if (!readFile(path, data))
+    {
+        fprintf(stderr, "Could not read %s\n", path);
+        return false;
+    }
+
+    _jstring string;
+    string.chars = model.name;
+    _jarray array;
+    array.elements = &data[0];
+    array.length = (jint)data.size();
+    Java_com_android_gl2jni_GL2JNILib_loadModel(env, NULL, &string, &array, model.external);
+    return true;
+}
+
+// Hands a whole file to one of the loaders that only take a buffer
+static bool loadBufferFile(JNIEnv* env, const char* path, void (*loader)(JNIEnv*, jobject, jbyteArray))
+{
+    std::vector<char> data;
+    if (!readFile(path, data))
+    {
+        fprintf(stderr, "Could not read %s\n", path);
+        return false;
+    }
+
+    _jarray array;
+    array.elements = &data[0];
+    array.length = (jint)data.size();
+    loader(env, NULL, &array);
+    return true;
+}
+
+// Releasing a model must return its range to the geometry heap, and
+// uploading it again must fit in the space that freed
+static bool checkModelReuse()
+{
+    FinishFramePrepare();
+    for (int i = 0 ; i < gNumModelArrayInfos ; i++)
+    {
+        size_t used = gGeometryHeap.getUsedBytes();
+        size_t capacity = gGeometryHeap.getCapacityBytes();
+        releaseBuffersForModel(i);
+        size_t released = gGeometryHeap.getUsedBytes();
+        bool freed = gModelArrayInfos[i].geometry.page < 0 && released < used;
+
+        createBuffersForModel(i);
+        if (!freed || gGeometryHeap.getUsedBytes() != used || gGeometryHeap.getCapacityBytes() > capacity)
+        {
+            printf("Model %d: %d bytes used, %d once released, %d uploaded again, capacity %d -> %d\n", i, (int)used, (int)released,
+                   (int)gGeometryHeap.getUsedBytes(), (int)capacity, (int)gGeometryHeap.getCapacityBytes());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void step(JNIEnv* env, float dx)
+{
+    Java_com_android_gl2jni_GL2JNILib_step(env, NULL, dx, 0, 0, 1);
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-v") == 0)
+    {
+        gVerbose = true;
+        arg++;
+    }
+    if (arg >= argc)
+    {
+        fprintf(stderr, "usage: %s [-v] resource_dir [frames] [map.txt] [map.pvs]\n", argv[0]);
+        return 1;
+    }
+    const char* directory = argv[arg];
+    int frames = (arg + 1 < argc) ? atoi(argv[arg+1]) : 600;
+    const char* map_path = (arg + 2 < argc) ? argv[arg+2] : NULL;
+    const char* pvs_path = (arg + 3 < argc) ? argv[arg+3] : NULL;
+    if (frames < 1) frames = 1;
+
+    NullGlBackend null_backend;
+    gGL = &null_backend;
+    JNIEnv env;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    // What the view does before the loading thread starts
+    loadPlaceholderTexture(&env, "OBJ_TYRE.TGA");
+    BenchModel tire = {"tire.3ds", "tire", false};
+    if (!loadModelFile(&env, directory, tire)) return 1;
+    Java_com_android_gl2jni_GL2JNILib_init(&env, NULL);
+    Java_com_android_gl2jni_GL2JNILib_resize(&env, NULL, BENCH_WIDTH, BENCH_HEIGHT);
+
+    int num_textures = sizeof(gTextureNames)/sizeof(gTextureNames[0]);
+    for (int i = 0 ; i < num_textures ; i++)
+        loadPlaceholderTexture(&env, gTextureNames[i]);
+    Java_com_android_gl2jni_GL2JNILib_doneLoadingTextures(&env, NULL);
+    while (loading_state == BINDING_TEXTURES)
+        step(&env, 0);
+
+    int num_models = sizeof(gModels)/sizeof(gModels[0]);
+    for (int i = 0 ; i < num_models ; i++)
+    {
+        if (!loadModelFile(&env, directory, gModels[i])) return 1;
+    }
+    if (map_path && !loadBufferFile(&env, map_path, Java_com_android_gl2jni_GL2JNILib_loadMap)) return 1;
+    if (pvs_path && !loadBufferFile(&env, pvs_path, Java_com_android_gl2jni_GL2JNILib_loadPVS)) return 1;
+    Java_com_android_gl2jni_GL2JNILib_doneLoadingModels(&env, NULL);
+
+    int loading_frames = 0;
+    while (game_state == LOADING_SCREEN)
+    {
+        step(&env, 0);
+        loading_frames++;
+        if (loading_state == FINISHED_LOADING) usleep(LOADING_FRAME_USEC);
+    }
+    printf("Loaded %d models, %d items in %.1f ms and %d loading screen frames\n", gNumModelArrayInfos, gItems.getCount(),
+           std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count(), loading_frames);
+
+    for (int i = 0 ; i < BENCH_WARMUP_FRAMES ; i++)
+        step(&env, BENCH_TURN);
+
+    null_backend.resetCounts();
+    double total_ms = 0, max_ms = 0;
+    for (int i = 0 ; i < frames ; i++)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        step(&env, BENCH_TURN);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        total_ms += ms;
+        if (ms > max_ms) max_ms = ms;
+    }
+
+    printf("%d frames, %d calls\n", frames, null_backend.getTotalCount());
+    for (int call = 0 ; call < GL_CALL_END_FRAME ; call++)
+    {
+        int count = null_backend.getCount(call);
+        if (count == 0) continue;
+        printf("  %-28s %9d  %8.1f per frame\n", getGlCallName(call), count, (double)count/frames);
+    }
+    printf("Frame: %.3f ms average, %.3f ms max\n", total_ms/frames, max_ms);
+
+    if (!checkModelReuse())
+    {
+        printf("Unloaded models do not give their heap space back\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <string.h>
+
+#include "transform.h"
+#include "simd.h"
+
+void TransformArray::clear()
+{
+    for (int e = 0 ; e < 12 ; e++)
+        m_Rows[e].clear();
+}
+
+void TransformArray::push(const float* matrix)
+{
+    for (int r = 0 ; r < 3 ; r++)
+    {
+        for (int c = 0 ; c < 4 ; c++)
+            m_Rows[r*4+c].push_back(matrix[c*4+r]);
+    }
+}
+
+void TransformArray::getRows(int item, float* rows) const
+{
+    for (int e = 0 ; e < 12 ; e++)
+        rows[e] = m_Rows[e][item];
+}
+
+// Transposes four vectors of one element for four items into four items
+// of four elements, and stores the ones in the batch
+static void storeColumns(float* dst, int stride, int batch, Float4 a, Float4 b, Float4 c, Float4 d)
+{
+    float4Transpose(a, b, c, d);
+    Float4 columns[4] = {a, b, c, d};
+    for (int j = 0 ; j < batch ; j++)
+        float4Store(&dst[j*stride], columns[j]);
+}
+
+void computeTransforms(float* mvps, float* models, const float* viewProjection, const TransformArray &transforms)
+{
+    int count = transforms.size();
+
+    Float4 vp[16];
+    for (int e = 0 ; e < 16 ; e++)
+        vp[e] = float4Set1(viewProjection[e]);
+    Float4 zero = float4Set1(0.0f), one = float4Set1(1.0f);
+
+    for (int base = 0 ; base < count ; base += 4)
+    {
+        int batch = (count - base < 4) ? count - base : 4;
+
+        // Element e of four items, the last item repeated past the end
+        Float4 m[12];
+        for (int e = 0 ; e < 12 ; e++)
+        {
+            const float* elements = transforms.getElements(e) + base;
+            if (batch == 4)
+            {
+                m[e] = float4Load(elements);
+            }
+            else
+            {
+                float padded[4];
+                for (int j = 0 ; j < 4 ; j++)
+                    padded[j] = elements[(j < batch) ? j : batch-1];
+                m[e] = float4Load(padded);
+            }
+        }
+
+        for (int c = 0 ; c < 4 ; c++)
+        {
+            if (mvps)
+            {
+                // Row r of column c: sum over k of VP(r,k) * M(k,c), plus
+                // VP(r,3) for the translation column
+                Float4 rows[4];
+                for (int r = 0 ; r < 4 ; r++)
+                {
+                    Float4 sum = (c == 3) ? vp[12+r] : zero;
+                    for (int k = 0 ; k < 3 ; k++)
+                        sum = float4Madd(vp[k*4+r], m[k*4+c], sum);
+                    rows[r] = sum;
+                }
+                storeColumns(&mvps[base*16 + c*4], 16, batch, rows[0], rows[1], rows[2], rows[3]);
+            }
+            if (models)
+                storeColumns(&models[base*16 + c*4], 16, batch, m[c], m[4+c], m[8+c], (c == 3) ? one : zero);
+        }
+    }
+}
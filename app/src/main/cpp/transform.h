@@ -0,0 +1,35 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+// Per-item transforms for the frame, kept as structure-of-arrays so the
+// matrix math for every item runs four items per SIMD step.  Matrices going
+// in and out are 4x4 column-major floats, as glm stores them.
+
+#include <vector>
+
+// Affine transforms stored as the twelve elements of their top three rows,
+// one array per element.  Array r*4+c holds row r, column c of every item,
+// which is also the layout of one item's instanceRows.
+class TransformArray
+{
+public:
+    void clear();
+
+    // matrix must be affine, its bottom row is taken to be (0, 0, 0, 1)
+    void push(const float* matrix);
+
+    int size() const { return (int)m_Rows[0].size(); }
+    const float* getElements(int element) const { return &m_Rows[element][0]; }
+
+    // Writes the item's top three rows, 12 floats
+    void getRows(int item, float* rows) const;
+
+private:
+    std::vector<float> m_Rows[12];
+};
+
+// Computes viewProjection * M (into mvps) and M itself (into models) for
+// every item, 16 floats each.  Either output may be NULL.
+void computeTransforms(float* mvps, float* models, const float* viewProjection, const TransformArray &transforms);
+
+#endif
@@ -0,0 +1,639 @@
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "trianglebvh.h"
+#include "jobs.h"
+#include "simd.h"
+
+#define BVH_MAX_DEPTH   64      // Deeper nodes are split at the median, which bounds the depth
+#define BVH_STACK_SIZE  96      // Traversal stack entries kept on the call stack, deeper trees get theirs on the heap
+
+static inline float dot3(const float* a, const float* b)
+{
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+static inline void cross3(float* dst, const float* a, const float* b)
+{
+    dst[0] = a[1]*b[2] - a[2]*b[1];
+    dst[1] = a[2]*b[0] - a[0]*b[2];
+    dst[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+static inline void sub3(float* dst, const float* a, const float* b)
+{
+    for (int k = 0 ; k < 3 ; k++)
+        dst[k] = a[k] - b[k];
+}
+
+static float boxArea(const float* min, const float* max)
+{
+    float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+    if (dx < 0 || dy < 0 || dz < 0) return 0;
+    return 2*(dx*dy + dy*dz + dz*dx);
+}
+
+static void emptyBox(float* min, float* max)
+{
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        min[k] = FLT_MAX;
+        max[k] = -FLT_MAX;
+    }
+}
+
+static void growBox(float* min, float* max, const float* boxMin, const float* boxMax)
+{
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        if (boxMin[k] < min[k]) min[k] = boxMin[k];
+        if (boxMax[k] > max[k]) max[k] = boxMax[k];
+    }
+}
+
+// Working data of one build, shared by the threads building subtrees.
+// Every subtree owns its range of order and the nodes it allocates.
+struct BvhBuilder
+{
+    TriangleBvh &bvh;
+    std::vector<float> boxes;           // 6 floats per source triangle
+    std::vector<float> centroids;       // 3 floats per source triangle
+    std::vector<int> order;             // Source triangles, partitioned in place
+    std::atomic<int> nextNode;
+    std::atomic<int> maxDepth;
+
+    explicit BvhBuilder(TriangleBvh &target) : bvh(target), nextNode(1), maxDepth(0) {}
+
+    void buildNode(int node, int first, int count, int depth);
+};
+
+void BvhBuilder::buildNode(int node, int first, int count, int depth)
+{
+    int deepest = maxDepth.load();
+    while (depth > deepest && !maxDepth.compare_exchange_weak(deepest, depth)) {}
+
+    float min[3], max[3], centroid_min[3], centroid_max[3];
+    emptyBox(min, max);
+    emptyBox(centroid_min, centroid_max);
+    for (int i = first ; i < first + count ; i++)
+    {
+        int tri = order[i];
+        growBox(min, max, &boxes[tri*6], &boxes[tri*6+3]);
+        growBox(centroid_min, centroid_max, &centroids[tri*3], &centroids[tri*3]);
+    }
+
+    BvhNode &out = bvh.m_Nodes[node];
+    memcpy(out.min, min, sizeof(min));
+    memcpy(out.max, max, sizeof(max));
+    out.first = first;
+    out.count = count;
+    if (count <= 2) return;
+
+    // Cost of a split relative to testing every triangle of the node, with
+    // a node visit counted like a triangle test
+    float best_cost = FLT_MAX;
+    int best_axis = -1, best_split = 0;
+    float parent_area = boxArea(min, max);
+    for (int axis = 0 ; axis < 3 && depth < BVH_MAX_DEPTH ; axis++)
+    {
+        float extent = centroid_max[axis] - centroid_min[axis];
+        if (extent <= 0) continue;
+        float scale = BVH_BINS*(1 - 1e-5f)/extent;
+
+        int bin_counts[BVH_BINS] = {0};
+        float bin_min[BVH_BINS][3], bin_max[BVH_BINS][3];
+        for (int b = 0 ; b < BVH_BINS ; b++)
+            emptyBox(bin_min[b], bin_max[b]);
+        for (int i = first ; i < first + count ; i++)
+        {
+            int tri = order[i];
+            int b = (int)((centroids[tri*3+axis] - centroid_min[axis])*scale);
+            bin_counts[b]++;
+            growBox(bin_min[b], bin_max[b], &boxes[tri*6], &boxes[tri*6+3]);
+        }
+
+        // Areas and counts left of every bin boundary, then swept from the right
+        float left_area[BVH_BINS-1];
+        int left_count[BVH_BINS-1];
+        float running_min[3], running_max[3];
+        int running_count = 0;
+        emptyBox(running_min, running_max);
+        for (int b = 0 ; b < BVH_BINS-1 ; b++)
+        {
+            growBox(running_min, running_max, bin_min[b], bin_max[b]);
+            running_count += bin_counts[b];
+            left_area[b] = boxArea(running_min, running_max);
+            left_count[b] = running_count;
+        }
+
+        emptyBox(running_min, running_max);
+        running_count = 0;
+        for (int b = BVH_BINS-1 ; b > 0 ; b--)
+        {
+            growBox(running_min, running_max, bin_min[b], bin_max[b]);
+            running_count += bin_counts[b];
+            if (left_count[b-1] == 0 || running_count == 0) continue;
+
+            float cost = 1 + (left_area[b-1]*left_count[b-1] + boxArea(running_min, running_max)*running_count)/parent_area;
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    int middle;
+    if (best_axis >= 0)
+    {
+        if (best_cost >= count && count <= BVH_MAX_LEAF_TRIANGLES) return;
+
+        float scale = BVH_BINS*(1 - 1e-5f)/(centroid_max[best_axis] - centroid_min[best_axis]);
+        const float* c = &centroids[0];
+        float origin = centroid_min[best_axis];
+        int* split = std::partition(&order[first], &order[first] + count, [&](int tri)
+        {
+            return (int)((c[tri*3+best_axis] - origin)*scale) < best_split;
+        });
+        middle = (int)(split - &order[0]);
+    }
+    else
+    {
+        // Too deep already, or every centroid in the same place so no bin
+        // can separate them
+        if (count <= BVH_MAX_LEAF_TRIANGLES) return;
+
+        int axis = 0;
+        for (int k = 1 ; k < 3 ; k++)
+        {
+            if (centroid_max[k] - centroid_min[k] > centroid_max[axis] - centroid_min[axis]) axis = k;
+        }
+        middle = first + count/2;
+        const float* c = &centroids[0];
+        std::nth_element(&order[first], &order[middle], &order[first] + count, [&](int a, int b)
+        {
+            return c[a*3+axis] < c[b*3+axis];
+        });
+    }
+
+    int children = nextNode.fetch_add(2);
+    out.first = children;
+    out.count = 0;
+
+    int left_count = middle - first;
+    if (count >= BVH_PARALLEL_TRIANGLES)
+    {
+        parallelFor(2, [&](int c)
+        {
+            if (c == 0) buildNode(children, first, left_count, depth + 1);
+            else buildNode(children + 1, middle, count - left_count, depth + 1);
+        });
+    }
+    else
+    {
+        buildNode(children, first, left_count, depth + 1);
+        buildNode(children + 1, middle, count - left_count, depth + 1);
+    }
+}
+
+TriangleBvh::TriangleBvh()
+    : m_Depth(0)
+{
+}
+
+void TriangleBvh::clear()
+{
+    m_Depth = 0;
+    m_Nodes.clear();
+    m_Triangles.clear();
+    m_TriangleIds.clear();
+}
+
+void TriangleBvh::build(const float* positions, const unsigned int* indices, int numTriangles)
+{
+    clear();
+    if (numTriangles <= 0) return;
+
+    BvhBuilder builder(*this);
+    builder.boxes.resize(numTriangles*6);
+    builder.centroids.resize(numTriangles*3);
+    builder.order.resize(numTriangles);
+    for (int t = 0 ; t < numTriangles ; t++)
+    {
+        float* min = &builder.boxes[t*6];
+        float* max = min + 3;
+        emptyBox(min, max);
+        for (int v = 0 ; v < 3 ; v++)
+        {
+            const float* p = &positions[indices[t*3+v]*3];
+            growBox(min, max, p, p);
+        }
+        for (int k = 0 ; k < 3 ; k++)
+            builder.centroids[t*3+k] = (min[k] + max[k])*0.5f;
+        builder.order[t] = t;
+    }
+
+    // A binary tree with at least one triangle per leaf never needs more
+    m_Nodes.resize(numTriangles*2);
+    builder.buildNode(0, 0, numTriangles, 0);
+    m_Nodes.resize(builder.nextNode.load());
+    m_Depth = builder.maxDepth.load();
+
+    m_TriangleIds = builder.order;
+    m_Triangles.resize(numTriangles*9);
+    for (int i = 0 ; i < numTriangles ; i++)
+    {
+        int t = m_TriangleIds[i];
+        const float* v0 = &positions[indices[t*3]*3];
+        const float* v1 = &positions[indices[t*3+1]*3];
+        const float* v2 = &positions[indices[t*3+2]*3];
+        float* dst = &m_Triangles[i*9];
+        memcpy(dst, v0, 3*sizeof(float));
+        sub3(dst+3, v1, v0);
+        sub3(dst+6, v2, v0);
+    }
+}
+
+void TriangleBvh::getBounds(float* box) const
+{
+    if (m_Nodes.empty())
+    {
+        memset(box, 0, 6*sizeof(float));
+        return;
+    }
+    memcpy(box, m_Nodes[0].min, 3*sizeof(float));
+    memcpy(box+3, m_Nodes[0].max, 3*sizeof(float));
+}
+
+// Entry distance of the ray into the box grown by radius, or -1 when it
+// misses it within maxT
+static inline float rayBox(const BvhNode &node, const float* origin, const float* inverseDir, float maxT, float radius)
+{
+    float entry = 0, exit = maxT;
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        float t1 = (node.min[k] - radius - origin[k])*inverseDir[k];
+        float t2 = (node.max[k] + radius - origin[k])*inverseDir[k];
+        entry = fmaxf(entry, fminf(t1, t2));
+        exit = fminf(exit, fmaxf(t1, t2));
+    }
+    return (entry <= exit) ? entry : -1;
+}
+
+// Moller-Trumbore, both sides of the triangle count
+static inline bool rayTriangle(const float* tri, const float* origin, const float* dir, float maxT, float &t, float &u, float &v)
+{
+    const float* e1 = tri + 3;
+    const float* e2 = tri + 6;
+    float p[3], s[3], q[3];
+    cross3(p, dir, e2);
+    float det = dot3(e1, p);
+    if (fabsf(det) < 1e-12f) return false;
+
+    float inverse_det = 1.0f/det;
+    sub3(s, origin, tri);
+    u = dot3(s, p)*inverse_det;
+    if (u < 0 || u > 1) return false;
+    cross3(q, s, e1);
+    v = dot3(dir, q)*inverse_det;
+    if (v < 0 || u + v > 1) return false;
+    t = dot3(e2, q)*inverse_det;
+    return t >= 0 && t <= maxT;
+}
+
+// Nodes still to be visited by a walk.  A walk never holds more than the
+// tree's depth plus one, so capacity is taken from the depth recorded by
+// the build and nothing is ever dropped.
+struct NodeStack
+{
+    int local[BVH_STACK_SIZE];
+    std::vector<int> heap;
+    int* nodes;
+    int size;
+
+    explicit NodeStack(int capacity) : nodes(local), size(0)
+    {
+        if (capacity > BVH_STACK_SIZE)
+        {
+            heap.resize(capacity);
+            nodes = &heap[0];
+        }
+    }
+
+    void push(int node) { nodes[size++] = node; }
+    int pop() { return nodes[--size]; }
+};
+
+// Walks the nodes the ray (with boxes grown by radius) reaches, nearest
+// child first.  test(leaf) tests the leaf's triangles and returns the new
+// maxT, or a negative value to stop.
+template <class LeafTest>
+static void walkRay(const std::vector<BvhNode> &nodes, int depth, const float* origin, const float* dir, float maxT, float radius, LeafTest test)
+{
+    if (nodes.empty()) return;
+
+    float inverse_dir[3];
+    for (int k = 0 ; k < 3 ; k++)
+        inverse_dir[k] = 1.0f/dir[k];
+    if (rayBox(nodes[0], origin, inverse_dir, maxT, radius) < 0) return;
+
+    NodeStack stack(depth + 1);
+    int node = 0;
+    for (;;)
+    {
+        const BvhNode &current = nodes[node];
+        if (current.count > 0)
+        {
+            maxT = test(current);
+            if (maxT < 0) return;
+        }
+        else
+        {
+            int near = current.first, far = current.first + 1;
+            float near_t = rayBox(nodes[near], origin, inverse_dir, maxT, radius);
+            float far_t = rayBox(nodes[far], origin, inverse_dir, maxT, radius);
+            if (far_t >= 0 && (near_t < 0 || far_t < near_t))
+            {
+                std::swap(near, far);
+                std::swap(near_t, far_t);
+            }
+            if (near_t >= 0)
+            {
+                if (far_t >= 0) stack.push(far);
+                node = near;
+                continue;
+            }
+        }
+
+        // Entries pushed before maxT shrank may be out of reach by now
+        for (;;)
+        {
+            if (stack.size == 0) return;
+            node = stack.pop();
+            if (rayBox(nodes[node], origin, inverse_dir, maxT, radius) >= 0) break;
+        }
+    }
+}
+
+bool TriangleBvh::raycast(const float* origin, const float* dir, float maxT, RayHit &hit) const
+{
+    hit.triangle = -1;
+    hit.t = maxT;
+    walkRay(m_Nodes, m_Depth, origin, dir, maxT, 0, [&](const BvhNode &leaf) -> float
+    {
+        for (int i = leaf.first ; i < leaf.first + leaf.count ; i++)
+        {
+            float t, u, v;
+            if (!rayTriangle(&m_Triangles[i*9], origin, dir, hit.t, t, u, v)) continue;
+            hit.t = t;
+            hit.u = u;
+            hit.v = v;
+            hit.triangle = m_TriangleIds[i];
+        }
+        return hit.t;
+    });
+    return hit.triangle >= 0;
+}
+
+bool TriangleBvh::raycastAny(const float* origin, const float* dir, float maxT) const
+{
+    bool found = false;
+    walkRay(m_Nodes, m_Depth, origin, dir, maxT, 0, [&](const BvhNode &leaf) -> float
+    {
+        for (int i = leaf.first ; i < leaf.first + leaf.count ; i++)
+        {
+            float t, u, v;
+            if (rayTriangle(&m_Triangles[i*9], origin, dir, maxT, t, u, v))
+            {
+                found = true;
+                return -1;
+            }
+        }
+        return maxT;
+    });
+    return found;
+}
+
+// Lanes of the packet whose ray enters the node, and their entry distances
+static inline int packetBox(const BvhNode &node, const Float4* origin, const Float4* inverseDir, Float4 maxT, Float4 &entry)
+{
+    Float4 near = float4Set1(0);
+    Float4 far = maxT;
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        Float4 t1 = float4Mul(float4Sub(float4Set1(node.min[k]), origin[k]), inverseDir[k]);
+        Float4 t2 = float4Mul(float4Sub(float4Set1(node.max[k]), origin[k]), inverseDir[k]);
+        near = float4Max(near, float4Min(t1, t2));
+        far = float4Min(far, float4Max(t1, t2));
+    }
+    entry = near;
+    return mask4Bits(float4GreaterEqual(far, near));
+}
+
+void TriangleBvh::raycastPacket(const float* origins, const float* dirs, const float* maxT, RayHit* hits) const
+{
+    float hit_t[4];
+    for (int r = 0 ; r < 4 ; r++)
+    {
+        hits[r].triangle = -1;
+        hits[r].t = maxT[r];
+        hit_t[r] = maxT[r];
+    }
+    if (m_Nodes.empty()) return;
+
+    Float4 origin[3], inverse_dir[3];
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        origin[k] = float4Set(origins[k], origins[3+k], origins[6+k], origins[9+k]);
+        inverse_dir[k] = float4Set(1.0f/dirs[k], 1.0f/dirs[3+k], 1.0f/dirs[6+k], 1.0f/dirs[9+k]);
+    }
+
+    NodeStack stack(m_Depth + 2);
+    stack.push(0);
+    while (stack.size > 0)
+    {
+        const BvhNode &node = m_Nodes[stack.pop()];
+        Float4 entry;
+        int lanes = packetBox(node, origin, inverse_dir, float4Load(hit_t), entry);
+        if (!lanes) continue;
+
+        if (node.count > 0)
+        {
+            for (int r = 0 ; r < 4 ; r++)
+            {
+                if (!(lanes & (1 << r))) continue;
+                for (int i = node.first ; i < node.first + node.count ; i++)
+                {
+                    float t, u, v;
+                    if (!rayTriangle(&m_Triangles[i*9], &origins[r*3], &dirs[r*3], hit_t[r], t, u, v)) continue;
+                    hit_t[r] = t;
+                    hits[r].t = t;
+                    hits[r].u = u;
+                    hits[r].v = v;
+                    hits[r].triangle = m_TriangleIds[i];
+                }
+            }
+            continue;
+        }
+
+        // Order the children by the first active ray, the others mostly agree
+        int lane = __builtin_ctz(lanes);
+        Float4 left_entry, right_entry;
+        int left = packetBox(m_Nodes[node.first], origin, inverse_dir, float4Load(hit_t), left_entry);
+        int right = packetBox(m_Nodes[node.first+1], origin, inverse_dir, float4Load(hit_t), right_entry);
+        float left_t[4], right_t[4];
+        float4Store(left_t, left_entry);
+        float4Store(right_t, right_entry);
+        bool right_first = right && (!left || right_t[lane] < left_t[lane]);
+        if (right_first)
+        {
+            if (left) stack.push(node.first);
+            stack.push(node.first + 1);
+        }
+        else
+        {
+            if (right) stack.push(node.first + 1);
+            if (left) stack.push(node.first);
+        }
+    }
+}
+
+// Parameter at which the ray first comes within radius of center, or -1
+static float raySphere(const float* origin, const float* dir, const float* center, float radius, float maxT)
+{
+    float m[3];
+    sub3(m, origin, center);
+    float c = dot3(m, m) - radius*radius;
+    if (c <= 0) return 0;
+    float b = dot3(m, dir);
+    if (b >= 0) return -1;
+    float a = dot3(dir, dir);
+    float discriminant = b*b - a*c;
+    if (discriminant < 0) return -1;
+    float t = (-b - sqrtf(discriminant))/a;
+    return (t <= maxT) ? t : -1;
+}
+
+// Same for the capsule around the segment a-b, without its end caps
+static float rayCylinder(const float* origin, const float* dir, const float* a, const float* b, float radius, float maxT)
+{
+    float ab[3], ao[3];
+    sub3(ab, b, a);
+    sub3(ao, origin, a);
+    float ab_ab = dot3(ab, ab), ab_ao = dot3(ab, ao), ab_d = dot3(ab, dir);
+    if (ab_ab <= 0) return -1;
+
+    float c = ab_ab*dot3(ao, ao) - ab_ao*ab_ao - radius*radius*ab_ab;
+    if (c <= 0)
+    {
+        float s = ab_ao/ab_ab;
+        return (s >= 0 && s <= 1) ? 0 : -1;
+    }
+
+    float a2 = ab_ab*dot3(dir, dir) - ab_d*ab_d;
+    if (a2 <= 1e-12f) return -1;
+    float b2 = ab_ab*dot3(dir, ao) - ab_d*ab_ao;
+    float discriminant = b2*b2 - a2*c;
+    if (discriminant < 0) return -1;
+    float t = (-b2 - sqrtf(discriminant))/a2;
+    if (t < 0 || t > maxT) return -1;
+
+    float s = (ab_ao + t*ab_d)/ab_ab;
+    return (s >= 0 && s <= 1) ? t : -1;
+}
+
+// Whether p, on the plane of the triangle with normal n, lies inside it
+static bool pointInTriangle(const float* p, const float* v0, const float* v1, const float* v2, const float* n)
+{
+    const float* corners[4] = {v0, v1, v2, v0};
+    for (int e = 0 ; e < 3 ; e++)
+    {
+        float edge[3], to_p[3], c[3];
+        sub3(edge, corners[e+1], corners[e]);
+        sub3(to_p, p, corners[e]);
+        cross3(c, edge, to_p);
+        if (dot3(c, n) < 0) return false;
+    }
+    return true;
+}
+
+// First contact of the moving sphere with the triangle: its face, then its
+// edges and corners, whichever comes first
+static float sweepTriangle(const float* tri, const float* origin, const float* dir, float radius, float maxT)
+{
+    float v0[3], v1[3], v2[3], n[3];
+    memcpy(v0, tri, sizeof(v0));
+    for (int k = 0 ; k < 3 ; k++)
+    {
+        v1[k] = v0[k] + tri[3+k];
+        v2[k] = v0[k] + tri[6+k];
+    }
+    cross3(n, tri+3, tri+6);
+    float length = sqrtf(dot3(n, n));
+
+    if (length > 0)
+    {
+        for (int k = 0 ; k < 3 ; k++)
+            n[k] /= length;
+
+        // Normal of the side the sphere is on, n keeps the winding for the
+        // inside test
+        float to_origin[3], side[3];
+        sub3(to_origin, origin, v0);
+        float distance = dot3(to_origin, n);
+        float sign = (distance < 0) ? -1.0f : 1.0f;
+        distance *= sign;
+        for (int k = 0 ; k < 3 ; k++)
+            side[k] = n[k]*sign;
+
+        // The point of the sphere nearest the plane touches it first, if
+        // that is inside the triangle nothing else can come earlier
+        float t = -1;
+        if (distance <= radius)
+            t = 0;
+        else if (dot3(dir, side) < 0)
+            t = (distance - radius)/-dot3(dir, side);
+        if (t >= 0 && t <= maxT)
+        {
+            float contact[3];
+            for (int k = 0 ; k < 3 ; k++)
+                contact[k] = origin[k] + dir[k]*t - side[k]*(t == 0 ? distance : radius);
+            if (pointInTriangle(contact, v0, v1, v2, n)) return t;
+        }
+    }
+
+    float best = -1;
+    const float* corners[4] = {v0, v1, v2, v0};
+    for (int e = 0 ; e < 3 ; e++)
+    {
+        float t = rayCylinder(origin, dir, corners[e], corners[e+1], radius, (best < 0) ? maxT : best);
+        if (t >= 0) best = t;
+        t = raySphere(origin, dir, corners[e], radius, (best < 0) ? maxT : best);
+        if (t >= 0) best = t;
+    }
+    return best;
+}
+
+bool TriangleBvh::sweepSphere(const float* origin, const float* dir, float radius, float maxT, RayHit &hit) const
+{
+    hit.triangle = -1;
+    hit.t = maxT;
+    hit.u = hit.v = 0;
+    walkRay(m_Nodes, m_Depth, origin, dir, maxT, radius, [&](const BvhNode &leaf) -> float
+    {
+        for (int i = leaf.first ; i < leaf.first + leaf.count ; i++)
+        {
+            float t = sweepTriangle(&m_Triangles[i*9], origin, dir, radius, hit.t);
+            if (t < 0 || (hit.triangle >= 0 && t >= hit.t)) continue;
+            hit.t = t;
+            hit.triangle = m_TriangleIds[i];
+        }
+        return hit.t;
+    });
+    return hit.triangle >= 0;
+}
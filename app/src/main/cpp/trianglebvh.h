@@ -0,0 +1,78 @@
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <vector>
+
+// Bounding volume hierarchy over the triangles of one model, for raycasts
+// and sphere sweeps against its exact surface.  It is built once, top down,
+// choosing every split with the surface area heuristic evaluated over a
+// fixed number of bins; big subtrees are built on the job pool.  Nodes are
+// stored in one flat array with the two children of a node next to each
+// other, and the triangles in leaf order right after being built, so a
+// query walks memory mostly forward.
+//
+// Queries are in the model's space.  A ray is origin + t*dir for t in
+// [0, maxT], dir does not have to be normalized, and t is returned in the
+// same units, so an affine transform of the ray leaves t unchanged.
+
+#define BVH_BINS                12
+#define BVH_MAX_LEAF_TRIANGLES  8
+#define BVH_PARALLEL_TRIANGLES  4096    // Subtrees this big build their halves on two threads
+
+struct BvhNode
+{
+    float min[3];
+    int first;                          // Inner nodes: left child, the right one follows.  Leaves: first triangle.
+    float max[3];
+    int count;                          // Triangles of a leaf, 0 for inner nodes
+};
+
+struct RayHit
+{
+    float t;
+    int triangle;                       // As numbered in the indices the BVH was built from, -1 for a miss
+    float u, v;                         // Barycentrics of the hit, 0 for sweeps
+};
+
+class TriangleBvh
+{
+public:
+    TriangleBvh();
+
+    // positions holds 3 floats per vertex, indices 3 per triangle
+    void build(const float* positions, const unsigned int* indices, int numTriangles);
+    void clear();
+
+    bool isEmpty() const { return m_Nodes.empty(); }
+    int getNodeCount() const { return (int)m_Nodes.size(); }
+    int getTriangleCount() const { return (int)m_TriangleIds.size(); }
+    int getDepth() const { return m_Depth; }
+
+    // min xyz, max xyz
+    void getBounds(float* box) const;
+
+    // Nearest hit within maxT
+    bool raycast(const float* origin, const float* dir, float maxT, RayHit &hit) const;
+
+    // Whether anything is hit within maxT, stopping at the first triangle
+    bool raycastAny(const float* origin, const float* dir, float maxT) const;
+
+    // Nearest hits of 4 rays walked down the tree together, box tests done
+    // 4-wide.  origins and dirs hold 3 floats per ray.  Rays that should
+    // not be cast get a maxT below 0.
+    void raycastPacket(const float* origins, const float* dirs, const float* maxT, RayHit* hits) const;
+
+    // First contact of a sphere of the given radius moving from origin
+    // along dir.  A sphere that already touches the surface hits at t = 0.
+    bool sweepSphere(const float* origin, const float* dir, float radius, float maxT, RayHit &hit) const;
+
+private:
+    friend struct BvhBuilder;
+
+    std::vector<BvhNode> m_Nodes;
+    int m_Depth;                        // Of the deepest leaf, the root is at 0
+    std::vector<float> m_Triangles;     // 9 floats per triangle in leaf order: first vertex and the two edges from it
+    std::vector<int> m_TriangleIds;     // Source index of each
+};
+
+#endif
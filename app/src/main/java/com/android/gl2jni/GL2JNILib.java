@@ -35,4 +35,9 @@ public class GL2JNILib {
     public static native void loadRAW(String filename, int width, int height, int src_size, int[] buffer);
     public static native void doneLoadingTextures();
     public static native void doneLoadingModels();
+    public static native void setCacheDir(String path);
+    public static native void loadMap(byte[] buffer);
+    public static native void loadPVS(byte[] buffer);
+    public static native void pause();
+    public static native void resume();
 }
@@ -83,6 +83,7 @@ class GL2JNIView extends GLSurfaceView {
     private static int screen_height = 100;
 
     private static Resources res;
+    private static String packageName;
 
     private static int[] TEXTURES_RESOURCES = {
             R.raw.barrel,
@@ -160,15 +161,15 @@ class GL2JNIView extends GLSurfaceView {
 
     public GL2JNIView(Context context) {
         super(context);
-        init(true, 0, 0);
+        init(context, true, 0, 0);
     }
 
     public GL2JNIView(Context context, boolean translucent, int depth, int stencil) {
         super(context);
-        init(translucent, depth, stencil);
+        init(context, translucent, depth, stencil);
     }
 
-    private void init(boolean translucent, int depth, int stencil) {
+    private void init(Context context, boolean translucent, int depth, int stencil) {
 
         /* By default, GLSurfaceView() creates a RGB_565 opaque surface.
          * If we want a translucent one, we should change the surface's
@@ -196,6 +197,9 @@ class GL2JNIView extends GLSurfaceView {
         setEGLConfigChooser(true);
 
         res = getResources();
+        packageName = context.getPackageName();
+
+        GL2JNILib.setCacheDir(context.getCacheDir().getAbsolutePath());
 
         loadThePreload();
 
@@ -422,6 +426,28 @@ class GL2JNIView extends GLSurfaceView {
     }
 
 
+    // The simulation thread is stopped while the app is in the background.
+    // Both go through the GL thread, the only one that uses the simulation.
+    @Override
+    public void onPause() {
+        queueEvent(new Runnable() {
+            public void run() {
+                GL2JNILib.pause();
+            }
+        });
+        super.onPause();
+    }
+
+    @Override
+    public void onResume() {
+        super.onResume();
+        queueEvent(new Runnable() {
+            public void run() {
+                GL2JNILib.resume();
+            }
+        });
+    }
+
     private final float TOUCH_SCALE_FACTOR = 180.0f / 320;
     private float[] mPrevX = new float[10];
     private float[] mPrevY = new float[10];
@@ -520,12 +546,46 @@ class GL2JNIView extends GLSurfaceView {
                 in_s.read(b);
                 GL2JNILib.loadModel(MODELS_NAMES[i],b,MODELS_EXTERNAL[i]);
             }
+            loadMap();
             GL2JNILib.doneLoadingModels();
         } catch (Exception ex) {
             System.out.println("Exception: " + ex.getMessage());
         }
     }
 
+    // Reads a whole raw resource by name, null if the app has none
+    public static byte[] readRawResource(String name) {
+        int rid = res.getIdentifier(name, "raw", packageName);
+        if (rid == 0) return null;
+        try {
+            InputStream in_s = res.openRawResource(rid);
+            byte[] data = new byte[in_s.available()];
+            int offset = 0;
+            while (offset < data.length) {
+                int read = in_s.read(data, offset, data.length - offset);
+                if (read < 0) break;
+                offset += read;
+            }
+            in_s.close();
+            return data;
+        } catch (Exception ex) {
+            System.out.println("Exception: " + ex.getMessage());
+        }
+        return null;
+    }
+
+    // Places the items of the optional "map" resource, with the visibility
+    // baked for it by tools/pvs_bake into "map_pvs"
+    public static void loadMap() {
+        byte[] map = readRawResource("map");
+        if (map == null) return;
+        GL2JNILib.loadMap(map);
+
+        byte[] pvs = readRawResource("map_pvs");
+        if (pvs != null)
+            GL2JNILib.loadPVS(pvs);
+    }
+
     static int[] pixels = new int[4096*4096];
 
     public static void loadTextures() {